@@ -0,0 +1,54 @@
+/**
+ * @file batch_call_list_store.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef BATCH_CALL_LIST_STORE_H__
+#define BATCH_CALL_LIST_STORE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "call_list_store.h"
+
+/// Implemented by call list stores that can write several fragments for
+/// the same IMPU in one operation, such as a call's BEGIN and END when the
+/// call was short enough for them to be merged. The fragments are for the
+/// same call, so share a fragment timestamp, and are written with the same
+/// Cassandra timestamp and TTL. They are either all written or all failed.
+class BatchCallListStore
+{
+public:
+  virtual ~BatchCallListStore() {}
+
+  /// Writes several fragments in one operation.
+  /// @returns         - OK if every fragment was written, or an error.
+  virtual CassandraStore::ResultCode write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail) = 0;
+
+  /// Writes several fragments to a store in one operation if the store
+  /// supports it, or one at a time if it doesn't (such as the Thrift
+  /// store), stopping at the first that fails.
+  /// @returns         - OK if every fragment was written, or the first
+  ///                    error.
+  static CassandraStore::ResultCode write_call_fragments(
+                     CallListStore::Store* store,
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail);
+};
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * @file bucketed_call_list_store.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef BUCKETED_CALL_LIST_STORE_H__
+#define BUCKETED_CALL_LIST_STORE_H__
+
+#include <string>
+#include <vector>
+
+#include "batch_call_list_store.h"
+#include "call_list_store.h"
+
+/// Call list store that splits each IMPU's call list into time buckets, on
+/// top of another store that does the actual reads and writes.
+///
+/// The standard layout keeps all of an IMPU's fragments in one row, keyed
+/// on the IMPU, which can grow very wide for heavy users between trims.
+/// Here, each fragment goes in the row for the bucket its timestamp falls
+/// in, keyed on
+///
+///   <IMPU>|b<bucket number>
+///
+/// where the bucket number is the fragment's start time divided by the
+/// bucket period. '|' can't appear unescaped in a SIP URI, so these keys
+/// can't clash with an IMPU. Fragments for a call always share a timestamp,
+/// so a call's BEGIN and END are always in the same bucket.
+///
+/// Reads cover the IMPU's row in the standard layout, so that calls written
+/// before bucketing was turned on are still seen, followed by the buckets
+/// that can still hold live fragments (the call list TTL back from now).
+/// Buckets are read newest first, and reading stops once more than
+/// max_calls calls have been found, as older calls would only be trimmed.
+///
+/// Rows that aren't call lists, such as the trim heartbeats (see
+/// TrimOwnership), are passed straight through to the underlying store.
+/// Fragments are still returned oldest first. Any calls found in the
+/// standard layout are moved into their buckets there and then (see
+/// migrate_call_fragments_sync), so each IMPU is migrated the first time
+/// its call list is read, and trims only ever have to delete from buckets.
+///
+/// Each read is one row read per bucket, so the bucket period must be long
+/// enough that the TTL spans at most MAX_BUCKETS buckets (see
+/// valid_period).
+class BucketedCallListStore : public CallListStore::Store,
+                              public BatchCallListStore
+{
+public:
+  /// Constructor.
+  /// @param store           - The underlying store. This takes ownership
+  ///                          of it.
+  /// @param bucket_period_s - Length of each bucket.
+  /// @param call_list_ttl_s - TTL of call list fragments. This must be
+  ///                          non-zero, as it bounds the buckets to read.
+  /// @param max_calls       - Calls after which to stop reading older
+  ///                          buckets, or 0 to read every bucket.
+  BucketedCallListStore(CallListStore::Store* store,
+                        int bucket_period_s,
+                        int call_list_ttl_s,
+                        int max_calls);
+
+  virtual ~BucketedCallListStore();
+
+  virtual CassandraStore::ResultCode write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail);
+
+  /// Moves an IMPU's fragments from the standard layout into buckets. Each
+  /// fragment is written with the TTL it has left, based on its timestamp.
+  /// @returns         - The number of fragments moved.
+  /// @param impu      - The IMPU.
+  /// @param trail     - SAS trail.
+  int migrate_call_fragments_sync(const std::string& impu, SAS::TrailId trail);
+
+  /// @returns         - The bucket a fragment timestamp falls in, or -1 if
+  ///                    the timestamp is invalid.
+  /// @param timestamp - The fragment timestamp (YYYYMMDDHHMMSS).
+  int64_t bucket(const std::string& timestamp) const;
+
+  /// @returns         - The row key for an IMPU's bucket.
+  static std::string bucket_key(const std::string& impu, int64_t bucket);
+
+  /// @returns         - The most buckets a read can cover.
+  static int buckets(int bucket_period_s, int call_list_ttl_s);
+
+  /// @returns         - Whether a read with this bucket period and TTL
+  ///                    covers no more than MAX_BUCKETS buckets.
+  static bool valid_period(int bucket_period_s, int call_list_ttl_s);
+
+  /// Most buckets a read may have to cover.
+  static const int MAX_BUCKETS = 32;
+
+private:
+  /// Parses a fragment timestamp into seconds since the epoch. The
+  /// timestamp is local time, but it is treated as UTC: this only matters
+  /// for consistency, not for the absolute time.
+  static bool parse_timestamp(const std::string& timestamp, time_t& time);
+
+  /// @returns         - Whether a row is a subscriber's call list, and so
+  ///                    is split into buckets.
+  static bool is_call_list(const std::string& impu);
+
+  /// Moves fragments read from the standard layout into buckets.
+  /// @param fragments - (in/out) The fragments read. Those that are moved
+  ///                    are removed, so only those left behind remain.
+  int migrate(const std::string& impu,
+              std::vector<CallListStore::CallFragment>& fragments,
+              SAS::TrailId trail);
+
+  /// @returns         - The number of calls (BEGIN or REJECTED fragments)
+  ///                    in a list of fragments.
+  static int count_calls(const std::vector<CallListStore::CallFragment>& fragments);
+
+  CallListStore::Store* _store;
+  int _bucket_period_s;
+  int _call_list_ttl_s;
+  int _max_calls;
+};
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * @file call_flood_detector.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_FLOOD_DETECTOR_H__
+#define CALL_FLOOD_DETECTOR_H__
+
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "call_list_store_processor.h"
+#include "counter.h"
+
+/// Detects floods of rejected calls to an IMPU (from robocallers or
+/// mass-calling events, say) and folds them into a single summary call.
+///
+/// Each IMPU's rejected calls are counted over a fixed window, which starts
+/// at its first rejected call. The first max_rejected_calls in a window are
+/// written as normal. Any more are folded: the first of them becomes the
+/// summary, and the rest are counted into it and freed. At the end of the
+/// window, the summary is written as one REJECTED call whose caller name
+/// says how many calls it stands for, and when they were, for example
+/// "25 missed calls between 2002-05-30T09:30:10 and 2002-05-30T09:31:02".
+///
+/// Putting the summary in the caller name is deliberate. The call list
+/// XML has nowhere else to put it that existing clients would show, and
+/// clients show the caller name in place of the caller's URI, so the
+/// subscriber sees the summary without any change to their client. The
+/// caller URI is that of the first folded call. The format of the summary
+/// is fixed (see describe), so a client that wants to can recognise it:
+///
+///   "<N> missed calls[ from multiple callers] between <first> and <last>"
+///
+/// where N is at least 2 and the times are the calls' start times, in the
+/// same format as <start-time>. If only one call was folded, it is written
+/// unchanged.
+///
+/// Calls that are folded into a summary and freed are reported to the load
+/// monitor as complete, as their work is done.
+///
+/// A flooded IMPU therefore gets at most max_rejected_calls + 1 REJECTED
+/// fragments per window, however many calls it receives.
+class CallFloodDetector
+{
+public:
+  /// Constructor.
+  /// @param processor          - The processor that owns the requests.
+  /// @param max_rejected_calls - Rejected calls to an IMPU to write in each
+  ///                             window before folding the rest.
+  /// @param window_ms          - Length of the window.
+  /// @param stats_aggregator   - Statistics aggregator.
+  CallFloodDetector(CallListStoreProcessor* processor,
+                    int max_rejected_calls,
+                    int window_ms,
+                    LastValueCache* stats_aggregator);
+
+  /// Destructor. Any summaries that haven't been flushed are freed.
+  virtual ~CallFloodDetector();
+
+  /// Checks a request to write a call fragment.
+  /// @returns         - The request to write, or NULL if it has been folded
+  ///                    into a summary (the detector then owns it).
+  /// @param request   - The request.
+  /// @param now_ms    - The current time, in milliseconds.
+  CallListStoreProcessor::CallListRequest* check(
+                          CallListStoreProcessor::CallListRequest* request,
+                          uint64_t now_ms);
+
+  /// Ends any windows that have expired.
+  /// @param now_ms    - The current time, in milliseconds.
+  /// @param summaries - (out) Summaries from the expired windows, to write.
+  void flush(uint64_t now_ms,
+             std::vector<CallListStoreProcessor::CallListRequest*>& summaries);
+
+private:
+  /// The rejected calls to an IMPU in the current window.
+  struct Window
+  {
+    uint64_t start_ms;
+    int calls;
+
+    /// Summary of the folded calls (NULL if none have been folded).
+    CallListStoreProcessor::CallListRequest* summary;
+    int folded;
+    time_t last_start_time;
+    bool mixed_callers;
+  };
+
+  /// Fills in the caller name of a summary from its window, in the format
+  /// given above. Change it with care, as clients may depend on it.
+  static void describe(const Window& window);
+
+  CallListStoreProcessor* _processor;
+  int _max_rejected_calls;
+  int _window_ms;
+
+  pthread_mutex_t _lock;
+  std::unordered_map<std::string, Window> _windows;
+
+  StatisticCounter _stat_folded_calls;
+};
+
+#endif
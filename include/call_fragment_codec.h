@@ -0,0 +1,101 @@
+/**
+ * @file call_fragment_codec.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_FRAGMENT_CODEC_H_
+#define CALL_FRAGMENT_CODEC_H_
+
+#include <string>
+
+#include "call_list_entry.h"
+#include "call_list_store.h"
+
+/// Encoding and decoding of the contents of stored call fragments.
+///
+/// Call fragment contents are stored either as the call list XML, or in a
+/// compact binary encoding. The two can be told apart by their first byte:
+/// XML contents always start with '<', and binary contents start with
+/// BINARY_MARKER. A call list row can therefore contain a mix of both (for
+/// example after the encoding has been changed), and readers should use
+/// to_xml to turn each fragment's contents into XML. Readers that predate
+/// the binary encoding can't, so the AS only writes it once
+/// call_fragment_reader_formats says the readers have been upgraded.
+///
+/// Version 1 of the binary encoding is laid out as follows.
+///
+///   BINARY_MARKER (1 byte)
+///   version (1 byte)
+///   fragment type (1 byte: 0 = BEGIN, 1 = END, 2 = REJECTED)
+///   flags (1 byte: bit 0 set if the call was outgoing)
+///
+/// followed, for BEGIN and REJECTED fragments, by
+///
+///   start time (varint)
+///   answer time (varint) - BEGIN only
+///   callee URI, callee name, caller URI, caller name (strings)
+///   answerer URI, answerer name (strings) - BEGIN only
+///
+/// and for END fragments by
+///
+///   end time (varint)
+///
+/// Varints are unsigned LEB128. Strings are a varint length followed by
+/// that many bytes. Times are seconds since the epoch with the UTC offset of
+/// the recording AS already applied, so that the XML rendered by the reader
+/// is identical to the XML the AS would have written.
+namespace CallFragmentCodec
+{
+  /// Encodings for the contents of a call fragment.
+  enum Encoding
+  {
+    XML,
+    BINARY
+  };
+
+  /// First byte of a binary-encoded fragment.
+  const char BINARY_MARKER = '\x01';
+
+  /// Current version of the binary encoding.
+  const char BINARY_VERSION = '\x01';
+
+  /// Parses the name of an encoding ("xml" or "binary").
+  /// @returns         - true if the name was recognised.
+  /// @param name      - The name of the encoding.
+  /// @param encoding  - (out) The encoding.
+  bool parse_encoding(const std::string& name, Encoding& encoding);
+
+  /// Encodes a call list entry as the contents of a call fragment.
+  /// @param encoding  - The encoding to use.
+  /// @param type      - The type of call fragment.
+  /// @param entry     - The call list entry.
+  /// @param contents  - (out) The encoded contents.
+  void encode(Encoding encoding,
+              CallListStore::CallFragment::Type type,
+              const CallListEntry& entry,
+              std::string& contents);
+
+  /// Decodes binary-encoded call fragment contents. The times in the
+  /// returned entry are EntryTimes::LOCAL.
+  /// @returns         - true if the contents were valid.
+  /// @param contents  - The encoded contents.
+  /// @param type      - (out) The type of call fragment.
+  /// @param entry     - (out) The call list entry.
+  bool decode(const std::string& contents,
+              CallListStore::CallFragment::Type& type,
+              CallListEntry& entry);
+
+  /// Converts call fragment contents in any encoding to the call list XML.
+  /// @returns         - true if the contents were valid.
+  /// @param contents  - The stored contents.
+  /// @param xml       - (out) The XML.
+  bool to_xml(const std::string& contents, std::string& xml);
+}
+
+#endif
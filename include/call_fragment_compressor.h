@@ -0,0 +1,91 @@
+/**
+ * @file call_fragment_compressor.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_FRAGMENT_COMPRESSOR_H__
+#define CALL_FRAGMENT_COMPRESSOR_H__
+
+#include <string>
+#include <zstd.h>
+
+#include "accumulator.h"
+
+/// Dictionary-based zstd compression of stored call fragment contents.
+///
+/// Compressed contents are COMPRESSED_MARKER followed by a single zstd frame
+/// (which records the dictionary ID and the uncompressed size). This can be
+/// told apart from both XML contents and CallFragmentCodec's binary
+/// encoding, so readers should call decompress on each fragment and then
+/// CallFragmentCodec::to_xml on the result.
+///
+/// Contents that don't get any smaller are stored as they are.
+///
+/// The dictionary must be one trained with "zstd --train" on the site's own
+/// call fragments (see train_call_fragment_dictionary). zstd also accepts
+/// any other content as a "raw" dictionary, but that compresses real call
+/// lists poorly, so the plugin refuses one (see is_trained).
+class CallFragmentCompressor
+{
+public:
+  /// First byte of compressed contents.
+  static const char COMPRESSED_MARKER = '\x02';
+
+  /// Largest contents decompress will produce. This is far bigger than any
+  /// real call fragment, and stops a corrupt frame exhausting memory.
+  static const size_t MAX_DECOMPRESSED_SIZE = 1024 * 1024;
+
+  /// Constructor.
+  /// @param dictionary        - The zstd dictionary (either trained, or raw
+  ///                            content).
+  /// @param level             - The zstd compression level.
+  /// @param stats_aggregator  - Statistics aggregator (may be NULL when only
+  ///                            decompressing).
+  CallFragmentCompressor(const std::string& dictionary,
+                         int level,
+                         LastValueCache* stats_aggregator);
+
+  /// Destructor.
+  virtual ~CallFragmentCompressor();
+
+  /// Reads a dictionary from a file.
+  /// @returns          - true if the file could be read and wasn't empty.
+  /// @param path       - The path to the dictionary file.
+  /// @param dictionary - (out) The contents of the file.
+  static bool read_dictionary(const std::string& path, std::string& dictionary);
+
+  /// @returns          - true if a dictionary was trained by zstd, rather
+  ///                     than being raw content.
+  static bool is_trained(const std::string& dictionary);
+
+  /// @returns - true if the dictionary was loaded successfully. If not,
+  ///            compress leaves contents untouched.
+  bool is_valid() const { return ((_cdict != NULL) && (_ddict != NULL)); }
+
+  /// Compresses call fragment contents in place. This is safe to call from
+  /// several threads at once.
+  /// @param contents - The contents to compress.
+  virtual void compress(std::string& contents);
+
+  /// Decompresses call fragment contents. Contents that aren't compressed
+  /// are passed through unchanged.
+  /// @returns              - true if the contents were valid.
+  /// @param contents       - The stored contents.
+  /// @param decompressed   - (out) The decompressed contents.
+  bool decompress(const std::string& contents, std::string& decompressed) const;
+
+private:
+  ZSTD_CDict* _cdict;
+  ZSTD_DDict* _ddict;
+
+  /// Ratio of uncompressed to stored size, as a percentage.
+  StatisticAccumulator* _stat_compression_ratio;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ * @file call_list_entry.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_ENTRY_H_
+#define CALL_LIST_ENTRY_H_
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+
+#include "call_list_store.h"
+
+/// Compact description of a call list entry. This is filled in on the SIP
+/// thread, and the contents of the call fragment are rendered from it on a
+/// memento worker thread.
+///
+/// Which fields are used depends on the type of the fragment.
+///   - BEGIN and REJECTED use the caller, callee, outgoing and start time.
+///     BEGIN also uses the answer time and answerer.
+///   - END only uses the end time.
+struct CallListEntry
+{
+  CallListEntry() :
+    start_time(0),
+    answer_time(0),
+    end_time(0),
+    outgoing(false)
+  {}
+
+  /// Caller URI and name (the name can be empty). For the summary of a
+  /// flood of rejected calls, the name describes the calls it stands for
+  /// (see CallFloodDetector).
+  std::string caller_uri;
+  std::string caller_name;
+
+  /// Callee URI and name (the name can be empty)
+  std::string callee_uri;
+  std::string callee_name;
+
+  /// Answerer URI and name (either can be empty)
+  std::string answerer_uri;
+  std::string answerer_name;
+
+  /// Start, answer and end times of the call
+  time_t start_time;
+  time_t answer_time;
+  time_t end_time;
+
+  /// Flag for whether the call is incoming or outgoing
+  bool outgoing;
+};
+
+/// How the times in a CallListEntry are rendered.
+///   - UTC: the times are real time_t values, and are rendered in the local
+///     timezone. This is the case for entries built on the SIP thread.
+///   - LOCAL: the UTC offset of the AS that recorded the call has already
+///     been applied (see CallFragmentCodec), so the times are rendered
+///     without any further conversion.
+enum struct EntryTimes
+{
+  UTC,
+  LOCAL
+};
+
+/// Renders the XML contents of a call fragment. The XML has the form:
+///  <to>
+///    <URI>callee_uri</URI>
+///    <name>callee_name</name> - may be absent
+///  </to>
+///  <from>
+///    <URI>caller_uri</URI>
+///    <name>caller_name</name> - may be absent
+///  </from>
+///  <outgoing>outgoing</outgoing>
+///  <start-time>start_time</start-time>
+///  <answered>answered</answered>
+///  <answer-time>answer_time</answer-time> - only present if the call was
+///                                           answered
+///  <answerer> - may be absent
+///    <URI>answerer_uri</URI>
+///    <name>answerer_name</name> - may be absent
+///  </answerer>
+///
+/// for BEGIN and REJECTED fragments, and
+///  <end-time>end_time</end-time>
+///
+/// for END fragments.
+///
+/// The layout (including the tab indentation and trailing newlines) matches
+/// what rapidxml::print produces for the equivalent document, so existing
+/// readers see no difference.
+/// @param type  - The type of call fragment.
+/// @param entry - The call list entry.
+/// @param times - How the times in the entry should be rendered.
+std::string render_call_list_xml(CallListStore::CallFragment::Type type,
+                                 const CallListEntry& entry,
+                                 EntryTimes times = EntryTimes::UTC);
+
+/// Writes the XML contents of a call fragment (as described for
+/// render_call_list_xml) straight into a caller-provided buffer, without
+/// allocating any memory. The output is not null-terminated.
+/// @returns       - The number of characters written, or 0 if the buffer
+///                  was too small.
+/// @param type    - The type of call fragment.
+/// @param entry   - The call list entry.
+/// @param buf     - The buffer to write into.
+/// @param buf_len - The size of the buffer.
+/// @param times   - How the times in the entry should be rendered.
+size_t write_call_list_xml(CallListStore::CallFragment::Type type,
+                           const CallListEntry& entry,
+                           char* buf,
+                           size_t buf_len,
+                           EntryTimes times = EntryTimes::UTC);
+
+#endif
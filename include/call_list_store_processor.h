@@ -12,7 +12,15 @@
 #ifndef CALL_LIST_STORE_PROCESSOR_H_
 #define CALL_LIST_STORE_PROCESSOR_H_
 
+#include <pthread.h>
+#include <deque>
+#include <unordered_map>
+
 #include "call_list_store.h"
+#include "call_list_entry.h"
+#include "call_list_view.h"
+#include "call_fragment_codec.h"
+#include "call_fragment_compressor.h"
 #include "threadpool.h"
 #include "load_monitor.h"
 #include "sas.h"
@@ -20,11 +28,37 @@
 #include "counter.h"
 #include "accumulator.h"
 #include "httpnotifier.h"
+#include "heavy_hitters.h"
+#include "trim_ownership.h"
+
+class CallFloodDetector;
 
 class CallListStoreProcessor
 {
 public:
   /// Constructor
+  /// @param begin_hold_ms  How long to hold BEGIN fragments in memory,
+  ///                       waiting for the END fragment so that the two can
+  ///                       be written together. 0 writes them straight away.
+  /// @param flood_max_rejected_calls  Rejected calls to an IMPU to write in
+  ///                       each flood window before folding the rest into a
+  ///                       summary (see CallFloodDetector). 0 disables this.
+  /// @param flood_window_ms  Length of the flood window.
+  /// @param cass_target_latency_us  Target latency for a request, from
+  ///                       being queued to being written. Each store
+  ///                       operation gives up once a request's target is
+  ///                       up (see DeadlineCallListStore). 0 means no
+  ///                       deadline. This only applies if call_list_store
+  ///                       is a DeadlineCallListStore, as nothing else can
+  ///                       give up on an operation.
+  /// @param call_list_view_store  Store for materialized call list views
+  ///                       (see CallListView), which are brought up to date
+  ///                       after each write. NULL if views are disabled.
+  /// @param trim_ownership  Which IMPUs this node trims. Call lists owned by
+  ///                       other nodes are only checked occasionally, and
+  ///                       only trimmed once they're far over the limit.
+  ///                       NULL if this node trims every call list it
+  ///                       writes to.
   CallListStoreProcessor(LoadMonitor* load_monitor,
                          CallListStore::Store* call_list_store,
                          const int max_call_list_length,
@@ -32,39 +66,78 @@ public:
                          const int call_list_ttl,
                          LastValueCache* stats_aggregator,
                          ExceptionHandler* exception_handler,
-                         HttpNotifier* notifier);
+                         HttpNotifier* notifier,
+                         CallFragmentCodec::Encoding fragment_encoding,
+                         CallFragmentCompressor* compressor,
+                         const int begin_hold_ms,
+                         const int flood_max_rejected_calls,
+                         const int flood_window_ms,
+                         const int cass_target_latency_us,
+                         CallListViewStore* call_list_view_store,
+                         TrimOwnership* trim_ownership);
 
   /// Destructor
   virtual ~CallListStoreProcessor();
 
-  /// This function constructs a Cassandra request to write a call to the
-  /// call list store. It runs synchronously, so must be done in a
-  /// separate thread to avoid introducing unnecessary latencies in the
-  /// call path.
-  /// @param impu       IMPU
-  /// @param timestamp  Timestamp of call list entry
-  /// @param id         Id of call list entry
-  /// @param type       Type of call fragment to write
-  /// @param xml        Contents of call list entry
-  /// @param trail      SAS trail
-  virtual void write_call_list_entry(std::string impu,
-                                     std::string timestamp,
-                                     std::string id,
-                                     CallListStore::CallFragment::Type type,
-                                     std::string xml,
-                                     SAS::TrailId trail);
-
+  /// A request to write a call fragment. Requests are recycled, and keep
+  /// the capacity of their strings from one use to the next, so filling one
+  /// in doesn't normally allocate any memory. Get requests from get_request
+  /// rather than creating them.
   struct CallListRequest
   {
+    CallListRequest() : trail(0), retries(0), retried_us(0), next(NULL) {}
+
+    /// Clears the request for reuse, keeping the capacity of its strings.
+    void reset();
+
     Utils::StopWatch stop_watch;
+
+    /// IMPU of the call list owner
     std::string impu;
-    std::string timestamp;
-    std::string id;
-    CallListStore::CallFragment::Type type;
-    std::string contents;
+
+    /// The fragment to write. The caller fills in the timestamp, id and
+    /// type, and the contents are encoded from the entry on a worker thread.
+    CallListStore::CallFragment fragment;
+
+    /// Details of the call list entry
+    CallListEntry entry;
+
     SAS::TrailId trail;
+
+    /// Times the request has been queued again after missing its deadline.
+    int retries;
+
+    /// Time spent on the request before it was last queued again. The stop
+    /// watch restarts each time, to give each attempt its own deadline, so
+    /// this is added back on to the latency reported for the request.
+    unsigned long retried_us;
+
+    /// Link in the list of free requests. For a BEGIN request that has been
+    /// merged with its END, this is the END request, which is written in
+    /// the same pass.
+    CallListRequest* next;
   };
 
+  /// Gets an empty request from the pool of free requests.
+  CallListRequest* get_request();
+
+  /// Returns a request to the pool of free requests.
+  void release_request(CallListRequest* request);
+
+  /// Finishes with a request that won't be written (because it has been
+  /// folded into a flood summary, say): reports it to the load monitor as
+  /// complete, as if it had been written, and returns it to the pool.
+  void complete_request(CallListRequest* request);
+
+  /// This function queues a request to write a call to the call list store.
+  /// The write runs synchronously, so must be done in a separate thread to
+  /// avoid introducing unnecessary latencies in the call path. The contents
+  /// of the call fragment are encoded on that thread too.
+  /// @param request    The request, from get_request. This takes ownership
+  ///                   of the request, which goes back to the pool once the
+  ///                   fragment has been written.
+  virtual void write_call_list_entry(CallListRequest* request);
+
   // LCOV_EXCL_START
   static void exception_callback(CallListStoreProcessor::CallListRequest* work)
   {
@@ -86,6 +159,16 @@ private:
     /// @param max_call_list_length Maximum number of complete calls to store
     /// @param call_list_ttl        TTL of call list store entries.
     /// @param num_threads          Number of memento worker threads to start
+    /// @param fragment_encoding    Encoding for the call fragment contents.
+    /// @param compressor           Compressor for the call fragment contents
+    ///                             (may be NULL).
+    /// @param target_latency_us    Target latency for a request (0 for no
+    ///                             deadline). Ignored unless call_list_store
+    ///                             is a DeadlineCallListStore.
+    /// @param view_store           Store for materialized call list views
+    ///                             (may be NULL).
+    /// @param trim_ownership       Which IMPUs this node trims (NULL for
+    ///                             all of them).
     /// @param max_queue            Max queue size to allow.
     Pool(CallListStoreProcessor* call_list_store_proc,
          CallListStore::Store* call_list_store,
@@ -96,6 +179,11 @@ private:
          ExceptionHandler* exception_handler,
          void (*callback)(CallListStoreProcessor::CallListRequest* work),
          HttpNotifier* http_notifier,
+         CallFragmentCodec::Encoding fragment_encoding,
+         CallFragmentCompressor* compressor,
+         const int target_latency_us,
+         CallListViewStore* view_store,
+         TrimOwnership* trim_ownership,
          unsigned int max_queue = 0);
 
     /// Destructor
@@ -105,14 +193,29 @@ private:
     /// Called by worker threads when they pull work off the queue.
     virtual void process_work(CallListStoreProcessor::CallListRequest*&);
 
+    /// Encodes and writes the fragments for a request and any requests
+    /// merged with it, in a single store operation where the store
+    /// supports it.
+    /// @returns               true if every write succeeded.
+    /// @param clr             The first request.
+    /// @param cass_timestamp  (out) Cassandra timestamp used for the write.
+    /// @param deadline_us     Deadline for the write (0 for none).
+    /// @param timed_out       (out) Set if the write missed its deadline.
+    bool write_fragments(CallListStoreProcessor::CallListRequest* clr,
+                         uint64_t& cass_timestamp,
+                         uint64_t deadline_us,
+                         bool& timed_out);
+
     /// Performs call trim processing
     /// @param impu            IMPU.
     /// @param fragments       (out) fragments to delete
     /// @param cass_timestamp  Cassandra timestamp
+    /// @param deadline_us     Deadline for the delete (0 for none).
     /// @param trail           SAS trail
-    void perform_call_trim(std::string impu,
+    void perform_call_trim(const std::string& impu,
                            std::vector<CallListStore::CallFragment>& fragments,
                            uint64_t cass_timestamp,
+                           uint64_t deadline_us,
                            SAS::TrailId trail);
 
     /// Works out if a trim is needed to reduce the length of an IMPU's
@@ -120,10 +223,68 @@ private:
     /// off time.
     /// @param impu            IMPU.
     /// @param fragments       (out) Fragments to be deleted
+    /// @param deadline_us     Deadline for the read (0 for none).
     /// @param trail           SAS trail
-    bool is_call_trim_needed(std::string impu,
+    /// @param stored          (out) If not NULL, set to the stored
+    ///                        fragments if they were read.
+    /// @returns               true if a trim is needed.
+    bool is_call_trim_needed(const std::string& impu,
                              std::vector<CallListStore::CallFragment>& fragments,
-                             SAS::TrailId trail);
+                             uint64_t deadline_us,
+                             SAS::TrailId trail,
+                             std::vector<CallListStore::CallFragment>* stored = NULL);
+
+    /// Adds the fragments of some requests for an IMPU to its call list
+    /// view. If the view changes between being read and replaced, this
+    /// tries again, up to MAX_VIEW_ATTEMPTS times, and for no longer than
+    /// MAX_VIEW_UPDATE_MS or the deadline.
+    /// @param impu            IMPU.
+    /// @param requests        The requests whose fragments were written.
+    /// @param stored          The IMPU's stored fragments, if they've
+    ///                        already been read, or NULL.
+    /// @param deadline_us     Deadline for the view operations (0 for
+    ///                        none).
+    /// @param trail           SAS trail
+    void update_view(const std::string& impu,
+                     const std::vector<CallListStoreProcessor::CallListRequest*>& requests,
+                     const std::vector<CallListStore::CallFragment>* stored,
+                     uint64_t deadline_us,
+                     SAS::TrailId trail);
+
+    /// Fills in a view from the stored call fragments, for an IMPU that
+    /// doesn't have a view yet (or whose view is corrupt). The fragments
+    /// are only read if the caller doesn't already have them.
+    /// @returns               false if the call list couldn't be read.
+    bool seed_view(const std::string& impu,
+                   CallListView& view,
+                   const std::vector<CallListStore::CallFragment>* stored,
+                   int64_t expiry_s,
+                   SAS::TrailId trail);
+
+    /// A node checks 1 in this many of the lists it would check, if it
+    /// owned them, for lists owned by other nodes.
+    static const int NON_OWNER_CHECK_RATIO = 10;
+
+    /// How far over the maximum length a list owned by another node can get
+    /// before this node trims it.
+    static const int NON_OWNER_TRIM_FACTOR = 2;
+
+    /// Times to try replacing a view before giving up.
+    static const int MAX_VIEW_ATTEMPTS = 5;
+
+    /// Longest to spend updating a view, even if the request has no
+    /// deadline.
+    static const int MAX_VIEW_UPDATE_MS = 100;
+
+    /// Works out the deadline for a request's store operations, from its
+    /// time in the queue and the target latency.
+    /// @returns               The deadline (on the DeadlineCallListStore
+    ///                        clock), or 0 for none.
+    uint64_t deadline(CallListStoreProcessor::CallListRequest* clr);
+
+    /// Counts a failed store operation as a timeout or an error.
+    /// @returns               true if it was a timeout.
+    bool record_failure(uint64_t deadline_us);
 
     /// Underlying call list store
     CallListStore::Store* _call_list_store;
@@ -142,10 +303,57 @@ private:
 
     /// Notifier
     HttpNotifier* _http_notifier;
+
+    /// Encoding for the call fragment contents.
+    CallFragmentCodec::Encoding _fragment_encoding;
+
+    /// Compressor for the call fragment contents (may be NULL).
+    CallFragmentCompressor* _compressor;
+
+    /// Target latency for a request (0 for no deadline, including if the
+    /// store can't enforce one).
+    int _target_latency_us;
+
+    /// Store for materialized call list views (may be NULL).
+    CallListViewStore* _view_store;
+
+    /// Which IMPUs this node trims (NULL for all of them).
+    TrimOwnership* _trim_ownership;
   };
 
   friend class Pool;
 
+  /// A BEGIN request held waiting for its END.
+  struct HeldRequest
+  {
+    CallListRequest* request;
+    uint64_t deadline_ms;
+  };
+
+  /// Holds a BEGIN request, or merges an END request with its held BEGIN.
+  /// @returns    The request to queue now (the merged BEGIN, or the request
+  ///             itself if it isn't held or merged), or NULL if it's held.
+  /// @param clr  The request.
+  CallListRequest* hold_or_merge(CallListRequest* clr);
+
+  /// Queues any held BEGIN requests whose hold has expired.
+  /// @param now_ms  The current time (from current_time_ms).
+  void expire_held_requests(uint64_t now_ms);
+
+  /// Thread that flushes held BEGIN requests when their hold expires, and
+  /// summaries of call floods at the end of their window.
+  static void* housekeeping_thread_fn(void* processor);
+  void housekeeping_thread();
+
+  /// Queues a request that has been held back (so its stop watch is
+  /// restarted, to leave the hold time out of the store's latency).
+  void queue_held_request(CallListRequest* clr);
+
+  static uint64_t current_time_ms();
+
+  /// Load monitor, to report requests that finish without being written.
+  LoadMonitor* _load_monitor;
+
   ///  Thread pool
   Pool* _thread_pool;
 
@@ -154,6 +362,36 @@ private:
   StatisticCounter _stat_failed_calls_recorded;
   StatisticAccumulator _stat_cassandra_read_latency;
   StatisticAccumulator _stat_cassandra_write_latency;
+  StatisticCounter _stat_cassandra_timeouts;
+  StatisticCounter _stat_cassandra_errors;
+  StatisticCounter _stat_cassandra_retries;
+  StatisticCounter _stat_view_updates;
+  StatisticCounter _stat_view_conflicts;
+  StatisticCounter _stat_view_errors;
+  StatisticCounter _stat_trims_not_owned;
+
+  /// IMPUs with the most writes and trims.
+  HotImpuTracker _hot_impus;
+
+  /// Pool of free requests, and the number of requests created because the
+  /// pool had run dry, protected by _request_lock.
+  pthread_mutex_t _request_lock;
+  CallListRequest* _free_requests;
+  size_t _num_free_requests;
+  size_t _num_extra_requests;
+
+  /// BEGIN requests held waiting for their END, keyed on the call's unique
+  /// ID, and the IDs in the order they were held. Protected by _held_lock.
+  int _begin_hold_ms;
+  pthread_mutex_t _held_lock;
+  pthread_cond_t _held_cond;
+  std::unordered_map<std::string, HeldRequest> _held_requests;
+  std::deque<std::string> _held_order;
+  bool _housekeeping_terminating;
+  pthread_t _housekeeping_thread;
+
+  /// Call flood detector (NULL if flood detection is disabled).
+  CallFloodDetector* _flood_detector;
 };
 
 #endif
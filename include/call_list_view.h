@@ -0,0 +1,132 @@
+/**
+ * @file call_list_view.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_VIEW_H__
+#define CALL_LIST_VIEW_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "call_list_store.h"
+
+/// A subscriber's whole call list, already merged and trimmed, kept
+/// alongside the call fragments so that it can be read with a single key
+/// read.
+///
+/// Each call holds the XML of its BEGIN or REJECTED fragment and, once the
+/// call has ended, the XML of its END fragment. A reader renders the call
+/// list from to_xml, without having to pair up fragments itself. Calls are
+/// kept in timestamp order.
+///
+/// Version 1 of the stored view is laid out as follows.
+///
+///   VIEW_VERSION (1 byte)
+///
+/// followed, for each call, by
+///
+///   timestamp, id (strings)
+///   expiry (8 bytes, seconds since the epoch, or 0 if never)
+///   BEGIN or REJECTED XML, END XML (strings, empty if not yet seen)
+///
+/// Strings are a 4 byte length followed by that many bytes. All integers
+/// are big-endian.
+class CallListView
+{
+public:
+  /// Current version of the stored view.
+  static const char VIEW_VERSION = '\x01';
+
+  struct Call
+  {
+    std::string timestamp;
+    std::string id;
+
+    /// When the call expires (seconds since the epoch), or 0 if never.
+    int64_t expiry_s;
+
+    /// XML of the BEGIN or REJECTED fragment, or empty if not yet seen.
+    std::string start;
+
+    /// XML of the END fragment, or empty if not yet seen.
+    std::string end;
+  };
+
+  /// Decodes a stored view.
+  /// @returns       - false if the view is malformed.
+  bool decode(const std::string& stored);
+
+  /// Encodes the view for storing.
+  void encode(std::string& stored) const;
+
+  /// Adds a fragment to the view, merging it into its call if the call is
+  /// already there. Adding the same fragment again has no effect.
+  /// @param fragment - The fragment (only its timestamp, id and type are
+  ///                   used).
+  /// @param xml      - The fragment's contents, as XML.
+  /// @param expiry_s - When the fragment expires (0 if never).
+  void add(const CallListStore::CallFragment& fragment,
+           const std::string& xml,
+           int64_t expiry_s);
+
+  /// Drops expired calls, and the oldest calls beyond the maximum length.
+  /// As with the stored fragments, only calls with a BEGIN or REJECTED
+  /// fragment count towards the length.
+  /// @param max_calls - Maximum number of calls to keep (0 for no limit).
+  /// @param now_s     - The current time (seconds since the epoch).
+  void trim(int max_calls, int64_t now_s);
+
+  /// Renders the call list as a sequence of <call> elements, skipping
+  /// calls that have expired or haven't started.
+  /// @param now_s     - The current time (seconds since the epoch).
+  void to_xml(int64_t now_s, std::string& xml) const;
+
+  std::vector<Call> calls;
+};
+
+/// Store for materialized call list views. Views are versioned, and only
+/// replaced if nobody else has replaced them since they were read, so that
+/// concurrent writers for the same subscriber don't lose each other's
+/// calls.
+class CallListViewStore
+{
+public:
+  virtual ~CallListViewStore() {}
+
+  /// Reads a subscriber's view.
+  /// @returns       - OK, NOT_FOUND if there's no view, or an error.
+  /// @param view    - (out) The stored view.
+  /// @param version - (out) The view's version, to pass to
+  ///                  set_call_list_view_sync.
+  virtual CassandraStore::ResultCode get_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  std::string& view,
+                                                  int64_t& version,
+                                                  SAS::TrailId trail) = 0;
+
+  /// Replaces a subscriber's view, if its version hasn't changed.
+  /// @returns       - OK (whether or not the view was replaced), or an
+  ///                  error.
+  /// @param version - The version the view was read at, or 0 if there
+  ///                  wasn't a view.
+  /// @param ttl     - TTL of the view (0 for none).
+  /// @param applied - (out) Whether the view was replaced. If not, it has
+  ///                  changed since it was read.
+  virtual CassandraStore::ResultCode set_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  const std::string& view,
+                                                  int64_t version,
+                                                  int32_t ttl,
+                                                  bool& applied,
+                                                  SAS::TrailId trail) = 0;
+};
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file cluster_communication_monitor.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CLUSTER_COMMUNICATION_MONITOR_H__
+#define CLUSTER_COMMUNICATION_MONITOR_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "base_communication_monitor.h"
+
+/// Reports the reachability of several Cassandra clusters to a single
+/// communication monitor, and so to a single alarm.
+///
+/// Each cluster reports to its own monitor from add_cluster. Failures are
+/// always passed on, but successes are only passed on while no cluster is
+/// failing, so one healthy cluster can't clear the alarm raised for
+/// another. A cluster stops failing as soon as a request to it succeeds.
+class ClusterCommunicationMonitor
+{
+public:
+  /// Constructor.
+  /// @param monitor - The monitor to report to. This takes ownership of it.
+  ClusterCommunicationMonitor(BaseCommunicationMonitor* monitor);
+
+  virtual ~ClusterCommunicationMonitor();
+
+  /// Adds a cluster.
+  /// @param name    - The cluster's name, for logs.
+  /// @returns       - The monitor the cluster should report to. This
+  ///                  remains owned by the ClusterCommunicationMonitor.
+  BaseCommunicationMonitor* add_cluster(const std::string& name);
+
+  /// @returns       - How many clusters are currently failing.
+  int failing_clusters() const { return _failing_clusters; }
+
+private:
+  class Cluster : public BaseCommunicationMonitor
+  {
+  public:
+    Cluster(ClusterCommunicationMonitor* parent, const std::string& name);
+    virtual ~Cluster() {}
+
+    virtual void inform_success(unsigned long now_ms = 0);
+    virtual void inform_failure(unsigned long now_ms = 0);
+
+  protected:
+    /// The parent's monitor does the tracking.
+    virtual void track_communication_changes(unsigned long now_ms = 0) {}
+
+  private:
+    ClusterCommunicationMonitor* _parent;
+    std::string _name;
+    std::atomic<bool> _failing;
+  };
+
+  BaseCommunicationMonitor* _monitor;
+  std::vector<Cluster*> _clusters;
+  std::atomic<int> _failing_clusters;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * @file consistency_policy.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CONSISTENCY_POLICY_H__
+#define CONSISTENCY_POLICY_H__
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+#include "cql_frame.h"
+
+/// Picks the consistency level for a kind of request, dropping to a weaker
+/// level while Cassandra is struggling.
+///
+/// This keeps exponentially weighted moving averages of the requests'
+/// latency and failure rate. If either goes above its threshold, the policy
+/// degrades, and level() returns the weaker level (LOCAL_ONE for the LOCAL_
+/// levels, ONE otherwise). It recovers once both are back below half their
+/// thresholds, and at least MIN_SAMPLES requests have been made at the
+/// weaker level, so it doesn't flap. It is safe to use from any thread.
+class ConsistencyPolicy
+{
+public:
+  /// @param normal                  - Level to use while Cassandra is
+  ///                                  healthy.
+  /// @param latency_threshold_us    - Average latency above which to
+  ///                                  degrade, or 0 to ignore latency.
+  /// @param error_threshold_percent - Percentage of requests failing above
+  ///                                  which to degrade, or 0 to ignore
+  ///                                  failures.
+  ConsistencyPolicy(Cql::Consistency normal,
+                    uint64_t latency_threshold_us,
+                    int error_threshold_percent);
+  virtual ~ConsistencyPolicy();
+
+  /// @returns - The level to use for the next request.
+  Cql::Consistency level() const
+  {
+    return _degraded.load() ? _weak : _normal;
+  }
+
+  bool degraded() const { return _degraded.load(); }
+
+  /// Records how long a request took, and whether Cassandra failed it.
+  /// @returns - true if this degraded or recovered the policy.
+  bool record(uint64_t latency_us, bool failed);
+
+  uint64_t latency_us() const;
+  int error_percent() const;
+
+  /// @returns - The level a policy with this normal level degrades to.
+  static Cql::Consistency weaken(Cql::Consistency level);
+
+  /// @returns - The level's name, as used in configuration.
+  static const char* name(Cql::Consistency level);
+
+  /// Parses a level's name (one, local_one, quorum or local_quorum).
+  /// @returns - false if the name isn't recognised.
+  static bool parse(const std::string& name, Cql::Consistency& level);
+
+  /// Weight of the newest sample in the averages is 1 / EWMA_DECAY.
+  static const int EWMA_DECAY = 16;
+
+  /// Requests needed before the policy first degrades, and at the weaker
+  /// level before it recovers.
+  static const int MIN_SAMPLES = 50;
+
+private:
+  const Cql::Consistency _normal;
+  const Cql::Consistency _weak;
+  const uint64_t _latency_threshold_us;
+  const int _error_threshold_percent;
+
+  std::atomic<bool> _degraded;
+
+  /// Protects everything below.
+  mutable pthread_mutex_t _lock;
+  uint64_t _latency_us;
+
+  /// Failure rate, in hundredths of a percent.
+  uint64_t _error_rate;
+
+  /// Requests since the policy was created, or last degraded.
+  int _samples;
+};
+
+#endif
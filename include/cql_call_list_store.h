@@ -0,0 +1,465 @@
+/**
+ * @file cql_call_list_store.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CQL_CALL_LIST_STORE_H__
+#define CQL_CALL_LIST_STORE_H__
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "accumulator.h"
+#include "base_communication_monitor.h"
+#include "batch_call_list_store.h"
+#include "call_list_store.h"
+#include "call_list_view.h"
+#include "consistency_policy.h"
+#include "cql_connection.h"
+#include "cql_frame.h"
+#include "keyed_statistic.h"
+#include "latency_window.h"
+#include "node_latency.h"
+#include "statistic.h"
+#include "token_ring.h"
+
+/// Call list store that talks to Cassandra over the CQL native protocol,
+/// rather than Thrift.
+///
+/// It uses the same call_lists table as the Thrift store (which CQL sees as
+/// a compact table of key, column1 and value), so the two can be swapped
+/// freely. Writes, reads and deletes are prepared statements, prepared once
+/// per connection, and each connection carries many requests at once.
+/// Results are reported with the same ResultCodes as the Thrift store.
+///
+/// If token awareness is on, the store learns the ring's token map from the
+/// system tables, and sends each request straight to the node that owns the
+/// partition, saving a hop inside the ring. It falls back to the configured
+/// hosts if the ring isn't known, or the owner can't be reached. How often
+/// each node is hit directly is published as a statistic.
+///
+/// The store also tracks each node's latency and requests in flight (see
+/// NodeLatency), and steers requests away from nodes that are slow before
+/// they fail outright. These are published as a statistic too.
+///
+/// Optionally, reads and timestamped writes are hedged: if one hasn't
+/// completed within a percentile of recent latency, the same request goes
+/// to another node too, and the first successful response wins. An error
+/// response is only taken once every attempt has failed. Hedges are capped
+/// at a percentage of the requests that could be hedged. How many are
+/// sent, and how many win, is published as a statistic.
+///
+/// Writes and reads each have a ConsistencyPolicy, which drops them to a
+/// weaker consistency level while Cassandra is slow or failing, rather than
+/// let call list writes back up. While reads are degraded, a read that
+/// finds nothing isn't retried at QUORUM either, since trimming can make do
+/// with what one replica has. The active levels are published as a
+/// statistic.
+///
+/// The store also keeps materialized call list views (see CallListView), in
+/// the call_list_views table (impu text PRIMARY KEY, version bigint, view
+/// blob). Views are replaced with lightweight
+/// transactions, conditional on the version that was read, and are read
+/// and written at QUORUM (or LOCAL_QUORUM, if writes are at a LOCAL_ level)
+/// so that a view that has been read is current.
+///
+/// Connections are normally opened when they're first used. Optionally,
+/// some of each node's connections are prewarmed instead: they're opened,
+/// with every statement prepared, in parallel when the store is created,
+/// and a background thread reopens them as soon as they're due a retry
+/// after failing, rather than leaving that to the next request. The time
+/// taken to open each connection is published as a statistic.
+///
+/// The same background thread reloads the token map, so requests never
+/// wait on the system tables. Each node's connections are keyed by its
+/// address, with configured hosts resolved to theirs, and the connections
+/// to nodes that leave the ring are closed.
+class CqlCallListStore : public CallListStore::Store,
+                         public BatchCallListStore,
+                         public CallListViewStore
+{
+public:
+  /// Statistics published by the stores for every Cassandra cluster. Each
+  /// store publishes its values under its cluster's name, and the connect
+  /// latency covers all clusters.
+  struct Statistics
+  {
+    Statistics(LastValueCache* stats_aggregator);
+
+    KeyedStatistic hedges;
+    KeyedStatistic consistency;
+    StatisticAccumulator connect_latency;
+    KeyedStatistic routes;
+    KeyedStatistic node_latency;
+  };
+
+  /// Constructor.
+  /// @param hosts            - Comma-separated Cassandra hosts.
+  /// @param port             - Port for the native protocol.
+  /// @param connections      - Connections to open to each host.
+  /// @param timeout_ms       - Connection and request timeout.
+  /// @param token_aware      - Whether to route requests to the partition's
+  ///                           owner.
+  /// @param hedge_percentile - Percentile of latency after which to hedge a
+  ///                           request, or 0 not to hedge.
+  /// @param hedge_budget_percent - Most hedges to send, as a percentage of
+  ///                           the requests that could be hedged.
+  /// @param write_consistency - Consistency level for writes.
+  /// @param read_consistency - Consistency level for reads.
+  /// @param degrade_latency_us - Average latency above which to drop to a
+  ///                           weaker consistency level, or 0 to ignore
+  ///                           latency.
+  /// @param degrade_error_percent - Percentage of requests failing above
+  ///                           which to drop to a weaker consistency level,
+  ///                           or 0 to ignore failures.
+  /// @param prewarm_connections - Connections to each node to keep open
+  ///                           ahead of requests, or 0 to open them all
+  ///                           when they're first used.
+  /// @param comm_monitor     - Monitor to report Cassandra reachability to.
+  ///                           May be NULL.
+  /// @param stats            - Statistics to publish to. These remain owned
+  ///                           by the caller.
+  /// @param cluster          - The cluster's name, to publish statistics
+  ///                           under, or empty if there's only the one.
+  CqlCallListStore(const std::string& hosts,
+                   int port,
+                   int connections,
+                   int timeout_ms,
+                   bool token_aware,
+                   int hedge_percentile,
+                   int hedge_budget_percent,
+                   Cql::Consistency write_consistency,
+                   Cql::Consistency read_consistency,
+                   uint64_t degrade_latency_us,
+                   int degrade_error_percent,
+                   int prewarm_connections,
+                   BaseCommunicationMonitor* comm_monitor,
+                   Statistics* stats,
+                   const std::string& cluster);
+
+  virtual ~CqlCallListStore();
+
+  virtual CassandraStore::ResultCode write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail);
+
+  /// Writes the fragments as a single CQL batch.
+  virtual CassandraStore::ResultCode write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode get_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  std::string& view,
+                                                  int64_t& version,
+                                                  SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode set_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  const std::string& view,
+                                                  int64_t version,
+                                                  int32_t ttl,
+                                                  bool& applied,
+                                                  SAS::TrailId trail);
+
+  /// @returns - The column name for a fragment, which is the same as the
+  ///            Thrift store's: call_<timestamp>_<id>_<type>.
+  static std::string column_name(const CallListStore::CallFragment& fragment);
+
+  /// Fills in a fragment's timestamp, ID and type from its column name.
+  /// @returns - false if the column name isn't valid.
+  static bool parse_column_name(const std::string& name,
+                                CallListStore::CallFragment& fragment);
+
+  /// Most deletes to send in a single batch.
+  static const size_t MAX_BATCH_SIZE = 100;
+
+private:
+  enum Statement
+  {
+    INSERT = 0,
+    SELECT,
+    DELETE,
+    SELECT_VIEW,
+    INSERT_VIEW,
+    UPDATE_VIEW,
+    NUM_STATEMENTS
+  };
+
+  static const char* const STATEMENTS[NUM_STATEMENTS];
+
+  /// Which of each statement's values is the partition key.
+  static const size_t KEY_VALUES[NUM_STATEMENTS];
+
+  /// A connection, and the IDs of the statements prepared on it.
+  struct Slot
+  {
+    CqlConnection* connection;
+    NodeLatency* node;
+    pthread_mutex_t lock;
+    std::string prepared[NUM_STATEMENTS];
+    uint64_t next_connect_ms;
+  };
+
+  /// Creates a slot for a host. The slot connects when it's first used.
+  /// @param address    - The host's address, to track its latency under.
+  Slot* new_slot(const std::string& host, const std::string& address);
+
+  /// @returns          - The address a configured host resolves to, or the
+  ///                     host itself if it doesn't resolve.
+  static std::string resolve_host(const std::string& host);
+
+  /// Connects a slot if it isn't connected, unless it has failed recently.
+  /// The caller must hold the slot's lock.
+  bool connect_slot(Slot* slot);
+
+  /// Opens any prewarmed connections that are closed and due a retry, in
+  /// parallel, and prepares every statement on them.
+  void prewarm();
+
+  /// A slot being prewarmed on its own thread.
+  struct PrewarmTask
+  {
+    CqlCallListStore* store;
+    Slot* slot;
+  };
+
+  /// Connects a slot and prepares every statement on it.
+  static void* prewarm_slot_fn(void* task);
+
+  static void* background_thread_fn(void* store);
+
+  /// Reloads the token map and reopens prewarmed connections until the
+  /// store is destroyed.
+  void background_thread();
+
+  /// Connects a slot if needed, and prepares a statement on it if needed.
+  /// @returns          - false if the slot isn't usable.
+  bool try_slot(Slot* slot, Statement statement, std::string& id);
+
+  /// Picks one of the configured connections, favouring faster nodes.
+  Slot* pick_slot();
+
+  /// Picks a connection for a partition key, connecting and preparing the
+  /// statement if needed.
+  /// @returns          - false if no connection is usable.
+  bool get_slot(Statement statement,
+                const std::string& key,
+                Slot*& slot,
+                std::string& id);
+
+  /// Runs a prepared statement, as a batch if there is more than one set of
+  /// values. KEY_VALUES gives the partition key in each set.
+  CassandraStore::ResultCode execute(
+                        Statement statement,
+                        const std::vector<std::vector<std::string>>& values,
+                        Cql::Consistency consistency,
+                        int64_t timestamp,
+                        std::string& rsp_body);
+
+  struct Hedge;
+  class HedgeCallback;
+
+  /// @returns          - Whether a request can be hedged.
+  bool hedgeable(Statement statement, int64_t timestamp) const;
+
+  /// Records the end of a request in its node's latency (see NodeLatency).
+  /// Successful responses are latency samples. Requests that failed, or
+  /// that the node rejected because it is overloaded or unavailable, count
+  /// as penalty_us. Other error responses aren't samples.
+  /// @param sent       - Whether a response arrived.
+  static void record_node_response(NodeLatency* node,
+                                   bool sent,
+                                   uint8_t rsp_opcode,
+                                   const std::string& rsp_body,
+                                   uint64_t latency_us,
+                                   uint64_t penalty_us);
+
+  /// Sends one attempt at a hedged request.
+  /// @returns          - false if the request couldn't be sent.
+  bool start_attempt(std::shared_ptr<Hedge> hedge,
+                     int attempt,
+                     Slot* slot,
+                     LatencyWindow* latency,
+                     const std::string& body);
+
+  /// Picks a connection to a different node to the primary, for a hedge.
+  /// @returns          - false if there isn't one ready.
+  bool pick_hedge_slot(Statement statement,
+                       const Slot* primary,
+                       Slot*& slot,
+                       std::string& id);
+
+  /// Waits until an attempt at a hedged request succeeds, they have all
+  /// failed, or the deadline passes. The caller must hold the hedge's lock.
+  static void wait_for_hedge(Hedge* hedge, uint64_t deadline_us);
+
+  /// Executes a statement on a slot, and on a second node too if the first
+  /// is slow to respond.
+  /// @returns          - false if no response arrived in time.
+  /// @param slot, id   - The slot and prepared statement to use. On return,
+  ///                     those of the response that was taken.
+  bool send_hedged(Statement statement,
+                   const std::vector<std::string>& values,
+                   Cql::Consistency consistency,
+                   int64_t timestamp,
+                   Slot*& slot,
+                   std::string& id,
+                   uint8_t& rsp_opcode,
+                   std::string& rsp_body);
+
+  /// Runs the SELECT at the given consistency level.
+  CassandraStore::ResultCode select(
+                            const std::string& impu,
+                            Cql::Consistency consistency,
+                            std::vector<CallListStore::CallFragment>& fragments);
+
+  /// Feeds the outcome of a request into a consistency policy, and
+  /// publishes the levels if the policy has changed level.
+  void record_consistency(ConsistencyPolicy& policy,
+                          const char* kind,
+                          uint64_t start_us,
+                          CassandraStore::ResultCode rc);
+
+  /// Publishes the active consistency levels.
+  void publish_consistency();
+
+  /// @returns          - The consistency level for reading and replacing
+  ///                     call list views.
+  Cql::Consistency view_consistency() const;
+
+  /// Runs an unprepared query on a slot.
+  bool query(Slot* slot,
+             const std::string& query,
+             std::vector<std::vector<std::string>>& rows);
+
+  /// Reloads the token map and publishes the routing counts if it's due.
+  /// Only called from the background thread, or before it starts.
+  void maybe_refresh_ring();
+
+  /// Loads the token map from the system tables of any reachable node.
+  /// @returns          - false if the token map couldn't be loaded.
+  bool refresh_ring();
+
+  /// Stops routing to nodes that aren't in the ring, apart from configured
+  /// hosts. Their connections are retired rather than freed, as requests
+  /// may still be using them. The caller must hold _ring_lock.
+  void retire_departed_slots(const std::set<std::string>& addresses);
+
+  /// Frees connections that were retired long enough ago that no request
+  /// can still be using them. The caller must hold _ring_lock.
+  void free_retired_slots(uint64_t now_ms);
+
+  /// Counts a request against the node it went to. The caller must hold
+  /// _ring_lock.
+  void record_route(const std::string& host, bool direct);
+
+  /// Publishes and resets the routing and hedging counts, and publishes
+  /// each node's latency. The caller must hold _ring_lock.
+  void publish_routes();
+
+  static uint64_t current_time_ms();
+  static uint64_t current_time_us();
+
+  /// How long to wait before retrying a connection that has failed.
+  static const int RECONNECT_INTERVAL_MS = 1000;
+
+  /// How often to reload the token map.
+  static const int RING_REFRESH_INTERVAL_MS = 60000;
+
+  /// How many times worse than another node's score the owner's score has
+  /// to be before a request skips the owner.
+  static const uint64_t SLOW_NODE_FACTOR = 4;
+
+  const int _port;
+  const int _connections;
+  const int _timeout_ms;
+  const bool _token_aware;
+  const int _hedge_percentile;
+  const int _hedge_budget_percent;
+  const int _prewarm_connections;
+
+  /// Connections to the configured hosts.
+  std::vector<Slot*> _slots;
+  std::atomic<unsigned int> _next_slot;
+  BaseCommunicationMonitor* _comm_monitor;
+  Statistics* _stats;
+  const std::string _cluster;
+
+  /// Recent latency of each statement, for working out when to hedge.
+  LatencyWindow* _hedge_latency[NUM_STATEMENTS];
+
+  /// Requests that could have been hedged, hedges sent, and hedges whose
+  /// response was taken, since the counts were last published.
+  std::atomic<uint64_t> _hedge_eligible;
+  std::atomic<uint64_t> _hedges_sent;
+  std::atomic<uint64_t> _hedges_won;
+
+  ConsistencyPolicy _write_policy;
+  ConsistencyPolicy _read_policy;
+
+  /// Protects _background_terminating, and wakes the background thread to
+  /// exit.
+  pthread_mutex_t _background_lock;
+  pthread_cond_t _background_cond;
+  bool _background_terminating;
+  bool _background_thread_running;
+  pthread_t _background_thread;
+
+  /// Protects everything below.
+  pthread_mutex_t _ring_lock;
+  TokenRing _ring;
+  uint64_t _next_ring_refresh_ms;
+
+  /// Connections to each node in the ring, by address. These are either
+  /// connections to a configured host, or in _discovered_slots.
+  std::map<std::string, std::vector<Slot*>> _host_slots;
+  std::vector<Slot*> _discovered_slots;
+
+  /// The configured hosts' addresses.
+  std::set<std::string> _configured_addresses;
+
+  /// Connections to nodes that have left the ring, and when they left.
+  std::vector<std::pair<uint64_t, Slot*>> _retired_slots;
+
+  struct RouteCounts
+  {
+    uint64_t direct;
+    uint64_t fallback;
+  };
+
+  std::map<std::string, RouteCounts> _routes;
+
+  /// Latency tracking for each node, by address.
+  std::map<std::string, NodeLatency*> _nodes;
+};
+
+#endif
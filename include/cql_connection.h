@@ -0,0 +1,161 @@
+/**
+ * @file cql_connection.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CQL_CONNECTION_H__
+#define CQL_CONNECTION_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// A connection to a Cassandra node over the CQL native protocol.
+///
+/// Requests from any number of threads share the connection. Each request
+/// in flight has its own stream ID, and a reader thread hands each response
+/// to the thread waiting on its stream, so a slow request doesn't hold up
+/// the others. Requests can also be sent without waiting, with the response
+/// handed to a callback.
+///
+/// If the connection fails, every request in flight fails and the
+/// connection stays down until connect() is called again.
+class CqlConnection
+{
+public:
+  /// Constructor.
+  /// @param host       - Host name or IP address of the node.
+  /// @param port       - Port for the native protocol.
+  /// @param timeout_ms - How long to wait to connect, or for a response.
+  CqlConnection(const std::string& host, int port, int timeout_ms);
+
+  /// Destructor. Closes the connection, failing any requests in flight.
+  virtual ~CqlConnection();
+
+  /// Opens the connection (if it isn't already open) and sends STARTUP.
+  /// @returns          - Whether the connection is ready for requests.
+  bool connect();
+
+  /// Closes the connection.
+  void disconnect();
+
+  bool is_connected();
+
+  /// Sends a request and waits for the response.
+  /// @returns          - false if the connection failed, or the response
+  ///                     didn't arrive in time.
+  /// @param opcode     - The request opcode.
+  /// @param body       - The request body.
+  /// @param rsp_opcode - The response opcode.
+  /// @param rsp_body   - The response body.
+  bool send_request(uint8_t opcode,
+                    const std::string& body,
+                    uint8_t& rsp_opcode,
+                    std::string& rsp_body);
+
+  /// Receives the outcome of a request sent with send_request_async.
+  class Callback
+  {
+  public:
+    virtual ~Callback() {}
+
+    /// Called once, on the connection's reader thread with the connection
+    /// locked, so it must be quick and mustn't use the connection.
+    /// @param success    - false if the connection failed.
+    /// @param rsp_opcode - The response opcode.
+    /// @param rsp_body   - The response body, which the callback may take.
+    virtual void on_response(bool success,
+                             uint8_t rsp_opcode,
+                             std::string& rsp_body) = 0;
+  };
+
+  /// Sends a request without waiting for the response. The connection
+  /// doesn't time the request out, so the caller has to stop waiting for
+  /// the callback if it doesn't want to wait indefinitely.
+  /// @returns          - false if the request couldn't be sent, in which case
+  ///                     the callback isn't called.
+  /// @param opcode     - The request opcode.
+  /// @param body       - The request body.
+  /// @param callback   - Called with the response. The connection takes
+  ///                     ownership of it, unless this returns false.
+  bool send_request_async(uint8_t opcode,
+                          const std::string& body,
+                          Callback* callback);
+
+  const std::string& host() const { return _host; }
+
+  /// Most requests that can be in flight on one connection.
+  static const int MAX_STREAMS = 1024;
+
+private:
+  struct PendingRequest
+  {
+    bool done;
+    bool failed;
+    bool abandoned;
+    uint8_t opcode;
+    std::string body;
+    Callback* callback;
+  };
+
+  /// Allocates a stream for a request.
+  /// @returns          - The stream, or -1 if the connection isn't up or has
+  ///                     no streams free.
+  int16_t add_pending(PendingRequest* pending, int& fd);
+
+  /// Writes a request to the socket, unless the connection has been
+  /// replaced since the request's stream was allocated.
+  /// @returns          - false if the request failed.
+  bool write_request(int fd, int16_t stream, const std::string& frame);
+
+  /// Completes a request, waking up the thread waiting for it or calling
+  /// its callback. The caller must hold _lock.
+  void complete_request(int16_t stream, bool success);
+
+  /// Opens the socket.
+  int open_socket();
+
+  /// Sends STARTUP and waits for READY, before the reader thread starts.
+  bool startup(int fd);
+
+  /// Closes the socket and waits for the reader thread. The caller must
+  /// not hold _lock.
+  void close_socket();
+
+  static void* reader_thread_fn(void* connection);
+  void reader_thread();
+
+  /// Fails every request in flight. The caller must hold _lock.
+  void fail_pending();
+
+  static bool read_fully(int fd, char* buffer, size_t len);
+  static bool write_fully(int fd, const char* buffer, size_t len);
+
+  const std::string _host;
+  const int _port;
+  const int _timeout_ms;
+
+  /// Protects _fd, _connected, _pending and _free_streams.
+  pthread_mutex_t _lock;
+  pthread_cond_t _cond;
+
+  /// Serialises writes to the socket.
+  pthread_mutex_t _write_lock;
+
+  int _fd;
+  bool _connected;
+  bool _reader_running;
+  pthread_t _reader;
+
+  std::vector<PendingRequest*> _pending;
+  std::vector<int16_t> _free_streams;
+};
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * @file cql_frame.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CQL_FRAME_H__
+#define CQL_FRAME_H__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Encoding and decoding of frames in version 4 of the CQL native protocol.
+///
+/// Only the parts of the protocol the call list store uses are covered:
+/// STARTUP, QUERY, PREPARE, EXECUTE and BATCH requests, and ERROR, READY
+/// and RESULT responses. All integers are big-endian.
+namespace Cql
+{
+  const uint8_t VERSION = 0x04;
+  const uint8_t RESPONSE_FLAG = 0x80;
+  const size_t HEADER_LEN = 9;
+
+  /// Largest frame body we'll accept (the protocol limit).
+  const uint32_t MAX_BODY_LEN = 256 * 1024 * 1024;
+
+  enum Opcode
+  {
+    OP_ERROR = 0x00,
+    OP_STARTUP = 0x01,
+    OP_READY = 0x02,
+    OP_AUTHENTICATE = 0x03,
+    OP_QUERY = 0x07,
+    OP_RESULT = 0x08,
+    OP_PREPARE = 0x09,
+    OP_EXECUTE = 0x0A,
+    OP_BATCH = 0x0D
+  };
+
+  enum Consistency
+  {
+    ONE = 0x0001,
+    QUORUM = 0x0004,
+    LOCAL_QUORUM = 0x0006,
+    LOCAL_ONE = 0x000A
+  };
+
+  enum ResultKind
+  {
+    RESULT_VOID = 1,
+    RESULT_ROWS = 2,
+    RESULT_SET_KEYSPACE = 3,
+    RESULT_PREPARED = 4,
+    RESULT_SCHEMA_CHANGE = 5
+  };
+
+  enum ErrorCode
+  {
+    ERR_SERVER = 0x0000,
+    ERR_PROTOCOL = 0x000A,
+    ERR_UNAVAILABLE = 0x1000,
+    ERR_OVERLOADED = 0x1001,
+    ERR_IS_BOOTSTRAPPING = 0x1002,
+    ERR_WRITE_TIMEOUT = 0x1100,
+    ERR_READ_TIMEOUT = 0x1200,
+    ERR_SYNTAX = 0x2000,
+    ERR_UNAUTHORIZED = 0x2100,
+    ERR_INVALID = 0x2200,
+    ERR_UNPREPARED = 0x2500
+  };
+
+  struct Header
+  {
+    uint8_t version;
+    uint8_t flags;
+    int16_t stream;
+    uint8_t opcode;
+    uint32_t length;
+  };
+
+  /// Appends protocol primitives to a buffer.
+  class Writer
+  {
+  public:
+    Writer(std::string& buffer) : _buffer(buffer) {}
+
+    void write_byte(uint8_t value);
+    void write_short(uint16_t value);
+    void write_int(int32_t value);
+    void write_long(int64_t value);
+
+    /// [string]: a short length followed by the bytes.
+    void write_string(const std::string& value);
+
+    /// [long string]: an int length followed by the bytes.
+    void write_long_string(const std::string& value);
+
+    /// [bytes]: an int length followed by the bytes.
+    void write_bytes(const std::string& value);
+
+    /// [short bytes]: a short length followed by the bytes.
+    void write_short_bytes(const std::string& value);
+
+    /// [string map]
+    void write_string_map(const std::map<std::string, std::string>& value);
+
+  private:
+    std::string& _buffer;
+  };
+
+  /// Reads protocol primitives from a frame body. Reads past the end of the
+  /// body fail, and every later read fails too, so callers can check ok()
+  /// once after a sequence of reads.
+  class Reader
+  {
+  public:
+    Reader(const std::string& buffer) : _buffer(buffer), _pos(0), _ok(true) {}
+
+    uint8_t read_byte();
+    uint16_t read_short();
+    int32_t read_int();
+    int64_t read_long();
+    std::string read_string();
+    std::string read_short_bytes();
+
+    /// Reads a [bytes] value. A negative length is a null value, which is
+    /// read as an empty string.
+    std::string read_bytes();
+
+    /// Skips an [option], as used for column types in result metadata.
+    void skip_option();
+
+    bool ok() const { return _ok; }
+
+  private:
+    bool have(size_t len);
+
+    const std::string& _buffer;
+    size_t _pos;
+    bool _ok;
+  };
+
+  /// Encodes a frame header into the first HEADER_LEN bytes of buffer.
+  void encode_header(const Header& header, uint8_t* buffer);
+
+  /// Decodes a frame header.
+  /// @returns        - false if the header isn't valid.
+  bool decode_header(const uint8_t* buffer, Header& header);
+
+  /// Builds a whole request frame.
+  std::string request(Opcode opcode, int16_t stream, const std::string& body);
+
+  /// Encodes an int as a CQL value.
+  std::string int_value(int32_t value);
+
+  /// Encodes a bigint as a CQL value.
+  std::string long_value(int64_t value);
+
+  /// Decodes a bigint value.
+  /// @returns - false if the value isn't 8 bytes long.
+  bool parse_long(const std::string& value, int64_t& result);
+
+  /// Request bodies.
+  std::string startup_body();
+  std::string query_body(const std::string& query, Consistency consistency);
+  std::string prepare_body(const std::string& query);
+
+  /// @param timestamp - Write timestamp in microseconds, or 0 to let the
+  ///                    server pick one.
+  std::string execute_body(const std::string& id,
+                           const std::vector<std::string>& values,
+                           Consistency consistency,
+                           int64_t timestamp);
+
+  /// An unlogged batch of executions of a single prepared statement.
+  std::string batch_body(const std::string& id,
+                         const std::vector<std::vector<std::string>>& values,
+                         Consistency consistency,
+                         int64_t timestamp);
+
+  /// Response bodies. Each returns false if the body is malformed.
+  bool parse_error(const std::string& body,
+                   int32_t& code,
+                   std::string& message,
+                   std::string& unprepared_id);
+  bool parse_result_kind(const std::string& body, int32_t& kind);
+  bool parse_prepared(const std::string& body, std::string& id);
+  bool parse_rows(const std::string& body,
+                  std::vector<std::vector<std::string>>& rows);
+
+  /// Decodes a list or set value.
+  /// @returns - false if the value is malformed.
+  bool parse_collection(const std::string& value,
+                        std::vector<std::string>& elements);
+}
+
+#endif
@@ -0,0 +1,184 @@
+/**
+ * @file deadline_call_list_store.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef DEADLINE_CALL_LIST_STORE_H__
+#define DEADLINE_CALL_LIST_STORE_H__
+
+#include <deque>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "batch_call_list_store.h"
+#include "call_list_store.h"
+#include "call_list_view.h"
+
+/// Call list store that makes operations give up at a deadline, on top of
+/// another store that does the actual reads and writes.
+///
+/// The caller sets a deadline for the operations on its thread with a
+/// Deadline object. Operations with a deadline are handed to this store's
+/// own threads, and the caller waits until the operation completes or the
+/// deadline passes, whichever is sooner. If the deadline passes, the caller
+/// gets RESOURCE_ERROR and carries on, and the operation is left to finish
+/// (or not) on its own. An operation whose deadline has passed by the time
+/// a thread picks it up isn't run at all.
+///
+/// This means a stuck connection in the underlying store ties up this
+/// store's threads, rather than the caller's. Operations without a deadline
+/// run on the caller's thread, as if this store wasn't there.
+///
+/// Call list view operations are handled the same way, if there's a view
+/// store underneath too.
+class DeadlineCallListStore : public CallListStore::Store,
+                              public BatchCallListStore,
+                              public CallListViewStore
+{
+public:
+  /// Sets the deadline for call list store operations on the current
+  /// thread, until it goes out of scope.
+  class Deadline
+  {
+  public:
+    /// @param deadline_us - The deadline (from current_time_us), or 0 for
+    ///                      no deadline.
+    Deadline(uint64_t deadline_us);
+    ~Deadline();
+
+    /// @returns           - The current thread's deadline, or 0.
+    static uint64_t current();
+
+  private:
+    uint64_t _previous_us;
+    static thread_local uint64_t _current_us;
+  };
+
+  /// Constructor.
+  /// @param store       - The underlying store. This takes ownership of it.
+  /// @param view_store  - The underlying view store, or NULL if there
+  ///                      isn't one. This is usually the underlying store
+  ///                      itself, so it isn't owned, but must last as long
+  ///                      as this store.
+  /// @param num_threads - Threads to run operations with a deadline on.
+  DeadlineCallListStore(CallListStore::Store* store,
+                        CallListViewStore* view_store,
+                        int num_threads);
+
+  virtual ~DeadlineCallListStore();
+
+  virtual CassandraStore::ResultCode write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode get_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  std::string& view,
+                                                  int64_t& version,
+                                                  SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode set_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  const std::string& view,
+                                                  int64_t version,
+                                                  int32_t ttl,
+                                                  bool& applied,
+                                                  SAS::TrailId trail);
+
+  /// @returns - The time on the monotonic clock, which deadlines are
+  ///            measured against.
+  static uint64_t current_time_us();
+
+  /// Most operations to queue for this store's threads. Operations beyond
+  /// this fail straight away, as the threads are clearly stuck.
+  static const size_t MAX_QUEUED_OPERATIONS = 1000;
+
+private:
+  /// An operation, and its result. The operation's arguments are copied,
+  /// as the caller may give up on it and free its own copies.
+  struct Operation
+  {
+    enum Type
+    {
+      WRITE,
+      GET,
+      DELETE,
+      GET_VIEW,
+      SET_VIEW
+    };
+
+    Operation(Type type, uint64_t deadline_us);
+
+    Type type;
+    uint64_t deadline_us;
+    std::string impu;
+    std::vector<CallListStore::CallFragment> fragments;
+    int64_t cass_timestamp;
+    int32_t ttl;
+    SAS::TrailId trail;
+
+    /// The view, its version, and whether it was replaced, for view
+    /// operations.
+    std::string view;
+    int64_t version;
+    bool applied;
+
+    bool done;
+    CassandraStore::ResultCode rc;
+  };
+
+  /// Runs an operation on one of this store's threads, and waits for it
+  /// until its deadline.
+  CassandraStore::ResultCode run(std::shared_ptr<Operation> op);
+
+  /// Runs an operation on the underlying store.
+  void execute(Operation* op);
+
+  static void* thread_fn(void* store);
+  void thread();
+
+  CallListStore::Store* _store;
+  CallListViewStore* _view_store;
+
+  /// Protects everything below.
+  pthread_mutex_t _lock;
+
+  /// Signalled when an operation is queued, or completes.
+  pthread_cond_t _queue_cond;
+  pthread_cond_t _done_cond;
+
+  std::deque<std::shared_ptr<Operation>> _queue;
+  bool _terminating;
+  std::vector<pthread_t> _threads;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file dialog_token.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef DIALOG_TOKEN_H__
+#define DIALOG_TOKEN_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <ctime>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+/// Details of a call that memento needs to write the END fragment when the
+/// call's BYE arrives.
+struct DialogDetails
+{
+  /// Start time of the call, formatted for Cassandra (YYYYMMDDHHMMSS in the
+  /// local time of the AS that saw the INVITE).
+  std::string timestamp;
+
+  /// Unique ID of the call, in decimal.
+  std::string id;
+
+  /// IMPU of the call list owner.
+  std::string impu;
+};
+
+/// AS-local table of dialog details, keyed by a short random ID. With the
+/// table enabled, the dialog token only has to carry the key.
+///
+/// This is only suitable where in-dialog requests come back through the
+/// same AS. If a BYE goes to a different AS, the key isn't found and no END
+/// fragment is written. Entries are removed when they're looked up, and the
+/// oldest are evicted once the table is full (for calls whose BYE never
+/// reaches memento).
+class DialogTable
+{
+public:
+  /// Constructor.
+  /// @param max_entries - Maximum number of dialogs to hold.
+  DialogTable(size_t max_entries);
+  virtual ~DialogTable();
+
+  /// Adds a dialog to the table.
+  /// @returns         - The key for the dialog.
+  /// @param details   - The details of the dialog.
+  uint64_t add(const DialogDetails& details);
+
+  /// Looks up and removes a dialog.
+  /// @returns         - true if the dialog was found.
+  /// @param key       - The key for the dialog.
+  /// @param timestamp - (out) The start time of the call.
+  /// @param id        - (out) The unique ID of the call.
+  /// @param impu      - (out) The IMPU of the call list owner.
+  bool take(uint64_t key,
+            std::string& timestamp,
+            std::string& id,
+            std::string& impu);
+
+  /// @returns         - The number of dialogs in the table.
+  size_t size();
+
+private:
+  /// A dialog, and its place in the eviction order.
+  struct Entry
+  {
+    DialogDetails details;
+    std::list<uint64_t>::iterator order;
+  };
+
+  size_t _max_entries;
+  pthread_mutex_t _lock;
+  std::unordered_map<uint64_t, Entry> _dialogs;
+
+  /// Keys of the dialogs in the table, oldest first, for eviction. A key
+  /// leaves this as soon as its dialog is taken, so this never holds more
+  /// than the dialogs in the table.
+  std::list<uint64_t> _order;
+};
+
+/// Compact dialog tokens, which memento adds to the Record-Route header on
+/// the INVITE, and reads back on the BYE to find the call.
+///
+/// There are three formats. They are told apart by their first character.
+///
+///  - Compact ('m'): COMPACT_PREFIX followed by the unpadded base64url
+///    encoding of
+///      start time (4 bytes, big-endian seconds since the epoch with the
+///                  AS's UTC offset applied)
+///      unique ID (8 bytes, big-endian)
+///      IMPU (the remaining bytes)
+///  - Table ('t'): TABLE_PREFIX followed by the unpadded base64url encoding
+///    of an 8-byte DialogTable key.
+///  - Legacy (a digit): <YYYYMMDDHHMMSS>_<unique ID>_<base64 IMPU>, as
+///    written by older versions. These are still accepted so that calls
+///    that span an upgrade are recorded correctly.
+///
+/// Every field is at a fixed offset, so decoding a compact or table token
+/// needs no searching or splitting.
+namespace DialogToken
+{
+  const char COMPACT_PREFIX = 'm';
+  const char TABLE_PREFIX = 't';
+
+  /// Builds a compact token.
+  /// @param start_time  - The start time of the call.
+  /// @param unique_id   - The unique ID of the call.
+  /// @param impu        - The IMPU of the call list owner.
+  /// @param impu_len    - The length of the IMPU.
+  /// @param token       - (out) The token.
+  void encode(time_t start_time,
+              uint64_t unique_id,
+              const char* impu,
+              size_t impu_len,
+              std::string& token);
+
+  /// Builds a token for a dialog held in a DialogTable.
+  /// @param key         - The DialogTable key.
+  /// @param token       - (out) The token.
+  void encode_key(uint64_t key, std::string& token);
+
+  /// Decodes a token in any format. The outputs are written in place, so
+  /// that they can be the fields of a recycled request.
+  /// @returns           - true if the token was valid (and, for a table
+  ///                      token, was found in the table).
+  /// @param token       - The token.
+  /// @param table       - The dialog table (may be NULL).
+  /// @param timestamp   - (out) The start time of the call, as YYYYMMDDHHMMSS.
+  /// @param id          - (out) The unique ID of the call.
+  /// @param impu        - (out) The IMPU of the call list owner.
+  bool decode(const std::string& token,
+              DialogTable* table,
+              std::string& timestamp,
+              std::string& id,
+              std::string& impu);
+}
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @file heavy_hitters.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef HEAVY_HITTERS_H__
+#define HEAVY_HITTERS_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "statistic.h"
+
+/// Finds the most frequent keys in a stream using the space-saving
+/// algorithm, in a fixed amount of memory.
+///
+/// Up to capacity keys are counted. When a new key arrives and the table is
+/// full, it replaces the key with the lowest count and inherits that count
+/// (which is recorded as the new key's error). Any key whose true count is
+/// more than total / capacity is guaranteed to be in the table, and each
+/// count overestimates the true count by at most its error.
+///
+/// This class is not thread-safe.
+class HeavyHitters
+{
+public:
+  struct Entry
+  {
+    std::string key;
+    uint64_t count;
+    uint64_t error;
+  };
+
+  /// Constructor.
+  /// @param capacity - Number of keys to count.
+  HeavyHitters(size_t capacity);
+
+  /// Counts a key.
+  /// @param key      - The key.
+  /// @param weight   - The amount to count.
+  void add(const std::string& key, uint64_t weight = 1);
+
+  /// Gets the keys with the highest counts.
+  /// @param n        - The number of keys to get.
+  /// @param top      - (out) The keys, highest count first.
+  void top(size_t n, std::vector<Entry>& top) const;
+
+  /// Forgets all the keys.
+  void clear();
+
+  /// Takes all the keys and their counts, leaving the table empty.
+  /// @param entries  - (out) The keys, in no particular order.
+  void take(std::vector<Entry>& entries);
+
+  /// Keeps the entries with the highest counts.
+  /// @param n        - The number of entries to keep.
+  /// @param entries  - (in/out) The entries, highest count first on return.
+  static void keep_top(size_t n, std::vector<Entry>& entries);
+
+private:
+  size_t _capacity;
+  std::vector<Entry> _entries;
+  std::unordered_map<std::string, size_t> _index;
+};
+
+/// Tracks the IMPUs with the most call list writes and trims, and publishes
+/// the top few of each as statistics.
+///
+/// Counts are kept for a fixed interval. The first update after the end of
+/// an interval publishes the top IMPUs from that interval and starts a new
+/// one, so the statistics show the heaviest IMPUs by rate over the last
+/// complete interval. Each statistic is a list of IMPU and count pairs,
+/// heaviest first. The counts are taken from the tables under the lock, but
+/// sorted and published after it is released, so that the thread that ends
+/// an interval doesn't hold up other writes while it publishes.
+class HotImpuTracker
+{
+public:
+  /// Constructor.
+  /// @param top_n            - Number of IMPUs to publish.
+  /// @param interval_ms      - Length of each interval.
+  /// @param stats_aggregator - Statistics aggregator.
+  HotImpuTracker(size_t top_n,
+                 uint64_t interval_ms,
+                 LastValueCache* stats_aggregator);
+
+  virtual ~HotImpuTracker();
+
+  /// Records a call fragment written for an IMPU.
+  void record_write(const std::string& impu, uint64_t now_ms);
+
+  /// Records call fragments trimmed for an IMPU.
+  void record_trim(const std::string& impu, uint64_t fragments, uint64_t now_ms);
+
+private:
+  /// Takes the counts if the interval has ended, and starts a new one.
+  /// Must be called with _lock held.
+  /// @returns        - Whether the interval has ended, and the counts need
+  ///                   publishing (see publish).
+  bool end_interval(uint64_t now_ms,
+                    std::vector<HeavyHitters::Entry>& writes,
+                    std::vector<HeavyHitters::Entry>& trims);
+
+  /// Publishes the counts from an interval. Must be called without _lock
+  /// held.
+  void publish(std::vector<HeavyHitters::Entry>& writes,
+               std::vector<HeavyHitters::Entry>& trims);
+
+  static void publish_top(std::vector<HeavyHitters::Entry>& entries,
+                          size_t top_n,
+                          Statistic& stat);
+
+  size_t _top_n;
+  uint64_t _interval_ms;
+  uint64_t _interval_start_ms;
+
+  pthread_mutex_t _lock;
+  HeavyHitters _writes;
+  HeavyHitters _trims;
+
+  Statistic _stat_top_writes;
+  Statistic _stat_top_trims;
+};
+
+#endif
@@ -14,17 +14,21 @@
 
 #include "httpconnection.h"
 #include "sas.h"
+#include "notify_circuit_breaker.h"
 
 class HttpNotifier
 {
 public:
-  HttpNotifier(HttpResolver* resolver, const std::string& notify_url);
+  HttpNotifier(HttpResolver* resolver,
+               const std::string& notify_url,
+               NotifyCircuitBreaker* circuit_breaker = NULL);
 
   virtual ~HttpNotifier();
 
   /// This function sends a HTTP POST to the notify URL, to notify it of the
   /// fact that a call list for a user has updated. This is synchronous.
-  /// Returns true iff the request was successful.
+  /// Returns true iff the request was successful. If the circuit breaker is
+  /// open the notification is dropped and this returns false.
   /// @param impu       IMPU of the member whose call list has been updated
   /// @param trail      The SAS trail
   virtual bool send_notify(const std::string& impu, SAS::TrailId trail);
@@ -38,6 +42,9 @@ private:
   HttpConnection *_http_connection;
 
   std::string _http_url_path;
+
+  /// Circuit breaker for the notify target (not owned, may be NULL).
+  NotifyCircuitBreaker* _circuit_breaker;
 };
 
 #endif
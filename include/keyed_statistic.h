@@ -0,0 +1,49 @@
+/**
+ * @file keyed_statistic.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef KEYED_STATISTIC_H__
+#define KEYED_STATISTIC_H__
+
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "statistic.h"
+
+/// Statistic that several publishers share, each under its own key, such as
+/// the stores for each Cassandra cluster.
+///
+/// A publisher's report replaces only its own values. The statistic is
+/// every key's values in key order, each key's preceded by the key itself.
+/// Values published under the empty key aren't preceded by anything, so a
+/// single unkeyed publisher sees the same format as a plain Statistic.
+class KeyedStatistic
+{
+public:
+  KeyedStatistic(const std::string& name, LastValueCache* stats_aggregator);
+  virtual ~KeyedStatistic();
+
+  /// Replaces the values published under a key, and republishes the
+  /// statistic.
+  void report_change(const std::string& key,
+                     const std::vector<std::string>& values);
+
+private:
+  /// @returns - The values to publish. Must be called with the lock held.
+  std::vector<std::string> all_values() const;
+
+  pthread_mutex_t _lock;
+  std::map<std::string, std::vector<std::string>> _values;
+  Statistic _stat;
+};
+
+#endif
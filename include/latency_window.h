@@ -0,0 +1,53 @@
+/**
+ * @file latency_window.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef LATENCY_WINDOW_H__
+#define LATENCY_WINDOW_H__
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+/// Tracks a percentile of recent request latencies.
+///
+/// This keeps the most recent WINDOW_SIZE samples, and works out the
+/// percentile again every RECALC_INTERVAL samples, so reading it is cheap.
+/// It is safe to use from any thread.
+class LatencyWindow
+{
+public:
+  /// @param percentile - The percentile to track, from 1 to 100.
+  LatencyWindow(int percentile);
+  virtual ~LatencyWindow();
+
+  void record(uint64_t latency_us);
+
+  /// @returns - The percentile, or 0 if there aren't MIN_SAMPLES samples
+  ///            yet.
+  uint64_t percentile_us() const { return _percentile_us.load(); }
+
+  static const size_t WINDOW_SIZE = 1000;
+  static const size_t RECALC_INTERVAL = 100;
+  static const size_t MIN_SAMPLES = 100;
+
+private:
+  const int _percentile;
+
+  pthread_mutex_t _lock;
+  std::vector<uint64_t> _samples;
+  size_t _next;
+  size_t _count;
+
+  std::atomic<uint64_t> _percentile_us;
+};
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * @file local_call_list_store.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef LOCAL_CALL_LIST_STORE_H__
+#define LOCAL_CALL_LIST_STORE_H__
+
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "batch_call_list_store.h"
+#include "call_list_store.h"
+
+/// Call list store that keeps call lists on local disk, for single node
+/// deployments that don't want to run Cassandra.
+///
+/// Every write and delete is appended to a log file. The live fragments are
+/// indexed in memory, by IMPU and then in timestamp order, as in the
+/// call_lists table, but the index only records where each fragment's
+/// contents are in the log; reads fetch them from there. On start up, the
+/// log is replayed to rebuild the index. A torn record at the end of the
+/// log, left by a crash part way through a write, is discarded.
+///
+/// As with Cassandra, fragments have a TTL, and writes and deletes carry a
+/// timestamp: a fragment is only overwritten or deleted by a request with
+/// a timestamp at least as new as its own. Expired fragments are skipped
+/// on reads and dropped from the index. Deletes leave a tombstone in the
+/// index, even if there was nothing to delete, so that an older write that
+/// arrives later doesn't bring the fragment back. Tombstones last until
+/// the log is next compacted.
+///
+/// A background thread syncs the log to disk every SYNC_INTERVAL_MS, like
+/// Cassandra's periodic commit log sync, so a crash can lose the last few
+/// seconds of writes. Once the log is more than twice the size of the live
+/// fragments (and at least MIN_COMPACTION_BYTES), the same thread compacts
+/// it: the live fragments are copied to a new log, which replaces the old
+/// one. Requests carry on while the fragments are copied, and anything
+/// they log meanwhile is copied across before the logs are switched.
+class LocalCallListStore : public CallListStore::Store,
+                           public BatchCallListStore
+{
+public:
+  /// @param path - The log file. It is created if it doesn't exist.
+  LocalCallListStore(const std::string& path);
+  virtual ~LocalCallListStore();
+
+  /// @returns    - false if the log couldn't be opened.
+  bool is_valid() const { return (_log != nullptr); }
+
+  virtual CassandraStore::ResultCode write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail);
+
+  /// Writes the fragments with a single append to the log.
+  virtual CassandraStore::ResultCode write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail);
+
+  /// Smallest log that is worth compacting.
+  static const uint64_t MIN_COMPACTION_BYTES = 16 * 1024 * 1024;
+
+  /// Longest to go without syncing the log to disk.
+  static const int SYNC_INTERVAL_MS = 10000;
+
+private:
+  enum Op
+  {
+    OP_WRITE = 1,
+    OP_DELETE = 2
+  };
+
+  /// A fragment in the index.
+  struct Entry
+  {
+    /// The fragment, without its contents.
+    CallListStore::CallFragment fragment;
+    int64_t cass_timestamp;
+
+    /// When the fragment expires (seconds since the epoch), or 0 if never.
+    int64_t expiry_s;
+
+    /// Where the fragment's contents are in the log. For a tombstone, this
+    /// is the end of the delete's record.
+    uint64_t contents_offset;
+    uint32_t contents_len;
+
+    /// Whether this is a tombstone, left by a delete.
+    bool deleted;
+  };
+
+  typedef std::map<std::string, Entry> Row;
+
+  /// An open log. Reads hold on to the log they found the fragments' offsets
+  /// for, so it stays open even if compaction replaces it meanwhile.
+  struct Log
+  {
+    Log(int fd) : fd(fd) {}
+    ~Log();
+
+    const int fd;
+  };
+
+  /// Encodes a log record.
+  static std::string encode(Op op,
+                            const std::string& impu,
+                            const Entry& entry,
+                            const std::string& contents);
+
+  /// Decodes a log record's body.
+  /// @returns    - false if the body is malformed.
+  static bool decode(const std::string& body,
+                     Op& op,
+                     std::string& impu,
+                     Entry& entry,
+                     std::string& contents);
+
+  /// Copies a fragment into an index entry, without its contents.
+  static void set_fragment(Entry& entry,
+                           const CallListStore::CallFragment& fragment);
+
+  /// Replays the log into the index, and truncates any torn record at the
+  /// end of it.
+  bool replay();
+
+  /// Applies a record to the index. The caller must hold _lock.
+  void apply(Op op, const std::string& impu, const Entry& entry);
+
+  /// Appends records to the log, and wakes the background thread if the
+  /// log is due to be compacted. The caller must hold _lock.
+  /// @param offset - (out) Where in the log the records start.
+  bool append(const std::string& records, uint64_t& offset);
+
+  /// Rewrites the log with just the live fragments, dropping tombstones.
+  /// The caller mustn't hold _lock.
+  bool compact();
+
+  static void* background_thread_fn(void* store);
+
+  /// Syncs the log and compacts it when it's due, until the store is
+  /// destroyed.
+  void background_thread();
+
+  /// @returns    - The bytes a fragment takes up in the log.
+  static uint64_t size(const std::string& impu, const Entry& entry);
+
+  /// @returns    - A fragment's key within its row, which sorts in
+  ///                timestamp order.
+  static std::string key(const CallListStore::CallFragment& fragment);
+
+  static int64_t current_time_s();
+  static uint64_t current_time_ms();
+
+  const std::string _path;
+
+  /// Protects everything below, and wakes the background thread.
+  pthread_mutex_t _lock;
+  pthread_cond_t _background_cond;
+  std::shared_ptr<Log> _log;
+  std::map<std::string, Row> _rows;
+  uint64_t _log_bytes;
+  uint64_t _live_bytes;
+
+  /// Whether anything has been logged since the log was last synced.
+  bool _unsynced;
+  uint64_t _next_sync_ms;
+
+  /// Whether the log is due to be compacted, or being compacted.
+  bool _compacting;
+  bool _terminating;
+  bool _background_thread_running;
+  pthread_t _background_thread;
+};
+
+#endif
@@ -22,6 +22,8 @@ extern "C" {
 #include "appserver.h"
 #include "load_monitor.h"
 #include "call_list_store_processor.h"
+#include "dialog_token.h"
+#include "tsx_slab.h"
 #include "sas.h"
 #include "zmq_lvc.h"
 
@@ -55,6 +57,23 @@ public:
   /// @param  max_token_rate         - Maximum token rate for the Cassandra load monitor (from configuration).
   /// @param  http_resolver          - HTTP resolver to use for HTTP connections.
   /// @param  memento_notify_url     - HTTP URL that memento should notify when call lists change.
+  /// @param  notify_circuit_breaker - Circuit breaker for the notify URL (may be NULL).
+  /// @param  fragment_encoding      - Encoding for stored call fragments (from configuration).
+  /// @param  fragment_compressor    - Compressor for stored call fragments (may be NULL).
+  /// @param  begin_hold_ms          - How long to hold BEGIN fragments waiting
+  ///                                  for the END (from configuration).
+  /// @param  flood_max_rejected_calls - Rejected calls to an IMPU to record in
+  ///                                  each flood window before folding the
+  ///                                  rest (from configuration, 0 disables).
+  /// @param  flood_window_ms        - Length of the flood window (from
+  ///                                  configuration).
+  /// @param  dialog_table_size      - Number of dialogs to hold locally, so that
+  ///                                  the dialog token only carries a key. 0
+  ///                                  puts all the call details in the token.
+  /// @param  call_list_view_store   - Store for materialized call list views
+  ///                                  (NULL if views are disabled).
+  /// @param  trim_ownership         - Which IMPUs this node trims (NULL for
+  ///                                  all of them).
   MementoAppServer(const std::string& service_name,
                    CallListStore::Store* call_list_store,
                    const std::string& home_domain,
@@ -69,7 +88,16 @@ public:
                    const float max_token_rate,
                    ExceptionHandler* exception_handler,
                    HttpResolver* http_resolver,
-                   const std::string& memento_notify_url);
+                   const std::string& memento_notify_url,
+                   NotifyCircuitBreaker* notify_circuit_breaker,
+                   CallFragmentCodec::Encoding fragment_encoding,
+                   CallFragmentCompressor* fragment_compressor,
+                   const int begin_hold_ms,
+                   const int flood_max_rejected_calls,
+                   const int flood_window_ms,
+                   const int dialog_table_size,
+                   CallListViewStore* call_list_view_store,
+                   TrimOwnership* trim_ownership);
 
   /// Virtual destructor.
   ~MementoAppServer();
@@ -108,6 +136,9 @@ private:
   /// Call list store processor.
   CallListStoreProcessor* _call_list_store_processor;
 
+  /// Table of dialogs (NULL if the details are held in the dialog tokens).
+  DialogTable* _dialog_table;
+
   /// Statistic.
   StatisticCounter _stat_calls_not_recorded_due_to_overload;
 };
@@ -153,55 +184,39 @@ public:
 
   /// Constructor.
   MementoAppServerTsx(CallListStoreProcessor* call_list_store_processor,
-                      std::string& service_name,
-                      std::string& home_domain);
+                      const std::string& service_name,
+                      const std::string& home_domain,
+                      DialogTable* dialog_table = NULL);
+
+  /// Transactions are created and destroyed on the SIP threads at the call
+  /// rate, so they are allocated from a per-thread slab rather than the
+  /// heap.
+  static void* operator new(size_t size);
+  static void operator delete(void* p, size_t size);
 
 private:
   /// Call list store processor.
   CallListStoreProcessor* _call_list_store_processor;
 
-  /// The name of this service.
-  std::string _service_name;
-
-  /// Home domain of deployment.
-  std::string _home_domain;
-
-  /// Flag for whether the call is incoming or outgoing
-  bool _outgoing;
+  /// The name of this service (owned by the MementoAppServer).
+  const std::string& _service_name;
 
-  /// Start time of the call
-  std::string _start_time_xml;
-  std::string _start_time_cassandra;
+  /// Home domain of deployment (owned by the MementoAppServer).
+  const std::string& _home_domain;
 
-  /// Caller name (can be empty)
-  std::string _caller_name;
+  /// Table of dialogs (owned by the MementoAppServer, may be NULL).
+  DialogTable* _dialog_table;
 
-  /// Caller URI
-  std::string _caller_uri;
-
-  /// Callee name (can be empty)
-  std::string _callee_name;
-
-  /// Callee URI
-  std::string _callee_uri;
-
-  /// Answerer name (can be empty)
-  std::string _answerer_name;
-
-  /// Answerer URI
-  std::string _answerer_uri;
+  /// The request to write the call's fragment with, from the processor's
+  /// pool. The details of the call are filled in straight into it as they
+  /// are found, and it's handed to the processor on the final response.
+  /// NULL if there's nothing to write, or it has been handed over.
+  CallListStoreProcessor::CallListRequest* _request;
 
   /// Flag for whether a response has already been received on this
   /// transaction
   bool _stored_entry;
 
-  /// Unique identifier for this transaction - generated from the timestamp
-  /// and a random number.
-  std::string _unique_id;
-
-  /// IMPU of the call list owner
-  std::string _impu;
-
   /// Flag for whether this transaction includes the initial dialog request.
   bool _includes_initial_request;
 };
@@ -213,13 +228,6 @@ private:
 /// @param pattern   - The format to use
 std::string create_formatted_timestamp(tm* timestamp, const char* pattern);
 
-// Converts a URI to a string
-std::string uri_to_string(pjsip_uri_context_e context,
-                          const pjsip_uri* uri);
-
-// Converts a PJ_STR to a string
-std::string pj_str_to_string(const pj_str_t* pjstr);
-
 // Converts a string to a URI
 pjsip_uri* uri_from_string(const std::string& uri_s,
                            pj_pool_t* pool,
@@ -0,0 +1,70 @@
+/**
+ * @file node_latency.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef NODE_LATENCY_H__
+#define NODE_LATENCY_H__
+
+#include <atomic>
+#include <stdint.h>
+
+/// Tracks how quickly a Cassandra node is responding, so that requests can
+/// be steered away from a node that is slow but hasn't failed.
+///
+/// This keeps an exponentially weighted moving average of the node's
+/// latency, and a count of the requests in flight to it. A node's score is
+/// the product of the two, which estimates how long a new request would
+/// wait, so lower is better. It is safe to use from any thread.
+///
+/// Only successful responses are latency samples. A node that fails fast
+/// (or rejects requests because it is overloaded) mustn't look fast, so
+/// failures are counted as a sample of a penalty latency instead, such as
+/// the request timeout. Error responses that say nothing about the node's
+/// health (such as an unprepared statement) aren't samples at all.
+class NodeLatency
+{
+public:
+  NodeLatency() : _ewma_us(0), _in_flight(0) {}
+
+  /// Records the start of a request to the node.
+  void request_started() { _in_flight++; }
+
+  /// Records a successful response from the node.
+  void request_finished(uint64_t latency_us);
+
+  /// Records a request to the node that failed, because it couldn't be
+  /// sent, wasn't answered in time, or the node said it was overloaded or
+  /// unavailable.
+  /// @param penalty_us - Latency to count the failure as.
+  void request_failed(uint64_t penalty_us);
+
+  /// Records the end of a request to the node that isn't a latency sample,
+  /// such as a response rejecting the request itself.
+  void request_discarded() { _in_flight--; }
+
+  uint64_t ewma_us() const { return _ewma_us.load(); }
+  int in_flight() const { return _in_flight.load(); }
+
+  /// @returns - The node's score. Nodes with no latency samples yet score
+  ///            as if they respond instantly, so they get tried.
+  uint64_t score() const;
+
+  /// Weight of the newest sample in the average is 1 / EWMA_DECAY.
+  static const int EWMA_DECAY = 8;
+
+private:
+  /// Adds a latency sample to the average.
+  void add_sample(uint64_t latency_us);
+
+  std::atomic<uint64_t> _ewma_us;
+  std::atomic<int> _in_flight;
+};
+
+#endif
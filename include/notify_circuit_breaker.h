@@ -0,0 +1,137 @@
+/**
+ * @file notify_circuit_breaker.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef NOTIFY_CIRCUIT_BREAKER_H__
+#define NOTIFY_CIRCUIT_BREAKER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "alarm.h"
+#include "counter.h"
+#include "statistic.h"
+
+/// Circuit breaker protecting the memento worker threads from a slow or
+/// unresponsive notification target.
+///
+/// The breaker starts CLOSED and lets every notification through.  Each
+/// notification that fails, or that takes longer than the latency budget,
+/// counts as a failure; once the configured number of consecutive failures is
+/// reached the breaker OPENs and notifications are dropped.  After the open
+/// period has elapsed the breaker goes HALF_OPEN and lets a single probe
+/// through at a time.  Enough successful probes close the breaker again; a
+/// failed probe re-opens it.
+///
+/// Each allowed notification gets a ticket, which it hands back when it
+/// completes.  Only notifications allowed since the breaker last changed
+/// state (or, while half-open, the current probe) count towards the
+/// breaker, so that a straggler allowed before the breaker opened can't
+/// pass for the probe.
+class NotifyCircuitBreaker
+{
+public:
+  enum State
+  {
+    CLOSED = 0,
+    OPEN = 1,
+    HALF_OPEN = 2
+  };
+
+  /// Constructor.
+  /// @param latency_budget_us  - Notifications slower than this count as
+  ///                             failures.
+  /// @param failure_threshold  - Number of consecutive failures that opens the
+  ///                             breaker.
+  /// @param open_time_ms       - How long the breaker stays open before
+  ///                             allowing probes through.
+  /// @param probes_to_close    - Number of successful probes needed to close
+  ///                             the breaker.
+  /// @param alarm              - Alarm raised while the breaker is not closed.
+  ///                             The breaker takes ownership.  May be NULL.
+  /// @param stats_aggregator   - Statistics aggregator (last value cache).
+  NotifyCircuitBreaker(unsigned long latency_budget_us,
+                       int failure_threshold,
+                       int open_time_ms,
+                       int probes_to_close,
+                       Alarm* alarm,
+                       LastValueCache* stats_aggregator);
+
+  /// Destructor.
+  virtual ~NotifyCircuitBreaker();
+
+  /// Called before sending a notification.  Returns true if the notification
+  /// should be sent, and false if it should be dropped.  Every call that
+  /// returns true must be followed by a call to request_succeeded or
+  /// request_failed.
+  /// @param ticket     - (out) Identifies the notification to
+  ///                     request_succeeded or request_failed.
+  virtual bool allow_request(uint64_t& ticket);
+
+  /// Report that an allowed notification completed successfully.
+  /// @param ticket     - The notification's ticket from allow_request.
+  /// @param latency_us - How long the notification took.
+  virtual void request_succeeded(uint64_t ticket, unsigned long latency_us);
+
+  /// Report that an allowed notification failed.
+  /// @param ticket     - The notification's ticket from allow_request.
+  virtual void request_failed(uint64_t ticket);
+
+  /// Returns the current state of the breaker.
+  State state();
+
+private:
+  /// Records a failure (or an over-budget success).  Must be called with the
+  /// lock held.
+  void record_failure();
+
+  /// Moves the breaker into a new state, updating the alarm and statistics.
+  /// Must be called with the lock held.
+  void set_state(State new_state);
+
+  /// Returns the current monotonic time in milliseconds.
+  static uint64_t current_time_ms();
+
+  const unsigned long _latency_budget_us;
+  const int _failure_threshold;
+  const int _open_time_ms;
+  const int _probes_to_close;
+
+  Alarm* _alarm;
+
+  pthread_mutex_t _lock;
+
+  /// Current state of the breaker.
+  State _state;
+
+  /// Number of consecutive failures while closed.
+  int _consecutive_failures;
+
+  /// Number of successful probes while half-open.
+  int _successful_probes;
+
+  /// Whether a probe is currently outstanding while half-open.
+  bool _probe_in_progress;
+
+  /// Ticket handed to notifications allowed now.  This moves on whenever
+  /// the state changes and whenever a probe is allowed, so only results
+  /// with the current ticket count.
+  uint64_t _generation;
+
+  /// Time at which the breaker last opened.
+  uint64_t _opened_at_ms;
+
+  // Statistics.
+  Statistic _stat_state;
+  StatisticCounter _stat_dropped_notifications;
+};
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * @file sharded_call_list_store.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef SHARDED_CALL_LIST_STORE_H__
+#define SHARDED_CALL_LIST_STORE_H__
+
+#include <atomic>
+#include <istream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "batch_call_list_store.h"
+#include "call_list_store.h"
+#include "statistic.h"
+#include "token_ring.h"
+
+/// Call list store that spreads IMPUs across several Cassandra clusters,
+/// each with its own store.
+///
+/// Each IMPU belongs to one cluster, picked by consistent hashing: every
+/// cluster has VIRTUAL_NODES tokens on a ring, and an IMPU belongs to the
+/// cluster owning its token. Adding a cluster only moves about 1 / N of the
+/// IMPUs. Individual IMPUs can be pinned to a cluster with an override, for
+/// example to keep them where their call lists already are.
+///
+/// The requests and failures sent to each cluster are published as a
+/// statistic. Clusters and overrides must all be added before the store is
+/// used.
+///
+/// The shard configuration file has one entry per line:
+///
+///   cluster <name> <comma-separated hosts>
+///   impu <IMPU> <cluster name>
+///
+/// Blank lines and lines starting with '#' are ignored.
+class ShardedCallListStore : public CallListStore::Store,
+                             public BatchCallListStore
+{
+public:
+  /// The contents of a shard configuration file.
+  struct Config
+  {
+    /// Each cluster's name and hosts, in file order.
+    std::vector<std::pair<std::string, std::string>> clusters;
+
+    /// The cluster each overridden IMPU is pinned to.
+    std::map<std::string, std::string> overrides;
+  };
+
+  /// @param stats_aggregator - Statistics aggregator (last value cache).
+  ShardedCallListStore(LastValueCache* stats_aggregator);
+
+  virtual ~ShardedCallListStore();
+
+  /// Adds a cluster.
+  /// @param name  - The cluster's name.
+  /// @param store - The cluster's store. This takes ownership of it.
+  void add_cluster(const std::string& name, CallListStore::Store* store);
+
+  /// Pins an IMPU to a cluster.
+  /// @returns     - false if there's no such cluster.
+  bool add_override(const std::string& impu, const std::string& cluster);
+
+  /// @returns     - The name of the cluster an IMPU belongs to.
+  const std::string& cluster(const std::string& impu) const;
+
+  virtual CassandraStore::ResultCode write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail);
+
+  virtual CassandraStore::ResultCode delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail);
+
+  /// Parses a shard configuration file.
+  /// @returns     - false if the file is invalid, has no clusters, names a
+  ///                cluster twice, or pins an IMPU to an unknown cluster.
+  static bool parse_config(std::istream& input, Config& config);
+
+  /// Reads and parses a shard configuration file.
+  static bool read_config(const std::string& path, Config& config);
+
+  /// Tokens each cluster has on the ring.
+  static const int VIRTUAL_NODES = 64;
+
+  /// How often to publish the per-cluster counts.
+  static const int STATS_INTERVAL_MS = 10000;
+
+private:
+  struct Cluster
+  {
+    CallListStore::Store* store;
+
+    /// Requests and failures since the counts were last published.
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> failures;
+  };
+
+  /// @returns     - The cluster an IMPU belongs to.
+  Cluster* cluster_for(const std::string& impu) const;
+
+  /// Counts a request against a cluster, and publishes the counts if
+  /// they're due.
+  void record(Cluster* cluster, CassandraStore::ResultCode rc);
+
+  static uint64_t current_time_ms();
+
+  std::map<std::string, Cluster*> _clusters;
+  std::vector<std::pair<int64_t, std::string>> _tokens;
+  TokenRing _ring;
+  std::map<std::string, std::string> _overrides;
+
+  std::atomic<uint64_t> _next_publish_ms;
+  Statistic _stat_shards;
+};
+
+#endif
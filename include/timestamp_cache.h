@@ -0,0 +1,61 @@
+/**
+ * @file timestamp_cache.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef TIMESTAMP_CACHE_H__
+#define TIMESTAMP_CACHE_H__
+
+#include <ctime>
+#include <string>
+
+/// Cached formatting of the timestamps memento writes.
+///
+/// Converting a time to local time takes the timezone lock, and strftime is
+/// slow, yet memento formats the same few seconds over and over (every call
+/// in progress starts, is answered or ends "now"). Each thread therefore
+/// keeps the broken-down time and both formatted strings for the last second
+/// it saw, so formatting a time in that second is just a copy. The cache is
+/// thread-local, so it is safe to use from any thread without locking.
+namespace TimestampCache
+{
+  /// Length of a Cassandra timestamp (YYYYMMDDHHMMSS).
+  const size_t CASSANDRA_LEN = 14;
+
+  /// Length of an XML timestamp (YYYY-MM-DDTHH:MM:SS).
+  const size_t XML_LEN = 19;
+
+  /// Space to allow for a formatted timestamp. This is enough for any year
+  /// that strftime can format.
+  const size_t MAX_LEN = 80;
+
+  /// Formats a time as a Cassandra timestamp, in local time.
+  /// @param time     - The time.
+  /// @param utc_offset_applied - true if the UTC offset has already been
+  ///                   applied to the time (so it's rendered as is).
+  /// @param out      - (out) The formatted time.
+  void format_cassandra(time_t time,
+                        bool utc_offset_applied,
+                        std::string& out);
+
+  /// Formats a time as an XML timestamp, in local time.
+  /// @returns        - The length of the formatted time.
+  /// @param time     - The time.
+  /// @param utc_offset_applied - true if the UTC offset has already been
+  ///                   applied to the time (so it's rendered as is).
+  /// @param buf      - (out) Buffer of at least MAX_LEN characters. The
+  ///                   output is not null-terminated.
+  size_t format_xml(time_t time, bool utc_offset_applied, char* buf);
+
+  /// @returns        - The local UTC offset, in seconds, at the given time.
+  /// @param time     - The time.
+  long utc_offset(time_t time);
+}
+
+#endif
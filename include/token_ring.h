@@ -0,0 +1,47 @@
+/**
+ * @file token_ring.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef TOKEN_RING_H__
+#define TOKEN_RING_H__
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// The token map of a Cassandra ring using the Murmur3 partitioner, used to
+/// work out which node owns a partition key.
+///
+/// Each node owns the range of tokens from the previous node's token
+/// (exclusive) up to its own (inclusive), wrapping round from the highest
+/// token to the lowest. This isn't thread-safe.
+class TokenRing
+{
+public:
+  /// @returns   - The Murmur3 token for a partition key, matching
+  ///              Cassandra's Murmur3Partitioner.
+  static int64_t token(const std::string& key);
+
+  /// Replaces the ring.
+  /// @param tokens - Each node's tokens, with its address, in any order.
+  void set(const std::vector<std::pair<int64_t, std::string>>& tokens);
+
+  /// @returns   - The address of the node that owns a token, or an empty
+  ///              string if the ring is empty.
+  const std::string& owner(int64_t token) const;
+
+  bool empty() const { return _tokens.empty(); }
+
+private:
+  std::vector<std::pair<int64_t, std::string>> _tokens;
+};
+
+#endif
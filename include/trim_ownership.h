@@ -0,0 +1,154 @@
+/**
+ * @file trim_ownership.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef TRIM_OWNERSHIP_H__
+#define TRIM_OWNERSHIP_H__
+
+#include <istream>
+#include <pthread.h>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "call_list_store.h"
+#include "token_ring.h"
+
+/// Works out which sprout node trims each IMPU's call list, so that only one
+/// node reads and trims a subscriber's calls however many nodes write them.
+///
+/// Each IMPU belongs to one node, picked by consistent hashing: every node
+/// has VIRTUAL_NODES tokens on a ring, and an IMPU belongs to the node
+/// owning its token. When a node joins or leaves, only about 1 / N of the
+/// IMPUs change owner.
+///
+/// The nodes are read from a cluster settings file, as kept up to date by
+/// the cluster manager as nodes join and leave the site:
+///
+///   servers=<address>:<port>,<address>:<port>,...
+///
+/// Other lines are ignored. The file is checked for changes at most every
+/// RELOAD_INTERVAL_MS. If it can't be read, the last good set of nodes is
+/// kept. If this node isn't in the set (or there isn't one yet), it trims
+/// every IMPU, so that a bad file can't stop trimming altogether.
+///
+/// The file lists the nodes that should be running, not the ones that are,
+/// so the nodes also exchange heartbeats through the call list store. Every
+/// HEARTBEAT_INTERVAL_MS, each node rewrites its own fragment in a reserved
+/// IMPU's row with a TTL of HEARTBEAT_TTL_S, and reads back the others'.
+/// Each node only ever has the one fragment, so the row doesn't fill up
+/// with expired ones. Only nodes with a live heartbeat are put in the ring,
+/// so the IMPUs of a node that has stopped are shared out between the rest.
+/// Until the first heartbeats have been read, or if they haven't been read
+/// for HEARTBEAT_TTL_S, every node in the file counts as live.
+///
+/// This is thread-safe.
+class TrimOwnership
+{
+public:
+  /// @param local_node      - This node's address, as it appears in the
+  ///                          file.
+  /// @param path            - The cluster settings file.
+  /// @param heartbeat_store - The store to exchange heartbeats through, or
+  ///                          NULL not to, and treat every node as live.
+  TrimOwnership(const std::string& local_node,
+                const std::string& path,
+                CallListStore::Store* heartbeat_store);
+  ~TrimOwnership();
+
+  /// @returns          - Whether this node trims an IMPU's call list.
+  bool owns(const std::string& impu);
+
+  /// Replaces the set of nodes sharing the trimming.
+  void set_nodes(const std::vector<std::string>& nodes);
+
+  /// Replaces the set of nodes known to be live. Nodes sharing the trimming
+  /// that aren't in this set are left out of the ring.
+  void set_live_nodes(const std::vector<std::string>& nodes);
+
+  /// Writes this node's heartbeat, and reads the live nodes from everyone's.
+  void heartbeat();
+
+  /// Parses the node addresses (without their ports) from a cluster
+  /// settings file.
+  /// @returns          - false if there's no servers line.
+  static bool parse_nodes(std::istream& input, std::vector<std::string>& nodes);
+
+  /// Tokens each node has on the ring.
+  static const int VIRTUAL_NODES = 64;
+
+  /// How often to check the cluster settings file for changes.
+  static const int RELOAD_INTERVAL_MS = 10000;
+
+  /// The IMPU the heartbeats are written to. It isn't a SIP URI, so it
+  /// can't clash with a subscriber's.
+  static const std::string HEARTBEAT_IMPU;
+
+  /// How often each node writes its heartbeat.
+  static const int HEARTBEAT_INTERVAL_MS = 10000;
+
+  /// How long a heartbeat lasts. A node drops out of the ring once it has
+  /// missed a few.
+  static const int HEARTBEAT_TTL_S = 35;
+
+  /// The timestamp of every heartbeat fragment. Each node's fragment is
+  /// keyed on this and the node's address, so each heartbeat overwrites the
+  /// node's last one.
+  static const std::string HEARTBEAT_TIMESTAMP;
+
+private:
+  /// Reloads the nodes if the file has changed. The caller must hold _lock.
+  void maybe_reload();
+
+  /// Rebuilds the ring from the live nodes sharing the trimming, if they've
+  /// changed. The caller must hold _lock.
+  void update_ring();
+
+  /// Replaces the ring. The caller must hold _lock.
+  void set_ring(const std::vector<std::string>& nodes);
+
+  /// @returns          - The address part of a <address>:<port> entry.
+  static std::string address(const std::string& server);
+
+  static void* heartbeat_thread_fn(void* ownership);
+  void heartbeat_thread();
+
+  static uint64_t current_time_ms();
+
+  const std::string _local_node;
+  const std::string _path;
+  CallListStore::Store* _heartbeat_store;
+
+  /// Protects everything below, and wakes the heartbeat thread.
+  pthread_mutex_t _lock;
+  pthread_cond_t _heartbeat_cond;
+  TokenRing _ring;
+  bool _local_in_ring;
+  uint64_t _next_reload_ms;
+  time_t _mtime;
+
+  /// The nodes sharing the trimming, and those of them in the ring.
+  std::vector<std::string> _nodes;
+  std::vector<std::string> _ring_nodes;
+
+  /// The nodes with a live heartbeat, once they've been read, and when
+  /// they were last read.
+  std::set<std::string> _live_nodes;
+  bool _live_nodes_known;
+  uint64_t _live_nodes_read_ms;
+
+  bool _terminating;
+  bool _heartbeat_thread_running;
+  pthread_t _heartbeat_thread;
+};
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ * @file tsx_slab.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef TSX_SLAB_H__
+#define TSX_SLAB_H__
+
+#include <cstddef>
+#include <new>
+#include <string>
+
+#include <pjsip.h>
+
+/// Largest URI that print_uri will print.
+static const size_t MAX_PRINTED_URI_LENGTH = 500;
+
+/// Prints a URI straight into a std::string, reusing the string's capacity,
+/// so that printing into a recycled string doesn't normally allocate.
+/// @param context  - The context to print the URI in.
+/// @param uri      - The URI to print (may be NULL).
+/// @param dest     - The string to print into. This is left empty if the URI
+///                   is NULL or is longer than MAX_PRINTED_URI_LENGTH.
+void print_uri(pjsip_uri_context_e context,
+               const pjsip_uri* uri,
+               std::string& dest);
+
+/// Assigns a pj_str_t to a std::string, reusing the capacity of the
+/// std::string.
+inline void assign_pj_str(std::string& dest, const pj_str_t& str)
+{
+  if (str.slen > 0)
+  {
+    dest.assign(str.ptr, str.slen);
+  }
+  else
+  {
+    dest.clear();
+  }
+}
+
+/// Per-thread cache of memory blocks for objects of type T. Objects that are
+/// created and destroyed at a high rate on the same threads (such as
+/// transactions) use this from their class-specific operator new and delete,
+/// so that most allocations neither hit the heap nor take the allocator's
+/// locks.
+///
+/// A block freed on one thread goes into that thread's cache, so blocks can
+/// migrate between threads. Each cache holds at most MAX_CACHED blocks, and
+/// anything beyond that goes back to the heap.
+template <class T, size_t MAX_CACHED = 64>
+class ThreadSlab
+{
+public:
+  /// Allocates a block big enough for a T.
+  static void* alloc()
+  {
+    FreeList& free_list = _free_list;
+
+    if (free_list.head != NULL)
+    {
+      Block* block = free_list.head;
+      free_list.head = block->next;
+      free_list.count--;
+      return block;
+    }
+
+    return ::operator new(sizeof(T));
+  }
+
+  /// Frees a block allocated by alloc.
+  static void release(void* p)
+  {
+    FreeList& free_list = _free_list;
+
+    if (free_list.count >= MAX_CACHED)
+    {
+      ::operator delete(p);
+      return;
+    }
+
+    Block* block = static_cast<Block*>(p);
+    block->next = free_list.head;
+    free_list.head = block;
+    free_list.count++;
+  }
+
+  /// @returns - The number of blocks cached on this thread, for tests.
+  static size_t cached() { return _free_list.count; }
+
+private:
+  struct Block
+  {
+    Block* next;
+  };
+
+  /// The free blocks for a thread. These go back to the heap when the thread
+  /// exits.
+  struct FreeList
+  {
+    FreeList() : head(NULL), count(0) {}
+
+    ~FreeList()
+    {
+      while (head != NULL)
+      {
+        Block* block = head;
+        head = block->next;
+        ::operator delete(block);
+      }
+    }
+
+    Block* head;
+    size_t count;
+  };
+
+  static thread_local FreeList _free_list;
+};
+
+template <class T, size_t MAX_CACHED>
+thread_local typename ThreadSlab<T, MAX_CACHED>::FreeList
+  ThreadSlab<T, MAX_CACHED>::_free_list;
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * @file batch_call_list_store.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "batch_call_list_store.h"
+
+CassandraStore::ResultCode BatchCallListStore::write_call_fragments(
+                     CallListStore::Store* store,
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail)
+{
+  BatchCallListStore* batch_store = dynamic_cast<BatchCallListStore*>(store);
+
+  if ((batch_store != NULL) && (fragments.size() > 1))
+  {
+    return batch_store->write_call_fragments_sync(impu,
+                                                  fragments,
+                                                  cass_timestamp,
+                                                  ttl,
+                                                  trail);
+  }
+
+  for (size_t ii = 0; ii < fragments.size(); ii++)
+  {
+    CassandraStore::ResultCode rc = store->write_call_fragment_sync(impu,
+                                                                    fragments[ii],
+                                                                    cass_timestamp,
+                                                                    ttl,
+                                                                    trail);
+
+    if (rc != CassandraStore::OK)
+    {
+      return rc;
+    }
+  }
+
+  return CassandraStore::OK;
+}
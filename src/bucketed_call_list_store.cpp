@@ -0,0 +1,403 @@
+/**
+ * @file bucketed_call_list_store.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <ctime>
+#include <map>
+
+#include "bucketed_call_list_store.h"
+#include "timestamp_cache.h"
+#include "trim_ownership.h"
+#include "log.h"
+
+BucketedCallListStore::BucketedCallListStore(CallListStore::Store* store,
+                                             int bucket_period_s,
+                                             int call_list_ttl_s,
+                                             int max_calls) :
+  CallListStore::Store(),
+  _store(store),
+  _bucket_period_s(bucket_period_s),
+  _call_list_ttl_s(call_list_ttl_s),
+  _max_calls(max_calls)
+{
+}
+
+BucketedCallListStore::~BucketedCallListStore()
+{
+  delete _store; _store = NULL;
+}
+
+bool BucketedCallListStore::parse_timestamp(const std::string& timestamp,
+                                            time_t& time)
+{
+  if (timestamp.length() != TimestampCache::CASSANDRA_LEN)
+  {
+    return false;
+  }
+
+  int fields[6];
+  static const int FIELD_LENGTHS[6] = {4, 2, 2, 2, 2, 2};
+  size_t pos = 0;
+
+  for (int ii = 0; ii < 6; ii++)
+  {
+    fields[ii] = 0;
+
+    for (int jj = 0; jj < FIELD_LENGTHS[ii]; jj++, pos++)
+    {
+      char c = timestamp[pos];
+
+      if ((c < '0') || (c > '9'))
+      {
+        return false;
+      }
+
+      fields[ii] = (fields[ii] * 10) + (c - '0');
+    }
+  }
+
+  tm broken_down = {};
+  broken_down.tm_year = fields[0] - 1900;
+  broken_down.tm_mon = fields[1] - 1;
+  broken_down.tm_mday = fields[2];
+  broken_down.tm_hour = fields[3];
+  broken_down.tm_min = fields[4];
+  broken_down.tm_sec = fields[5];
+  time = timegm(&broken_down);
+  return true;
+}
+
+int64_t BucketedCallListStore::bucket(const std::string& timestamp) const
+{
+  time_t time;
+
+  if (!parse_timestamp(timestamp, time))
+  {
+    return -1;
+  }
+
+  return time / _bucket_period_s;
+}
+
+std::string BucketedCallListStore::bucket_key(const std::string& impu,
+                                              int64_t bucket)
+{
+  return impu + "|b" + std::to_string(bucket);
+}
+
+bool BucketedCallListStore::is_call_list(const std::string& impu)
+{
+  return (impu != TrimOwnership::HEARTBEAT_IMPU);
+}
+
+int BucketedCallListStore::buckets(int bucket_period_s, int call_list_ttl_s)
+{
+  // The TTL back from now can start part way through a bucket.
+  return (call_list_ttl_s / bucket_period_s) + 1 +
+         ((call_list_ttl_s % bucket_period_s != 0) ? 1 : 0);
+}
+
+bool BucketedCallListStore::valid_period(int bucket_period_s,
+                                         int call_list_ttl_s)
+{
+  return ((bucket_period_s > 0) &&
+          (call_list_ttl_s > 0) &&
+          (buckets(bucket_period_s, call_list_ttl_s) <= MAX_BUCKETS));
+}
+
+int BucketedCallListStore::count_calls(
+                 const std::vector<CallListStore::CallFragment>& fragments)
+{
+  int calls = 0;
+
+  for (std::vector<CallListStore::CallFragment>::const_iterator it = fragments.begin();
+       it != fragments.end();
+       ++it)
+  {
+    if ((it->type == CallListStore::CallFragment::Type::BEGIN) ||
+        (it->type == CallListStore::CallFragment::Type::REJECTED))
+    {
+      calls++;
+    }
+  }
+
+  return calls;
+}
+
+CassandraStore::ResultCode BucketedCallListStore::write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail)
+{
+  if (!is_call_list(impu))
+  {
+    return _store->write_call_fragment_sync(impu,
+                                            fragment,
+                                            cass_timestamp,
+                                            ttl,
+                                            trail);
+  }
+
+  int64_t fragment_bucket = bucket(fragment.timestamp);
+
+  if (fragment_bucket < 0)
+  {
+    // LCOV_EXCL_START
+    TRC_WARNING("Invalid call fragment timestamp %s - writing to the IMPU's row",
+                fragment.timestamp.c_str());
+    return _store->write_call_fragment_sync(impu,
+                                            fragment,
+                                            cass_timestamp,
+                                            ttl,
+                                            trail);
+    // LCOV_EXCL_STOP
+  }
+
+  return _store->write_call_fragment_sync(
+                                      bucket_key(impu, fragment_bucket),
+                                      fragment,
+                                      cass_timestamp,
+                                      ttl,
+                                      trail);
+}
+
+CassandraStore::ResultCode BucketedCallListStore::write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail)
+{
+  // Fragments written together are for the same call, so share a timestamp
+  // and a bucket.
+  int64_t fragment_bucket = bucket(fragments[0].timestamp);
+
+  if (fragment_bucket < 0)
+  {
+    // LCOV_EXCL_START
+    TRC_WARNING("Invalid call fragment timestamp %s - writing to the IMPU's row",
+                fragments[0].timestamp.c_str());
+    return BatchCallListStore::write_call_fragments(_store,
+                                                    impu,
+                                                    fragments,
+                                                    cass_timestamp,
+                                                    ttl,
+                                                    trail);
+    // LCOV_EXCL_STOP
+  }
+
+  return BatchCallListStore::write_call_fragments(
+                                              _store,
+                                              bucket_key(impu, fragment_bucket),
+                                              fragments,
+                                              cass_timestamp,
+                                              ttl,
+                                              trail);
+}
+
+CassandraStore::ResultCode BucketedCallListStore::get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail)
+{
+  if (!is_call_list(impu))
+  {
+    return _store->get_call_fragments_sync(impu, fragments, trail);
+  }
+
+  // Start with the IMPU's row in the standard layout. Anything in it was
+  // written before bucketing was turned on, so it's older than anything in
+  // the buckets.
+  CassandraStore::ResultCode rc =
+        _store->get_call_fragments_sync(impu, fragments, trail);
+
+  if (rc == CassandraStore::NOT_FOUND)
+  {
+    rc = CassandraStore::OK;
+  }
+  else if (rc != CassandraStore::OK)
+  {
+    return rc;
+  }
+  else if (!fragments.empty())
+  {
+    // Anything that is moved is read again from its bucket below.
+    migrate(impu, fragments, trail);
+  }
+
+  // Then read the buckets that could hold fragments that haven't expired,
+  // newest first, until there are more calls than we need. Fragment
+  // timestamps are in the AS's local time, so work out the current bucket
+  // the same way.
+  time_t now = time(NULL);
+  now += TimestampCache::utc_offset(now);
+  int64_t first_bucket = (now - _call_list_ttl_s) / _bucket_period_s;
+  int64_t last_bucket = now / _bucket_period_s;
+  std::vector<std::vector<CallListStore::CallFragment>> buckets;
+  int calls = 0;
+
+  for (int64_t bucket = last_bucket; bucket >= first_bucket; bucket--)
+  {
+    std::vector<CallListStore::CallFragment> bucket_fragments;
+    rc = _store->get_call_fragments_sync(bucket_key(impu, bucket),
+                                         bucket_fragments,
+                                         trail);
+
+    if (rc == CassandraStore::NOT_FOUND)
+    {
+      rc = CassandraStore::OK;
+      continue;
+    }
+    else if (rc != CassandraStore::OK)
+    {
+      return rc;
+    }
+
+    calls += count_calls(bucket_fragments);
+    buckets.push_back(std::vector<CallListStore::CallFragment>());
+    buckets.back().swap(bucket_fragments);
+
+    if ((_max_calls > 0) && (calls > _max_calls))
+    {
+      TRC_DEBUG("Found %d calls for %s - not reading older buckets",
+                calls, impu.c_str());
+      break;
+    }
+  }
+
+  // Return the fragments oldest first.
+  for (std::vector<std::vector<CallListStore::CallFragment>>::reverse_iterator it =
+         buckets.rbegin();
+       it != buckets.rend();
+       ++it)
+  {
+    fragments.insert(fragments.end(), it->begin(), it->end());
+  }
+
+  return rc;
+}
+
+CassandraStore::ResultCode BucketedCallListStore::delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail)
+{
+  // Group the fragments by bucket, and delete from each bucket's row.
+  std::map<int64_t, std::vector<CallListStore::CallFragment>> buckets;
+
+  for (std::vector<CallListStore::CallFragment>::const_iterator it = fragments.begin();
+       it != fragments.end();
+       ++it)
+  {
+    buckets[bucket(it->timestamp)].push_back(*it);
+  }
+
+  CassandraStore::ResultCode result = CassandraStore::OK;
+
+  for (std::map<int64_t, std::vector<CallListStore::CallFragment>>::const_iterator it =
+         buckets.begin();
+       it != buckets.end();
+       ++it)
+  {
+    // Fragments with invalid timestamps were written to the IMPU's row.
+    std::string key = (it->first < 0) ? impu : bucket_key(impu, it->first);
+    CassandraStore::ResultCode rc =
+      _store->delete_old_call_fragments_sync(key,
+                                             it->second,
+                                             cass_timestamp,
+                                             trail);
+
+    if (rc != CassandraStore::OK)
+    {
+      result = rc;
+    }
+  }
+
+  return result;
+}
+
+int BucketedCallListStore::migrate_call_fragments_sync(const std::string& impu,
+                                                       SAS::TrailId trail)
+{
+  std::vector<CallListStore::CallFragment> fragments;
+  CassandraStore::ResultCode rc =
+        _store->get_call_fragments_sync(impu, fragments, trail);
+
+  if (rc != CassandraStore::OK)
+  {
+    return 0;
+  }
+
+  return migrate(impu, fragments, trail);
+}
+
+int BucketedCallListStore::migrate(
+                       const std::string& impu,
+                       std::vector<CallListStore::CallFragment>& fragments,
+                       SAS::TrailId trail)
+{
+  time_t now = time(NULL);
+  now += TimestampCache::utc_offset(now);
+  int64_t cass_timestamp = CallListStore::Store::generate_timestamp();
+  int migrated = 0;
+  std::vector<CallListStore::CallFragment> moved;
+  std::vector<CallListStore::CallFragment> left;
+
+  for (std::vector<CallListStore::CallFragment>::const_iterator it = fragments.begin();
+       it != fragments.end();
+       ++it)
+  {
+    time_t fragment_time;
+
+    if (!parse_timestamp(it->timestamp, fragment_time))
+    {
+      // Leave fragments we can't place where they are.
+      left.push_back(*it); // LCOV_EXCL_LINE
+      continue; // LCOV_EXCL_LINE
+    }
+
+    // Keep the fragment's original expiry time. Fragments that have
+    // (nearly) expired are just deleted.
+    int64_t ttl = _call_list_ttl_s - (now - fragment_time);
+
+    if ((ttl <= 0) ||
+        (_store->write_call_fragment_sync(
+                           bucket_key(impu, fragment_time / _bucket_period_s),
+                           *it,
+                           cass_timestamp,
+                           ttl,
+                           trail) == CassandraStore::OK))
+    {
+      moved.push_back(*it);
+      migrated++;
+    }
+    else
+    {
+      left.push_back(*it);
+    }
+  }
+
+  fragments.swap(left);
+
+  if (!moved.empty())
+  {
+    TRC_DEBUG("Moving %d call fragments for %s into buckets",
+              migrated, impu.c_str());
+    _store->delete_old_call_fragments_sync(impu,
+                                           moved,
+                                           cass_timestamp + 1,
+                                           trail);
+  }
+
+  return migrated;
+}
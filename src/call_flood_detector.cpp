@@ -0,0 +1,159 @@
+/**
+ * @file call_flood_detector.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "call_flood_detector.h"
+#include "timestamp_cache.h"
+#include "log.h"
+
+CallFloodDetector::CallFloodDetector(CallListStoreProcessor* processor,
+                                     int max_rejected_calls,
+                                     int window_ms,
+                                     LastValueCache* stats_aggregator) :
+  _processor(processor),
+  _max_rejected_calls(max_rejected_calls),
+  _window_ms(window_ms),
+  _stat_folded_calls("memento_folded_calls", stats_aggregator)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+CallFloodDetector::~CallFloodDetector()
+{
+  for (std::unordered_map<std::string, Window>::iterator it = _windows.begin();
+       it != _windows.end();
+       ++it)
+  {
+    if (it->second.summary != NULL)
+    {
+      _processor->release_request(it->second.summary);
+    }
+  }
+
+  pthread_mutex_destroy(&_lock);
+}
+
+CallListStoreProcessor::CallListRequest* CallFloodDetector::check(
+                              CallListStoreProcessor::CallListRequest* request,
+                              uint64_t now_ms)
+{
+  if (request->fragment.type != CallListStore::CallFragment::Type::REJECTED)
+  {
+    return request;
+  }
+
+  CallListStoreProcessor::CallListRequest* folded = NULL;
+
+  pthread_mutex_lock(&_lock);
+
+  Window& window = _windows[request->impu];
+
+  if (window.calls == 0)
+  {
+    window.start_ms = now_ms;
+  }
+
+  window.calls++;
+
+  if (window.calls > _max_rejected_calls)
+  {
+    if (window.summary == NULL)
+    {
+      // This is the first call to fold, so it becomes the summary.
+      TRC_DEBUG("Folding rejected calls to %s", request->impu.c_str());
+      window.summary = request;
+      window.mixed_callers = false;
+    }
+    else
+    {
+      if (request->entry.caller_uri != window.summary->entry.caller_uri)
+      {
+        window.mixed_callers = true;
+      }
+
+      folded = request;
+    }
+
+    window.folded++;
+    window.last_start_time = request->entry.start_time;
+    request = NULL;
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  if (request == NULL)
+  {
+    _stat_folded_calls.increment();
+  }
+
+  if (folded != NULL)
+  {
+    // The load monitor counted this request in, so it must be counted out
+    // too, or it will think requests are piling up.
+    _processor->complete_request(folded);
+  }
+
+  return request;
+}
+
+void CallFloodDetector::flush(
+             uint64_t now_ms,
+             std::vector<CallListStoreProcessor::CallListRequest*>& summaries)
+{
+  pthread_mutex_lock(&_lock);
+
+  std::unordered_map<std::string, Window>::iterator it = _windows.begin();
+
+  while (it != _windows.end())
+  {
+    if (now_ms - it->second.start_ms < (uint64_t)_window_ms)
+    {
+      ++it;
+      continue;
+    }
+
+    if (it->second.summary != NULL)
+    {
+      describe(it->second);
+      summaries.push_back(it->second.summary);
+    }
+
+    it = _windows.erase(it);
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+void CallFloodDetector::describe(const Window& window)
+{
+  CallListEntry& entry = window.summary->entry;
+
+  if (window.folded == 1)
+  {
+    // Only one call was folded, so it can be written as it was.
+    return;
+  }
+
+  char first[TimestampCache::MAX_LEN];
+  size_t first_len = TimestampCache::format_xml(entry.start_time, false, first);
+  char last[TimestampCache::MAX_LEN];
+  size_t last_len = TimestampCache::format_xml(window.last_start_time, false, last);
+
+  entry.caller_name = std::to_string(window.folded);
+  entry.caller_name.append(" missed calls");
+
+  if (window.mixed_callers)
+  {
+    entry.caller_name.append(" from multiple callers");
+  }
+
+  entry.caller_name.append(" between ").append(first, first_len);
+  entry.caller_name.append(" and ").append(last, last_len);
+}
@@ -0,0 +1,304 @@
+/**
+ * @file call_fragment_codec.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <stdint.h>
+
+#include "call_fragment_codec.h"
+#include "timestamp_cache.h"
+
+namespace CallFragmentCodec
+{
+
+static const uint8_t FLAG_OUTGOING = 0x01;
+
+static const char TYPE_BEGIN = 0;
+static const char TYPE_END = 1;
+static const char TYPE_REJECTED = 2;
+
+// Applies the local UTC offset to a time, so it can be rendered without
+// knowing the timezone.
+static uint64_t to_local_seconds(time_t time)
+{
+  return (uint64_t)(int64_t)(time + TimestampCache::utc_offset(time));
+}
+
+static void put_varint(std::string& out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back((char)((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+
+  out.push_back((char)value);
+}
+
+static void put_string(std::string& out, const std::string& value)
+{
+  put_varint(out, value.length());
+  out.append(value);
+}
+
+/// Reads the binary encoding, checking bounds as it goes.
+class Reader
+{
+public:
+  Reader(const std::string& in) : _in(in), _pos(0) {}
+
+  bool get_byte(char& value)
+  {
+    if (_pos >= _in.length())
+    {
+      return false;
+    }
+
+    value = _in[_pos++];
+    return true;
+  }
+
+  bool get_varint(uint64_t& value)
+  {
+    value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+      char byte;
+      if (!get_byte(byte))
+      {
+        return false;
+      }
+
+      value |= (uint64_t)(byte & 0x7f) << shift;
+
+      if ((byte & 0x80) == 0)
+      {
+        return true;
+      }
+    }
+
+    // Too many continuation bytes.
+    return false;
+  }
+
+  bool get_time(time_t& value)
+  {
+    uint64_t raw;
+    if (!get_varint(raw))
+    {
+      return false;
+    }
+
+    value = (time_t)(int64_t)raw;
+    return true;
+  }
+
+  bool get_string(std::string& value)
+  {
+    uint64_t len;
+    if ((!get_varint(len)) || (len > _in.length() - _pos))
+    {
+      return false;
+    }
+
+    value.assign(_in, _pos, len);
+    _pos += len;
+    return true;
+  }
+
+  bool at_end() const { return _pos == _in.length(); }
+
+private:
+  const std::string& _in;
+  size_t _pos;
+};
+
+bool parse_encoding(const std::string& name, Encoding& encoding)
+{
+  if (name == "xml")
+  {
+    encoding = XML;
+    return true;
+  }
+  else if (name == "binary")
+  {
+    encoding = BINARY;
+    return true;
+  }
+
+  return false;
+}
+
+void encode(Encoding encoding,
+            CallListStore::CallFragment::Type type,
+            const CallListEntry& entry,
+            std::string& contents)
+{
+  if (encoding == XML)
+  {
+    // Write into a stack buffer and assign, so that contents keeps its
+    // capacity (requests are recycled, so it normally has plenty).
+    char buf[4096];
+    size_t len = write_call_list_xml(type, entry, buf, sizeof(buf));
+
+    if (len > 0)
+    {
+      contents.assign(buf, len);
+    }
+    else
+    {
+      contents = render_call_list_xml(type, entry);
+    }
+
+    return;
+  }
+
+  contents.clear();
+  contents.reserve(32 +
+                   entry.callee_uri.length() + entry.callee_name.length() +
+                   entry.caller_uri.length() + entry.caller_name.length() +
+                   entry.answerer_uri.length() + entry.answerer_name.length());
+  contents.push_back(BINARY_MARKER);
+  contents.push_back(BINARY_VERSION);
+
+  switch (type)
+  {
+  case CallListStore::CallFragment::Type::BEGIN:
+    contents.push_back(TYPE_BEGIN);
+    break;
+
+  case CallListStore::CallFragment::Type::END:
+    contents.push_back(TYPE_END);
+    break;
+
+  case CallListStore::CallFragment::Type::REJECTED:
+    contents.push_back(TYPE_REJECTED);
+    break;
+  }
+
+  contents.push_back((char)(entry.outgoing ? FLAG_OUTGOING : 0));
+
+  if (type == CallListStore::CallFragment::Type::END)
+  {
+    put_varint(contents, to_local_seconds(entry.end_time));
+    return;
+  }
+
+  put_varint(contents, to_local_seconds(entry.start_time));
+
+  if (type == CallListStore::CallFragment::Type::BEGIN)
+  {
+    put_varint(contents, to_local_seconds(entry.answer_time));
+  }
+
+  put_string(contents, entry.callee_uri);
+  put_string(contents, entry.callee_name);
+  put_string(contents, entry.caller_uri);
+  put_string(contents, entry.caller_name);
+
+  if (type == CallListStore::CallFragment::Type::BEGIN)
+  {
+    put_string(contents, entry.answerer_uri);
+    put_string(contents, entry.answerer_name);
+  }
+}
+
+bool decode(const std::string& contents,
+            CallListStore::CallFragment::Type& type,
+            CallListEntry& entry)
+{
+  Reader reader(contents);
+  char marker;
+  char version;
+  char type_byte;
+  char flags;
+
+  if ((!reader.get_byte(marker)) ||
+      (marker != BINARY_MARKER) ||
+      (!reader.get_byte(version)) ||
+      (version != BINARY_VERSION) ||
+      (!reader.get_byte(type_byte)) ||
+      (!reader.get_byte(flags)))
+  {
+    return false;
+  }
+
+  entry = CallListEntry();
+  entry.outgoing = ((flags & FLAG_OUTGOING) != 0);
+
+  switch (type_byte)
+  {
+  case TYPE_BEGIN:
+    type = CallListStore::CallFragment::Type::BEGIN;
+    break;
+
+  case TYPE_END:
+    type = CallListStore::CallFragment::Type::END;
+    return (reader.get_time(entry.end_time) && reader.at_end());
+
+  case TYPE_REJECTED:
+    type = CallListStore::CallFragment::Type::REJECTED;
+    break;
+
+  default:
+    return false;
+  }
+
+  if (!reader.get_time(entry.start_time))
+  {
+    return false;
+  }
+
+  if ((type == CallListStore::CallFragment::Type::BEGIN) &&
+      (!reader.get_time(entry.answer_time)))
+  {
+    return false;
+  }
+
+  if ((!reader.get_string(entry.callee_uri)) ||
+      (!reader.get_string(entry.callee_name)) ||
+      (!reader.get_string(entry.caller_uri)) ||
+      (!reader.get_string(entry.caller_name)))
+  {
+    return false;
+  }
+
+  if ((type == CallListStore::CallFragment::Type::BEGIN) &&
+      ((!reader.get_string(entry.answerer_uri)) ||
+       (!reader.get_string(entry.answerer_name))))
+  {
+    return false;
+  }
+
+  return reader.at_end();
+}
+
+bool to_xml(const std::string& contents, std::string& xml)
+{
+  if ((contents.empty()) || (contents[0] != BINARY_MARKER))
+  {
+    // Plain XML.
+    xml = contents;
+    return true;
+  }
+
+  CallListStore::CallFragment::Type type;
+  CallListEntry entry;
+
+  if (!decode(contents, type, entry))
+  {
+    return false;
+  }
+
+  xml = render_call_list_xml(type, entry, EntryTimes::LOCAL);
+  return true;
+}
+
+}
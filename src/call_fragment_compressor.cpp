@@ -0,0 +1,195 @@
+/**
+ * @file call_fragment_compressor.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "call_fragment_compressor.h"
+#include "log.h"
+
+/// Per-thread zstd contexts. Creating a context is expensive, so each memento
+/// worker thread keeps its own for the life of the thread.
+struct ZstdContexts
+{
+  ZstdContexts() : cctx(ZSTD_createCCtx()), dctx(ZSTD_createDCtx()) {}
+
+  ~ZstdContexts()
+  {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+  }
+
+  ZSTD_CCtx* cctx;
+  ZSTD_DCtx* dctx;
+};
+
+static thread_local ZstdContexts zstd_contexts;
+
+/// Per-thread scratch buffer for compressed contents. This is swapped with
+/// the contents once they have been compressed, so both keep their capacity
+/// and compressing doesn't normally allocate any memory.
+static thread_local std::string zstd_scratch;
+
+const char CallFragmentCompressor::COMPRESSED_MARKER;
+const size_t CallFragmentCompressor::MAX_DECOMPRESSED_SIZE;
+
+CallFragmentCompressor::CallFragmentCompressor(const std::string& dictionary,
+                                               int level,
+                                               LastValueCache* stats_aggregator) :
+  _cdict(NULL),
+  _ddict(NULL),
+  _stat_compression_ratio(NULL)
+{
+  if (!dictionary.empty())
+  {
+    _cdict = ZSTD_createCDict(dictionary.data(), dictionary.length(), level);
+    _ddict = ZSTD_createDDict(dictionary.data(), dictionary.length());
+  }
+
+  if (!is_valid())
+  {
+    TRC_ERROR("Failed to load call fragment compression dictionary");
+  }
+
+  if (stats_aggregator != NULL)
+  {
+    _stat_compression_ratio =
+      new StatisticAccumulator("memento_fragment_compression_ratio",
+                               stats_aggregator);
+  }
+}
+
+CallFragmentCompressor::~CallFragmentCompressor()
+{
+  ZSTD_freeCDict(_cdict); _cdict = NULL;
+  ZSTD_freeDDict(_ddict); _ddict = NULL;
+  delete _stat_compression_ratio; _stat_compression_ratio = NULL;
+}
+
+bool CallFragmentCompressor::read_dictionary(const std::string& path,
+                                             std::string& dictionary)
+{
+  std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+
+  if (!file.is_open())
+  {
+    TRC_ERROR("Unable to open call fragment dictionary %s", path.c_str());
+    return false;
+  }
+
+  std::stringstream contents;
+  contents << file.rdbuf();
+  dictionary = contents.str();
+
+  if (dictionary.empty())
+  {
+    TRC_ERROR("Call fragment dictionary %s is empty", path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool CallFragmentCompressor::is_trained(const std::string& dictionary)
+{
+  // Trained dictionaries have a header with a non-zero ID. Raw content
+  // dictionaries don't.
+  return (ZSTD_getDictID_fromDict(dictionary.data(), dictionary.length()) != 0);
+}
+
+void CallFragmentCompressor::compress(std::string& contents)
+{
+  if ((!is_valid()) || (contents.empty()))
+  {
+    return;
+  }
+
+  std::string& compressed = zstd_scratch;
+  compressed.resize(1 + ZSTD_compressBound(contents.length()));
+  compressed[0] = COMPRESSED_MARKER;
+  size_t rc = ZSTD_compress_usingCDict(zstd_contexts.cctx,
+                                       &compressed[1],
+                                       compressed.length() - 1,
+                                       contents.data(),
+                                       contents.length(),
+                                       _cdict);
+
+  if (ZSTD_isError(rc))
+  {
+    // LCOV_EXCL_START - the output buffer is always big enough.
+    TRC_WARNING("Failed to compress call fragment: %s", ZSTD_getErrorName(rc));
+    return;
+    // LCOV_EXCL_STOP
+  }
+
+  size_t uncompressed_len = contents.length();
+
+  if (1 + rc < uncompressed_len)
+  {
+    compressed.resize(1 + rc);
+    contents.swap(compressed);
+  }
+
+  if (_stat_compression_ratio != NULL)
+  {
+    _stat_compression_ratio->accumulate((uncompressed_len * 100) /
+                                        contents.length());
+  }
+}
+
+bool CallFragmentCompressor::decompress(const std::string& contents,
+                                        std::string& decompressed) const
+{
+  if ((contents.empty()) || (contents[0] != COMPRESSED_MARKER))
+  {
+    decompressed = contents;
+    return true;
+  }
+
+  if (!is_valid())
+  {
+    TRC_DEBUG("Can't decompress call fragment - no dictionary");
+    return false;
+  }
+
+  const char* frame = contents.data() + 1;
+  size_t frame_len = contents.length() - 1;
+  unsigned long long size = ZSTD_getFrameContentSize(frame, frame_len);
+
+  if ((size == ZSTD_CONTENTSIZE_UNKNOWN) ||
+      (size == ZSTD_CONTENTSIZE_ERROR) ||
+      (size > MAX_DECOMPRESSED_SIZE))
+  {
+    TRC_DEBUG("Invalid compressed call fragment");
+    return false;
+  }
+
+  // Decompress into a scratch buffer with a spare byte, so that a frame that
+  // is bigger than its header says is spotted rather than truncated.
+  std::vector<char> buf(size + 1);
+  size_t rc = ZSTD_decompress_usingDDict(zstd_contexts.dctx,
+                                         buf.data(),
+                                         buf.size(),
+                                         frame,
+                                         frame_len,
+                                         _ddict);
+
+  if ((ZSTD_isError(rc)) || (rc != size))
+  {
+    TRC_DEBUG("Failed to decompress call fragment: %s",
+              ZSTD_isError(rc) ? ZSTD_getErrorName(rc) : "size mismatch");
+    return false;
+  }
+
+  decompressed.assign(buf.data(), rc);
+  return true;
+}
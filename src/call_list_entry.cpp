@@ -0,0 +1,314 @@
+/**
+ * @file call_list_entry.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "call_list_entry.h"
+#include "timestamp_cache.h"
+
+static const int MAX_CALL_ENTRY_LENGTH = 4096;
+
+// Constants to create the Call list XML
+namespace MementoXML
+{
+  static const char* TO = "to";
+  static const char* FROM = "from";
+  static const char* NAME = "name";
+  static const char* URI = "URI";
+  static const char* OUTGOING = "outgoing";
+  static const char* ANSWERED = "answered";
+  static const char* ANSWERER = "answerer";
+  static const char* START_TIME = "start-time";
+  static const char* END_TIME = "end-time";
+  static const char* ANSWER_TIME = "answer-time";
+}
+
+// Returns whether a character has to be replaced by an entity reference in
+// element text. These are the characters that rapidxml::print expands.
+static inline bool needs_escape(char c)
+{
+  return ((c == '<') || (c == '>') || (c == '&') || (c == '\'') || (c == '"'));
+}
+
+// Returns the length of the leading run of characters that can be copied
+// without escaping. Call list values rarely contain any special characters,
+// so this normally covers the whole value. Where SSE2 is available it checks
+// 16 characters at a time.
+static inline size_t plain_prefix(const char* s, size_t n)
+{
+  size_t ii = 0;
+
+#if defined(__SSE2__)
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i gt = _mm_set1_epi8('>');
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i apos = _mm_set1_epi8('\'');
+  const __m128i quot = _mm_set1_epi8('"');
+
+  for (; ii + 16 <= n; ii += 16)
+  {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + ii));
+    __m128i match = _mm_or_si128(
+                      _mm_or_si128(_mm_cmpeq_epi8(chunk, lt),
+                                   _mm_cmpeq_epi8(chunk, gt)),
+                      _mm_or_si128(_mm_cmpeq_epi8(chunk, amp),
+                                   _mm_or_si128(_mm_cmpeq_epi8(chunk, apos),
+                                                _mm_cmpeq_epi8(chunk, quot))));
+    int mask = _mm_movemask_epi8(match);
+
+    if (mask != 0)
+    {
+      return ii + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  while ((ii < n) && (!needs_escape(s[ii])))
+  {
+    ii++;
+  }
+
+  return ii;
+}
+
+/// Bounds-checked writer for the call list XML. Once the buffer overflows
+/// all further writes are discarded and overflowed() returns true.
+class CallListXmlWriter
+{
+public:
+  CallListXmlWriter(char* buf, size_t buf_len, EntryTimes times) :
+    _start(buf),
+    _pos(buf),
+    _end(buf + buf_len),
+    _times(times),
+    _overflowed(false)
+  {}
+
+  bool overflowed() const { return _overflowed; }
+  size_t length() const { return _pos - _start; }
+
+  void raw(const char* s, size_t n)
+  {
+    if ((size_t)(_end - _pos) < n)
+    {
+      _overflowed = true;
+      _pos = _end;
+      return;
+    }
+
+    memcpy(_pos, s, n);
+    _pos += n;
+  }
+
+  void raw(const char* s)
+  {
+    raw(s, strlen(s));
+  }
+
+  void raw(char c)
+  {
+    raw(&c, 1);
+  }
+
+  void indent(int depth)
+  {
+    for (int ii = 0; ii < depth; ii++)
+    {
+      raw('\t');
+    }
+  }
+
+  void escaped(const char* s, size_t n)
+  {
+    while (n > 0)
+    {
+      size_t plain = plain_prefix(s, n);
+      raw(s, plain);
+
+      if (plain == n)
+      {
+        break;
+      }
+
+      switch (s[plain])
+      {
+      case '<':  raw("&lt;", 4);   break;
+      case '>':  raw("&gt;", 4);   break;
+      case '&':  raw("&amp;", 5);  break;
+      case '\'': raw("&apos;", 6); break;
+      default:   raw("&quot;", 6); break;
+      }
+
+      s += plain + 1;
+      n -= plain + 1;
+    }
+  }
+
+  // Writes <tag>value</tag> on its own line, or <tag/> if the value is empty.
+  void element(int depth, const char* tag, const char* value, size_t value_len)
+  {
+    // The values used to be copied into the DOM as C strings, so anything
+    // after an embedded null was dropped. Keep doing the same.
+    const char* nul = (const char*)memchr(value, '\0', value_len);
+    if (nul != NULL)
+    {
+      value_len = nul - value;
+    }
+
+    indent(depth);
+    raw('<');
+    raw(tag);
+
+    if (value_len == 0)
+    {
+      raw("/>\n", 3);
+      return;
+    }
+
+    raw('>');
+    escaped(value, value_len);
+    raw("</", 2);
+    raw(tag);
+    raw(">\n", 2);
+  }
+
+  void element(int depth, const char* tag, const std::string& value)
+  {
+    element(depth, tag, value.data(), value.length());
+  }
+
+  // Writes <tag>YYYY-MM-DDTHH:MM:SS</tag> on its own line, in local time.
+  void time_element(int depth, const char* tag, time_t time)
+  {
+    char formatted_time[TimestampCache::MAX_LEN];
+    size_t len = TimestampCache::format_xml(time,
+                                            (_times == EntryTimes::LOCAL),
+                                            formatted_time);
+    element(depth, tag, formatted_time, len);
+  }
+
+  // Writes <tag>
+  //          <URI>uri</URI>
+  //          <name>name</name>
+  //        </tag>
+  // The name is left out if it is empty.
+  void party(const char* tag, const std::string& uri, const std::string& name)
+  {
+    raw('<');
+    raw(tag);
+    raw(">\n", 2);
+
+    element(1, MementoXML::URI, uri);
+
+    if (!name.empty())
+    {
+      element(1, MementoXML::NAME, name);
+    }
+
+    raw("</", 2);
+    raw(tag);
+    raw(">\n", 2);
+  }
+
+private:
+  char* _start;
+  char* _pos;
+  char* _end;
+  EntryTimes _times;
+  bool _overflowed;
+};
+
+size_t write_call_list_xml(CallListStore::CallFragment::Type type,
+                           const CallListEntry& entry,
+                           char* buf,
+                           size_t buf_len,
+                           EntryTimes times)
+{
+  CallListXmlWriter writer(buf, buf_len, times);
+
+  if (type == CallListStore::CallFragment::Type::END)
+  {
+    writer.time_element(0, MementoXML::END_TIME, entry.end_time);
+  }
+  else
+  {
+    // Fill in the 'to' values from the callee values, and the 'from' values
+    // from the caller values.
+    writer.party(MementoXML::TO, entry.callee_uri, entry.callee_name);
+    writer.party(MementoXML::FROM, entry.caller_uri, entry.caller_name);
+
+    // Set outgoing to 1 if the call is outgoing, and 0 otherwise.
+    writer.element(0, MementoXML::OUTGOING, entry.outgoing ? "1" : "0", 1);
+
+    // Set the start time.
+    writer.time_element(0, MementoXML::START_TIME, entry.start_time);
+
+    if (type == CallListStore::CallFragment::Type::REJECTED)
+    {
+      // If the call was rejected, set answered to 0.
+      writer.element(0, MementoXML::ANSWERED, "0", 1);
+    }
+    else
+    {
+      // If the call was answered, set answered to 1 and fill in the answer
+      // time.
+      writer.element(0, MementoXML::ANSWERED, "1", 1);
+      writer.time_element(0, MementoXML::ANSWER_TIME, entry.answer_time);
+
+      // The answerer is only present if the responder supplied a P-A-I and
+      // didn't request privacy.
+      if (!entry.answerer_uri.empty())
+      {
+        writer.party(MementoXML::ANSWERER,
+                     entry.answerer_uri,
+                     entry.answerer_name);
+      }
+    }
+  }
+
+  // rapidxml::print terminated the document itself with a newline.
+  writer.raw('\n');
+
+  return writer.overflowed() ? 0 : writer.length();
+}
+
+std::string render_call_list_xml(CallListStore::CallFragment::Type type,
+                                 const CallListEntry& entry,
+                                 EntryTimes times)
+{
+  char contents[MAX_CALL_ENTRY_LENGTH];
+  size_t len = write_call_list_xml(type, entry, contents, sizeof(contents), times);
+
+  if (len > 0)
+  {
+    return std::string(contents, len);
+  }
+
+  // The entry doesn't fit in the usual buffer (which would have overrun the
+  // stack buffer with the old rapidxml code). Keep growing a heap buffer
+  // until it does.
+  size_t buf_len = sizeof(contents);
+  std::vector<char> buf;
+
+  do
+  {
+    buf_len *= 2;
+    buf.resize(buf_len);
+    len = write_call_list_xml(type, entry, buf.data(), buf.size(), times);
+  }
+  while (len == 0);
+
+  return std::string(buf.data(), len);
+}
@@ -8,7 +8,33 @@
  * Otherwise no rights are granted except for those provided to you by
  * Metaswitch Networks in a separate written agreement.
  */
+#include <time.h>
+
 #include "call_list_store_processor.h"
+#include "batch_call_list_store.h"
+#include "call_flood_detector.h"
+#include "deadline_call_list_store.h"
+
+/// Number of requests to create up front, and the most to keep in the pool
+/// of free requests.
+static const size_t PREALLOCATED_REQUESTS = 64;
+static const size_t MAX_FREE_REQUESTS = 1024;
+
+/// Most BEGIN requests to hold waiting for their END. Once this many are
+/// held, further BEGIN requests are written straight away.
+static const size_t MAX_HELD_REQUESTS = 10000;
+
+/// Number of IMPUs to publish in the hot IMPU statistics, and the interval
+/// they're counted over.
+static const size_t HOT_IMPUS_PUBLISHED = 10;
+static const uint64_t HOT_IMPUS_INTERVAL_MS = 60000;
+
+/// How often to check for the end of call flood windows.
+static const uint64_t FLOOD_FLUSH_INTERVAL_MS = 1000;
+
+/// How many times to queue a request again after its writes miss their
+/// deadline. Writing a fragment again just overwrites it, so this is safe.
+static const int MAX_WRITE_RETRIES = 1;
 
 /// Constructor.
 CallListStoreProcessor::CallListStoreProcessor(LoadMonitor* load_monitor,
@@ -18,7 +44,16 @@ CallListStoreProcessor::CallListStoreProcessor(LoadMonitor* load_monitor,
                                                const int call_list_ttl,
                                                LastValueCache* stats_aggregator,
                                                ExceptionHandler* exception_handler,
-                                               HttpNotifier* http_notifier) :
+                                               HttpNotifier* http_notifier,
+                                               CallFragmentCodec::Encoding fragment_encoding,
+                                               CallFragmentCompressor* compressor,
+                                               const int begin_hold_ms,
+                                               const int flood_max_rejected_calls,
+                                               const int flood_window_ms,
+                                               const int cass_target_latency_us,
+                                               CallListViewStore* call_list_view_store,
+                                               TrimOwnership* trim_ownership) :
+  _load_monitor(load_monitor),
   _thread_pool(new Pool(this,
                         call_list_store,
                         load_monitor,
@@ -27,102 +62,489 @@ CallListStoreProcessor::CallListStoreProcessor(LoadMonitor* load_monitor,
                         memento_threads,
                         exception_handler,
                         &exception_callback,
-                        http_notifier)),
+                        http_notifier,
+                        fragment_encoding,
+                        compressor,
+                        cass_target_latency_us,
+                        call_list_view_store,
+                        trim_ownership)),
   _stat_completed_calls_recorded("memento_completed_calls", stats_aggregator),
   _stat_failed_calls_recorded("memento_failed_calls", stats_aggregator),
   _stat_cassandra_read_latency("memento_cassandra_read_latency", stats_aggregator),
-  _stat_cassandra_write_latency("memento_cassandra_write_latency", stats_aggregator)
+  _stat_cassandra_write_latency("memento_cassandra_write_latency", stats_aggregator),
+  _stat_cassandra_timeouts("memento_cassandra_timeouts", stats_aggregator),
+  _stat_cassandra_errors("memento_cassandra_errors", stats_aggregator),
+  _stat_cassandra_retries("memento_cassandra_retries", stats_aggregator),
+  _stat_view_updates("memento_call_list_view_updates", stats_aggregator),
+  _stat_view_conflicts("memento_call_list_view_conflicts", stats_aggregator),
+  _stat_view_errors("memento_call_list_view_errors", stats_aggregator),
+  _stat_trims_not_owned("memento_trims_not_owned", stats_aggregator),
+  _hot_impus(HOT_IMPUS_PUBLISHED, HOT_IMPUS_INTERVAL_MS, stats_aggregator),
+  _free_requests(NULL),
+  _num_free_requests(0),
+  _num_extra_requests(0),
+  _begin_hold_ms(begin_hold_ms),
+  _housekeeping_terminating(false),
+  _flood_detector(NULL)
 {
+  pthread_mutex_init(&_request_lock, NULL);
+  pthread_mutex_init(&_held_lock, NULL);
+
+  // The housekeeping thread waits for deadlines on the monotonic clock.
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_held_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  for (size_t ii = 0; ii < PREALLOCATED_REQUESTS; ii++)
+  {
+    release_request(new CallListRequest());
+  }
+
+  if (flood_max_rejected_calls > 0)
+  {
+    _flood_detector = new CallFloodDetector(this,
+                                            flood_max_rejected_calls,
+                                            flood_window_ms,
+                                            stats_aggregator);
+  }
+
   _thread_pool->start();
+
+  if (((_begin_hold_ms > 0) || (_flood_detector != NULL)) &&
+      (pthread_create(&_housekeeping_thread,
+                      NULL,
+                      &housekeeping_thread_fn,
+                      this) != 0))
+  {
+    // LCOV_EXCL_START
+    TRC_ERROR("Failed to start housekeeping thread - not holding BEGIN fragments or folding call floods");
+    _begin_hold_ms = 0;
+    delete _flood_detector; _flood_detector = NULL;
+    // LCOV_EXCL_STOP
+  }
 }
 
 /// Destructor.
 CallListStoreProcessor::~CallListStoreProcessor()
 {
+  if ((_begin_hold_ms > 0) || (_flood_detector != NULL))
+  {
+    pthread_mutex_lock(&_held_lock);
+    _housekeeping_terminating = true;
+    pthread_cond_signal(&_held_cond);
+    pthread_mutex_unlock(&_held_lock);
+    pthread_join(_housekeeping_thread, NULL);
+
+    // Queue anything that's still held.
+    expire_held_requests(UINT64_MAX);
+
+    if (_flood_detector != NULL)
+    {
+      std::vector<CallListRequest*> summaries;
+      _flood_detector->flush(UINT64_MAX, summaries);
+
+      for (size_t ii = 0; ii < summaries.size(); ii++)
+      {
+        queue_held_request(summaries[ii]);
+      }
+    }
+  }
+
   if (_thread_pool != NULL)
   {
     _thread_pool->stop();
     _thread_pool->join();
     delete _thread_pool; _thread_pool = NULL;
   }
+
+  delete _flood_detector; _flood_detector = NULL;
+
+  while (_free_requests != NULL)
+  {
+    CallListRequest* request = _free_requests;
+    _free_requests = request->next;
+    delete request;
+  }
+
+  pthread_cond_destroy(&_held_cond);
+  pthread_mutex_destroy(&_held_lock);
+  pthread_mutex_destroy(&_request_lock);
+}
+
+void CallListStoreProcessor::CallListRequest::reset()
+{
+  impu.clear();
+  fragment.timestamp.clear();
+  fragment.id.clear();
+  fragment.contents.clear();
+  entry.caller_uri.clear();
+  entry.caller_name.clear();
+  entry.callee_uri.clear();
+  entry.callee_name.clear();
+  entry.answerer_uri.clear();
+  entry.answerer_name.clear();
+  entry.start_time = 0;
+  entry.answer_time = 0;
+  entry.end_time = 0;
+  entry.outgoing = false;
+  trail = 0;
+  retries = 0;
+  retried_us = 0;
+  next = NULL;
+}
+
+CallListStoreProcessor::CallListRequest* CallListStoreProcessor::get_request()
+{
+  CallListRequest* request = NULL;
+
+  pthread_mutex_lock(&_request_lock);
+
+  if (_free_requests != NULL)
+  {
+    request = _free_requests;
+    _free_requests = request->next;
+    _num_free_requests--;
+  }
+  else
+  {
+    _num_extra_requests++;
+  }
+
+  pthread_mutex_unlock(&_request_lock);
+
+  if (request == NULL)
+  {
+    // The pool has run dry, which means requests are queued up behind slow
+    // writes. Create another one - it joins the pool once it's been used.
+    request = new CallListRequest();
+  }
+
+  request->next = NULL;
+  return request;
+}
+
+void CallListStoreProcessor::release_request(CallListRequest* request)
+{
+  request->reset();
+
+  pthread_mutex_lock(&_request_lock);
+
+  if (_num_free_requests < MAX_FREE_REQUESTS)
+  {
+    request->next = _free_requests;
+    _free_requests = request;
+    _num_free_requests++;
+    request = NULL;
+  }
+
+  pthread_mutex_unlock(&_request_lock);
+
+  // Don't let the pool grow without bound after a burst.
+  delete request;
 }
 
-/// Creates a call list entry and adds it to the queue.
-void CallListStoreProcessor::write_call_list_entry(
-                                      std::string impu,
-                                      std::string timestamp,
-                                      std::string id,
-                                      CallListStore::CallFragment::Type type,
-                                      std::string xml,
-                                      SAS::TrailId trail)
+void CallListStoreProcessor::complete_request(CallListRequest* request)
 {
-  // Create stop watch to time how long between the CallListStoreProcessor
-  // receives the request, and a worker thread finishes processing it.
-
-  // Create a call list entry and populate it
-  CallListRequest* clr = new CallListStoreProcessor::CallListRequest();
-
-  clr->impu = impu;
-  clr->timestamp = timestamp;
-  clr->id = id;
-  clr->type = type;
-  clr->contents = xml;
-  clr->trail = trail;
+  unsigned long latency_us = 0;
+  if (request->stop_watch.read(latency_us))
+  {
+    _load_monitor->request_complete(request->retried_us + latency_us,
+                                    request->trail);
+  }
+
+  release_request(request);
+}
+
+/// Adds a call list request to the queue.
+void CallListStoreProcessor::write_call_list_entry(CallListRequest* clr)
+{
+  // Start the stop watch to time how long between the CallListStoreProcessor
+  // receiving the request, and a worker thread finishing processing it.
   clr->stop_watch.start();
 
-  _thread_pool->add_work(clr);
+  if (_flood_detector != NULL)
+  {
+    clr = _flood_detector->check(clr, current_time_ms());
+  }
+
+  if ((clr != NULL) && (_begin_hold_ms > 0))
+  {
+    clr = hold_or_merge(clr);
+  }
+
+  if (clr != NULL)
+  {
+    _thread_pool->add_work(clr);
+  }
 }
 
-// Write the call list entry to the call list store
-void CallListStoreProcessor::Pool::process_work(
-                                  CallListStoreProcessor::CallListRequest*& clr)
+// Most calls are short, so rather than writing the BEGIN fragment when the
+// call is answered, it is held for a while in case the END fragment comes
+// along. If it does, the two are processed together, which saves a trip
+// through the queue, a trim check and a notification.
+CallListStoreProcessor::CallListRequest* CallListStoreProcessor::hold_or_merge(
+                                                          CallListRequest* clr)
 {
-  // Create the CallFragment
-  CallListStore::CallFragment call_fragment;
-  call_fragment.type = clr->type;
-  call_fragment.id = clr->id;
-  call_fragment.contents = clr->contents;
-  call_fragment.timestamp = clr->timestamp;
+  if (clr->fragment.type == CallListStore::CallFragment::Type::BEGIN)
+  {
+    bool held = false;
 
-  // Create the cassandra timestamp
-  uint64_t cass_timestamp = CallListStore::Store::generate_timestamp();
+    pthread_mutex_lock(&_held_lock);
 
-  unsigned long latency_us;
-  Utils::StopWatch stop_watch;
-  stop_watch.start();
+    if (_held_requests.size() < MAX_HELD_REQUESTS)
+    {
+      HeldRequest& held_request = _held_requests[clr->fragment.id];
 
-  CassandraStore::ResultCode rc = _call_list_store->write_call_fragment_sync(
-                                                    clr->impu,
-                                                    call_fragment,
-                                                    cass_timestamp,
-                                                    _call_list_ttl,
-                                                    clr->trail);
+      if (held_request.request == NULL)
+      {
+        held_request.request = clr;
+        held_request.deadline_ms = current_time_ms() + _begin_hold_ms;
+        _held_order.push_back(clr->fragment.id);
+        held = true;
 
-  if (rc == CassandraStore::OK)
+        if (_held_order.size() == 1)
+        {
+          // The housekeeping thread may be waiting for longer than this
+          // hold, so wake it up.
+          pthread_cond_signal(&_held_cond);
+        }
+      }
+    }
+
+    pthread_mutex_unlock(&_held_lock);
+
+    return held ? NULL : clr;
+  }
+  else if (clr->fragment.type == CallListStore::CallFragment::Type::END)
   {
-    // Record the latency.
-    latency_us = 0;
-    if (stop_watch.read(latency_us))
+    CallListRequest* begin = NULL;
+
+    pthread_mutex_lock(&_held_lock);
+
+    std::unordered_map<std::string, HeldRequest>::iterator it =
+                                      _held_requests.find(clr->fragment.id);
+
+    if ((it != _held_requests.end()) &&
+        (it->second.request->fragment.timestamp == clr->fragment.timestamp) &&
+        (it->second.request->impu == clr->impu))
     {
-      _call_list_store_proc->_stat_cassandra_write_latency.accumulate(latency_us);
+      begin = it->second.request;
+      _held_requests.erase(it);
     }
 
-    // Record that we have successfully written a call record.
-    if (clr->type == CallListStore::CallFragment::Type::END)
+    pthread_mutex_unlock(&_held_lock);
+
+    if (begin != NULL)
     {
-      _call_list_store_proc->_stat_completed_calls_recorded.increment();
+      TRC_DEBUG("Merging END fragment for %s with held BEGIN fragment",
+                clr->fragment.id.c_str());
+      begin->stop_watch.start();
+      begin->next = clr;
+      return begin;
     }
-    else if (clr->type == CallListStore::CallFragment::Type::REJECTED)
+  }
+
+  return clr;
+}
+
+void CallListStoreProcessor::expire_held_requests(uint64_t now_ms)
+{
+  std::vector<CallListRequest*> expired;
+
+  pthread_mutex_lock(&_held_lock);
+
+  while (!_held_order.empty())
+  {
+    std::unordered_map<std::string, HeldRequest>::iterator it =
+                                    _held_requests.find(_held_order.front());
+
+    if (it != _held_requests.end())
     {
-      _call_list_store_proc->_stat_failed_calls_recorded.increment();
+      if (it->second.deadline_ms > now_ms)
+      {
+        // Requests are held in deadline order, so nothing else has expired.
+        break;
+      }
+
+      expired.push_back(it->second.request);
+      _held_requests.erase(it);
+    }
+
+    // Otherwise the request has already been merged with its END.
+    _held_order.pop_front();
+  }
+
+  pthread_mutex_unlock(&_held_lock);
+
+  for (size_t ii = 0; ii < expired.size(); ii++)
+  {
+    queue_held_request(expired[ii]);
+  }
+}
+
+void CallListStoreProcessor::queue_held_request(CallListRequest* clr)
+{
+  // Don't count the hold time against the store's latency.
+  clr->stop_watch.start();
+  _thread_pool->add_work(clr);
+}
+
+void* CallListStoreProcessor::housekeeping_thread_fn(void* processor)
+{
+  ((CallListStoreProcessor*)processor)->housekeeping_thread();
+  return NULL;
+}
+
+void CallListStoreProcessor::housekeeping_thread()
+{
+  uint64_t next_flood_flush_ms = current_time_ms() + FLOOD_FLUSH_INTERVAL_MS;
+
+  pthread_mutex_lock(&_held_lock);
+
+  while (!_housekeeping_terminating)
+  {
+    // Wait until the oldest held request is due, allowing for it having
+    // already been merged (in which case this just wakes up early), or until
+    // it's time to check for the end of flood windows.
+    uint64_t deadline_ms = UINT64_MAX;
+
+    if (!_held_order.empty())
+    {
+      std::unordered_map<std::string, HeldRequest>::iterator it =
+                                    _held_requests.find(_held_order.front());
+      deadline_ms = (it != _held_requests.end()) ?
+                      it->second.deadline_ms : current_time_ms();
+    }
+
+    if ((_flood_detector != NULL) && (next_flood_flush_ms < deadline_ms))
+    {
+      deadline_ms = next_flood_flush_ms;
+    }
+
+    if (deadline_ms == UINT64_MAX)
+    {
+      pthread_cond_wait(&_held_cond, &_held_lock);
+    }
+    else
+    {
+      struct timespec deadline;
+      deadline.tv_sec = deadline_ms / 1000;
+      deadline.tv_nsec = (deadline_ms % 1000) * 1000000;
+      pthread_cond_timedwait(&_held_cond, &_held_lock, &deadline);
+    }
+
+    pthread_mutex_unlock(&_held_lock);
+
+    uint64_t now_ms = current_time_ms();
+    expire_held_requests(now_ms);
+
+    if ((_flood_detector != NULL) && (now_ms >= next_flood_flush_ms))
+    {
+      std::vector<CallListRequest*> summaries;
+      _flood_detector->flush(now_ms, summaries);
+
+      for (size_t ii = 0; ii < summaries.size(); ii++)
+      {
+        queue_held_request(summaries[ii]);
+      }
+
+      next_flood_flush_ms = now_ms + FLOOD_FLUSH_INTERVAL_MS;
+    }
+
+    pthread_mutex_lock(&_held_lock);
+  }
+
+  pthread_mutex_unlock(&_held_lock);
+}
+
+uint64_t CallListStoreProcessor::current_time_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+// Write the call list entry to the call list store. If the request is a
+// BEGIN merged with its END, both fragments are written in one operation,
+// and the trim check, view update and notification are done once for the
+// call. If the write misses its deadline, the whole request is queued to be
+// tried again.
+void CallListStoreProcessor::Pool::process_work(
+                                  CallListStoreProcessor::CallListRequest*& clr)
+{
+  bool timed_out = false;
+  uint64_t cass_timestamp = 0;
+  uint64_t deadline_us = deadline(clr);
+  bool written = write_fragments(clr, cass_timestamp, deadline_us, timed_out);
+
+  // The requests whose fragments were written, to add to the view.
+  std::vector<CallListRequest*> written_requests;
+
+  if ((written) && (_view_store != NULL))
+  {
+    for (CallListRequest* request = clr;
+         request != NULL;
+         request = request->next)
+    {
+      written_requests.push_back(request);
+    }
+  }
+
+  if ((timed_out) && (clr->retries < MAX_WRITE_RETRIES))
+  {
+    TRC_DEBUG("Retrying call list write for IMPU: %s", clr->impu.c_str());
+    clr->retries++;
+    _call_list_store_proc->_stat_cassandra_retries.increment();
+
+    // Queuing the request again restarts its stop watches, so keep the
+    // time spent so far to report to the load monitor at the end.
+    for (CallListRequest* request = clr;
+         request != NULL;
+         request = request->next)
+    {
+      unsigned long latency_us = 0;
+      if (request->stop_watch.read(latency_us))
+      {
+        request->retried_us += latency_us;
+      }
     }
 
-    // Reduce the number of stored calls (if necessary)
+    _call_list_store_proc->queue_held_request(clr);
+    clr = NULL;
+    return;
+  }
+
+  if (written)
+  {
+    // Reduce the number of stored calls (if necessary). If the stored calls
+    // are read for this, keep them to seed the view with, if it needs it.
     std::vector<CallListStore::CallFragment> records_to_delete;
+    std::vector<CallListStore::CallFragment> stored;
+
+    if (is_call_trim_needed(clr->impu,
+                            records_to_delete,
+                            deadline_us,
+                            clr->trail,
+                            (_view_store != NULL) ? &stored : NULL))
+    {
+      perform_call_trim(clr->impu,
+                        records_to_delete,
+                        cass_timestamp,
+                        deadline_us,
+                        clr->trail);
+    }
 
-    if (is_call_trim_needed(clr->impu, records_to_delete, clr->trail))
+    if (_view_store != NULL)
     {
-      perform_call_trim(clr->impu, records_to_delete, cass_timestamp, clr->trail);
+      // The fragments just written are stored, so if the stored calls were
+      // read, there's at least one.
+      update_view(clr->impu,
+                  written_requests,
+                  stored.empty() ? NULL : &stored,
+                  deadline_us,
+                  clr->trail);
     }
 
     // Notify anyone listening for updates
@@ -131,22 +553,367 @@ void CallListStoreProcessor::Pool::process_work(
       _http_notifier->send_notify(clr->impu, clr->trail);
     }
   }
-  else
+
+  while (clr != NULL)
+  {
+    CallListRequest* next = clr->next;
+
+    // Record the latency of the request
+    unsigned long latency_us = 0;
+    if (clr->stop_watch.read(latency_us))
+    {
+      latency_us += clr->retried_us;
+      TRC_DEBUG("Request latency = %luus", latency_us);
+      _load_monitor->request_complete(latency_us, clr->trail);
+    }
+
+    _call_list_store_proc->release_request(clr);
+    clr = next;
+  }
+}
+
+// Bring the IMPU's materialized view up to date with the fragments just
+// written. The view is read, the fragments merged in and the view trimmed,
+// and then the view is replaced only if nobody else has replaced it in the
+// meantime. If someone has, go round again with their view, as long as
+// there's time.
+void CallListStoreProcessor::Pool::update_view(
+              const std::string& impu,
+              const std::vector<CallListStoreProcessor::CallListRequest*>& requests,
+              const std::vector<CallListStore::CallFragment>* stored_fragments,
+              uint64_t deadline_us,
+              SAS::TrailId trail)
+{
+  int64_t now_s = time(NULL);
+  int64_t expiry_s = (_call_list_ttl > 0) ? (now_s + _call_list_ttl) : 0;
+
+  // The view is only there to speed up reads, so don't hold the worker
+  // thread up for long over it, even if the request has no deadline.
+  uint64_t view_deadline_us = DeadlineCallListStore::current_time_us() +
+                              MAX_VIEW_UPDATE_MS * 1000;
+
+  if ((deadline_us != 0) && (deadline_us < view_deadline_us))
+  {
+    view_deadline_us = deadline_us;
+  }
+
+  DeadlineCallListStore::Deadline deadline(view_deadline_us);
+
+  // The view holds the XML whatever the fragment encoding, so render it
+  // once up front.
+  std::vector<std::string> xml(requests.size());
+
+  for (size_t ii = 0; ii < requests.size(); ii++)
+  {
+    CallFragmentCodec::encode(CallFragmentCodec::XML,
+                              requests[ii]->fragment.type,
+                              requests[ii]->entry,
+                              xml[ii]);
+  }
+
+  int attempt;
+
+  for (attempt = 0;
+       (attempt < MAX_VIEW_ATTEMPTS) &&
+       ((attempt == 0) ||
+        (DeadlineCallListStore::current_time_us() < view_deadline_us));
+       attempt++)
+  {
+    std::string stored;
+    int64_t version = 0;
+    CallListView view;
+    CassandraStore::ResultCode rc =
+      _view_store->get_call_list_view_sync(impu, stored, version, trail);
+
+    if (rc == CassandraStore::NOT_FOUND)
+    {
+      version = 0;
+
+      if (!seed_view(impu, view, stored_fragments, expiry_s, trail))
+      {
+        _call_list_store_proc->_stat_view_errors.increment();
+        return;
+      }
+    }
+    else if (rc != CassandraStore::OK)
+    {
+      TRC_ERROR("Reading call list view for IMPU: %s failed with rc %d",
+                impu.c_str(), rc);
+      _call_list_store_proc->_stat_view_errors.increment();
+      return;
+    }
+    else if (!view.decode(stored))
+    {
+      TRC_WARNING("Rebuilding invalid call list view for IMPU: %s",
+                  impu.c_str());
+
+      if (!seed_view(impu, view, stored_fragments, expiry_s, trail))
+      {
+        _call_list_store_proc->_stat_view_errors.increment();
+        return;
+      }
+    }
+
+    for (size_t ii = 0; ii < requests.size(); ii++)
+    {
+      view.add(requests[ii]->fragment, xml[ii], expiry_s);
+    }
+
+    view.trim(_max_call_list_length, now_s);
+    view.encode(stored);
+
+    bool applied = false;
+    rc = _view_store->set_call_list_view_sync(impu,
+                                              stored,
+                                              version,
+                                              _call_list_ttl,
+                                              applied,
+                                              trail);
+
+    if (rc != CassandraStore::OK)
+    {
+      TRC_ERROR("Writing call list view for IMPU: %s failed with rc %d",
+                impu.c_str(), rc);
+      _call_list_store_proc->_stat_view_errors.increment();
+      return;
+    }
+
+    if (applied)
+    {
+      _call_list_store_proc->_stat_view_updates.increment();
+      return;
+    }
+
+    TRC_DEBUG("Call list view for IMPU: %s changed since it was read",
+              impu.c_str());
+    _call_list_store_proc->_stat_view_conflicts.increment();
+  }
+
+  TRC_WARNING("Giving up on call list view for IMPU: %s after %d attempts",
+              impu.c_str(), attempt);
+  _call_list_store_proc->_stat_view_errors.increment();
+}
+
+// The stored fragments don't say when they expire, so they're given the
+// expiry of the fragments being added. They can only outlive their stored
+// fragments by a little, since the view is trimmed to the same length. The
+// caller has set the deadline for the read.
+bool CallListStoreProcessor::Pool::seed_view(
+                     const std::string& impu,
+                     CallListView& view,
+                     const std::vector<CallListStore::CallFragment>* stored,
+                     int64_t expiry_s,
+                     SAS::TrailId trail)
+{
+  std::vector<CallListStore::CallFragment> fragments;
+
+  view.calls.clear();
+
+  if (stored == NULL)
+  {
+    CassandraStore::ResultCode rc =
+      _call_list_store->get_call_fragments_sync(impu, fragments, trail);
+
+    if (rc == CassandraStore::NOT_FOUND)
+    {
+      return true;
+    }
+
+    if (rc != CassandraStore::OK)
+    {
+      TRC_ERROR("Reading call list to seed view for IMPU: %s failed with rc %d",
+                impu.c_str(), rc);
+      return false;
+    }
+
+    stored = &fragments;
+  }
+
+  std::string decompressed;
+  std::string xml;
+
+  for (std::vector<CallListStore::CallFragment>::const_iterator fragment =
+         stored->begin();
+       fragment != stored->end();
+       ++fragment)
+  {
+    if (((_compressor != NULL) &&
+         (!_compressor->decompress(fragment->contents, decompressed))) ||
+        (!CallFragmentCodec::to_xml((_compressor != NULL) ? decompressed :
+                                                            fragment->contents,
+                                    xml)))
+    {
+      TRC_DEBUG("Skipping invalid call fragment for IMPU: %s", impu.c_str());
+      continue;
+    }
+
+    view.add(*fragment, xml, expiry_s);
+  }
+
+  return true;
+}
+
+uint64_t CallListStoreProcessor::Pool::deadline(
+                                  CallListStoreProcessor::CallListRequest* clr)
+{
+  unsigned long queued_us = 0;
+
+  if ((_target_latency_us <= 0) || (!clr->stop_watch.read(queued_us)))
+  {
+    return 0;
+  }
+
+  // The request has the rest of its target latency. If that's already
+  // used up, the deadline is now, so the operations fail straight away.
+  uint64_t now_us = DeadlineCallListStore::current_time_us();
+
+  if (queued_us >= (unsigned long)_target_latency_us)
+  {
+    return now_us;
+  }
+
+  return now_us + _target_latency_us - queued_us;
+}
+
+bool CallListStoreProcessor::Pool::record_failure(uint64_t deadline_us)
+{
+  if ((deadline_us != 0) &&
+      (DeadlineCallListStore::current_time_us() >= deadline_us))
+  {
+    _call_list_store_proc->_stat_cassandra_timeouts.increment();
+    return true;
+  }
+
+  _call_list_store_proc->_stat_cassandra_errors.increment();
+  return false;
+}
+
+bool CallListStoreProcessor::Pool::write_fragments(
+                                  CallListStoreProcessor::CallListRequest* clr,
+                                  uint64_t& cass_timestamp,
+                                  uint64_t deadline_us,
+                                  bool& timed_out)
+{
+  // Fill in the contents of each CallFragment, encoding them from the
+  // entry.
+  for (CallListRequest* request = clr; request != NULL; request = request->next)
+  {
+    CallListStore::CallFragment& call_fragment = request->fragment;
+    CallFragmentCodec::encode(_fragment_encoding,
+                              call_fragment.type,
+                              request->entry,
+                              call_fragment.contents);
+
+    if (_compressor != NULL)
+    {
+      _compressor->compress(call_fragment.contents);
+    }
+  }
+
+  // Create the cassandra timestamp
+  cass_timestamp = CallListStore::Store::generate_timestamp();
+
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
+
+  CassandraStore::ResultCode rc;
+
+  {
+    DeadlineCallListStore::Deadline deadline(deadline_us);
+
+    if (clr->next == NULL)
+    {
+      // A single fragment is written straight from the request, so none of
+      // its strings are copied.
+      rc = _call_list_store->write_call_fragment_sync(clr->impu,
+                                                      clr->fragment,
+                                                      cass_timestamp,
+                                                      _call_list_ttl,
+                                                      clr->trail);
+    }
+    else
+    {
+      // Merged fragments are written in one operation, which is a single
+      // CQL batch or local log append, or a write per fragment on stores
+      // that can't batch them. The fragments are swapped out of the
+      // requests into a vector kept for this thread, and back again
+      // afterwards (the requests may be retried, and the view is updated
+      // from them), so none of their strings are copied.
+      static thread_local std::vector<CallListStore::CallFragment> fragments;
+      fragments.clear();
+
+      for (CallListRequest* request = clr;
+           request != NULL;
+           request = request->next)
+      {
+        fragments.push_back(CallListStore::CallFragment());
+        std::swap(fragments.back(), request->fragment);
+      }
+
+      rc = BatchCallListStore::write_call_fragments(_call_list_store,
+                                                    clr->impu,
+                                                    fragments,
+                                                    cass_timestamp,
+                                                    _call_list_ttl,
+                                                    clr->trail);
+
+      size_t ii = 0;
+
+      for (CallListRequest* request = clr;
+           request != NULL;
+           request = request->next, ii++)
+      {
+        std::swap(fragments[ii], request->fragment);
+      }
+
+      fragments.clear();
+    }
+  }
+
+  if (rc != CassandraStore::OK)
   {
-    // The write failed - log this and don't retry
-    TRC_ERROR("Writing call list entry for IMPU: %s failed with rc %d",
-                                                clr->impu.c_str(), rc);
+    // The write failed - log this. If it ran out of time, the caller
+    // decides whether to retry.
+    if (record_failure(deadline_us))
+    {
+      TRC_WARNING("Writing call list entry for IMPU: %s timed out",
+                  clr->impu.c_str());
+      timed_out = true;
+    }
+    else
+    {
+      TRC_ERROR("Writing call list entry for IMPU: %s failed with rc %d",
+                                                  clr->impu.c_str(), rc);
+    }
+
+    return false;
   }
 
-  // Record the latency of the request
-  latency_us = 0;
-  if (clr->stop_watch.read(latency_us))
+  // Record the latency.
+  unsigned long latency_us = 0;
+  if (stop_watch.read(latency_us))
   {
-    TRC_DEBUG("Request latency = %ldus", latency_us);
-    _load_monitor->request_complete(latency_us, clr->trail);
+    _call_list_store_proc->_stat_cassandra_write_latency.accumulate(latency_us);
   }
 
-  delete clr; clr = NULL;
+  _call_list_store_proc->_hot_impus.record_write(clr->impu,
+                                                 current_time_ms());
+
+  // Record that we have successfully written call records.
+  for (CallListRequest* request = clr; request != NULL; request = request->next)
+  {
+    if (request->fragment.type == CallListStore::CallFragment::Type::END)
+    {
+      _call_list_store_proc->_stat_completed_calls_recorded.increment();
+    }
+    else if (request->fragment.type ==
+                                   CallListStore::CallFragment::Type::REJECTED)
+    {
+      _call_list_store_proc->_stat_failed_calls_recorded.increment();
+    }
+  }
+
+  return true;
 }
 
 // If the number of stored calls is greater than 110% of the max_call_list_length
@@ -154,12 +921,18 @@ void CallListStoreProcessor::Pool::process_work(
 // Checking the number of stored calls is done on average every
 // 1 (max_call_list_length / 10) calls.
 void CallListStoreProcessor::Pool::perform_call_trim(
-                    std::string impu,
+                    const std::string& impu,
                     std::vector<CallListStore::CallFragment>& records_to_delete,
                     uint64_t cass_timestamp,
+                    uint64_t deadline_us,
                     SAS::TrailId trail)
 {
+  _call_list_store_proc->_hot_impus.record_trim(impu,
+                                                records_to_delete.size(),
+                                                current_time_ms());
+
   // Delete the old records
+  DeadlineCallListStore::Deadline deadline(deadline_us);
   CassandraStore::ResultCode rc =
           _call_list_store->delete_old_call_fragments_sync(impu,
                                                            records_to_delete,
@@ -167,7 +940,9 @@ void CallListStoreProcessor::Pool::perform_call_trim(
                                                            trail);
   if (rc != CassandraStore::OK)
   {
-    // The delete failed - log this and don't retry
+    // The delete failed - log this and don't retry. A later write will
+    // trigger another trim.
+    record_failure(deadline_us);
     TRC_ERROR("Deleting call list entries for IMPU: %s failed with rc %d",
                                                           impu.c_str(), rc);
   }
@@ -179,9 +954,11 @@ void CallListStoreProcessor::Pool::perform_call_trim(
 /// is too high, returns a timestamp to delete before to reduce the call
 /// list length.
 bool CallListStoreProcessor::Pool::is_call_trim_needed(
-                    std::string impu,
+                    const std::string& impu,
                     std::vector<CallListStore::CallFragment>& records_to_delete,
-                    SAS::TrailId trail)
+                    uint64_t deadline_us,
+                    SAS::TrailId trail,
+                    std::vector<CallListStore::CallFragment>* stored)
 {
   if (_max_call_list_length == 0)
   {
@@ -204,15 +981,38 @@ bool CallListStoreProcessor::Pool::is_call_trim_needed(
     return false; // LCOV_EXCL_LINE
   }
 
+  // Only one node trims each IMPU, so that nodes writing calls for the same
+  // subscriber don't all read and trim the same call list. The owner only
+  // checks the list when it writes to it, though, and may not know about
+  // every write, so now and again check a list owned by another node too,
+  // and trim it if it's got far too long.
+  double trim_threshold = _max_call_list_length * 1.1;
+
+  if ((_trim_ownership != NULL) && (!_trim_ownership->owns(impu)))
+  {
+    if ((rand() % NON_OWNER_CHECK_RATIO) != 0)
+    {
+      TRC_DEBUG("Call list for IMPU: %s is trimmed by another node",
+                impu.c_str());
+      _call_list_store_proc->_stat_trims_not_owned.increment();
+      return false;
+    }
+
+    trim_threshold = _max_call_list_length * NON_OWNER_TRIM_FACTOR;
+  }
+
   bool call_trim_needed = false;
 
   Utils::StopWatch stop_watch;
   stop_watch.start();
 
   std::vector<CallListStore::CallFragment> records;
-  CassandraStore::ResultCode rc = _call_list_store->get_call_fragments_sync(impu,
-                                                                            records,
-                                                                            trail);
+  CassandraStore::ResultCode rc;
+
+  {
+    DeadlineCallListStore::Deadline deadline(deadline_us);
+    rc = _call_list_store->get_call_fragments_sync(impu, records, trail);
+  }
 
   if (rc == CassandraStore::OK)
   {
@@ -240,8 +1040,9 @@ bool CallListStoreProcessor::Pool::is_call_trim_needed(
 
     // If there are more stored calls than 110% of the maximum then we
     // need to delete some (110% is used so that the deletes can be
-    // batched).
-    if (count > (_max_call_list_length * 1.1))
+    // batched). Lists owned by another node are left to it unless they're
+    // well over.
+    if (count > trim_threshold)
     {
       int num_to_delete = count - _max_call_list_length;
 
@@ -260,10 +1061,20 @@ bool CallListStoreProcessor::Pool::is_call_trim_needed(
 
       call_trim_needed = true;
     }
+
+    if (stored != NULL)
+    {
+      stored->swap(records);
+    }
   }
   else
   {
     // The read failed - log this and don't retry
+    if (rc != CassandraStore::NOT_FOUND)
+    {
+      record_failure(deadline_us);
+    }
+
     TRC_ERROR("Reading call list entries for IMPU: %s failed with rc %d",
                                                               impu.c_str(), rc);
   }
@@ -280,6 +1091,11 @@ CallListStoreProcessor::Pool::Pool(CallListStoreProcessor* call_list_store_proce
                                    ExceptionHandler* exception_handler,
                                    void (*callback)(CallListStoreProcessor::CallListRequest*),
                                    HttpNotifier* http_notifier,
+                                   CallFragmentCodec::Encoding fragment_encoding,
+                                   CallFragmentCompressor* compressor,
+                                   const int target_latency_us,
+                                   CallListViewStore* view_store,
+                                   TrimOwnership* trim_ownership,
                                    unsigned int max_queue) :
   ThreadPool<CallListStoreProcessor::CallListRequest*>(num_threads,
                                                        exception_handler,
@@ -290,7 +1106,17 @@ CallListStoreProcessor::Pool::Pool(CallListStoreProcessor* call_list_store_proce
   _max_call_list_length(max_call_list_length),
   _call_list_ttl(call_list_ttl),
   _call_list_store_proc(call_list_store_processor),
-  _http_notifier(http_notifier)
+  _http_notifier(http_notifier),
+  _fragment_encoding(fragment_encoding),
+  _compressor(compressor),
+  // Only a DeadlineCallListStore can give up on an operation. Without one,
+  // a failure after the deadline isn't a timeout, and retrying it only
+  // adds to the load on a store that's struggling.
+  _target_latency_us(
+    (dynamic_cast<DeadlineCallListStore*>(call_list_store) != NULL) ?
+      target_latency_us : 0),
+  _view_store(view_store),
+  _trim_ownership(trim_ownership)
 {}
 
 
@@ -0,0 +1,215 @@
+/**
+ * @file call_list_view.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+
+#include "call_list_view.h"
+
+static void put_int(std::string& buffer, uint64_t value, int bytes)
+{
+  for (int ii = bytes - 1; ii >= 0; ii--)
+  {
+    buffer.push_back((char)(value >> (ii * 8)));
+  }
+}
+
+static void put_string(std::string& buffer, const std::string& value)
+{
+  put_int(buffer, value.length(), 4);
+  buffer.append(value);
+}
+
+static bool get_int(const std::string& buffer,
+                    size_t& pos,
+                    int bytes,
+                    uint64_t& value)
+{
+  if (buffer.length() - pos < (size_t)bytes)
+  {
+    return false;
+  }
+
+  value = 0;
+
+  for (int ii = 0; ii < bytes; ii++)
+  {
+    value = (value << 8) | (uint8_t)buffer[pos++];
+  }
+
+  return true;
+}
+
+static bool get_string(const std::string& buffer,
+                       size_t& pos,
+                       std::string& value)
+{
+  uint64_t len;
+
+  if ((!get_int(buffer, pos, 4, len)) || (buffer.length() - pos < len))
+  {
+    return false;
+  }
+
+  value = buffer.substr(pos, len);
+  pos += len;
+  return true;
+}
+
+// Orders calls as the call_lists table does: by timestamp, then ID.
+static bool earlier(const CallListView::Call& call,
+                    const std::pair<std::string, std::string>& key)
+{
+  return (call.timestamp < key.first) ||
+         ((call.timestamp == key.first) && (call.id < key.second));
+}
+
+static bool expired(const CallListView::Call& call, int64_t now_s)
+{
+  return ((call.expiry_s != 0) && (call.expiry_s <= now_s));
+}
+
+bool CallListView::decode(const std::string& stored)
+{
+  calls.clear();
+
+  if ((stored.empty()) || (stored[0] != VIEW_VERSION))
+  {
+    return false;
+  }
+
+  size_t pos = 1;
+
+  while (pos < stored.length())
+  {
+    Call call;
+    uint64_t expiry_s;
+
+    if ((!get_string(stored, pos, call.timestamp)) ||
+        (!get_string(stored, pos, call.id)) ||
+        (!get_int(stored, pos, 8, expiry_s)) ||
+        (!get_string(stored, pos, call.start)) ||
+        (!get_string(stored, pos, call.end)))
+    {
+      calls.clear();
+      return false;
+    }
+
+    call.expiry_s = (int64_t)expiry_s;
+    calls.push_back(call);
+  }
+
+  return true;
+}
+
+void CallListView::encode(std::string& stored) const
+{
+  stored.clear();
+  stored.push_back(VIEW_VERSION);
+
+  for (std::vector<Call>::const_iterator call = calls.begin();
+       call != calls.end();
+       ++call)
+  {
+    put_string(stored, call->timestamp);
+    put_string(stored, call->id);
+    put_int(stored, (uint64_t)call->expiry_s, 8);
+    put_string(stored, call->start);
+    put_string(stored, call->end);
+  }
+}
+
+void CallListView::add(const CallListStore::CallFragment& fragment,
+                       const std::string& xml,
+                       int64_t expiry_s)
+{
+  std::pair<std::string, std::string> key(fragment.timestamp, fragment.id);
+  std::vector<Call>::iterator call =
+    std::lower_bound(calls.begin(), calls.end(), key, earlier);
+
+  if ((call == calls.end()) ||
+      (call->timestamp != fragment.timestamp) ||
+      (call->id != fragment.id))
+  {
+    Call new_call;
+    new_call.timestamp = fragment.timestamp;
+    new_call.id = fragment.id;
+    new_call.expiry_s = expiry_s;
+    call = calls.insert(call, new_call);
+  }
+  else if ((call->expiry_s != 0) &&
+           ((expiry_s == 0) || (expiry_s > call->expiry_s)))
+  {
+    // The call lasts as long as its longest lived fragment.
+    call->expiry_s = expiry_s;
+  }
+
+  if (fragment.type == CallListStore::CallFragment::Type::END)
+  {
+    call->end = xml;
+  }
+  else
+  {
+    call->start = xml;
+  }
+}
+
+void CallListView::trim(int max_calls, int64_t now_s)
+{
+  calls.erase(std::remove_if(calls.begin(),
+                             calls.end(),
+                             [now_s](const Call& call)
+                             {
+                               return expired(call, now_s);
+                             }),
+              calls.end());
+
+  if (max_calls <= 0)
+  {
+    return;
+  }
+
+  // Walk back from the newest call to find the oldest one to keep. Any END
+  // fragments older than that go too.
+  int started = 0;
+  size_t first = calls.size();
+
+  while ((first > 0) && (started < max_calls))
+  {
+    first--;
+
+    if (!calls[first].start.empty())
+    {
+      started++;
+    }
+  }
+
+  calls.erase(calls.begin(), calls.begin() + first);
+}
+
+void CallListView::to_xml(int64_t now_s, std::string& xml) const
+{
+  xml.clear();
+
+  for (std::vector<Call>::const_iterator call = calls.begin();
+       call != calls.end();
+       ++call)
+  {
+    if ((call->start.empty()) || (expired(*call, now_s)))
+    {
+      continue;
+    }
+
+    xml.append("<call>");
+    xml.append(call->start);
+    xml.append(call->end);
+    xml.append("</call>");
+  }
+}
@@ -0,0 +1,75 @@
+/**
+ * @file cluster_communication_monitor.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "cluster_communication_monitor.h"
+#include "log.h"
+
+ClusterCommunicationMonitor::ClusterCommunicationMonitor(
+                                           BaseCommunicationMonitor* monitor) :
+  _monitor(monitor),
+  _failing_clusters(0)
+{
+}
+
+ClusterCommunicationMonitor::~ClusterCommunicationMonitor()
+{
+  for (size_t ii = 0; ii < _clusters.size(); ii++)
+  {
+    delete _clusters[ii];
+  }
+
+  delete _monitor;
+}
+
+BaseCommunicationMonitor* ClusterCommunicationMonitor::add_cluster(
+                                                       const std::string& name)
+{
+  Cluster* cluster = new Cluster(this, name);
+  _clusters.push_back(cluster);
+  return cluster;
+}
+
+ClusterCommunicationMonitor::Cluster::Cluster(
+                                   ClusterCommunicationMonitor* parent,
+                                   const std::string& name) :
+  BaseCommunicationMonitor(),
+  _parent(parent),
+  _name(name),
+  _failing(false)
+{
+}
+
+void ClusterCommunicationMonitor::Cluster::inform_success(unsigned long now_ms)
+{
+  if (_failing.exchange(false))
+  {
+    TRC_STATUS("Cassandra cluster %s is reachable again", _name.c_str());
+    _parent->_failing_clusters--;
+  }
+
+  // Only let the monitor see this success if every other cluster is fine
+  // too, or it could clear the alarm while one is still unreachable.
+  if (_parent->_failing_clusters == 0)
+  {
+    _parent->_monitor->inform_success(now_ms);
+  }
+}
+
+void ClusterCommunicationMonitor::Cluster::inform_failure(unsigned long now_ms)
+{
+  if (!_failing.exchange(true))
+  {
+    TRC_ERROR("Failed to reach Cassandra cluster %s", _name.c_str());
+    _parent->_failing_clusters++;
+  }
+
+  _parent->_monitor->inform_failure(now_ms);
+}
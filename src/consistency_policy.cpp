@@ -0,0 +1,131 @@
+/**
+ * @file consistency_policy.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "consistency_policy.h"
+
+ConsistencyPolicy::ConsistencyPolicy(Cql::Consistency normal,
+                                     uint64_t latency_threshold_us,
+                                     int error_threshold_percent) :
+  _normal(normal),
+  _weak(weaken(normal)),
+  _latency_threshold_us(latency_threshold_us),
+  _error_threshold_percent(error_threshold_percent),
+  _degraded(false),
+  _latency_us(0),
+  _error_rate(0),
+  _samples(0)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+ConsistencyPolicy::~ConsistencyPolicy()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+bool ConsistencyPolicy::record(uint64_t latency_us, bool failed)
+{
+  pthread_mutex_lock(&_lock);
+
+  int64_t error_sample = failed ? 10000 : 0;
+  _latency_us += ((int64_t)latency_us - (int64_t)_latency_us) / EWMA_DECAY;
+  _error_rate += (error_sample - (int64_t)_error_rate) / EWMA_DECAY;
+  _samples++;
+
+  bool slow = ((_latency_threshold_us != 0) &&
+               (_latency_us > _latency_threshold_us));
+  bool failing = ((_error_threshold_percent != 0) &&
+                  (_error_rate > (uint64_t)_error_threshold_percent * 100));
+  bool recovered = (((_latency_threshold_us == 0) ||
+                     (_latency_us < _latency_threshold_us / 2)) &&
+                    ((_error_threshold_percent == 0) ||
+                     (_error_rate < (uint64_t)_error_threshold_percent * 50)));
+  bool changed = false;
+
+  if (_samples >= MIN_SAMPLES)
+  {
+    if ((!_degraded.load()) && ((slow) || (failing)))
+    {
+      _degraded.store(true);
+      _samples = 0;
+      changed = true;
+    }
+    else if ((_degraded.load()) && (recovered))
+    {
+      _degraded.store(false);
+      changed = true;
+    }
+  }
+
+  pthread_mutex_unlock(&_lock);
+  return changed;
+}
+
+uint64_t ConsistencyPolicy::latency_us() const
+{
+  pthread_mutex_lock(&_lock);
+  uint64_t latency_us = _latency_us;
+  pthread_mutex_unlock(&_lock);
+  return latency_us;
+}
+
+int ConsistencyPolicy::error_percent() const
+{
+  pthread_mutex_lock(&_lock);
+  int error_percent = _error_rate / 100;
+  pthread_mutex_unlock(&_lock);
+  return error_percent;
+}
+
+Cql::Consistency ConsistencyPolicy::weaken(Cql::Consistency level)
+{
+  return ((level == Cql::LOCAL_QUORUM) || (level == Cql::LOCAL_ONE)) ?
+    Cql::LOCAL_ONE :
+    Cql::ONE;
+}
+
+const char* ConsistencyPolicy::name(Cql::Consistency level)
+{
+  switch (level)
+  {
+  case Cql::ONE:
+    return "one";
+
+  case Cql::QUORUM:
+    return "quorum";
+
+  case Cql::LOCAL_QUORUM:
+    return "local_quorum";
+
+  case Cql::LOCAL_ONE:
+    return "local_one";
+
+  default:
+    return "unknown"; // LCOV_EXCL_LINE
+  }
+}
+
+bool ConsistencyPolicy::parse(const std::string& name, Cql::Consistency& level)
+{
+  static const Cql::Consistency LEVELS[] =
+    {Cql::ONE, Cql::QUORUM, Cql::LOCAL_QUORUM, Cql::LOCAL_ONE};
+
+  for (size_t ii = 0; ii < sizeof(LEVELS) / sizeof(LEVELS[0]); ii++)
+  {
+    if (name == ConsistencyPolicy::name(LEVELS[ii]))
+    {
+      level = LEVELS[ii];
+      return true;
+    }
+  }
+
+  return false;
+}
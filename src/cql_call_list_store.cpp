@@ -0,0 +1,1678 @@
+/**
+ * @file cql_call_list_store.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cql_call_list_store.h"
+#include "utils.h"
+#include "log.h"
+
+static const std::string COLUMN_PREFIX = "call_";
+static const std::string BEGIN_STR = "begin";
+static const std::string END_STR = "end";
+static const std::string REJECTED_STR = "rejected";
+
+const char* const CqlCallListStore::STATEMENTS[NUM_STATEMENTS] =
+{
+  "INSERT INTO memento.call_lists (key, column1, value) VALUES (?, ?, ?) "
+    "USING TTL ?",
+  "SELECT column1, value FROM memento.call_lists WHERE key = ?",
+  "DELETE FROM memento.call_lists WHERE key = ? AND column1 = ?",
+  "SELECT version, view FROM memento.call_list_views WHERE impu = ?",
+  "INSERT INTO memento.call_list_views (impu, version, view) VALUES (?, ?, ?) "
+    "IF NOT EXISTS USING TTL ?",
+  "UPDATE memento.call_list_views USING TTL ? SET version = ?, view = ? "
+    "WHERE impu = ? IF version = ?"
+};
+
+const size_t CqlCallListStore::KEY_VALUES[NUM_STATEMENTS] =
+{
+  0, 0, 0, 0, 0, 3
+};
+
+CqlCallListStore::Statistics::Statistics(LastValueCache* stats_aggregator) :
+  hedges("memento_cql_hedges", stats_aggregator),
+  consistency("memento_cql_consistency", stats_aggregator),
+  connect_latency("memento_cql_connect_latency", stats_aggregator),
+  routes("memento_cql_routes", stats_aggregator),
+  node_latency("memento_cql_node_latency", stats_aggregator)
+{
+}
+
+CqlCallListStore::CqlCallListStore(const std::string& hosts,
+                                   int port,
+                                   int connections,
+                                   int timeout_ms,
+                                   bool token_aware,
+                                   int hedge_percentile,
+                                   int hedge_budget_percent,
+                                   Cql::Consistency write_consistency,
+                                   Cql::Consistency read_consistency,
+                                   uint64_t degrade_latency_us,
+                                   int degrade_error_percent,
+                                   int prewarm_connections,
+                                   BaseCommunicationMonitor* comm_monitor,
+                                   Statistics* stats,
+                                   const std::string& cluster) :
+  CallListStore::Store(),
+  _port(port),
+  _connections(connections),
+  _timeout_ms(timeout_ms),
+  _token_aware(token_aware),
+  _hedge_percentile(hedge_percentile),
+  _hedge_budget_percent(hedge_budget_percent),
+  _prewarm_connections(prewarm_connections),
+  _next_slot(0),
+  _comm_monitor(comm_monitor),
+  _stats(stats),
+  _cluster(cluster),
+  _hedge_eligible(0),
+  _hedges_sent(0),
+  _hedges_won(0),
+  _write_policy(write_consistency, degrade_latency_us, degrade_error_percent),
+  _read_policy(read_consistency, degrade_latency_us, degrade_error_percent),
+  _background_terminating(false),
+  _background_thread_running(false),
+  _next_ring_refresh_ms(0)
+{
+  pthread_mutex_init(&_ring_lock, NULL);
+
+  for (int ii = 0; ii < NUM_STATEMENTS; ii++)
+  {
+    _hedge_latency[ii] = new LatencyWindow(hedge_percentile);
+  }
+
+  std::vector<std::string> host_list;
+  Utils::split_string(hosts, ',', host_list, 0, true);
+
+  // Interleave the hosts, so that consecutive requests go to different
+  // hosts.
+  for (int ii = 0; ii < connections; ii++)
+  {
+    for (std::vector<std::string>::const_iterator host = host_list.begin();
+         host != host_list.end();
+         ++host)
+    {
+      // Key the host's connections by its address, as the token map does,
+      // so that a host configured by name isn't given a second set of
+      // connections once the ring is loaded.
+      std::string address = resolve_host(*host);
+      Slot* slot = new_slot(*host, address);
+      _slots.push_back(slot);
+      _host_slots[address].push_back(slot);
+      _configured_addresses.insert(address);
+    }
+  }
+
+  pthread_mutex_init(&_background_lock, NULL);
+
+  // The background thread waits on the monotonic clock.
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_background_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  // Load the token map, and open the prewarmed connections, now rather than
+  // while the first requests wait.
+  maybe_refresh_ring();
+
+  if (_prewarm_connections > 0)
+  {
+    prewarm();
+  }
+
+  if (pthread_create(&_background_thread, NULL, &background_thread_fn, this) == 0)
+  {
+    _background_thread_running = true;
+  }
+  else
+  {
+    TRC_ERROR("Failed to start CQL background thread"); // LCOV_EXCL_LINE
+  }
+}
+
+CqlCallListStore::~CqlCallListStore()
+{
+  pthread_mutex_lock(&_background_lock);
+  _background_terminating = true;
+  pthread_cond_signal(&_background_cond);
+  pthread_mutex_unlock(&_background_lock);
+
+  if (_background_thread_running)
+  {
+    pthread_join(_background_thread, NULL);
+  }
+
+  pthread_cond_destroy(&_background_cond);
+  pthread_mutex_destroy(&_background_lock);
+
+  std::vector<Slot*> slots = _slots;
+  slots.insert(slots.end(), _discovered_slots.begin(), _discovered_slots.end());
+
+  for (std::vector<std::pair<uint64_t, Slot*>>::const_iterator it =
+         _retired_slots.begin();
+       it != _retired_slots.end();
+       ++it)
+  {
+    slots.push_back(it->second);
+  }
+
+  for (std::vector<Slot*>::iterator it = slots.begin();
+       it != slots.end();
+       ++it)
+  {
+    delete (*it)->connection;
+    pthread_mutex_destroy(&(*it)->lock);
+    delete *it;
+  }
+
+  for (std::map<std::string, NodeLatency*>::iterator it = _nodes.begin();
+       it != _nodes.end();
+       ++it)
+  {
+    delete it->second;
+  }
+
+  for (int ii = 0; ii < NUM_STATEMENTS; ii++)
+  {
+    delete _hedge_latency[ii];
+  }
+
+  pthread_mutex_destroy(&_ring_lock);
+}
+
+std::string CqlCallListStore::resolve_host(const std::string& host)
+{
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* result = NULL;
+  std::string address = host;
+
+  if (getaddrinfo(host.c_str(), NULL, &hints, &result) == 0)
+  {
+    char buf[INET6_ADDRSTRLEN];
+    const void* addr = (result->ai_family == AF_INET6) ?
+      (const void*)&((struct sockaddr_in6*)result->ai_addr)->sin6_addr :
+      (const void*)&((struct sockaddr_in*)result->ai_addr)->sin_addr;
+
+    if (inet_ntop(result->ai_family, addr, buf, sizeof(buf)) != NULL)
+    {
+      address = buf;
+    }
+
+    freeaddrinfo(result);
+  }
+  else
+  {
+    TRC_WARNING("Failed to resolve Cassandra host %s", host.c_str()); // LCOV_EXCL_LINE
+  }
+
+  return address;
+}
+
+CqlCallListStore::Slot* CqlCallListStore::new_slot(const std::string& host,
+                                                   const std::string& address)
+{
+  NodeLatency*& node = _nodes[address];
+
+  if (node == NULL)
+  {
+    node = new NodeLatency();
+  }
+
+  Slot* slot = new Slot();
+  slot->connection = new CqlConnection(host, _port, _timeout_ms);
+  slot->node = node;
+  pthread_mutex_init(&slot->lock, NULL);
+  slot->next_connect_ms = 0;
+  return slot;
+}
+
+std::string CqlCallListStore::column_name(
+                                   const CallListStore::CallFragment& fragment)
+{
+  const std::string* type;
+
+  switch (fragment.type)
+  {
+  case CallListStore::CallFragment::Type::BEGIN:
+    type = &BEGIN_STR;
+    break;
+
+  case CallListStore::CallFragment::Type::END:
+    type = &END_STR;
+    break;
+
+  default:
+    type = &REJECTED_STR;
+    break;
+  }
+
+  return COLUMN_PREFIX + fragment.timestamp + "_" + fragment.id + "_" + *type;
+}
+
+bool CqlCallListStore::parse_column_name(const std::string& name,
+                                         CallListStore::CallFragment& fragment)
+{
+  // The ID may contain underscores, but the timestamp and type can't.
+  size_t ts_start = COLUMN_PREFIX.length();
+  size_t ts_end = name.find('_', ts_start);
+  size_t type_start = name.rfind('_');
+
+  if ((name.compare(0, ts_start, COLUMN_PREFIX) != 0) ||
+      (ts_end == std::string::npos) ||
+      (type_start <= ts_end))
+  {
+    return false;
+  }
+
+  std::string type = name.substr(type_start + 1);
+
+  if (type == BEGIN_STR)
+  {
+    fragment.type = CallListStore::CallFragment::Type::BEGIN;
+  }
+  else if (type == END_STR)
+  {
+    fragment.type = CallListStore::CallFragment::Type::END;
+  }
+  else if (type == REJECTED_STR)
+  {
+    fragment.type = CallListStore::CallFragment::Type::REJECTED;
+  }
+  else
+  {
+    return false;
+  }
+
+  fragment.timestamp = name.substr(ts_start, ts_end - ts_start);
+  fragment.id = name.substr(ts_end + 1, type_start - ts_end - 1);
+  return true;
+}
+
+CassandraStore::ResultCode CqlCallListStore::write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail)
+{
+  return write_call_fragments_sync(impu,
+                                   std::vector<CallListStore::CallFragment>(1, fragment),
+                                   cass_timestamp,
+                                   ttl,
+                                   trail);
+}
+
+CassandraStore::ResultCode CqlCallListStore::write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail)
+{
+  // More than one set of values is sent as a batch.
+  std::vector<std::vector<std::string>> values(fragments.size());
+
+  for (size_t ii = 0; ii < fragments.size(); ii++)
+  {
+    values[ii].push_back(impu);
+    values[ii].push_back(column_name(fragments[ii]));
+    values[ii].push_back(fragments[ii].contents);
+    values[ii].push_back(Cql::int_value(ttl));
+  }
+
+  std::string rsp_body;
+  uint64_t start_us = current_time_us();
+  CassandraStore::ResultCode rc = execute(INSERT,
+                                          values,
+                                          _write_policy.level(),
+                                          cass_timestamp,
+                                          rsp_body);
+  record_consistency(_write_policy, "write", start_us, rc);
+  return rc;
+}
+
+CassandraStore::ResultCode CqlCallListStore::get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail)
+{
+  // As with the Thrift store, if a read at ONE finds nothing, try again at
+  // QUORUM, in case the node we asked has missed the writes. Don't bother
+  // while reads are degraded.
+  Cql::Consistency consistency = _read_policy.level();
+  uint64_t start_us = current_time_us();
+  CassandraStore::ResultCode rc = select(impu, consistency, fragments);
+
+  if ((rc == CassandraStore::NOT_FOUND) &&
+      (!_read_policy.degraded()) &&
+      ((consistency == Cql::ONE) || (consistency == Cql::LOCAL_ONE)))
+  {
+    rc = select(impu,
+                (consistency == Cql::ONE) ? Cql::QUORUM : Cql::LOCAL_QUORUM,
+                fragments);
+  }
+
+  record_consistency(_read_policy, "read", start_us, rc);
+  return rc;
+}
+
+void CqlCallListStore::record_consistency(ConsistencyPolicy& policy,
+                                          const char* kind,
+                                          uint64_t start_us,
+                                          CassandraStore::ResultCode rc)
+{
+  bool failed = ((rc == CassandraStore::CONNECTION_ERROR) ||
+                 (rc == CassandraStore::RESOURCE_ERROR) ||
+                 (rc == CassandraStore::UNKNOWN_ERROR));
+
+  if (!policy.record(current_time_us() - start_us, failed))
+  {
+    return;
+  }
+
+  if (policy.degraded())
+  {
+    TRC_WARNING("Cassandra %ss are struggling (%lu us, %d%% failing) - "
+                "dropping to consistency level %s",
+                kind,
+                (unsigned long)policy.latency_us(),
+                policy.error_percent(),
+                ConsistencyPolicy::name(policy.level()));
+  }
+  else
+  {
+    TRC_STATUS("Cassandra %ss have recovered - back to consistency level %s",
+               kind,
+               ConsistencyPolicy::name(policy.level()));
+  }
+
+  publish_consistency();
+}
+
+void CqlCallListStore::publish_consistency()
+{
+  std::vector<std::string> values;
+  values.push_back(ConsistencyPolicy::name(_write_policy.level()));
+  values.push_back(ConsistencyPolicy::name(_read_policy.level()));
+  _stats->consistency.report_change(_cluster, values);
+}
+
+CassandraStore::ResultCode CqlCallListStore::select(
+                            const std::string& impu,
+                            Cql::Consistency consistency,
+                            std::vector<CallListStore::CallFragment>& fragments)
+{
+  std::vector<std::vector<std::string>> values(1);
+  values[0].push_back(impu);
+
+  std::string rsp_body;
+  CassandraStore::ResultCode rc = execute(SELECT,
+                                          values,
+                                          consistency,
+                                          0,
+                                          rsp_body);
+
+  if (rc != CassandraStore::OK)
+  {
+    return rc;
+  }
+
+  std::vector<std::vector<std::string>> rows;
+
+  if (!Cql::parse_rows(rsp_body, rows))
+  {
+    TRC_WARNING("Invalid CQL rows result for %s", impu.c_str());
+    return CassandraStore::UNKNOWN_ERROR;
+  }
+
+  // Rows come back in column name order, which is timestamp order.
+  fragments.clear();
+
+  for (std::vector<std::vector<std::string>>::const_iterator row = rows.begin();
+       row != rows.end();
+       ++row)
+  {
+    CallListStore::CallFragment fragment;
+
+    if ((row->size() != 2) || (!parse_column_name((*row)[0], fragment)))
+    {
+      TRC_DEBUG("Skipping unrecognised call list column for %s", impu.c_str());
+      continue;
+    }
+
+    fragment.contents = (*row)[1];
+    fragments.push_back(fragment);
+  }
+
+  return fragments.empty() ? CassandraStore::NOT_FOUND : CassandraStore::OK;
+}
+
+CassandraStore::ResultCode CqlCallListStore::get_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  std::string& view,
+                                                  int64_t& version,
+                                                  SAS::TrailId trail)
+{
+  std::vector<std::vector<std::string>> values(1);
+  values[0].push_back(impu);
+
+  std::string rsp_body;
+  CassandraStore::ResultCode rc = execute(SELECT_VIEW,
+                                          values,
+                                          view_consistency(),
+                                          0,
+                                          rsp_body);
+
+  if (rc != CassandraStore::OK)
+  {
+    return rc;
+  }
+
+  std::vector<std::vector<std::string>> rows;
+
+  if (!Cql::parse_rows(rsp_body, rows))
+  {
+    TRC_WARNING("Invalid CQL rows result for %s", impu.c_str());
+    return CassandraStore::UNKNOWN_ERROR;
+  }
+
+  if (rows.empty())
+  {
+    return CassandraStore::NOT_FOUND;
+  }
+
+  if ((rows[0].size() != 2) || (!Cql::parse_long(rows[0][0], version)))
+  {
+    TRC_WARNING("Invalid call list view for %s", impu.c_str());
+    return CassandraStore::UNKNOWN_ERROR;
+  }
+
+  view = rows[0][1];
+  return CassandraStore::OK;
+}
+
+CassandraStore::ResultCode CqlCallListStore::set_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  const std::string& view,
+                                                  int64_t version,
+                                                  int32_t ttl,
+                                                  bool& applied,
+                                                  SAS::TrailId trail)
+{
+  // A new view is only inserted if there still isn't one, and an existing
+  // view is only updated if it's still at the version that was read.
+  std::vector<std::vector<std::string>> values(1);
+  Statement statement;
+
+  if (version == 0)
+  {
+    statement = INSERT_VIEW;
+    values[0].push_back(impu);
+    values[0].push_back(Cql::long_value(1));
+    values[0].push_back(view);
+    values[0].push_back(Cql::int_value(ttl));
+  }
+  else
+  {
+    statement = UPDATE_VIEW;
+    values[0].push_back(Cql::int_value(ttl));
+    values[0].push_back(Cql::long_value(version + 1));
+    values[0].push_back(view);
+    values[0].push_back(impu);
+    values[0].push_back(Cql::long_value(version));
+  }
+
+  std::string rsp_body;
+  CassandraStore::ResultCode rc = execute(statement,
+                                          values,
+                                          view_consistency(),
+                                          0,
+                                          rsp_body);
+
+  if (rc != CassandraStore::OK)
+  {
+    return rc;
+  }
+
+  // The first column of the result says whether the condition held.
+  std::vector<std::vector<std::string>> rows;
+
+  if ((!Cql::parse_rows(rsp_body, rows)) ||
+      (rows.empty()) ||
+      (rows[0].empty()) ||
+      (rows[0][0].length() != 1))
+  {
+    TRC_WARNING("Invalid CQL conditional update result for %s", impu.c_str());
+    return CassandraStore::UNKNOWN_ERROR;
+  }
+
+  applied = (rows[0][0][0] != 0);
+  return CassandraStore::OK;
+}
+
+Cql::Consistency CqlCallListStore::view_consistency() const
+{
+  Cql::Consistency level = _write_policy.level();
+  return ((level == Cql::LOCAL_ONE) || (level == Cql::LOCAL_QUORUM)) ?
+    Cql::LOCAL_QUORUM : Cql::QUORUM;
+}
+
+CassandraStore::ResultCode CqlCallListStore::delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail)
+{
+  CassandraStore::ResultCode result = CassandraStore::OK;
+  std::vector<std::vector<std::string>> values;
+
+  for (size_t ii = 0; ii < fragments.size(); ii++)
+  {
+    std::vector<std::string> row;
+    row.push_back(impu);
+    row.push_back(column_name(fragments[ii]));
+    values.push_back(row);
+
+    if ((values.size() == MAX_BATCH_SIZE) || (ii == fragments.size() - 1))
+    {
+      std::string rsp_body;
+      CassandraStore::ResultCode rc = execute(DELETE,
+                                              values,
+                                              Cql::ONE,
+                                              cass_timestamp,
+                                              rsp_body);
+
+      if (rc != CassandraStore::OK)
+      {
+        result = rc;
+      }
+
+      values.clear();
+    }
+  }
+
+  return result;
+}
+
+bool CqlCallListStore::connect_slot(Slot* slot)
+{
+  if (slot->connection->is_connected())
+  {
+    return true;
+  }
+
+  uint64_t now_ms = current_time_ms();
+
+  if (now_ms < slot->next_connect_ms)
+  {
+    return false;
+  }
+
+  // Statements need preparing again on a new connection.
+  for (int ii = 0; ii < NUM_STATEMENTS; ii++)
+  {
+    slot->prepared[ii].clear();
+  }
+
+  uint64_t start_us = current_time_us();
+
+  if (!slot->connection->connect())
+  {
+    slot->next_connect_ms = now_ms + RECONNECT_INTERVAL_MS;
+    return false;
+  }
+
+  _stats->connect_latency.accumulate(current_time_us() - start_us);
+  return true;
+}
+
+void CqlCallListStore::prewarm()
+{
+  std::vector<Slot*> slots;
+  pthread_mutex_lock(&_ring_lock);
+
+  for (std::map<std::string, std::vector<Slot*>>::const_iterator it = _host_slots.begin();
+       it != _host_slots.end();
+       ++it)
+  {
+    for (size_t ii = 0;
+         (ii < it->second.size()) && (ii < (size_t)_prewarm_connections);
+         ii++)
+    {
+      slots.push_back(it->second[ii]);
+    }
+  }
+
+  pthread_mutex_unlock(&_ring_lock);
+
+  uint64_t now_ms = current_time_ms();
+  std::vector<pthread_t> threads;
+
+  for (std::vector<Slot*>::const_iterator it = slots.begin();
+       it != slots.end();
+       ++it)
+  {
+    Slot* slot = *it;
+
+    // Skip connections that are ready, or have failed too recently to
+    // retry. Connections opened to load the token map still need their
+    // statements preparing.
+    pthread_mutex_lock(&slot->lock);
+    bool due;
+
+    if (slot->connection->is_connected())
+    {
+      due = false;
+
+      for (int ii = 0; ii < NUM_STATEMENTS; ii++)
+      {
+        due = due || slot->prepared[ii].empty();
+      }
+    }
+    else
+    {
+      due = (now_ms >= slot->next_connect_ms);
+    }
+
+    pthread_mutex_unlock(&slot->lock);
+
+    if (!due)
+    {
+      continue;
+    }
+
+    PrewarmTask* task = new PrewarmTask();
+    task->store = this;
+    task->slot = slot;
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, &prewarm_slot_fn, task) == 0)
+    {
+      threads.push_back(thread);
+    }
+    else
+    {
+      prewarm_slot_fn(task); // LCOV_EXCL_LINE
+    }
+  }
+
+  for (size_t ii = 0; ii < threads.size(); ii++)
+  {
+    pthread_join(threads[ii], NULL);
+  }
+
+  if (!threads.empty())
+  {
+    TRC_DEBUG("Prewarmed %d CQL connections", (int)threads.size());
+  }
+}
+
+void* CqlCallListStore::prewarm_slot_fn(void* task)
+{
+  PrewarmTask* prewarm_task = (PrewarmTask*)task;
+  std::string id;
+
+  for (int ii = 0; ii < NUM_STATEMENTS; ii++)
+  {
+    if (!prewarm_task->store->try_slot(prewarm_task->slot, (Statement)ii, id))
+    {
+      break;
+    }
+  }
+
+  delete prewarm_task;
+  return NULL;
+}
+
+void* CqlCallListStore::background_thread_fn(void* store)
+{
+  ((CqlCallListStore*)store)->background_thread();
+  return NULL;
+}
+
+void CqlCallListStore::background_thread()
+{
+  pthread_mutex_lock(&_background_lock);
+
+  while (!_background_terminating)
+  {
+    // Check as often as failed connections become due a retry.
+    uint64_t wake_us = current_time_us() + RECONNECT_INTERVAL_MS * 1000;
+    struct timespec wake;
+    wake.tv_sec = wake_us / 1000000;
+    wake.tv_nsec = (wake_us % 1000000) * 1000;
+    pthread_cond_timedwait(&_background_cond, &_background_lock, &wake);
+
+    if (_background_terminating)
+    {
+      break;
+    }
+
+    pthread_mutex_unlock(&_background_lock);
+
+    // Reload the token map first, so that every node in the ring has
+    // connections to open.
+    maybe_refresh_ring();
+
+    if (_prewarm_connections > 0)
+    {
+      prewarm();
+    }
+
+    pthread_mutex_lock(&_background_lock);
+  }
+
+  pthread_mutex_unlock(&_background_lock);
+}
+
+bool CqlCallListStore::try_slot(Slot* slot,
+                                Statement statement,
+                                std::string& id)
+{
+  pthread_mutex_lock(&slot->lock);
+
+  if (!connect_slot(slot))
+  {
+    pthread_mutex_unlock(&slot->lock);
+    return false;
+  }
+
+  if (slot->prepared[statement].empty())
+  {
+    uint8_t rsp_opcode;
+    std::string rsp_body;
+
+    if ((!slot->connection->send_request(
+                               Cql::OP_PREPARE,
+                               Cql::prepare_body(STATEMENTS[statement]),
+                               rsp_opcode,
+                               rsp_body)) ||
+        (rsp_opcode != Cql::OP_RESULT) ||
+        (!Cql::parse_prepared(rsp_body, slot->prepared[statement])))
+    {
+      TRC_WARNING("Failed to prepare CQL statement on %s",
+                  slot->connection->host().c_str());
+      slot->prepared[statement].clear();
+      pthread_mutex_unlock(&slot->lock);
+      return false;
+    }
+  }
+
+  id = slot->prepared[statement];
+  pthread_mutex_unlock(&slot->lock);
+  return true;
+}
+
+CqlCallListStore::Slot* CqlCallListStore::pick_slot()
+{
+  // Pick the better of two connections at random. This avoids slow nodes
+  // without piling every request onto whichever node is fastest.
+  Slot* first = _slots[rand() % _slots.size()];
+  Slot* second = _slots[rand() % _slots.size()];
+  return (second->node->score() < first->node->score()) ? second : first;
+}
+
+bool CqlCallListStore::get_slot(Statement statement,
+                                const std::string& key,
+                                Slot*& slot,
+                                std::string& id)
+{
+  unsigned int next = _next_slot++;
+  Slot* candidate = pick_slot();
+
+  if (_token_aware)
+  {
+    // Look up the connections to the node that owns the partition.
+    std::string owner;
+    std::vector<Slot*> owner_slots;
+    pthread_mutex_lock(&_ring_lock);
+
+    if (!_ring.empty())
+    {
+      owner = _ring.owner(TokenRing::token(key));
+      std::map<std::string, std::vector<Slot*>>::const_iterator it =
+        _host_slots.find(owner);
+
+      if (it != _host_slots.end())
+      {
+        owner_slots = it->second;
+      }
+    }
+
+    pthread_mutex_unlock(&_ring_lock);
+
+    if (!owner_slots.empty())
+    {
+      slot = owner_slots[next % owner_slots.size()];
+
+      // Skip the owner if it's much slower than another node, as the extra
+      // hop costs less than waiting for it.
+      if ((slot->node->score() <=
+           candidate->node->score() * SLOW_NODE_FACTOR) &&
+          (try_slot(slot, statement, id)))
+      {
+        pthread_mutex_lock(&_ring_lock);
+        record_route(owner, true);
+        pthread_mutex_unlock(&_ring_lock);
+        return true;
+      }
+    }
+  }
+
+  if (try_slot(candidate, statement, id))
+  {
+    slot = candidate;
+    pthread_mutex_lock(&_ring_lock);
+    record_route(slot->connection->host(), false);
+    pthread_mutex_unlock(&_ring_lock);
+    return true;
+  }
+
+  // Fall back to trying each configured connection in turn, starting with
+  // the next one round.
+  for (size_t ii = 0; ii < _slots.size(); ii++)
+  {
+    slot = _slots[(next + ii) % _slots.size()];
+
+    if ((slot != candidate) && (try_slot(slot, statement, id)))
+    {
+      pthread_mutex_lock(&_ring_lock);
+      record_route(slot->connection->host(), false);
+      pthread_mutex_unlock(&_ring_lock);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+CassandraStore::ResultCode CqlCallListStore::execute(
+                        Statement statement,
+                        const std::vector<std::vector<std::string>>& values,
+                        Cql::Consistency consistency,
+                        int64_t timestamp,
+                        std::string& rsp_body)
+{
+  // Allow one retry, in case the statement has been evicted from the
+  // server's prepared statement cache.
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    Slot* slot;
+    std::string id;
+
+    if (!get_slot(statement, values[0][KEY_VALUES[statement]], slot, id))
+    {
+      TRC_ERROR("No usable CQL connection to Cassandra");
+
+      if (_comm_monitor)
+      {
+        _comm_monitor->inform_failure();
+      }
+
+      return CassandraStore::CONNECTION_ERROR;
+    }
+
+    bool batch = (values.size() > 1);
+    uint8_t rsp_opcode;
+    bool sent;
+
+    if ((!batch) && (hedgeable(statement, timestamp)))
+    {
+      sent = send_hedged(statement,
+                         values[0],
+                         consistency,
+                         timestamp,
+                         slot,
+                         id,
+                         rsp_opcode,
+                         rsp_body);
+    }
+    else
+    {
+      std::string body = batch ?
+        Cql::batch_body(id, values, consistency, timestamp) :
+        Cql::execute_body(id, values[0], consistency, timestamp);
+
+      uint64_t start_us = current_time_us();
+      slot->node->request_started();
+      sent = slot->connection->send_request(batch ? Cql::OP_BATCH :
+                                                    Cql::OP_EXECUTE,
+                                            body,
+                                            rsp_opcode,
+                                            rsp_body);
+      record_node_response(slot->node,
+                           sent,
+                           rsp_opcode,
+                           rsp_body,
+                           current_time_us() - start_us,
+                           (uint64_t)_timeout_ms * 1000);
+    }
+
+    if (!sent)
+    {
+      if (_comm_monitor)
+      {
+        _comm_monitor->inform_failure();
+      }
+
+      return CassandraStore::CONNECTION_ERROR;
+    }
+
+    if (_comm_monitor)
+    {
+      _comm_monitor->inform_success();
+    }
+
+    if (rsp_opcode == Cql::OP_RESULT)
+    {
+      return CassandraStore::OK;
+    }
+
+    int32_t code;
+    std::string message;
+    std::string unprepared_id;
+
+    if ((rsp_opcode != Cql::OP_ERROR) ||
+        (!Cql::parse_error(rsp_body, code, message, unprepared_id)))
+    {
+      TRC_WARNING("Unexpected CQL response (opcode %d)", rsp_opcode); // LCOV_EXCL_LINE
+      return CassandraStore::UNKNOWN_ERROR; // LCOV_EXCL_LINE
+    }
+
+    TRC_DEBUG("CQL error %d: %s", code, message.c_str());
+
+    switch (code)
+    {
+    case Cql::ERR_UNPREPARED:
+      pthread_mutex_lock(&slot->lock);
+
+      if (slot->prepared[statement] == id)
+      {
+        slot->prepared[statement].clear();
+      }
+
+      pthread_mutex_unlock(&slot->lock);
+      break;
+
+    case Cql::ERR_UNAVAILABLE:
+    case Cql::ERR_OVERLOADED:
+    case Cql::ERR_IS_BOOTSTRAPPING:
+    case Cql::ERR_WRITE_TIMEOUT:
+    case Cql::ERR_READ_TIMEOUT:
+      return CassandraStore::RESOURCE_ERROR;
+
+    case Cql::ERR_SYNTAX:
+    case Cql::ERR_UNAUTHORIZED:
+    case Cql::ERR_INVALID:
+      TRC_ERROR("Cassandra rejected CQL statement: %s", message.c_str());
+      return CassandraStore::INVALID_REQUEST;
+
+    default:
+      return CassandraStore::UNKNOWN_ERROR;
+    }
+  }
+
+  return CassandraStore::UNKNOWN_ERROR; // LCOV_EXCL_LINE
+}
+
+/// The state shared by the attempts at a hedged request.
+struct CqlCallListStore::Hedge
+{
+  Hedge() : outstanding(0), winner(-1), errored(-1), rsp_opcode(0)
+  {
+    pthread_mutex_init(&lock, NULL);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+  }
+
+  ~Hedge()
+  {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+  }
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /// Attempts sent that haven't completed.
+  int outstanding;
+
+  /// The attempt whose response was taken, or -1 if there isn't one yet.
+  int winner;
+
+  /// The first attempt to get an error response, or -1 if none has. Its
+  /// response is held in case every other attempt fails too.
+  int errored;
+  uint8_t rsp_opcode;
+  std::string rsp_body;
+};
+
+/// Completes one attempt at a hedged request. The first successful response
+/// wins. An error response is only taken if no attempt succeeds.
+class CqlCallListStore::HedgeCallback : public CqlConnection::Callback
+{
+public:
+  HedgeCallback(std::shared_ptr<Hedge> hedge,
+                int attempt,
+                NodeLatency* node,
+                LatencyWindow* latency,
+                uint64_t penalty_us) :
+    _hedge(hedge),
+    _attempt(attempt),
+    _node(node),
+    _latency(latency),
+    _penalty_us(penalty_us),
+    _start_us(current_time_us())
+  {
+  }
+
+  virtual void on_response(bool success,
+                           uint8_t rsp_opcode,
+                           std::string& rsp_body)
+  {
+    uint64_t latency_us = current_time_us() - _start_us;
+    record_node_response(_node,
+                         success,
+                         rsp_opcode,
+                         rsp_body,
+                         latency_us,
+                         _penalty_us);
+
+    // Fast error responses would drag the hedging percentile down.
+    if ((success) && (rsp_opcode == Cql::OP_RESULT))
+    {
+      _latency->record(latency_us);
+    }
+
+    pthread_mutex_lock(&_hedge->lock);
+    _hedge->outstanding--;
+
+    if ((success) &&
+        (_hedge->winner < 0) &&
+        ((rsp_opcode == Cql::OP_RESULT) || (_hedge->errored < 0)))
+    {
+      if (rsp_opcode == Cql::OP_RESULT)
+      {
+        _hedge->winner = _attempt;
+      }
+      else
+      {
+        _hedge->errored = _attempt;
+      }
+
+      _hedge->rsp_opcode = rsp_opcode;
+      _hedge->rsp_body.swap(rsp_body);
+    }
+
+    pthread_cond_signal(&_hedge->cond);
+    pthread_mutex_unlock(&_hedge->lock);
+  }
+
+private:
+  std::shared_ptr<Hedge> _hedge;
+  const int _attempt;
+  NodeLatency* _node;
+  LatencyWindow* _latency;
+  const uint64_t _penalty_us;
+  const uint64_t _start_us;
+};
+
+void CqlCallListStore::record_node_response(NodeLatency* node,
+                                            bool sent,
+                                            uint8_t rsp_opcode,
+                                            const std::string& rsp_body,
+                                            uint64_t latency_us,
+                                            uint64_t penalty_us)
+{
+  if (!sent)
+  {
+    node->request_failed(penalty_us);
+    return;
+  }
+
+  if (rsp_opcode == Cql::OP_RESULT)
+  {
+    node->request_finished(latency_us);
+    return;
+  }
+
+  int32_t code;
+  std::string message;
+  std::string unprepared_id;
+
+  if ((rsp_opcode == Cql::OP_ERROR) &&
+      (Cql::parse_error(rsp_body, code, message, unprepared_id)))
+  {
+    switch (code)
+    {
+    case Cql::ERR_UNAVAILABLE:
+    case Cql::ERR_OVERLOADED:
+    case Cql::ERR_IS_BOOTSTRAPPING:
+    case Cql::ERR_WRITE_TIMEOUT:
+    case Cql::ERR_READ_TIMEOUT:
+      node->request_failed(penalty_us);
+      return;
+
+    default:
+      break;
+    }
+  }
+
+  node->request_discarded();
+}
+
+bool CqlCallListStore::hedgeable(Statement statement, int64_t timestamp) const
+{
+  // Only requests that are safe to repeat are hedged. A write is, as long
+  // as both copies carry the same timestamp.
+  return ((_hedge_percentile > 0) &&
+          ((statement == SELECT) ||
+           (statement == SELECT_VIEW) ||
+           ((statement == INSERT) && (timestamp != 0))));
+}
+
+bool CqlCallListStore::start_attempt(std::shared_ptr<Hedge> hedge,
+                                     int attempt,
+                                     Slot* slot,
+                                     LatencyWindow* latency,
+                                     const std::string& body)
+{
+  pthread_mutex_lock(&hedge->lock);
+  hedge->outstanding++;
+  pthread_mutex_unlock(&hedge->lock);
+
+  slot->node->request_started();
+  HedgeCallback* callback = new HedgeCallback(hedge,
+                                              attempt,
+                                              slot->node,
+                                              latency,
+                                              (uint64_t)_timeout_ms * 1000);
+
+  if (!slot->connection->send_request_async(Cql::OP_EXECUTE, body, callback))
+  {
+    slot->node->request_failed((uint64_t)_timeout_ms * 1000);
+    delete callback;
+
+    pthread_mutex_lock(&hedge->lock);
+    hedge->outstanding--;
+    pthread_mutex_unlock(&hedge->lock);
+    return false;
+  }
+
+  return true;
+}
+
+bool CqlCallListStore::pick_hedge_slot(Statement statement,
+                                       const Slot* primary,
+                                       Slot*& slot,
+                                       std::string& id)
+{
+  size_t start = rand();
+
+  for (size_t ii = 0; ii < _slots.size(); ii++)
+  {
+    slot = _slots[(start + ii) % _slots.size()];
+
+    // Don't wait for a connection to a hedge; if it's not up already, the
+    // primary is likely to win anyway.
+    if ((slot->connection->host() != primary->connection->host()) &&
+        (slot->connection->is_connected()) &&
+        (try_slot(slot, statement, id)))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void CqlCallListStore::wait_for_hedge(Hedge* hedge, uint64_t deadline_us)
+{
+  struct timespec deadline;
+  deadline.tv_sec = deadline_us / 1000000;
+  deadline.tv_nsec = (deadline_us % 1000000) * 1000;
+
+  while ((hedge->winner < 0) && (hedge->outstanding > 0))
+  {
+    if (pthread_cond_timedwait(&hedge->cond, &hedge->lock, &deadline) ==
+                                                                    ETIMEDOUT)
+    {
+      break;
+    }
+  }
+}
+
+bool CqlCallListStore::send_hedged(Statement statement,
+                                   const std::vector<std::string>& values,
+                                   Cql::Consistency consistency,
+                                   int64_t timestamp,
+                                   Slot*& slot,
+                                   std::string& id,
+                                   uint8_t& rsp_opcode,
+                                   std::string& rsp_body)
+{
+  Slot* slots[2] = {slot, NULL};
+  std::string ids[2] = {id, ""};
+  LatencyWindow* latency = _hedge_latency[statement];
+  std::shared_ptr<Hedge> hedge(new Hedge());
+  uint64_t start_us = current_time_us();
+
+  if (!start_attempt(hedge,
+                     0,
+                     slot,
+                     latency,
+                     Cql::execute_body(id, values, consistency, timestamp)))
+  {
+    return false;
+  }
+
+  _hedge_eligible++;
+
+  // Wait for the primary for as long as most requests take. If we don't
+  // have enough samples to know how long that is yet, don't hedge.
+  uint64_t delay_us = latency->percentile_us();
+  pthread_mutex_lock(&hedge->lock);
+
+  if (delay_us > 0)
+  {
+    wait_for_hedge(hedge.get(), start_us + delay_us);
+  }
+
+  bool hedge_due = ((delay_us > 0) &&
+                    (hedge->winner < 0) &&
+                    (hedge->outstanding > 0));
+  pthread_mutex_unlock(&hedge->lock);
+
+  if ((hedge_due) &&
+      ((_hedges_sent + 1) * 100 <= _hedge_eligible * _hedge_budget_percent) &&
+      (pick_hedge_slot(statement, slot, slots[1], ids[1])) &&
+      (start_attempt(hedge,
+                     1,
+                     slots[1],
+                     latency,
+                     Cql::execute_body(ids[1], values, consistency, timestamp))))
+  {
+    TRC_DEBUG("Hedging CQL request to %s with %s",
+              slot->connection->host().c_str(),
+              slots[1]->connection->host().c_str());
+    _hedges_sent++;
+  }
+
+  pthread_mutex_lock(&hedge->lock);
+  wait_for_hedge(hedge.get(), start_us + (uint64_t)_timeout_ms * 1000);
+
+  // No attempt succeeded, so take an error response if there was one
+  // (e.g. the node was overloaded) rather than just fail.
+  int winner = (hedge->winner >= 0) ? hedge->winner : hedge->errored;
+
+  if (winner >= 0)
+  {
+    rsp_opcode = hedge->rsp_opcode;
+    rsp_body.swap(hedge->rsp_body);
+  }
+
+  pthread_mutex_unlock(&hedge->lock);
+
+  if (winner < 0)
+  {
+    TRC_WARNING("CQL request to %s failed or timed out",
+                slot->connection->host().c_str());
+    return false;
+  }
+
+  if (winner == 1)
+  {
+    _hedges_won++;
+  }
+
+  slot = slots[winner];
+  id = ids[winner];
+  return true;
+}
+
+bool CqlCallListStore::query(Slot* slot,
+                             const std::string& query,
+                             std::vector<std::vector<std::string>>& rows)
+{
+  uint8_t rsp_opcode;
+  std::string rsp_body;
+
+  return ((slot->connection->send_request(Cql::OP_QUERY,
+                                          Cql::query_body(query, Cql::ONE),
+                                          rsp_opcode,
+                                          rsp_body)) &&
+          (rsp_opcode == Cql::OP_RESULT) &&
+          (Cql::parse_rows(rsp_body, rows)));
+}
+
+/// Converts an inet value to a string, or returns an empty string for an
+/// unspecified address.
+static std::string inet_to_string(const std::string& value)
+{
+  char buf[INET6_ADDRSTRLEN];
+  const char* addr = NULL;
+
+  if (value.length() == 4)
+  {
+    addr = inet_ntop(AF_INET, value.data(), buf, sizeof(buf));
+  }
+  else if (value.length() == 16)
+  {
+    addr = inet_ntop(AF_INET6, value.data(), buf, sizeof(buf));
+  }
+
+  if ((addr == NULL) ||
+      (std::string(addr) == "0.0.0.0") ||
+      (std::string(addr) == "::"))
+  {
+    return "";
+  }
+
+  return addr;
+}
+
+/// Adds a node's tokens to the token map.
+static bool add_tokens(const std::string& address,
+                       const std::string& tokens_value,
+                       std::vector<std::pair<int64_t, std::string>>& tokens)
+{
+  std::vector<std::string> node_tokens;
+
+  if (!Cql::parse_collection(tokens_value, node_tokens))
+  {
+    return false;
+  }
+
+  for (std::vector<std::string>::const_iterator it = node_tokens.begin();
+       it != node_tokens.end();
+       ++it)
+  {
+    tokens.push_back(std::make_pair(strtoll(it->c_str(), NULL, 10), address));
+  }
+
+  return true;
+}
+
+void CqlCallListStore::maybe_refresh_ring()
+{
+  // Only the background thread (or the constructor, before it starts) gets
+  // here, so requests carry on with the old ring while it's reloaded.
+  uint64_t now_ms = current_time_ms();
+  pthread_mutex_lock(&_ring_lock);
+  bool due = (now_ms >= _next_ring_refresh_ms);
+  pthread_mutex_unlock(&_ring_lock);
+
+  if (!due)
+  {
+    return;
+  }
+
+  bool refreshed = (_token_aware) ? refresh_ring() : true;
+
+  pthread_mutex_lock(&_ring_lock);
+  free_retired_slots(now_ms);
+  _next_ring_refresh_ms = now_ms + (refreshed ? RING_REFRESH_INTERVAL_MS :
+                                                RECONNECT_INTERVAL_MS);
+  publish_routes();
+  pthread_mutex_unlock(&_ring_lock);
+}
+
+bool CqlCallListStore::refresh_ring()
+{
+  for (size_t ii = 0; ii < _slots.size(); ii++)
+  {
+    Slot* slot = _slots[ii];
+    pthread_mutex_lock(&slot->lock);
+    bool connected = connect_slot(slot);
+    pthread_mutex_unlock(&slot->lock);
+
+    std::vector<std::vector<std::string>> local;
+    std::vector<std::vector<std::string>> peers;
+
+    if ((!connected) ||
+        (!query(slot,
+                "SELECT partitioner, rpc_address, tokens FROM system.local",
+                local)) ||
+        (local.size() != 1) ||
+        (local[0].size() != 3) ||
+        (!query(slot,
+                "SELECT peer, rpc_address, tokens FROM system.peers",
+                peers)))
+    {
+      continue;
+    }
+
+    const std::string& partitioner = local[0][0];
+
+    if (partitioner.find("Murmur3Partitioner") == std::string::npos)
+    {
+      // LCOV_EXCL_START
+      TRC_WARNING("Cassandra uses %s, so requests can't be routed by token",
+                  partitioner.c_str());
+      return false;
+      // LCOV_EXCL_STOP
+    }
+
+    std::vector<std::pair<int64_t, std::string>> tokens;
+    std::string local_address = inet_to_string(local[0][1]);
+
+    if (local_address.empty())
+    {
+      local_address = resolve_host(slot->connection->host()); // LCOV_EXCL_LINE
+    }
+
+    bool valid = add_tokens(local_address, local[0][2], tokens);
+
+    for (std::vector<std::vector<std::string>>::const_iterator peer = peers.begin();
+         peer != peers.end();
+         ++peer)
+    {
+      if (peer->size() != 3)
+      {
+        valid = false; // LCOV_EXCL_LINE
+        break; // LCOV_EXCL_LINE
+      }
+
+      std::string address = inet_to_string((*peer)[1]);
+
+      if (address.empty())
+      {
+        address = inet_to_string((*peer)[0]);
+      }
+
+      valid = valid && add_tokens(address, (*peer)[2], tokens);
+    }
+
+    if (!valid)
+    {
+      TRC_WARNING("Invalid token map from %s", slot->connection->host().c_str()); // LCOV_EXCL_LINE
+      continue; // LCOV_EXCL_LINE
+    }
+
+    pthread_mutex_lock(&_ring_lock);
+    _ring.set(tokens);
+
+    // Make sure there are connections to every node. They connect when
+    // they're first used.
+    std::set<std::string> addresses;
+
+    for (std::vector<std::pair<int64_t, std::string>>::const_iterator it = tokens.begin();
+         it != tokens.end();
+         ++it)
+    {
+      addresses.insert(it->second);
+      std::vector<Slot*>& slots = _host_slots[it->second];
+
+      while (slots.size() < (size_t)_connections)
+      {
+        Slot* new_host_slot = new_slot(it->second, it->second);
+        _discovered_slots.push_back(new_host_slot);
+        slots.push_back(new_host_slot);
+      }
+    }
+
+    retire_departed_slots(addresses);
+    pthread_mutex_unlock(&_ring_lock);
+
+    TRC_DEBUG("Loaded token map with %d tokens from %s",
+              (int)tokens.size(), slot->connection->host().c_str());
+    return true;
+  }
+
+  return false;
+}
+
+void CqlCallListStore::retire_departed_slots(
+                                       const std::set<std::string>& addresses)
+{
+  uint64_t now_ms = current_time_ms();
+  std::map<std::string, std::vector<Slot*>>::iterator it = _host_slots.begin();
+
+  while (it != _host_slots.end())
+  {
+    if ((addresses.count(it->first) != 0) ||
+        (_configured_addresses.count(it->first) != 0))
+    {
+      ++it;
+      continue;
+    }
+
+    TRC_DEBUG("Cassandra node %s has left the ring", it->first.c_str());
+
+    for (std::vector<Slot*>::const_iterator slot = it->second.begin();
+         slot != it->second.end();
+         ++slot)
+    {
+      _discovered_slots.erase(std::find(_discovered_slots.begin(),
+                                        _discovered_slots.end(),
+                                        *slot));
+      _retired_slots.push_back(std::make_pair(now_ms, *slot));
+    }
+
+    _host_slots.erase(it++);
+  }
+}
+
+void CqlCallListStore::free_retired_slots(uint64_t now_ms)
+{
+  std::vector<std::pair<uint64_t, Slot*>>::iterator it = _retired_slots.begin();
+
+  while (it != _retired_slots.end())
+  {
+    if (now_ms < it->first + RING_REFRESH_INTERVAL_MS)
+    {
+      ++it;
+      continue;
+    }
+
+    Slot* slot = it->second;
+    it = _retired_slots.erase(it);
+
+    // Stop publishing the node's latency, unless it has rejoined the ring
+    // or has other connections still waiting to be freed.
+    const std::string& address = slot->connection->host();
+    bool in_use = (_host_slots.count(address) != 0);
+
+    for (size_t ii = 0; (!in_use) && (ii < _retired_slots.size()); ii++)
+    {
+      in_use = (_retired_slots[ii].second->node == slot->node);
+    }
+
+    if (!in_use)
+    {
+      _nodes.erase(address);
+      delete slot->node;
+    }
+
+    delete slot->connection;
+    pthread_mutex_destroy(&slot->lock);
+    delete slot;
+  }
+}
+
+void CqlCallListStore::record_route(const std::string& host, bool direct)
+{
+  RouteCounts& counts = _routes[host];
+
+  if (direct)
+  {
+    counts.direct++;
+  }
+  else
+  {
+    counts.fallback++;
+  }
+}
+
+void CqlCallListStore::publish_routes()
+{
+  std::vector<std::string> values;
+  values.reserve(_routes.size() * 3);
+
+  for (std::map<std::string, RouteCounts>::const_iterator it = _routes.begin();
+       it != _routes.end();
+       ++it)
+  {
+    values.push_back(it->first);
+    values.push_back(std::to_string(it->second.direct));
+    values.push_back(std::to_string(it->second.fallback));
+  }
+
+  _stats->routes.report_change(_cluster, values);
+  _routes.clear();
+
+  values.clear();
+  values.reserve(_nodes.size() * 3);
+
+  for (std::map<std::string, NodeLatency*>::const_iterator it = _nodes.begin();
+       it != _nodes.end();
+       ++it)
+  {
+    values.push_back(it->first);
+    values.push_back(std::to_string(it->second->ewma_us()));
+    values.push_back(std::to_string(it->second->in_flight()));
+  }
+
+  _stats->node_latency.report_change(_cluster, values);
+
+  values.clear();
+  values.push_back(std::to_string(_hedge_eligible.exchange(0)));
+  values.push_back(std::to_string(_hedges_sent.exchange(0)));
+  values.push_back(std::to_string(_hedges_won.exchange(0)));
+  _stats->hedges.report_change(_cluster, values);
+
+  publish_consistency();
+}
+
+uint64_t CqlCallListStore::current_time_ms()
+{
+  return current_time_us() / 1000;
+}
+
+uint64_t CqlCallListStore::current_time_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
@@ -0,0 +1,566 @@
+/**
+ * @file cql_connection.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cql_connection.h"
+#include "cql_frame.h"
+#include "log.h"
+
+CqlConnection::CqlConnection(const std::string& host,
+                             int port,
+                             int timeout_ms) :
+  _host(host),
+  _port(port),
+  _timeout_ms(timeout_ms),
+  _fd(-1),
+  _connected(false),
+  _reader_running(false),
+  _pending(MAX_STREAMS, NULL)
+{
+  pthread_mutex_init(&_lock, NULL);
+  pthread_mutex_init(&_write_lock, NULL);
+
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  // Hand out low stream IDs first.
+  for (int stream = MAX_STREAMS - 1; stream >= 0; stream--)
+  {
+    _free_streams.push_back(stream);
+  }
+}
+
+CqlConnection::~CqlConnection()
+{
+  close_socket();
+
+  for (std::vector<PendingRequest*>::iterator it = _pending.begin();
+       it != _pending.end();
+       ++it)
+  {
+    delete *it; *it = NULL;
+  }
+
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_write_lock);
+  pthread_mutex_destroy(&_lock);
+}
+
+bool CqlConnection::connect()
+{
+  if (is_connected())
+  {
+    return true;
+  }
+
+  // Tidy up after any previous connection.
+  close_socket();
+
+  int fd = open_socket();
+
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  if (!startup(fd))
+  {
+    close(fd);
+    return false;
+  }
+
+  pthread_mutex_lock(&_lock);
+  _fd = fd;
+  _connected = true;
+  _reader_running = true;
+  pthread_create(&_reader, NULL, reader_thread_fn, this);
+  pthread_mutex_unlock(&_lock);
+
+  TRC_STATUS("Connected to %s:%d over CQL", _host.c_str(), _port);
+  return true;
+}
+
+void CqlConnection::disconnect()
+{
+  close_socket();
+}
+
+bool CqlConnection::is_connected()
+{
+  pthread_mutex_lock(&_lock);
+  bool connected = _connected;
+  pthread_mutex_unlock(&_lock);
+  return connected;
+}
+
+int CqlConnection::open_socket()
+{
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addrs = NULL;
+  std::string port = std::to_string(_port);
+
+  int rc = getaddrinfo(_host.c_str(), port.c_str(), &hints, &addrs);
+
+  if (rc != 0)
+  {
+    TRC_WARNING("Failed to resolve %s: %s", _host.c_str(), gai_strerror(rc));
+    return -1;
+  }
+
+  int fd = -1;
+
+  for (struct addrinfo* addr = addrs; addr != NULL; addr = addr->ai_next)
+  {
+    fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+
+    if (fd < 0)
+    {
+      continue; // LCOV_EXCL_LINE
+    }
+
+    // Connect without blocking, so that we can time the connection out.
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    rc = ::connect(fd, addr->ai_addr, addr->ai_addrlen);
+
+    if ((rc < 0) && (errno == EINPROGRESS))
+    {
+      struct pollfd pfd = {fd, POLLOUT, 0};
+      int error = ETIMEDOUT;
+      socklen_t error_len = sizeof(error);
+
+      if (poll(&pfd, 1, _timeout_ms) == 1)
+      {
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+      }
+
+      rc = (error == 0) ? 0 : -1;
+    }
+
+    if (rc == 0)
+    {
+      fcntl(fd, F_SETFL, flags);
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      struct timeval timeout = {_timeout_ms / 1000,
+                                (_timeout_ms % 1000) * 1000};
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      break;
+    }
+
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(addrs);
+
+  if (fd < 0)
+  {
+    TRC_WARNING("Failed to connect to %s:%d", _host.c_str(), _port);
+  }
+
+  return fd;
+}
+
+bool CqlConnection::startup(int fd)
+{
+  // Time out the handshake. Once the reader thread is running it waits for
+  // as long as the connection is idle.
+  struct timeval timeout = {_timeout_ms / 1000, (_timeout_ms % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::string frame = Cql::request(Cql::OP_STARTUP, 0, Cql::startup_body());
+  char header_buf[Cql::HEADER_LEN];
+  Cql::Header header;
+
+  if ((!write_fully(fd, frame.data(), frame.length())) ||
+      (!read_fully(fd, header_buf, Cql::HEADER_LEN)) ||
+      (!Cql::decode_header((uint8_t*)header_buf, header)))
+  {
+    TRC_WARNING("CQL handshake with %s:%d failed", _host.c_str(), _port);
+    return false;
+  }
+
+  std::string body(header.length, '\0');
+
+  if ((header.length > 0) && (!read_fully(fd, &body[0], header.length)))
+  {
+    TRC_WARNING("CQL handshake with %s:%d failed", _host.c_str(), _port); // LCOV_EXCL_LINE
+    return false; // LCOV_EXCL_LINE
+  }
+
+  if (header.opcode != Cql::OP_READY)
+  {
+    // LCOV_EXCL_START
+    if (header.opcode == Cql::OP_AUTHENTICATE)
+    {
+      TRC_ERROR("%s:%d requires authentication, which isn't supported",
+                _host.c_str(), _port);
+    }
+    else
+    {
+      TRC_WARNING("%s:%d rejected the CQL handshake", _host.c_str(), _port);
+    }
+
+    return false;
+    // LCOV_EXCL_STOP
+  }
+
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return true;
+}
+
+void CqlConnection::close_socket()
+{
+  pthread_mutex_lock(&_lock);
+  _connected = false;
+
+  if (_fd >= 0)
+  {
+    // Wakes up the reader thread.
+    shutdown(_fd, SHUT_RDWR);
+  }
+
+  bool reader_running = _reader_running;
+  _reader_running = false;
+  pthread_mutex_unlock(&_lock);
+
+  if (reader_running)
+  {
+    pthread_join(_reader, NULL);
+  }
+
+  // Take the write lock, so that no-one is writing to the socket when we
+  // close it.
+  pthread_mutex_lock(&_write_lock);
+  pthread_mutex_lock(&_lock);
+
+  if (_fd >= 0)
+  {
+    close(_fd);
+    _fd = -1;
+  }
+
+  pthread_mutex_unlock(&_lock);
+  pthread_mutex_unlock(&_write_lock);
+}
+
+int16_t CqlConnection::add_pending(PendingRequest* pending, int& fd)
+{
+  pthread_mutex_lock(&_lock);
+
+  if ((!_connected) || (_free_streams.empty()))
+  {
+    pthread_mutex_unlock(&_lock);
+    return -1;
+  }
+
+  int16_t stream = _free_streams.back();
+  _free_streams.pop_back();
+  _pending[stream] = pending;
+  fd = _fd;
+  pthread_mutex_unlock(&_lock);
+
+  return stream;
+}
+
+bool CqlConnection::write_request(int fd,
+                                  int16_t stream,
+                                  const std::string& frame)
+{
+  pthread_mutex_lock(&_write_lock);
+
+  // Check the connection hasn't been replaced since we picked the stream.
+  pthread_mutex_lock(&_lock);
+  PendingRequest* pending = _pending[stream];
+  bool current = ((_connected) &&
+                  (_fd == fd) &&
+                  (pending != NULL) &&
+                  (!pending->failed));
+
+  if (!current)
+  {
+    if ((pending != NULL) && (!pending->failed))
+    {
+      complete_request(stream, false);
+    }
+
+    pthread_mutex_unlock(&_lock);
+    pthread_mutex_unlock(&_write_lock);
+    return false;
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  bool written = write_fully(fd, frame.data(), frame.length());
+
+  if (!written)
+  {
+    // Shut the socket down. The reader thread then fails every request in
+    // flight, including this one.
+    TRC_WARNING("Failed to send CQL request to %s:%d", _host.c_str(), _port);
+    shutdown(fd, SHUT_RDWR);
+  }
+
+  pthread_mutex_unlock(&_write_lock);
+  return written;
+}
+
+bool CqlConnection::send_request(uint8_t opcode,
+                                 const std::string& body,
+                                 uint8_t& rsp_opcode,
+                                 std::string& rsp_body)
+{
+  PendingRequest* pending = new PendingRequest();
+  pending->done = false;
+  pending->failed = false;
+  pending->abandoned = false;
+  pending->opcode = 0;
+  pending->callback = NULL;
+  int fd;
+  int16_t stream = add_pending(pending, fd);
+
+  if (stream < 0)
+  {
+    delete pending;
+    return false;
+  }
+
+  write_request(fd, stream, Cql::request((Cql::Opcode)opcode, stream, body));
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += _timeout_ms / 1000;
+  deadline.tv_nsec += (_timeout_ms % 1000) * 1000000;
+
+  if (deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&_lock);
+
+  while ((!pending->done) && (!pending->failed))
+  {
+    if (pthread_cond_timedwait(&_cond, &_lock, &deadline) == ETIMEDOUT)
+    {
+      break;
+    }
+  }
+
+  bool success = pending->done;
+
+  if ((pending->done) || (pending->failed))
+  {
+    rsp_opcode = pending->opcode;
+    rsp_body.swap(pending->body);
+    delete pending;
+    _pending[stream] = NULL;
+    _free_streams.push_back(stream);
+  }
+  else
+  {
+    // Leave the stream for the reader thread to free when the response
+    // turns up.
+    TRC_WARNING("CQL request to %s:%d timed out", _host.c_str(), _port);
+    pending->abandoned = true;
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  return success;
+}
+
+bool CqlConnection::send_request_async(uint8_t opcode,
+                                       const std::string& body,
+                                       Callback* callback)
+{
+  PendingRequest* pending = new PendingRequest();
+  pending->done = false;
+  pending->failed = false;
+  pending->abandoned = false;
+  pending->opcode = 0;
+  pending->callback = callback;
+  int fd;
+  int16_t stream = add_pending(pending, fd);
+
+  if (stream < 0)
+  {
+    delete pending;
+    return false;
+  }
+
+  // If this fails, the callback has been (or is about to be) called with the
+  // failure, so the request still counts as sent.
+  write_request(fd, stream, Cql::request((Cql::Opcode)opcode, stream, body));
+  return true;
+}
+
+void CqlConnection::complete_request(int16_t stream, bool success)
+{
+  PendingRequest* pending = _pending[stream];
+
+  if ((pending->abandoned) || (pending->callback != NULL))
+  {
+    if (pending->callback != NULL)
+    {
+      pending->callback->on_response(success, pending->opcode, pending->body);
+      delete pending->callback;
+    }
+
+    delete pending;
+    _pending[stream] = NULL;
+    _free_streams.push_back(stream);
+  }
+  else
+  {
+    pending->done = success;
+    pending->failed = !success;
+    pthread_cond_broadcast(&_cond);
+  }
+}
+
+void* CqlConnection::reader_thread_fn(void* connection)
+{
+  ((CqlConnection*)connection)->reader_thread();
+  return NULL;
+}
+
+void CqlConnection::reader_thread()
+{
+  pthread_mutex_lock(&_lock);
+  int fd = _fd;
+  pthread_mutex_unlock(&_lock);
+
+  while (true)
+  {
+    char header_buf[Cql::HEADER_LEN];
+    Cql::Header header;
+
+    if ((!read_fully(fd, header_buf, Cql::HEADER_LEN)) ||
+        (!Cql::decode_header((uint8_t*)header_buf, header)))
+    {
+      break;
+    }
+
+    std::string body(header.length, '\0');
+
+    if ((header.length > 0) && (!read_fully(fd, &body[0], header.length)))
+    {
+      break; // LCOV_EXCL_LINE
+    }
+
+    if ((header.stream < 0) || (header.stream >= MAX_STREAMS))
+    {
+      // Server-initiated events, which we don't register for.
+      continue; // LCOV_EXCL_LINE
+    }
+
+    pthread_mutex_lock(&_lock);
+    PendingRequest* pending = _pending[header.stream];
+
+    if ((pending != NULL) && (!pending->done) && (!pending->failed))
+    {
+      pending->opcode = header.opcode;
+      pending->body.swap(body);
+      complete_request(header.stream, true);
+    }
+
+    pthread_mutex_unlock(&_lock);
+  }
+
+  pthread_mutex_lock(&_lock);
+
+  if (_connected)
+  {
+    TRC_WARNING("Lost CQL connection to %s:%d", _host.c_str(), _port);
+    _connected = false;
+  }
+
+  fail_pending();
+  pthread_mutex_unlock(&_lock);
+}
+
+void CqlConnection::fail_pending()
+{
+  for (int stream = 0; stream < MAX_STREAMS; stream++)
+  {
+    PendingRequest* pending = _pending[stream];
+
+    if ((pending != NULL) && (!pending->done) && (!pending->failed))
+    {
+      complete_request(stream, false);
+    }
+  }
+}
+
+bool CqlConnection::read_fully(int fd, char* buffer, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t rc = recv(fd, buffer, len, 0);
+
+    if (rc < 0 && errno == EINTR)
+    {
+      continue; // LCOV_EXCL_LINE
+    }
+
+    if (rc <= 0)
+    {
+      return false;
+    }
+
+    buffer += rc;
+    len -= rc;
+  }
+
+  return true;
+}
+
+bool CqlConnection::write_fully(int fd, const char* buffer, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t rc = send(fd, buffer, len, MSG_NOSIGNAL);
+
+    if (rc < 0 && errno == EINTR)
+    {
+      continue; // LCOV_EXCL_LINE
+    }
+
+    if (rc <= 0)
+    {
+      return false;
+    }
+
+    buffer += rc;
+    len -= rc;
+  }
+
+  return true;
+}
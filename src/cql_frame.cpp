@@ -0,0 +1,489 @@
+/**
+ * @file cql_frame.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "cql_frame.h"
+
+namespace Cql
+{
+  // Query parameter flags.
+  static const uint8_t FLAG_VALUES = 0x01;
+  static const uint8_t FLAG_DEFAULT_TIMESTAMP = 0x20;
+
+  // Rows metadata flags.
+  static const int32_t FLAG_GLOBAL_TABLES_SPEC = 0x0001;
+  static const int32_t FLAG_HAS_MORE_PAGES = 0x0002;
+  static const int32_t FLAG_NO_METADATA = 0x0004;
+
+  // Column types with parameters.
+  static const uint16_t TYPE_CUSTOM = 0x0000;
+  static const uint16_t TYPE_LIST = 0x0020;
+  static const uint16_t TYPE_MAP = 0x0021;
+  static const uint16_t TYPE_SET = 0x0022;
+  static const uint16_t TYPE_UDT = 0x0030;
+  static const uint16_t TYPE_TUPLE = 0x0031;
+
+  static const uint8_t BATCH_UNLOGGED = 1;
+  static const uint8_t BATCH_PREPARED = 1;
+
+  void Writer::write_byte(uint8_t value)
+  {
+    _buffer.push_back((char)value);
+  }
+
+  void Writer::write_short(uint16_t value)
+  {
+    write_byte(value >> 8);
+    write_byte(value);
+  }
+
+  void Writer::write_int(int32_t value)
+  {
+    write_short((uint32_t)value >> 16);
+    write_short((uint32_t)value);
+  }
+
+  void Writer::write_long(int64_t value)
+  {
+    write_int((uint64_t)value >> 32);
+    write_int((uint64_t)value);
+  }
+
+  void Writer::write_string(const std::string& value)
+  {
+    write_short(value.length());
+    _buffer.append(value);
+  }
+
+  void Writer::write_long_string(const std::string& value)
+  {
+    write_int(value.length());
+    _buffer.append(value);
+  }
+
+  void Writer::write_bytes(const std::string& value)
+  {
+    write_long_string(value);
+  }
+
+  void Writer::write_short_bytes(const std::string& value)
+  {
+    write_string(value);
+  }
+
+  void Writer::write_string_map(const std::map<std::string, std::string>& value)
+  {
+    write_short(value.size());
+
+    for (std::map<std::string, std::string>::const_iterator it = value.begin();
+         it != value.end();
+         ++it)
+    {
+      write_string(it->first);
+      write_string(it->second);
+    }
+  }
+
+  bool Reader::have(size_t len)
+  {
+    if ((_ok) && (_buffer.length() - _pos < len))
+    {
+      _ok = false;
+    }
+
+    return _ok;
+  }
+
+  uint8_t Reader::read_byte()
+  {
+    return have(1) ? (uint8_t)_buffer[_pos++] : 0;
+  }
+
+  uint16_t Reader::read_short()
+  {
+    uint16_t value = read_byte() << 8;
+    return value | read_byte();
+  }
+
+  int32_t Reader::read_int()
+  {
+    uint32_t value = (uint32_t)read_short() << 16;
+    return value | read_short();
+  }
+
+  int64_t Reader::read_long()
+  {
+    uint64_t value = (uint64_t)(uint32_t)read_int() << 32;
+    return value | (uint32_t)read_int();
+  }
+
+  std::string Reader::read_string()
+  {
+    size_t len = read_short();
+
+    if (!have(len))
+    {
+      return "";
+    }
+
+    std::string value = _buffer.substr(_pos, len);
+    _pos += len;
+    return value;
+  }
+
+  std::string Reader::read_short_bytes()
+  {
+    return read_string();
+  }
+
+  std::string Reader::read_bytes()
+  {
+    int32_t len = read_int();
+
+    if ((len < 0) || (!have(len)))
+    {
+      return "";
+    }
+
+    std::string value = _buffer.substr(_pos, len);
+    _pos += len;
+    return value;
+  }
+
+  void Reader::skip_option()
+  {
+    uint16_t id = read_short();
+
+    switch (id)
+    {
+    case TYPE_CUSTOM:
+      read_string();
+      break;
+
+    case TYPE_LIST:
+    case TYPE_SET:
+      skip_option();
+      break;
+
+    case TYPE_MAP:
+      skip_option();
+      skip_option();
+      break;
+
+    case TYPE_UDT:
+      {
+        read_string();
+        read_string();
+        uint16_t fields = read_short();
+
+        for (uint16_t ii = 0; (ii < fields) && (_ok); ii++)
+        {
+          read_string();
+          skip_option();
+        }
+      }
+      break;
+
+    case TYPE_TUPLE:
+      {
+        uint16_t fields = read_short();
+
+        for (uint16_t ii = 0; (ii < fields) && (_ok); ii++)
+        {
+          skip_option();
+        }
+      }
+      break;
+
+    default:
+      // A native type, with no parameters.
+      break;
+    }
+  }
+
+  void encode_header(const Header& header, uint8_t* buffer)
+  {
+    buffer[0] = header.version;
+    buffer[1] = header.flags;
+    buffer[2] = (uint16_t)header.stream >> 8;
+    buffer[3] = (uint16_t)header.stream;
+    buffer[4] = header.opcode;
+    buffer[5] = header.length >> 24;
+    buffer[6] = header.length >> 16;
+    buffer[7] = header.length >> 8;
+    buffer[8] = header.length;
+  }
+
+  bool decode_header(const uint8_t* buffer, Header& header)
+  {
+    header.version = buffer[0];
+    header.flags = buffer[1];
+    header.stream = (int16_t)(((uint16_t)buffer[2] << 8) | buffer[3]);
+    header.opcode = buffer[4];
+    header.length = ((uint32_t)buffer[5] << 24) |
+                    ((uint32_t)buffer[6] << 16) |
+                    ((uint32_t)buffer[7] << 8) |
+                    (uint32_t)buffer[8];
+
+    return (((header.version & ~RESPONSE_FLAG) == VERSION) &&
+            (header.length <= MAX_BODY_LEN));
+  }
+
+  std::string request(Opcode opcode, int16_t stream, const std::string& body)
+  {
+    Header header;
+    header.version = VERSION;
+    header.flags = 0;
+    header.stream = stream;
+    header.opcode = opcode;
+    header.length = body.length();
+
+    std::string frame(HEADER_LEN, '\0');
+    encode_header(header, (uint8_t*)&frame[0]);
+    frame.append(body);
+    return frame;
+  }
+
+  std::string int_value(int32_t value)
+  {
+    std::string encoded;
+    Writer(encoded).write_int(value);
+    return encoded;
+  }
+
+  std::string long_value(int64_t value)
+  {
+    std::string encoded;
+    Writer(encoded).write_long(value);
+    return encoded;
+  }
+
+  bool parse_long(const std::string& value, int64_t& result)
+  {
+    if (value.length() != 8)
+    {
+      return false;
+    }
+
+    uint64_t decoded = 0;
+
+    for (size_t ii = 0; ii < 8; ii++)
+    {
+      decoded = (decoded << 8) | (uint8_t)value[ii];
+    }
+
+    result = (int64_t)decoded;
+    return true;
+  }
+
+  std::string startup_body()
+  {
+    std::map<std::string, std::string> options;
+    options["CQL_VERSION"] = "3.0.0";
+
+    std::string body;
+    Writer(body).write_string_map(options);
+    return body;
+  }
+
+  std::string query_body(const std::string& query, Consistency consistency)
+  {
+    std::string body;
+    Writer writer(body);
+    writer.write_long_string(query);
+    writer.write_short(consistency);
+    writer.write_byte(0);
+    return body;
+  }
+
+  std::string prepare_body(const std::string& query)
+  {
+    std::string body;
+    Writer(body).write_long_string(query);
+    return body;
+  }
+
+  std::string execute_body(const std::string& id,
+                           const std::vector<std::string>& values,
+                           Consistency consistency,
+                           int64_t timestamp)
+  {
+    std::string body;
+    Writer writer(body);
+    writer.write_short_bytes(id);
+    writer.write_short(consistency);
+    writer.write_byte(FLAG_VALUES |
+                      ((timestamp != 0) ? FLAG_DEFAULT_TIMESTAMP : 0));
+    writer.write_short(values.size());
+
+    for (std::vector<std::string>::const_iterator it = values.begin();
+         it != values.end();
+         ++it)
+    {
+      writer.write_bytes(*it);
+    }
+
+    if (timestamp != 0)
+    {
+      writer.write_long(timestamp);
+    }
+
+    return body;
+  }
+
+  std::string batch_body(const std::string& id,
+                         const std::vector<std::vector<std::string>>& values,
+                         Consistency consistency,
+                         int64_t timestamp)
+  {
+    std::string body;
+    Writer writer(body);
+    writer.write_byte(BATCH_UNLOGGED);
+    writer.write_short(values.size());
+
+    for (std::vector<std::vector<std::string>>::const_iterator it = values.begin();
+         it != values.end();
+         ++it)
+    {
+      writer.write_byte(BATCH_PREPARED);
+      writer.write_short_bytes(id);
+      writer.write_short(it->size());
+
+      for (std::vector<std::string>::const_iterator value = it->begin();
+           value != it->end();
+           ++value)
+      {
+        writer.write_bytes(*value);
+      }
+    }
+
+    writer.write_short(consistency);
+    writer.write_byte((timestamp != 0) ? FLAG_DEFAULT_TIMESTAMP : 0);
+
+    if (timestamp != 0)
+    {
+      writer.write_long(timestamp);
+    }
+
+    return body;
+  }
+
+  bool parse_error(const std::string& body,
+                   int32_t& code,
+                   std::string& message,
+                   std::string& unprepared_id)
+  {
+    Reader reader(body);
+    code = reader.read_int();
+    message = reader.read_string();
+
+    if (code == ERR_UNPREPARED)
+    {
+      unprepared_id = reader.read_short_bytes();
+    }
+
+    return reader.ok();
+  }
+
+  bool parse_result_kind(const std::string& body, int32_t& kind)
+  {
+    Reader reader(body);
+    kind = reader.read_int();
+    return reader.ok();
+  }
+
+  bool parse_prepared(const std::string& body, std::string& id)
+  {
+    Reader reader(body);
+    int32_t kind = reader.read_int();
+    id = reader.read_short_bytes();
+    return ((reader.ok()) && (kind == RESULT_PREPARED));
+  }
+
+  bool parse_rows(const std::string& body,
+                  std::vector<std::vector<std::string>>& rows)
+  {
+    Reader reader(body);
+
+    if (reader.read_int() != RESULT_ROWS)
+    {
+      return false;
+    }
+
+    int32_t flags = reader.read_int();
+    int32_t columns = reader.read_int();
+
+    if (flags & FLAG_HAS_MORE_PAGES)
+    {
+      reader.read_bytes();
+    }
+
+    if (!(flags & FLAG_NO_METADATA))
+    {
+      bool global_spec = (flags & FLAG_GLOBAL_TABLES_SPEC);
+
+      if (global_spec)
+      {
+        reader.read_string();
+        reader.read_string();
+      }
+
+      for (int32_t ii = 0; (ii < columns) && (reader.ok()); ii++)
+      {
+        if (!global_spec)
+        {
+          reader.read_string();
+          reader.read_string();
+        }
+
+        reader.read_string();
+        reader.skip_option();
+      }
+    }
+
+    int32_t row_count = reader.read_int();
+
+    if ((!reader.ok()) || (columns < 0) || (row_count < 0))
+    {
+      return false;
+    }
+
+    rows.clear();
+
+    for (int32_t ii = 0; (ii < row_count) && (reader.ok()); ii++)
+    {
+      std::vector<std::string> row;
+
+      for (int32_t jj = 0; (jj < columns) && (reader.ok()); jj++)
+      {
+        row.push_back(reader.read_bytes());
+      }
+
+      rows.push_back(row);
+    }
+
+    return reader.ok();
+  }
+
+  bool parse_collection(const std::string& value,
+                        std::vector<std::string>& elements)
+  {
+    Reader reader(value);
+    int32_t count = reader.read_int();
+    elements.clear();
+
+    for (int32_t ii = 0; (ii < count) && (reader.ok()); ii++)
+    {
+      elements.push_back(reader.read_bytes());
+    }
+
+    return reader.ok();
+  }
+}
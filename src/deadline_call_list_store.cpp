@@ -0,0 +1,416 @@
+/**
+ * @file deadline_call_list_store.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <errno.h>
+#include <time.h>
+
+#include "deadline_call_list_store.h"
+#include "log.h"
+
+thread_local uint64_t DeadlineCallListStore::Deadline::_current_us = 0;
+
+DeadlineCallListStore::Deadline::Deadline(uint64_t deadline_us) :
+  _previous_us(_current_us)
+{
+  _current_us = deadline_us;
+}
+
+DeadlineCallListStore::Deadline::~Deadline()
+{
+  _current_us = _previous_us;
+}
+
+uint64_t DeadlineCallListStore::Deadline::current()
+{
+  return _current_us;
+}
+
+DeadlineCallListStore::Operation::Operation(Type type, uint64_t deadline_us) :
+  type(type),
+  deadline_us(deadline_us),
+  cass_timestamp(0),
+  ttl(0),
+  trail(0),
+  version(0),
+  applied(false),
+  done(false),
+  rc(CassandraStore::RESOURCE_ERROR)
+{
+}
+
+DeadlineCallListStore::DeadlineCallListStore(CallListStore::Store* store,
+                                             CallListViewStore* view_store,
+                                             int num_threads) :
+  CallListStore::Store(),
+  _store(store),
+  _view_store(view_store),
+  _terminating(false)
+{
+  pthread_mutex_init(&_lock, NULL);
+
+  // Deadlines are on the monotonic clock.
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_queue_cond, &cond_attr);
+  pthread_cond_init(&_done_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  for (int ii = 0; ii < num_threads; ii++)
+  {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, &thread_fn, this) == 0)
+    {
+      _threads.push_back(thread);
+    }
+    else
+    {
+      TRC_ERROR("Failed to start call list store thread"); // LCOV_EXCL_LINE
+    }
+  }
+}
+
+DeadlineCallListStore::~DeadlineCallListStore()
+{
+  pthread_mutex_lock(&_lock);
+  _terminating = true;
+  pthread_cond_broadcast(&_queue_cond);
+  pthread_mutex_unlock(&_lock);
+
+  for (size_t ii = 0; ii < _threads.size(); ii++)
+  {
+    pthread_join(_threads[ii], NULL);
+  }
+
+  pthread_cond_destroy(&_done_cond);
+  pthread_cond_destroy(&_queue_cond);
+  pthread_mutex_destroy(&_lock);
+
+  delete _store; _store = NULL;
+}
+
+CassandraStore::ResultCode DeadlineCallListStore::write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail)
+{
+  uint64_t deadline_us = Deadline::current();
+
+  if (deadline_us == 0)
+  {
+    return _store->write_call_fragment_sync(impu,
+                                            fragment,
+                                            cass_timestamp,
+                                            ttl,
+                                            trail);
+  }
+
+  std::shared_ptr<Operation> op(new Operation(Operation::WRITE, deadline_us));
+  op->impu = impu;
+  op->fragments.push_back(fragment);
+  op->cass_timestamp = cass_timestamp;
+  op->ttl = ttl;
+  op->trail = trail;
+  return run(op);
+}
+
+CassandraStore::ResultCode DeadlineCallListStore::write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail)
+{
+  uint64_t deadline_us = Deadline::current();
+
+  if (deadline_us == 0)
+  {
+    return BatchCallListStore::write_call_fragments(_store,
+                                                    impu,
+                                                    fragments,
+                                                    cass_timestamp,
+                                                    ttl,
+                                                    trail);
+  }
+
+  std::shared_ptr<Operation> op(new Operation(Operation::WRITE, deadline_us));
+  op->impu = impu;
+  op->fragments = fragments;
+  op->cass_timestamp = cass_timestamp;
+  op->ttl = ttl;
+  op->trail = trail;
+  return run(op);
+}
+
+CassandraStore::ResultCode DeadlineCallListStore::get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail)
+{
+  uint64_t deadline_us = Deadline::current();
+
+  if (deadline_us == 0)
+  {
+    return _store->get_call_fragments_sync(impu, fragments, trail);
+  }
+
+  std::shared_ptr<Operation> op(new Operation(Operation::GET, deadline_us));
+  op->impu = impu;
+  op->trail = trail;
+  CassandraStore::ResultCode rc = run(op);
+
+  if (rc == CassandraStore::OK)
+  {
+    // The operation has completed, so its thread has finished with the
+    // fragments.
+    fragments.swap(op->fragments);
+  }
+
+  return rc;
+}
+
+CassandraStore::ResultCode DeadlineCallListStore::delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail)
+{
+  uint64_t deadline_us = Deadline::current();
+
+  if (deadline_us == 0)
+  {
+    return _store->delete_old_call_fragments_sync(impu,
+                                                  fragments,
+                                                  cass_timestamp,
+                                                  trail);
+  }
+
+  std::shared_ptr<Operation> op(new Operation(Operation::DELETE, deadline_us));
+  op->impu = impu;
+  op->fragments = fragments;
+  op->cass_timestamp = cass_timestamp;
+  op->trail = trail;
+  return run(op);
+}
+
+CassandraStore::ResultCode DeadlineCallListStore::get_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  std::string& view,
+                                                  int64_t& version,
+                                                  SAS::TrailId trail)
+{
+  if (_view_store == NULL)
+  {
+    return CassandraStore::INVALID_REQUEST;
+  }
+
+  uint64_t deadline_us = Deadline::current();
+
+  if (deadline_us == 0)
+  {
+    return _view_store->get_call_list_view_sync(impu, view, version, trail);
+  }
+
+  std::shared_ptr<Operation> op(new Operation(Operation::GET_VIEW,
+                                              deadline_us));
+  op->impu = impu;
+  op->trail = trail;
+  CassandraStore::ResultCode rc = run(op);
+
+  if (rc == CassandraStore::OK)
+  {
+    view.swap(op->view);
+    version = op->version;
+  }
+
+  return rc;
+}
+
+CassandraStore::ResultCode DeadlineCallListStore::set_call_list_view_sync(
+                                                  const std::string& impu,
+                                                  const std::string& view,
+                                                  int64_t version,
+                                                  int32_t ttl,
+                                                  bool& applied,
+                                                  SAS::TrailId trail)
+{
+  if (_view_store == NULL)
+  {
+    return CassandraStore::INVALID_REQUEST;
+  }
+
+  uint64_t deadline_us = Deadline::current();
+
+  if (deadline_us == 0)
+  {
+    return _view_store->set_call_list_view_sync(impu,
+                                                view,
+                                                version,
+                                                ttl,
+                                                applied,
+                                                trail);
+  }
+
+  std::shared_ptr<Operation> op(new Operation(Operation::SET_VIEW,
+                                              deadline_us));
+  op->impu = impu;
+  op->view = view;
+  op->version = version;
+  op->ttl = ttl;
+  op->trail = trail;
+  CassandraStore::ResultCode rc = run(op);
+
+  // If the caller gives up on the operation, the view may or may not be
+  // replaced, so it has to assume it wasn't.
+  applied = (rc == CassandraStore::OK) && (op->applied);
+  return rc;
+}
+
+CassandraStore::ResultCode DeadlineCallListStore::run(
+                                                std::shared_ptr<Operation> op)
+{
+  if (current_time_us() >= op->deadline_us)
+  {
+    return CassandraStore::RESOURCE_ERROR;
+  }
+
+  pthread_mutex_lock(&_lock);
+
+  if (_queue.size() >= MAX_QUEUED_OPERATIONS)
+  {
+    pthread_mutex_unlock(&_lock);
+    TRC_WARNING("Too many call list store operations queued");
+    return CassandraStore::RESOURCE_ERROR;
+  }
+
+  _queue.push_back(op);
+  pthread_cond_signal(&_queue_cond);
+
+  struct timespec deadline;
+  deadline.tv_sec = op->deadline_us / 1000000;
+  deadline.tv_nsec = (op->deadline_us % 1000000) * 1000;
+
+  while (!op->done)
+  {
+    if (pthread_cond_timedwait(&_done_cond, &_lock, &deadline) == ETIMEDOUT)
+    {
+      break;
+    }
+  }
+
+  bool done = op->done;
+  CassandraStore::ResultCode rc = (done) ? op->rc :
+                                           CassandraStore::RESOURCE_ERROR;
+  pthread_mutex_unlock(&_lock);
+
+  if (!done)
+  {
+    TRC_DEBUG("Call list store operation for %s missed its deadline",
+              op->impu.c_str());
+  }
+
+  return rc;
+}
+
+void DeadlineCallListStore::execute(Operation* op)
+{
+  switch (op->type)
+  {
+  case Operation::WRITE:
+    op->rc = BatchCallListStore::write_call_fragments(_store,
+                                                      op->impu,
+                                                      op->fragments,
+                                                      op->cass_timestamp,
+                                                      op->ttl,
+                                                      op->trail);
+    break;
+
+  case Operation::GET:
+    op->rc = _store->get_call_fragments_sync(op->impu,
+                                             op->fragments,
+                                             op->trail);
+    break;
+
+  case Operation::DELETE:
+    op->rc = _store->delete_old_call_fragments_sync(op->impu,
+                                                    op->fragments,
+                                                    op->cass_timestamp,
+                                                    op->trail);
+    break;
+
+  case Operation::GET_VIEW:
+    op->rc = _view_store->get_call_list_view_sync(op->impu,
+                                                  op->view,
+                                                  op->version,
+                                                  op->trail);
+    break;
+
+  case Operation::SET_VIEW:
+    op->rc = _view_store->set_call_list_view_sync(op->impu,
+                                                  op->view,
+                                                  op->version,
+                                                  op->ttl,
+                                                  op->applied,
+                                                  op->trail);
+    break;
+  }
+}
+
+void* DeadlineCallListStore::thread_fn(void* store)
+{
+  ((DeadlineCallListStore*)store)->thread();
+  return NULL;
+}
+
+void DeadlineCallListStore::thread()
+{
+  pthread_mutex_lock(&_lock);
+
+  while (true)
+  {
+    while ((_queue.empty()) && (!_terminating))
+    {
+      pthread_cond_wait(&_queue_cond, &_lock);
+    }
+
+    if (_queue.empty())
+    {
+      break;
+    }
+
+    std::shared_ptr<Operation> op = _queue.front();
+    _queue.pop_front();
+    pthread_mutex_unlock(&_lock);
+
+    // Don't bother with operations the caller has given up on. These fail
+    // with RESOURCE_ERROR.
+    if (current_time_us() < op->deadline_us)
+    {
+      execute(op.get());
+    }
+
+    pthread_mutex_lock(&_lock);
+    op->done = true;
+    pthread_cond_broadcast(&_done_cond);
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+uint64_t DeadlineCallListStore::current_time_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
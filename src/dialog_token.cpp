@@ -0,0 +1,350 @@
+/**
+ * @file dialog_token.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include "dialog_token.h"
+#include "timestamp_cache.h"
+#include "base64.h"
+#include "utils.h"
+
+static const char BASE64URL_CHARS[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Sizes of the fixed fields at the start of a compact token.
+static const size_t START_TIME_BYTES = 4;
+static const size_t UNIQUE_ID_BYTES = 8;
+static const size_t FIXED_BYTES = START_TIME_BYTES + UNIQUE_ID_BYTES;
+
+// Largest token we'll try to decode. Record-Route headers are limited in
+// size anyway, so this is just a sanity check.
+static const size_t MAX_TOKEN_BYTES = 2048;
+
+/// Lookup table from base64url character to its 6-bit value, or 0xff for
+/// characters that aren't in the alphabet.
+class Base64UrlDecodeTable
+{
+public:
+  Base64UrlDecodeTable()
+  {
+    for (int ii = 0; ii < 256; ii++)
+    {
+      _values[ii] = 0xff;
+    }
+
+    for (int ii = 0; ii < 64; ii++)
+    {
+      _values[(unsigned char)BASE64URL_CHARS[ii]] = ii;
+    }
+  }
+
+  uint8_t operator[](char c) const { return _values[(unsigned char)c]; }
+
+private:
+  uint8_t _values[256];
+};
+
+static const Base64UrlDecodeTable BASE64URL_VALUES;
+
+// Appends the unpadded base64url encoding of some bytes. This works on three
+// bytes at a time, so the common case is a single table lookup per output
+// character.
+static void append_base64url(std::string& out, const uint8_t* in, size_t len)
+{
+  size_t ii = 0;
+
+  for (; ii + 3 <= len; ii += 3)
+  {
+    uint32_t triple = (in[ii] << 16) | (in[ii + 1] << 8) | in[ii + 2];
+    char quad[4] = {BASE64URL_CHARS[(triple >> 18) & 0x3f],
+                    BASE64URL_CHARS[(triple >> 12) & 0x3f],
+                    BASE64URL_CHARS[(triple >> 6) & 0x3f],
+                    BASE64URL_CHARS[triple & 0x3f]};
+    out.append(quad, 4);
+  }
+
+  if (ii + 1 == len)
+  {
+    uint32_t triple = in[ii] << 16;
+    out.push_back(BASE64URL_CHARS[(triple >> 18) & 0x3f]);
+    out.push_back(BASE64URL_CHARS[(triple >> 12) & 0x3f]);
+  }
+  else if (ii + 2 == len)
+  {
+    uint32_t triple = (in[ii] << 16) | (in[ii + 1] << 8);
+    out.push_back(BASE64URL_CHARS[(triple >> 18) & 0x3f]);
+    out.push_back(BASE64URL_CHARS[(triple >> 12) & 0x3f]);
+    out.push_back(BASE64URL_CHARS[(triple >> 6) & 0x3f]);
+  }
+}
+
+// Decodes unpadded base64url into a buffer, which must have room for
+// (len * 3) / 4 bytes.
+// @returns - The number of bytes decoded, or -1 if the input is invalid.
+static int decode_base64url(const char* in, size_t len, uint8_t* out)
+{
+  if (len % 4 == 1)
+  {
+    return -1;
+  }
+
+  uint8_t* start = out;
+  size_t ii = 0;
+
+  for (; ii + 4 <= len; ii += 4)
+  {
+    uint8_t a = BASE64URL_VALUES[in[ii]];
+    uint8_t b = BASE64URL_VALUES[in[ii + 1]];
+    uint8_t c = BASE64URL_VALUES[in[ii + 2]];
+    uint8_t d = BASE64URL_VALUES[in[ii + 3]];
+
+    if ((a | b | c | d) & 0xc0)
+    {
+      return -1;
+    }
+
+    uint32_t triple = (a << 18) | (b << 12) | (c << 6) | d;
+    *out++ = triple >> 16;
+    *out++ = triple >> 8;
+    *out++ = triple;
+  }
+
+  if (ii < len)
+  {
+    // Two or three characters left, making one or two bytes.
+    uint8_t a = BASE64URL_VALUES[in[ii]];
+    uint8_t b = BASE64URL_VALUES[in[ii + 1]];
+    uint8_t c = (ii + 2 < len) ? BASE64URL_VALUES[in[ii + 2]] : 0;
+
+    if ((a | b | c) & 0xc0)
+    {
+      return -1;
+    }
+
+    uint32_t triple = (a << 18) | (b << 12) | (c << 6);
+    *out++ = triple >> 16;
+
+    if (ii + 2 < len)
+    {
+      *out++ = triple >> 8;
+    }
+  }
+
+  return out - start;
+}
+
+static void put_uint(uint8_t* out, uint64_t value, size_t bytes)
+{
+  for (size_t ii = 0; ii < bytes; ii++)
+  {
+    out[bytes - 1 - ii] = (uint8_t)(value >> (8 * ii));
+  }
+}
+
+static uint64_t get_uint(const uint8_t* in, size_t bytes)
+{
+  uint64_t value = 0;
+
+  for (size_t ii = 0; ii < bytes; ii++)
+  {
+    value = (value << 8) | in[ii];
+  }
+
+  return value;
+}
+
+static void format_id(uint64_t id, std::string& formatted)
+{
+  char buf[24];
+  int len = snprintf(buf, sizeof(buf), "%lu", (unsigned long)id);
+  formatted.assign(buf, len);
+}
+
+namespace DialogToken
+{
+
+void encode(time_t start_time,
+            uint64_t unique_id,
+            const char* impu,
+            size_t impu_len,
+            std::string& token)
+{
+  uint32_t local_seconds =
+    (uint32_t)(start_time + TimestampCache::utc_offset(start_time));
+
+  uint8_t fixed[FIXED_BYTES];
+  put_uint(fixed, local_seconds, START_TIME_BYTES);
+  put_uint(fixed + START_TIME_BYTES, unique_id, UNIQUE_ID_BYTES);
+
+  // Encode the fixed fields and IMPU as one stream, so that there is no
+  // padding between them. FIXED_BYTES is a multiple of three, so the IMPU
+  // starts on a character boundary and can be encoded separately.
+  token.clear();
+  token.reserve(1 + ((FIXED_BYTES + impu_len) * 4 + 2) / 3);
+  token.push_back(COMPACT_PREFIX);
+  append_base64url(token, fixed, FIXED_BYTES);
+  append_base64url(token, (const uint8_t*)impu, impu_len);
+}
+
+void encode_key(uint64_t key, std::string& token)
+{
+  uint8_t bytes[8];
+  put_uint(bytes, key, sizeof(bytes));
+  token.clear();
+  token.push_back(TABLE_PREFIX);
+  append_base64url(token, bytes, sizeof(bytes));
+}
+
+// Decodes a token written by older versions, of the form
+// <timestamp>_<unique_id>_<base64 encoded impu>.
+static bool decode_legacy(const std::string& token,
+                          std::string& timestamp,
+                          std::string& id,
+                          std::string& impu)
+{
+  std::vector<std::string> values;
+  Utils::split_string(token, '_', values, 3, false);
+
+  if (values.size() != 3)
+  {
+    return false;
+  }
+
+  timestamp = std::move(values[0]);
+  id = std::move(values[1]);
+  impu = base64_decode(values[2]);
+  return true;
+}
+
+bool decode(const std::string& token,
+            DialogTable* table,
+            std::string& timestamp,
+            std::string& id,
+            std::string& impu)
+{
+  if (token.empty())
+  {
+    return false;
+  }
+
+  if ((token[0] != COMPACT_PREFIX) && (token[0] != TABLE_PREFIX))
+  {
+    return decode_legacy(token, timestamp, id, impu);
+  }
+
+  size_t len = token.length() - 1;
+
+  if (len > MAX_TOKEN_BYTES)
+  {
+    return false;
+  }
+
+  uint8_t bytes[(MAX_TOKEN_BYTES * 3) / 4 + 3];
+  int decoded = decode_base64url(token.data() + 1, len, bytes);
+
+  if (token[0] == TABLE_PREFIX)
+  {
+    return ((decoded == 8) &&
+            (table != NULL) &&
+            (table->take(get_uint(bytes, 8), timestamp, id, impu)));
+  }
+
+  if ((decoded < 0) || ((size_t)decoded < FIXED_BYTES))
+  {
+    return false;
+  }
+
+  // The start time has the UTC offset applied, so rendering it as UTC gives
+  // exactly the timestamp the AS that saw the INVITE used.
+  TimestampCache::format_cassandra((time_t)get_uint(bytes, START_TIME_BYTES),
+                                   true,
+                                   timestamp);
+  format_id(get_uint(bytes + START_TIME_BYTES, UNIQUE_ID_BYTES), id);
+  impu.assign((const char*)bytes + FIXED_BYTES, decoded - FIXED_BYTES);
+  return true;
+}
+
+}
+
+DialogTable::DialogTable(size_t max_entries) :
+  _max_entries(max_entries)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+DialogTable::~DialogTable()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+uint64_t DialogTable::add(const DialogDetails& details)
+{
+  pthread_mutex_lock(&_lock);
+
+  // Pick an unused random key. The keys are random (rather than a counter)
+  // so that they don't collide with keys from before a restart.
+  uint64_t key;
+  do
+  {
+    key = Utils::generate_unique_integer(0, 0);
+  }
+  while (_dialogs.find(key) != _dialogs.end());
+
+  Entry& entry = _dialogs[key];
+  entry.details = details;
+  entry.order = _order.insert(_order.end(), key);
+
+  // Evict the oldest dialogs if the table is full.
+  while (_dialogs.size() > _max_entries)
+  {
+    _dialogs.erase(_order.front());
+    _order.pop_front();
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  return key;
+}
+
+bool DialogTable::take(uint64_t key,
+                       std::string& timestamp,
+                       std::string& id,
+                       std::string& impu)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&_lock);
+
+  std::unordered_map<uint64_t, Entry>::iterator it = _dialogs.find(key);
+
+  if (it != _dialogs.end())
+  {
+    timestamp = std::move(it->second.details.timestamp);
+    id = std::move(it->second.details.id);
+    impu = std::move(it->second.details.impu);
+    _order.erase(it->second.order);
+    _dialogs.erase(it);
+    found = true;
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  return found;
+}
+
+size_t DialogTable::size()
+{
+  pthread_mutex_lock(&_lock);
+  size_t size = _dialogs.size();
+  pthread_mutex_unlock(&_lock);
+  return size;
+}
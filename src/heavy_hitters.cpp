@@ -0,0 +1,195 @@
+/**
+ * @file heavy_hitters.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+
+#include "heavy_hitters.h"
+
+/// Number of IMPUs to count for each of the published statistics. This is
+/// several times the number published, so the published counts are good.
+static const size_t COUNTED_IMPUS_PER_PUBLISHED = 8;
+
+HeavyHitters::HeavyHitters(size_t capacity) :
+  _capacity(capacity)
+{
+  _entries.reserve(capacity);
+  _index.reserve(capacity);
+}
+
+void HeavyHitters::add(const std::string& key, uint64_t weight)
+{
+  std::unordered_map<std::string, size_t>::iterator it = _index.find(key);
+
+  if (it != _index.end())
+  {
+    _entries[it->second].count += weight;
+    return;
+  }
+
+  if (_entries.size() < _capacity)
+  {
+    Entry entry = {key, weight, 0};
+    _index[key] = _entries.size();
+    _entries.push_back(entry);
+    return;
+  }
+
+  if (_capacity == 0)
+  {
+    return; // LCOV_EXCL_LINE
+  }
+
+  // Replace the key with the lowest count. The table is small, so a linear
+  // scan is cheaper than keeping it ordered.
+  size_t min = 0;
+
+  for (size_t ii = 1; ii < _entries.size(); ii++)
+  {
+    if (_entries[ii].count < _entries[min].count)
+    {
+      min = ii;
+    }
+  }
+
+  Entry& entry = _entries[min];
+  _index.erase(entry.key);
+  entry.key = key;
+  entry.error = entry.count;
+  entry.count += weight;
+  _index[key] = min;
+}
+
+void HeavyHitters::top(size_t n, std::vector<Entry>& top) const
+{
+  top = _entries;
+  keep_top(n, top);
+}
+
+void HeavyHitters::clear()
+{
+  _entries.clear();
+  _index.clear();
+}
+
+void HeavyHitters::take(std::vector<Entry>& entries)
+{
+  entries.clear();
+  entries.swap(_entries);
+  _entries.reserve(_capacity);
+  _index.clear();
+}
+
+void HeavyHitters::keep_top(size_t n, std::vector<Entry>& entries)
+{
+  n = std::min(n, entries.size());
+  std::partial_sort(entries.begin(),
+                    entries.begin() + n,
+                    entries.end(),
+                    [](const Entry& a, const Entry& b) { return a.count > b.count; });
+  entries.resize(n);
+}
+
+HotImpuTracker::HotImpuTracker(size_t top_n,
+                               uint64_t interval_ms,
+                               LastValueCache* stats_aggregator) :
+  _top_n(top_n),
+  _interval_ms(interval_ms),
+  _interval_start_ms(0),
+  _writes(top_n * COUNTED_IMPUS_PER_PUBLISHED),
+  _trims(top_n * COUNTED_IMPUS_PER_PUBLISHED),
+  _stat_top_writes("memento_top_write_impus", stats_aggregator),
+  _stat_top_trims("memento_top_trim_impus", stats_aggregator)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+HotImpuTracker::~HotImpuTracker()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+void HotImpuTracker::record_write(const std::string& impu, uint64_t now_ms)
+{
+  std::vector<HeavyHitters::Entry> writes;
+  std::vector<HeavyHitters::Entry> trims;
+
+  pthread_mutex_lock(&_lock);
+  bool ended = end_interval(now_ms, writes, trims);
+  _writes.add(impu);
+  pthread_mutex_unlock(&_lock);
+
+  if (ended)
+  {
+    publish(writes, trims);
+  }
+}
+
+void HotImpuTracker::record_trim(const std::string& impu,
+                                 uint64_t fragments,
+                                 uint64_t now_ms)
+{
+  std::vector<HeavyHitters::Entry> writes;
+  std::vector<HeavyHitters::Entry> trims;
+
+  pthread_mutex_lock(&_lock);
+  bool ended = end_interval(now_ms, writes, trims);
+  _trims.add(impu, fragments);
+  pthread_mutex_unlock(&_lock);
+
+  if (ended)
+  {
+    publish(writes, trims);
+  }
+}
+
+bool HotImpuTracker::end_interval(uint64_t now_ms,
+                                  std::vector<HeavyHitters::Entry>& writes,
+                                  std::vector<HeavyHitters::Entry>& trims)
+{
+  if (_interval_start_ms == 0)
+  {
+    _interval_start_ms = now_ms;
+  }
+  else if (now_ms - _interval_start_ms >= _interval_ms)
+  {
+    _writes.take(writes);
+    _trims.take(trims);
+    _interval_start_ms = now_ms;
+    return true;
+  }
+
+  return false;
+}
+
+void HotImpuTracker::publish(std::vector<HeavyHitters::Entry>& writes,
+                             std::vector<HeavyHitters::Entry>& trims)
+{
+  publish_top(writes, _top_n, _stat_top_writes);
+  publish_top(trims, _top_n, _stat_top_trims);
+}
+
+void HotImpuTracker::publish_top(std::vector<HeavyHitters::Entry>& entries,
+                                 size_t top_n,
+                                 Statistic& stat)
+{
+  HeavyHitters::keep_top(top_n, entries);
+
+  std::vector<std::string> values;
+  values.reserve(entries.size() * 2);
+
+  for (size_t ii = 0; ii < entries.size(); ii++)
+  {
+    values.push_back(entries[ii].key);
+    values.push_back(std::to_string(entries[ii].count));
+  }
+
+  stat.report_change(values);
+}
@@ -16,10 +16,13 @@
 #include "rapidjson/stringbuffer.h"
 
 /// Constructor.
-HttpNotifier::HttpNotifier(HttpResolver* resolver, const std::string& notify_url) :
+HttpNotifier::HttpNotifier(HttpResolver* resolver,
+                           const std::string& notify_url,
+                           NotifyCircuitBreaker* circuit_breaker) :
   _http_resolver(resolver),
   _http_client(NULL),
-  _http_connection(NULL)
+  _http_connection(NULL),
+  _circuit_breaker(circuit_breaker)
 {
   std::string url_scheme;
   std::string url_server;
@@ -64,6 +67,15 @@ bool HttpNotifier::send_notify(const std::string& impu,
     return true;
   }
 
+  uint64_t ticket = 0;
+
+  if ((_circuit_breaker != NULL) && (!_circuit_breaker->allow_request(ticket)))
+  {
+    // The notify target is misbehaving - don't tie up this worker waiting on
+    // it.  The client will pick up the change on its next call list fetch.
+    return false;
+  }
+
   rapidjson::Document notification;
   notification.SetObject();
   rapidjson::Value impu_value;
@@ -76,6 +88,9 @@ bool HttpNotifier::send_notify(const std::string& impu,
 
   std::string body = buffer.GetString();
 
+  Utils::StopWatch stop_watch;
+  stop_watch.start();
+
   HTTPCode http_code = 
     _http_connection->create_request(HttpClient::RequestType::POST, 
                                     _http_url_path)
@@ -84,5 +99,20 @@ bool HttpNotifier::send_notify(const std::string& impu,
      .send()
      .get_rc();
 
+  if (_circuit_breaker != NULL)
+  {
+    unsigned long latency_us = 0;
+    stop_watch.read(latency_us);
+
+    if (http_code == HTTP_OK)
+    {
+      _circuit_breaker->request_succeeded(ticket, latency_us);
+    }
+    else
+    {
+      _circuit_breaker->request_failed(ticket);
+    }
+  }
+
   return (http_code == HTTP_OK);
 }
@@ -0,0 +1,55 @@
+/**
+ * @file keyed_statistic.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "keyed_statistic.h"
+
+KeyedStatistic::KeyedStatistic(const std::string& name,
+                               LastValueCache* stats_aggregator) :
+  _stat(name, stats_aggregator)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+KeyedStatistic::~KeyedStatistic()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+void KeyedStatistic::report_change(const std::string& key,
+                                   const std::vector<std::string>& values)
+{
+  // Publish under the lock, so that two publishers can't overtake each
+  // other and leave the older values published.
+  pthread_mutex_lock(&_lock);
+  _values[key] = values;
+  _stat.report_change(all_values());
+  pthread_mutex_unlock(&_lock);
+}
+
+std::vector<std::string> KeyedStatistic::all_values() const
+{
+  std::vector<std::string> all_values;
+
+  for (std::map<std::string, std::vector<std::string>>::const_iterator it =
+         _values.begin();
+       it != _values.end();
+       ++it)
+  {
+    if (!it->first.empty())
+    {
+      all_values.push_back(it->first);
+    }
+
+    all_values.insert(all_values.end(), it->second.begin(), it->second.end());
+  }
+
+  return all_values;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file latency_window.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+
+#include "latency_window.h"
+
+LatencyWindow::LatencyWindow(int percentile) :
+  _percentile(percentile),
+  _samples(WINDOW_SIZE, 0),
+  _next(0),
+  _count(0),
+  _percentile_us(0)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+LatencyWindow::~LatencyWindow()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+void LatencyWindow::record(uint64_t latency_us)
+{
+  pthread_mutex_lock(&_lock);
+  _samples[_next] = latency_us;
+  _next = (_next + 1) % WINDOW_SIZE;
+  _count++;
+
+  if ((_count >= MIN_SAMPLES) && (_count % RECALC_INTERVAL == 0))
+  {
+    size_t size = (_count < WINDOW_SIZE) ? _count : WINDOW_SIZE;
+    std::vector<uint64_t> samples(_samples.begin(), _samples.begin() + size);
+    size_t index = (size * _percentile + 99) / 100;
+    index = (index > 0) ? index - 1 : 0;
+    std::nth_element(samples.begin(),
+                     samples.begin() + index,
+                     samples.end());
+    _percentile_us = samples[index];
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
@@ -0,0 +1,846 @@
+/**
+ * @file local_call_list_store.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "local_call_list_store.h"
+#include "log.h"
+
+// Each record is a header (the body length and a checksum of the body),
+// then the body.
+static const size_t RECORD_HEADER_LEN = 8;
+
+// Largest record body we'll accept on replay. Anything bigger is corrupt.
+static const uint32_t MAX_RECORD_LEN = 16 * 1024 * 1024;
+
+static void put_int(std::string& buffer, uint64_t value, int bytes)
+{
+  for (int ii = bytes - 1; ii >= 0; ii--)
+  {
+    buffer.push_back((char)(value >> (ii * 8)));
+  }
+}
+
+static void put_string(std::string& buffer, const std::string& value)
+{
+  put_int(buffer, value.length(), 4);
+  buffer.append(value);
+}
+
+static bool get_int(const std::string& buffer,
+                    size_t& pos,
+                    int bytes,
+                    uint64_t& value)
+{
+  if (buffer.length() - pos < (size_t)bytes)
+  {
+    return false;
+  }
+
+  value = 0;
+
+  for (int ii = 0; ii < bytes; ii++)
+  {
+    value = (value << 8) | (uint8_t)buffer[pos++];
+  }
+
+  return true;
+}
+
+static bool get_string(const std::string& buffer,
+                       size_t& pos,
+                       std::string& value)
+{
+  uint64_t len;
+
+  if ((!get_int(buffer, pos, 4, len)) || (buffer.length() - pos < len))
+  {
+    return false;
+  }
+
+  value = buffer.substr(pos, len);
+  pos += len;
+  return true;
+}
+
+// FNV-1a, which is plenty to spot a torn write.
+static uint32_t checksum(const char* data, size_t len)
+{
+  uint32_t hash = 2166136261u;
+
+  for (size_t ii = 0; ii < len; ii++)
+  {
+    hash = (hash ^ (uint8_t)data[ii]) * 16777619u;
+  }
+
+  return hash;
+}
+
+static bool write_fully(int fd, const std::string& data)
+{
+  size_t written = 0;
+
+  while (written < data.length())
+  {
+    ssize_t rc = write(fd, data.data() + written, data.length() - written);
+
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue; // LCOV_EXCL_LINE
+      }
+
+      return false;
+    }
+
+    written += rc;
+  }
+
+  return true;
+}
+
+static bool read_fully(int fd, uint64_t offset, size_t len, std::string& data)
+{
+  data.resize(len);
+  size_t done = 0;
+
+  while (done < len)
+  {
+    ssize_t rc = pread(fd, &data[done], len - done, offset + done);
+
+    if ((rc < 0) && (errno == EINTR))
+    {
+      continue; // LCOV_EXCL_LINE
+    }
+
+    if (rc <= 0)
+    {
+      return false;
+    }
+
+    done += rc;
+  }
+
+  return true;
+}
+
+LocalCallListStore::LocalCallListStore(const std::string& path) :
+  CallListStore::Store(),
+  _path(path),
+  _log_bytes(0),
+  _live_bytes(0),
+  _unsynced(false),
+  _next_sync_ms(0),
+  _compacting(false),
+  _terminating(false),
+  _background_thread_running(false)
+{
+  pthread_mutex_init(&_lock, NULL);
+
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_background_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+
+  if (fd == -1)
+  {
+    TRC_ERROR("Unable to open local call list store %s: %s",
+              path.c_str(),
+              strerror(errno));
+    return;
+  }
+
+  _log.reset(new Log(fd));
+
+  if (!replay())
+  {
+    _log.reset();
+    return;
+  }
+
+  _next_sync_ms = current_time_ms() + SYNC_INTERVAL_MS;
+
+  if (pthread_create(&_background_thread,
+                     NULL,
+                     &background_thread_fn,
+                     this) == 0)
+  {
+    _background_thread_running = true;
+  }
+  else
+  {
+    TRC_ERROR("Unable to start the local call list store's sync thread"); // LCOV_EXCL_LINE
+  }
+}
+
+LocalCallListStore::~LocalCallListStore()
+{
+  pthread_mutex_lock(&_lock);
+  _terminating = true;
+  pthread_cond_signal(&_background_cond);
+  pthread_mutex_unlock(&_lock);
+
+  if (_background_thread_running)
+  {
+    pthread_join(_background_thread, NULL);
+  }
+
+  if (_log != nullptr)
+  {
+    fdatasync(_log->fd);
+    _log.reset();
+  }
+
+  pthread_cond_destroy(&_background_cond);
+  pthread_mutex_destroy(&_lock);
+}
+
+LocalCallListStore::Log::~Log()
+{
+  close(fd);
+}
+
+CassandraStore::ResultCode LocalCallListStore::write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail)
+{
+  return write_call_fragments_sync(impu,
+                                   std::vector<CallListStore::CallFragment>(1, fragment),
+                                   cass_timestamp,
+                                   ttl,
+                                   trail);
+}
+
+CassandraStore::ResultCode LocalCallListStore::write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail)
+{
+  int64_t expiry_s = (ttl > 0) ? current_time_s() + ttl : 0;
+  std::vector<Entry> entries(fragments.size());
+  std::string records;
+
+  for (size_t ii = 0; ii < fragments.size(); ii++)
+  {
+    set_fragment(entries[ii], fragments[ii]);
+    entries[ii].cass_timestamp = cass_timestamp;
+    entries[ii].expiry_s = expiry_s;
+    entries[ii].contents_len = fragments[ii].contents.length();
+    records.append(encode(OP_WRITE, impu, entries[ii], fragments[ii].contents));
+
+    // The contents end the record. This is relative to the first record
+    // until we know where they'll be appended.
+    entries[ii].contents_offset = records.length() - entries[ii].contents_len;
+  }
+
+  pthread_mutex_lock(&_lock);
+  uint64_t offset;
+
+  if (!append(records, offset))
+  {
+    pthread_mutex_unlock(&_lock);
+    return CassandraStore::RESOURCE_ERROR;
+  }
+
+  for (size_t ii = 0; ii < entries.size(); ii++)
+  {
+    entries[ii].contents_offset += offset;
+    apply(OP_WRITE, impu, entries[ii]);
+  }
+
+  pthread_mutex_unlock(&_lock);
+  return CassandraStore::OK;
+}
+
+CassandraStore::ResultCode LocalCallListStore::get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail)
+{
+  int64_t now_s = current_time_s();
+  std::vector<Entry> entries;
+  std::shared_ptr<Log> log;
+  fragments.clear();
+
+  pthread_mutex_lock(&_lock);
+  std::map<std::string, Row>::iterator row = _rows.find(impu);
+
+  if (row != _rows.end())
+  {
+    for (Row::iterator it = row->second.begin(); it != row->second.end();)
+    {
+      if ((it->second.expiry_s != 0) && (it->second.expiry_s <= now_s))
+      {
+        _live_bytes -= size(impu, it->second);
+        row->second.erase(it++);
+        continue;
+      }
+
+      if (!it->second.deleted)
+      {
+        entries.push_back(it->second);
+      }
+
+      ++it;
+    }
+
+    if (row->second.empty())
+    {
+      _rows.erase(row);
+    }
+  }
+
+  log = _log;
+  pthread_mutex_unlock(&_lock);
+
+  if (entries.empty())
+  {
+    return CassandraStore::NOT_FOUND;
+  }
+
+  // Fetch the contents without holding the lock. The log is append only,
+  // so they can't change under us.
+  fragments.resize(entries.size());
+
+  for (size_t ii = 0; ii < entries.size(); ii++)
+  {
+    fragments[ii] = entries[ii].fragment;
+
+    if (!read_fully(log->fd,
+                    entries[ii].contents_offset,
+                    entries[ii].contents_len,
+                    fragments[ii].contents))
+    {
+      TRC_ERROR("Unable to read from local call list store %s: %s",
+                _path.c_str(),
+                strerror(errno));
+      fragments.clear();
+      return CassandraStore::RESOURCE_ERROR;
+    }
+  }
+
+  return CassandraStore::OK;
+}
+
+CassandraStore::ResultCode LocalCallListStore::delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail)
+{
+  std::vector<Entry> entries(fragments.size());
+  std::string records;
+
+  for (size_t ii = 0; ii < fragments.size(); ii++)
+  {
+    set_fragment(entries[ii], fragments[ii]);
+    entries[ii].cass_timestamp = cass_timestamp;
+    entries[ii].expiry_s = 0;
+    entries[ii].contents_len = 0;
+    records.append(encode(OP_DELETE, impu, entries[ii], ""));
+
+    // Place the tombstone at the end of its record, as replay does, so
+    // compaction knows whether it was logged before the snapshot.
+    entries[ii].contents_offset = records.length();
+  }
+
+  pthread_mutex_lock(&_lock);
+  uint64_t offset;
+
+  if (!append(records, offset))
+  {
+    pthread_mutex_unlock(&_lock);
+    return CassandraStore::RESOURCE_ERROR;
+  }
+
+  for (size_t ii = 0; ii < entries.size(); ii++)
+  {
+    entries[ii].contents_offset += offset;
+    apply(OP_DELETE, impu, entries[ii]);
+  }
+
+  pthread_mutex_unlock(&_lock);
+  return CassandraStore::OK;
+}
+
+std::string LocalCallListStore::encode(Op op,
+                                       const std::string& impu,
+                                       const Entry& entry,
+                                       const std::string& contents)
+{
+  std::string body;
+  put_int(body, op, 1);
+  put_string(body, impu);
+  put_string(body, entry.fragment.timestamp);
+  put_string(body, entry.fragment.id);
+  put_int(body, (uint8_t)entry.fragment.type, 1);
+  put_int(body, entry.cass_timestamp, 8);
+  put_int(body, entry.expiry_s, 8);
+  put_string(body, contents);
+
+  std::string record;
+  put_int(record, body.length(), 4);
+  put_int(record, checksum(body.data(), body.length()), 4);
+  record.append(body);
+  return record;
+}
+
+bool LocalCallListStore::decode(const std::string& body,
+                                Op& op,
+                                std::string& impu,
+                                Entry& entry,
+                                std::string& contents)
+{
+  size_t pos = 0;
+  uint64_t op_value;
+  uint64_t type;
+  uint64_t cass_timestamp;
+  uint64_t expiry_s;
+
+  if ((!get_int(body, pos, 1, op_value)) ||
+      (!get_string(body, pos, impu)) ||
+      (!get_string(body, pos, entry.fragment.timestamp)) ||
+      (!get_string(body, pos, entry.fragment.id)) ||
+      (!get_int(body, pos, 1, type)) ||
+      (!get_int(body, pos, 8, cass_timestamp)) ||
+      (!get_int(body, pos, 8, expiry_s)) ||
+      (!get_string(body, pos, contents)) ||
+      (pos != body.length()) ||
+      ((op_value != OP_WRITE) && (op_value != OP_DELETE)) ||
+      (type > (uint8_t)CallListStore::CallFragment::Type::REJECTED))
+  {
+    return false;
+  }
+
+  op = (Op)op_value;
+  entry.fragment.type = (CallListStore::CallFragment::Type)type;
+  entry.cass_timestamp = cass_timestamp;
+  entry.expiry_s = expiry_s;
+  entry.contents_len = contents.length();
+  return true;
+}
+
+void LocalCallListStore::set_fragment(Entry& entry,
+                                      const CallListStore::CallFragment& fragment)
+{
+  entry.fragment.timestamp = fragment.timestamp;
+  entry.fragment.id = fragment.id;
+  entry.fragment.type = fragment.type;
+}
+
+bool LocalCallListStore::replay()
+{
+  struct stat st;
+
+  if (fstat(_log->fd, &st) != 0)
+  {
+    TRC_ERROR("Unable to read local call list store %s: %s", // LCOV_EXCL_LINE
+              _path.c_str(), // LCOV_EXCL_LINE
+              strerror(errno)); // LCOV_EXCL_LINE
+    return false; // LCOV_EXCL_LINE
+  }
+
+  uint64_t file_bytes = st.st_size;
+  uint64_t offset = 0;
+  int records = 0;
+
+  pthread_mutex_lock(&_lock);
+
+  while (offset < file_bytes)
+  {
+    std::string header;
+    std::string body;
+    size_t pos = 0;
+    uint64_t len;
+    uint64_t sum;
+    Op op;
+    std::string impu;
+    Entry entry;
+    std::string contents;
+
+    if ((!read_fully(_log->fd, offset, RECORD_HEADER_LEN, header)) ||
+        (!get_int(header, pos, 4, len)) ||
+        (!get_int(header, pos, 4, sum)) ||
+        (len > MAX_RECORD_LEN) ||
+        (!read_fully(_log->fd, offset + RECORD_HEADER_LEN, len, body)) ||
+        (checksum(body.data(), body.length()) != sum) ||
+        (!decode(body, op, impu, entry, contents)))
+    {
+      break;
+    }
+
+    offset += RECORD_HEADER_LEN + len;
+    entry.contents_offset = offset - entry.contents_len;
+    apply(op, impu, entry);
+    records++;
+  }
+
+  if (offset < file_bytes)
+  {
+    TRC_WARNING("Discarding %lu bytes of torn or corrupt records from %s",
+                (unsigned long)(file_bytes - offset),
+                _path.c_str());
+
+    if (ftruncate(_log->fd, offset) != 0)
+    {
+      TRC_ERROR("Unable to truncate local call list store %s: %s", // LCOV_EXCL_LINE
+                _path.c_str(), // LCOV_EXCL_LINE
+                strerror(errno)); // LCOV_EXCL_LINE
+      pthread_mutex_unlock(&_lock); // LCOV_EXCL_LINE
+      return false; // LCOV_EXCL_LINE
+    }
+  }
+
+  _log_bytes = offset;
+  TRC_STATUS("Loaded %d records (%lu live bytes) from local call list store %s",
+             records,
+             (unsigned long)_live_bytes,
+             _path.c_str());
+  pthread_mutex_unlock(&_lock);
+  return true;
+}
+
+void LocalCallListStore::apply(Op op, const std::string& impu, const Entry& entry)
+{
+  std::map<std::string, Row>::iterator row = _rows.find(impu);
+  std::string entry_key = key(entry.fragment);
+
+  if (row == _rows.end())
+  {
+    row = _rows.insert(std::make_pair(impu, Row())).first;
+  }
+
+  Row::iterator it = row->second.find(entry_key);
+
+  if (it != row->second.end())
+  {
+    // Requests only replace a fragment at least as old as them, and
+    // tombstones win ties, as in Cassandra.
+    if ((it->second.cass_timestamp > entry.cass_timestamp) ||
+        ((it->second.deleted) &&
+         (it->second.cass_timestamp == entry.cass_timestamp)))
+    {
+      return;
+    }
+
+    if (!it->second.deleted)
+    {
+      _live_bytes -= size(impu, it->second);
+    }
+  }
+
+  // A delete leaves a tombstone, even if there's nothing to delete, so
+  // that an older write applied later doesn't bring the fragment back.
+  Entry& stored = row->second[entry_key];
+  stored = entry;
+  stored.deleted = (op == OP_DELETE);
+
+  if (!stored.deleted)
+  {
+    _live_bytes += size(impu, stored);
+  }
+}
+
+bool LocalCallListStore::append(const std::string& records, uint64_t& offset)
+{
+  if (_log == nullptr)
+  {
+    return false;
+  }
+
+  if (!write_fully(_log->fd, records))
+  {
+    TRC_ERROR("Unable to write to local call list store %s: %s",
+              _path.c_str(),
+              strerror(errno));
+
+    // Don't leave a partial record behind, or replay would stop there.
+    if (ftruncate(_log->fd, _log_bytes) != 0)
+    {
+      TRC_ERROR("Unable to truncate local call list store %s: %s", // LCOV_EXCL_LINE
+                _path.c_str(), // LCOV_EXCL_LINE
+                strerror(errno)); // LCOV_EXCL_LINE
+    }
+
+    return false;
+  }
+
+  offset = _log_bytes;
+  _log_bytes += records.length();
+  _unsynced = true;
+
+  if ((!_compacting) &&
+      (_log_bytes >= MIN_COMPACTION_BYTES) &&
+      (_log_bytes > 2 * _live_bytes))
+  {
+    _compacting = true;
+    pthread_cond_signal(&_background_cond);
+  }
+
+  return true;
+}
+
+bool LocalCallListStore::compact()
+{
+  std::string compact_path = _path + ".compact";
+  int fd = open(compact_path.c_str(),
+                O_RDWR | O_CREAT | O_TRUNC | O_APPEND,
+                0600);
+
+  if (fd == -1)
+  {
+    TRC_ERROR("Unable to compact local call list store %s: %s",
+              _path.c_str(),
+              strerror(errno));
+    return false;
+  }
+
+  std::shared_ptr<Log> new_log(new Log(fd));
+
+  // Copy the live fragments from a snapshot of the index, so that requests
+  // can carry on meanwhile. The index only holds where each fragment is,
+  // so the snapshot is small next to the log.
+  pthread_mutex_lock(&_lock);
+  std::shared_ptr<Log> old_log = _log;
+  uint64_t copied_bytes = _log_bytes;
+  std::map<std::string, Row> rows = _rows;
+  pthread_mutex_unlock(&_lock);
+
+  if (old_log == nullptr)
+  {
+    unlink(compact_path.c_str());
+    return false;
+  }
+
+  int64_t now_s = current_time_s();
+  uint64_t new_bytes = 0;
+  std::map<uint64_t, uint64_t> moved;
+  std::string records;
+  bool ok = true;
+
+  for (std::map<std::string, Row>::const_iterator row = rows.begin();
+       (row != rows.end()) && (ok);
+       ++row)
+  {
+    for (Row::const_iterator it = row->second.begin();
+         (it != row->second.end()) && (ok);
+         ++it)
+    {
+      std::string contents;
+
+      if ((it->second.deleted) ||
+          ((it->second.expiry_s != 0) && (it->second.expiry_s <= now_s)))
+      {
+        continue;
+      }
+
+      ok = read_fully(old_log->fd,
+                      it->second.contents_offset,
+                      it->second.contents_len,
+                      contents);
+      records.append(encode(OP_WRITE, row->first, it->second, contents));
+      moved[it->second.contents_offset] =
+        new_bytes + records.length() - contents.length();
+
+      if (records.length() >= 1024 * 1024)
+      {
+        ok = ok && write_fully(fd, records);
+        new_bytes += records.length();
+        records.clear();
+      }
+    }
+  }
+
+  ok = ok && (write_fully(fd, records)) && (fdatasync(fd) == 0);
+  new_bytes += records.length();
+
+  if (!ok)
+  {
+    TRC_ERROR("Unable to compact local call list store %s: %s",
+              _path.c_str(),
+              strerror(errno));
+    unlink(compact_path.c_str());
+    return false;
+  }
+
+  // Copy across whatever has been logged since the snapshot, and switch to
+  // the new log. This is usually little, so it's done under the lock.
+  pthread_mutex_lock(&_lock);
+  std::string recent;
+  ok = (read_fully(old_log->fd,
+                   copied_bytes,
+                   _log_bytes - copied_bytes,
+                   recent)) &&
+       (write_fully(fd, recent)) &&
+       (fdatasync(fd) == 0) &&
+       (rename(compact_path.c_str(), _path.c_str()) == 0);
+
+  if (!ok)
+  {
+    pthread_mutex_unlock(&_lock);
+    TRC_ERROR("Unable to compact local call list store %s: %s",
+              _path.c_str(),
+              strerror(errno));
+    unlink(compact_path.c_str());
+    return false;
+  }
+
+  // Point the index at the fragments' new places. Anything logged since the
+  // snapshot has just moved along, and anything missing from the new log
+  // had expired or was a tombstone, which the new log has no record of.
+  for (std::map<std::string, Row>::iterator row = _rows.begin();
+       row != _rows.end();)
+  {
+    for (Row::iterator it = row->second.begin(); it != row->second.end();)
+    {
+      Entry& entry = it->second;
+
+      if (entry.contents_offset >= copied_bytes)
+      {
+        entry.contents_offset = entry.contents_offset - copied_bytes + new_bytes;
+      }
+      else
+      {
+        std::map<uint64_t, uint64_t>::const_iterator new_offset =
+          moved.find(entry.contents_offset);
+
+        if (new_offset == moved.end())
+        {
+          if (!entry.deleted)
+          {
+            _live_bytes -= size(row->first, entry);
+          }
+
+          row->second.erase(it++);
+          continue;
+        }
+
+        entry.contents_offset = new_offset->second;
+      }
+
+      ++it;
+    }
+
+    if (row->second.empty())
+    {
+      _rows.erase(row++);
+    }
+    else
+    {
+      ++row;
+    }
+  }
+
+  TRC_STATUS("Compacted local call list store %s from %lu to %lu bytes",
+             _path.c_str(),
+             (unsigned long)_log_bytes,
+             (unsigned long)(new_bytes + recent.length()));
+  _log = new_log;
+  _log_bytes = new_bytes + recent.length();
+  pthread_mutex_unlock(&_lock);
+  return true;
+}
+
+void* LocalCallListStore::background_thread_fn(void* store)
+{
+  ((LocalCallListStore*)store)->background_thread();
+  return NULL;
+}
+
+void LocalCallListStore::background_thread()
+{
+  pthread_mutex_lock(&_lock);
+
+  while (!_terminating)
+  {
+    if (_compacting)
+    {
+      pthread_mutex_unlock(&_lock);
+      compact();
+      pthread_mutex_lock(&_lock);
+      _compacting = false;
+      continue;
+    }
+
+    uint64_t now_ms = current_time_ms();
+
+    if (now_ms >= _next_sync_ms)
+    {
+      _next_sync_ms = now_ms + SYNC_INTERVAL_MS;
+
+      if (_unsynced)
+      {
+        // Sync without the lock, so writes carry on meanwhile.
+        std::shared_ptr<Log> log = _log;
+        _unsynced = false;
+        pthread_mutex_unlock(&_lock);
+        fdatasync(log->fd);
+        pthread_mutex_lock(&_lock);
+      }
+
+      continue;
+    }
+
+    struct timespec wake;
+    wake.tv_sec = _next_sync_ms / 1000;
+    wake.tv_nsec = (_next_sync_ms % 1000) * 1000000;
+    pthread_cond_timedwait(&_background_cond, &_lock, &wake);
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+uint64_t LocalCallListStore::size(const std::string& impu, const Entry& entry)
+{
+  // Header, op, type, timestamps, and a length for each string.
+  return RECORD_HEADER_LEN + 1 + 1 + 8 + 8 + 4 * 4 +
+         impu.length() +
+         entry.fragment.timestamp.length() +
+         entry.fragment.id.length() +
+         entry.contents_len;
+}
+
+std::string LocalCallListStore::key(const CallListStore::CallFragment& fragment)
+{
+  std::string key = fragment.timestamp;
+  key.push_back('\0');
+  key.append(fragment.id);
+  key.push_back('\0');
+  key.push_back('0' + (char)fragment.type);
+  return key;
+}
+
+int64_t LocalCallListStore::current_time_s()
+{
+  // Expiry times are kept on disk, so use the wall clock.
+  return time(NULL);
+}
+
+uint64_t LocalCallListStore::current_time_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
@@ -12,36 +12,75 @@
 #include "call_list_store_processor.h"
 #include "httpnotifier.h"
 #include "log.h"
-#include "rapidxml/rapidxml.hpp"
-#include "rapidxml/rapidxml_print.hpp"
-#include "base64.h"
+#include "dialog_token.h"
+#include "timestamp_cache.h"
 #include <ctime>
 #include "utils.h"
 #include "mementosasevent.h"
 
-static const int MAX_CALL_ENTRY_LENGTH = 4096;
-static const char* TIMESTAMP_PATTERN = "%Y%m%d%H%M%S";
-static const char* XML_PATTERN = "%Y-%m-%dT%H:%M:%S";
-
 static const pj_str_t ORIG = pj_str((char*)"orig");
 static const pj_str_t ORIG_CDIV = pj_str((char*)"orig-cdiv");
 static const pj_str_t P_SERVED_USER = pj_str((char*)"P-Served-User");
 static const pj_str_t P_ASSERTED_IDENTITY = pj_str((char*)"P-Asserted-Identity");
+static const pj_str_t PRIVACY = pj_str((char*)"Privacy");
 static const pj_str_t SESCASE = pj_str((char*)"sescase");
 
-// Constants to create the Call list XML
-namespace MementoXML
+/// The headers memento looks at, collected in a single pass over a
+/// message's header list. Each is the first header of its kind, or NULL.
+struct MementoHeaders
+{
+  pjsip_cseq_hdr* cseq;
+  pjsip_routing_hdr* p_served_user;
+  pjsip_routing_hdr* p_asserted_identity;
+  pjsip_generic_string_hdr* privacy;
+};
+
+// Returns whether a header has the given name. The lengths are compared
+// first, which rules out almost every header without looking at the name.
+static inline bool hdr_name_is(const pjsip_hdr* hdr, const pj_str_t& name)
+{
+  return ((hdr->name.slen == name.slen) &&
+          (pj_stricmp(&hdr->name, &name) == 0));
+}
+
+// Walks a message's headers once, picking out the ones memento needs,
+// rather than walking the header list once per header with
+// pjsip_msg_find_hdr_by_name.
+static void scan_headers(pjsip_msg* msg, MementoHeaders& headers)
 {
-  static const char* TO = "to";
-  static const char* FROM = "from";
-  static const char* NAME = "name";
-  static const char* URI = "URI";
-  static const char* OUTGOING = "outgoing";
-  static const char* ANSWERED = "answered";
-  static const char* ANSWERER = "answerer";
-  static const char* START_TIME = "start-time";
-  static const char* END_TIME = "end-time";
-  static const char* ANSWER_TIME = "answer-time";
+  headers.cseq = NULL;
+  headers.p_served_user = NULL;
+  headers.p_asserted_identity = NULL;
+  headers.privacy = NULL;
+
+  for (pjsip_hdr* hdr = msg->hdr.next; hdr != &msg->hdr; hdr = hdr->next)
+  {
+    if (hdr->type == PJSIP_H_CSEQ)
+    {
+      if (headers.cseq == NULL)
+      {
+        headers.cseq = (pjsip_cseq_hdr*)hdr;
+      }
+    }
+    else if (hdr->type == PJSIP_H_OTHER)
+    {
+      if ((headers.p_asserted_identity == NULL) &&
+          (hdr_name_is(hdr, P_ASSERTED_IDENTITY)))
+      {
+        headers.p_asserted_identity = (pjsip_routing_hdr*)hdr;
+      }
+      else if ((headers.p_served_user == NULL) &&
+               (hdr_name_is(hdr, P_SERVED_USER)))
+      {
+        headers.p_served_user = (pjsip_routing_hdr*)hdr;
+      }
+      else if ((headers.privacy == NULL) &&
+               (hdr_name_is(hdr, PRIVACY)))
+      {
+        headers.privacy = (pjsip_generic_string_hdr*)hdr;
+      }
+    }
+  }
 }
 
 /// Constructor.
@@ -59,7 +98,16 @@ MementoAppServer::MementoAppServer(const std::string& service_name,
                                    const float max_token_rate,
                                    ExceptionHandler* exception_handler,
                                    HttpResolver* http_resolver,
-                                   const std::string& memento_notify_url) :
+                                   const std::string& memento_notify_url,
+                                   NotifyCircuitBreaker* notify_circuit_breaker,
+                                   CallFragmentCodec::Encoding fragment_encoding,
+                                   CallFragmentCompressor* fragment_compressor,
+                                   const int begin_hold_ms,
+                                   const int flood_max_rejected_calls,
+                                   const int flood_window_ms,
+                                   const int dialog_table_size,
+                                   CallListViewStore* call_list_view_store,
+                                   TrimOwnership* trim_ownership) :
   AppServer(service_name),
   _service_name(service_name),
   _home_domain(home_domain),
@@ -68,7 +116,9 @@ MementoAppServer::MementoAppServer(const std::string& service_name,
                                 init_token_rate,
                                 min_token_rate,
                                 max_token_rate)),
-  _http_notifier(new HttpNotifier(http_resolver, memento_notify_url)),
+  _http_notifier(new HttpNotifier(http_resolver,
+                                  memento_notify_url,
+                                  notify_circuit_breaker)),
   _call_list_store_processor(new CallListStoreProcessor(_load_monitor,
                                                         call_list_store,
                                                         max_call_list_length,
@@ -76,7 +126,17 @@ MementoAppServer::MementoAppServer(const std::string& service_name,
                                                         call_list_ttl,
                                                         stats_aggregator,
                                                         exception_handler,
-                                                        _http_notifier)),
+                                                        _http_notifier,
+                                                        fragment_encoding,
+                                                        fragment_compressor,
+                                                        begin_hold_ms,
+                                                        flood_max_rejected_calls,
+                                                        flood_window_ms,
+                                                        cass_target_latency,
+                                                        call_list_view_store,
+                                                        trim_ownership)),
+  _dialog_table((dialog_table_size > 0) ?
+                  new DialogTable(dialog_table_size) : NULL),
   _stat_calls_not_recorded_due_to_overload("memento_not_recorded_overload",
                                            stats_aggregator)
 {
@@ -88,6 +148,7 @@ MementoAppServer::~MementoAppServer()
   delete _load_monitor; _load_monitor = NULL;
   delete _call_list_store_processor; _call_list_store_processor = NULL;
   delete _http_notifier; _http_notifier = NULL;
+  delete _dialog_table; _dialog_table = NULL;
 }
 
 // Returns an AppServerTsx if the load monitor admits the request, and if
@@ -123,37 +184,64 @@ AppServerTsx* MementoAppServer::get_app_tsx(SproutletHelper* helper,
   MementoAppServerTsx* memento_tsx =
                     new MementoAppServerTsx(_call_list_store_processor,
                                             _service_name,
-                                            _home_domain);
+                                            _home_domain,
+                                            _dialog_table);
   return memento_tsx;
 }
 
 // Constructor
 MementoAppServerTsx::MementoAppServerTsx(
                      CallListStoreProcessor* call_list_store_processor,
-                     std::string& service_name,
-                     std::string& home_domain) :
+                     const std::string& service_name,
+                     const std::string& home_domain,
+                     DialogTable* dialog_table) :
     AppServerTsx(),
     _call_list_store_processor(call_list_store_processor),
     _service_name(service_name),
     _home_domain(home_domain),
-    _outgoing(false),
-    _start_time_xml(""),
-    _start_time_cassandra(""),
-    _caller_name(""),
-    _caller_uri(""),
-    _callee_name(""),
-    _callee_uri(""),
-    _answerer_name(""),
-    _answerer_uri(""),
+    _dialog_table(dialog_table),
+    _request(NULL),
     _stored_entry(false),
-    _unique_id(""),
-    _impu(""),
     _includes_initial_request(false)
 {
 }
 
 // Destructor
-MementoAppServerTsx::~MementoAppServerTsx() {}
+MementoAppServerTsx::~MementoAppServerTsx()
+{
+  if (_request != NULL)
+  {
+    // The call never got a final response, so there's nothing to write.
+    _call_list_store_processor->release_request(_request);
+  }
+}
+
+void* MementoAppServerTsx::operator new(size_t size)
+{
+  // Subclasses are bigger than the slab's blocks, so go to the heap.
+  if (size != sizeof(MementoAppServerTsx))
+  {
+    return ::operator new(size);
+  }
+
+  return ThreadSlab<MementoAppServerTsx>::alloc();
+}
+
+void MementoAppServerTsx::operator delete(void* p, size_t size)
+{
+  if (p == NULL)
+  {
+    return;
+  }
+
+  if (size != sizeof(MementoAppServerTsx))
+  {
+    ::operator delete(p);
+    return;
+  }
+
+  ThreadSlab<MementoAppServerTsx>::release(p);
+}
 
 void MementoAppServerTsx::on_initial_request(pjsip_msg* req)
 {
@@ -163,23 +251,26 @@ void MementoAppServerTsx::on_initial_request(pjsip_msg* req)
   // Mark that memento should care about this transaction's response.
   _includes_initial_request = true;
 
+  // The details of the call go straight into the request that will write
+  // its fragment.
+  CallListStoreProcessor::CallListRequest* request =
+                                      _call_list_store_processor->get_request();
+  CallListEntry& entry = request->entry;
+
   // Get the current time
-  time_t rawtime;
-  time(&rawtime);
-  tm* start_time = localtime(&rawtime);
-  _start_time_xml = create_formatted_timestamp(start_time, XML_PATTERN);
-  _start_time_cassandra = create_formatted_timestamp(start_time, TIMESTAMP_PATTERN);
+  time(&entry.start_time);
+  TimestampCache::format_cassandra(entry.start_time,
+                                   false,
+                                   request->fragment.timestamp);
+
+  MementoHeaders headers;
+  scan_headers(req, headers);
 
   // Is the call originating or terminating?
-  std::string served_user;
-  pjsip_routing_hdr* psu_hdr = (pjsip_routing_hdr*)
-                     pjsip_msg_find_hdr_by_name(req, &P_SERVED_USER, NULL);
+  pjsip_routing_hdr* psu_hdr = headers.p_served_user;
 
   if (psu_hdr != NULL)
   {
-    pjsip_uri* uri = (pjsip_uri*)pjsip_uri_get_uri(&psu_hdr->name_addr);
-    served_user = uri_to_string(PJSIP_URI_IN_ROUTING_HDR, uri);
-
     pjsip_param* sescase = pjsip_param_find(&psu_hdr->other_param, &SESCASE);
     pjsip_param* orig_cdiv = pjsip_param_find(&psu_hdr->other_param, &ORIG_CDIV);
 
@@ -193,68 +284,90 @@ void MementoAppServerTsx::on_initial_request(pjsip_msg* req)
       // invoking memento on orig-cdiv in their IFCs.
       TRC_DEBUG("Request is originating");
 
-      _outgoing = true;
+      entry.outgoing = true;
     }
   }
 
-  // Get the caller, callee and impu values
-  if (_outgoing)
+  // Get the caller, callee and impu values. These are printed straight into
+  // the request.
+  if (entry.outgoing)
   {
     // Get the callee's URI amd name from the To header.
-    _callee_uri = uri_to_string(PJSIP_URI_IN_FROMTO_HDR,
-                    (pjsip_uri*)pjsip_uri_get_uri(PJSIP_MSG_TO_HDR(req)->uri));
-    _callee_name = pj_str_to_string(&((pjsip_name_addr*)
-                                       (PJSIP_MSG_TO_HDR(req)->uri))->display);
+    print_uri(PJSIP_URI_IN_FROMTO_HDR,
+              (pjsip_uri*)pjsip_uri_get_uri(PJSIP_MSG_TO_HDR(req)->uri),
+              entry.callee_uri);
+    assign_pj_str(entry.callee_name,
+                  ((pjsip_name_addr*)(PJSIP_MSG_TO_HDR(req)->uri))->display);
 
     // Get the caller's URI and name from the P-Asserted Identity header. If
     // this is missing, use the From header.
-    pjsip_routing_hdr* asserted_id = (pjsip_routing_hdr*)
-               pjsip_msg_find_hdr_by_name(req, &P_ASSERTED_IDENTITY, NULL);
+    pjsip_routing_hdr* asserted_id = headers.p_asserted_identity;
 
     if (asserted_id != NULL)
     {
-      _caller_uri = uri_to_string(PJSIP_URI_IN_FROMTO_HDR,
-                       (pjsip_uri*)pjsip_uri_get_uri(&asserted_id->name_addr));
-      _caller_name = pj_str_to_string(&asserted_id->name_addr.display);
+      print_uri(PJSIP_URI_IN_FROMTO_HDR,
+                (pjsip_uri*)pjsip_uri_get_uri(&asserted_id->name_addr),
+                entry.caller_uri);
+      assign_pj_str(entry.caller_name, asserted_id->name_addr.display);
     }
     else
     {
       TRC_WARNING("INVITE missing P-Asserted-Identity");
+      _call_list_store_processor->release_request(request);
       send_request(req);
       return;
     }
 
     // Set the IMPU equal to the caller's URI
-    _impu = _caller_uri;
+    request->impu = entry.caller_uri;
   }
   else
   {
     // Get the callee's URI from the request URI. There can be no name value.
-    _callee_uri =  uri_to_string(PJSIP_URI_IN_FROMTO_HDR, req->line.req.uri);
+    print_uri(PJSIP_URI_IN_FROMTO_HDR, req->line.req.uri, entry.callee_uri);
 
     // Get the caller's URI and name from the From header.
-    _caller_uri = uri_to_string(PJSIP_URI_IN_FROMTO_HDR,
-                (pjsip_uri*)pjsip_uri_get_uri(PJSIP_MSG_FROM_HDR(req)->uri));
-    _caller_name = pj_str_to_string(&((pjsip_name_addr*)
-                                   (PJSIP_MSG_FROM_HDR(req)->uri))->display);
+    print_uri(PJSIP_URI_IN_FROMTO_HDR,
+              (pjsip_uri*)pjsip_uri_get_uri(PJSIP_MSG_FROM_HDR(req)->uri),
+              entry.caller_uri);
+    assign_pj_str(entry.caller_name,
+                  ((pjsip_name_addr*)(PJSIP_MSG_FROM_HDR(req)->uri))->display);
 
     // Set the IMPU equal to the callee's URI
-    _impu = _callee_uri;
+    request->impu = entry.callee_uri;
   }
 
-  // Add a unique ID containing the IMPU to the record route header.
-  // This has the format:
-  //     <YYYYMMDDHHMMSS>_<unique_id>_<base64 encoded impu>.memento.<home domain>
-  _unique_id = std::to_string(Utils::generate_unique_integer(0,0));
-  std::string encoded_impu =
-     base64_encode(reinterpret_cast<const unsigned char*>(_impu.c_str()),
-                                                          _impu.length());
-  std::string dialog_id = std::string(_start_time_cassandra).
-                          append("_").
-                          append(_unique_id).
-                          append("_").
-                          append(encoded_impu);
+  // Add a token identifying the call to the record route header. This
+  // carries the start time, unique ID and IMPU (or, with the dialog table
+  // enabled, just the key for them) - see dialog_token.h.
+  uint64_t unique_id = Utils::generate_unique_integer(0,0);
+  char unique_id_str[24];
+  int unique_id_len = snprintf(unique_id_str,
+                               sizeof(unique_id_str),
+                               "%lu",
+                               (unsigned long)unique_id);
+  request->fragment.id.assign(unique_id_str, unique_id_len);
+
+  std::string dialog_id;
+
+  if (_dialog_table != NULL)
+  {
+    DialogDetails details;
+    details.timestamp = request->fragment.timestamp;
+    details.id = request->fragment.id;
+    details.impu = request->impu;
+    DialogToken::encode_key(_dialog_table->add(details), dialog_id);
+  }
+  else
+  {
+    DialogToken::encode(entry.start_time,
+                        unique_id,
+                        request->impu.data(),
+                        request->impu.length(),
+                        dialog_id);
+  }
 
+  _request = request;
   add_to_dialog(dialog_id);
   send_request(req);
 }
@@ -270,60 +383,36 @@ void MementoAppServerTsx::on_in_dialog_request(pjsip_msg* req)
     return;
   }
 
-  // Get the dialog id. It has the format:
-  //  <YYYYMMDDHHMMSS>_<unique_id>_<base64 encoded impu>
+  // Decode the dialog token straight into the request, and record the
+  // current time as the end time of the call. The XML is rendered from this
+  // on a memento worker thread.
+  CallListStoreProcessor::CallListRequest* request =
+                                      _call_list_store_processor->get_request();
   std::string dialogid = dialog_id();
 
-  // Pull out the timestamp, id and IMPU.
-  std::vector<std::string> dialog_values;
-  Utils::split_string(dialogid, '_', dialog_values, 3, false);
-
-  if (dialog_values.size() != 3)
+  if (!DialogToken::decode(dialogid,
+                           _dialog_table,
+                           request->fragment.timestamp,
+                           request->fragment.id,
+                           request->impu))
   {
     // LCOV_EXCL_START
     TRC_WARNING("Invalid dialog ID (%s)", dialogid.c_str());
+    _call_list_store_processor->release_request(request);
     send_request(req);
     return;
     // LCOV_EXCL_STOP
   }
 
-  std::string timestamp = dialog_values[0];
-  _unique_id = dialog_values[1];
-  _impu = base64_decode(dialog_values[2]);
-
-  // Create the XML. XML should be of the form:
-  //   <end-time><current time></end-time>
-
-  // Get the current time
-  time_t currenttime;
-  time(&currenttime);
-  tm* ct = localtime(&currenttime);
-
-  // Create the XML
-  rapidxml::xml_document<> doc;
-  std::string end_timestamp = create_formatted_timestamp(ct, XML_PATTERN);
-
-  rapidxml::xml_node<>* root = doc.allocate_node(
-                                  rapidxml::node_element,
-                                  MementoXML::END_TIME,
-                                  doc.allocate_string(end_timestamp.c_str()));
-  doc.append_node(root);
-
-  char contents[MAX_CALL_ENTRY_LENGTH] = {0};
-  char* end = rapidxml::print(contents, doc);
-  *end = 0;
+  request->fragment.type = CallListStore::CallFragment::Type::END;
+  time(&request->entry.end_time);
+  request->trail = trail();
 
   // Write the call list entry to the call list store.
   SAS::Event event(trail(), SASEvent::CALL_LIST_END_FRAGMENT, 0);
   SAS::report_event(event);
 
-  _call_list_store_processor->write_call_list_entry(
-                                        _impu,
-                                        timestamp,
-                                        _unique_id,
-                                        CallListStore::CallFragment::Type::END,
-                                        contents,
-                                        trail());
+  _call_list_store_processor->write_call_list_entry(request);
 
   send_request(req);
 }
@@ -332,11 +421,14 @@ void MementoAppServerTsx::on_response(pjsip_msg* rsp, int fork_id)
 {
   TRC_DEBUG("Memento processing a response");
 
-  pjsip_cseq_hdr* cseq = (pjsip_cseq_hdr*)pjsip_msg_find_hdr(rsp,
-                                                             PJSIP_H_CSEQ,
-                                                             NULL);
+  MementoHeaders headers;
+  scan_headers(rsp, headers);
+  pjsip_cseq_hdr* cseq = headers.cseq;
 
-  if (cseq == NULL || cseq->method.id != PJSIP_INVITE_METHOD || !_includes_initial_request)
+  if (cseq == NULL ||
+      cseq->method.id != PJSIP_INVITE_METHOD ||
+      !_includes_initial_request ||
+      _request == NULL)
   {
     // Response isn't for the initial INVITE, do nothing
     send_response(rsp);
@@ -361,118 +453,26 @@ void MementoAppServerTsx::on_response(pjsip_msg* rsp, int fork_id)
      _stored_entry = true;
   }
 
-  // Create the XML. The XML should have the format:
-  //  <to>
-  //    <URI>_callee_uri</URI>
-  //    <name>_callee_name</name> - may be absent
-  //  </to>
-  //  <from>
-  //    <URI>_caller_uri</URI>
-  //    <name>_caller_name</name> - may be absent
-  //  </from>
-  //  <answered>_answered</answered>
-  //  <outgoing>_outgoing</outgoing>
-  //  <start-time>_start_time</start-time>
-  //  <answer-time><current time></answer-time> - Only present if
-  //                                              call was answered
-  //  <answerer> - may be absent
-  //    <URI>_answerer_uri</URI>
-  //    <name>_answerer_name</name> - may be absent
-  //  </answerer>
-  rapidxml::xml_document<> doc;
-
-  // Fill in the 'to' values from the callee values.
-  rapidxml::xml_node<>* to = doc.allocate_node(rapidxml::node_element,
-                                               MementoXML::TO);
-  rapidxml::xml_node<>* to_uri = doc.allocate_node(
-                                      rapidxml::node_element,
-                                      MementoXML::URI,
-                                      doc.allocate_string(_callee_uri.c_str()));
-  to->append_node(to_uri);
-
-  if (_callee_name != "")
-  {
-    rapidxml::xml_node<>* to_name = doc.allocate_node(
-                                      rapidxml::node_element,
-				      MementoXML::NAME,
-                                      doc.allocate_string(_callee_name.c_str()));
-    to->append_node(to_name);
-  }
-
-  doc.append_node(to);
-
-  // Fill in the 'from' values from the caller values.
-  rapidxml::xml_node<>* from = doc.allocate_node(rapidxml::node_element,
-                                                 MementoXML::FROM);
-  rapidxml::xml_node<>* from_uri = doc.allocate_node(
-                                        rapidxml::node_element,
-					MementoXML::URI,
-                                        doc.allocate_string(_caller_uri.c_str()));
-  from->append_node(from_uri);
-
-  if (_caller_name != "")
-  {
-    rapidxml::xml_node<>* from_name = doc.allocate_node(
-                                        rapidxml::node_element,
-					MementoXML::NAME,
-					doc.allocate_string(_caller_name.c_str()));
-    from->append_node(from_name);
-  }
-
-  doc.append_node(from);
-
-  // Set outgoing to 1 if the call is outgoing, and 0 otherwise.
-  std::string outgoing_str = _outgoing ? "1" : "0";
-  rapidxml::xml_node<>* outgoing = doc.allocate_node(
-                                         rapidxml::node_element,
-					 MementoXML::OUTGOING,
-                                         doc.allocate_string(outgoing_str.c_str()));
-  doc.append_node(outgoing);
-
-  // Set the start time.
-  rapidxml::xml_node<>* start_time = doc.allocate_node(
-                                      rapidxml::node_element,
-                                      MementoXML::START_TIME,
-                                      doc.allocate_string(_start_time_xml.c_str()));
-  doc.append_node(start_time);
-
+  // Fill in the remaining details of the call. The XML is rendered from these
+  // on a memento worker thread (see render_call_list_xml).
+  CallListEntry& entry = _request->entry;
   CallListStore::CallFragment::Type type;
 
   if (rsp->line.status.code >= 300)
   {
-    // If the call was rejected, set answered to 0.
-    rapidxml::xml_node<>* answered = doc.allocate_node(rapidxml::node_element,
-                                                       MementoXML::ANSWERED,
-                                                       "0");
-    doc.append_node(answered);
     type = CallListStore::CallFragment::Type::REJECTED;
   }
   else
   {
-    // If the call was answered, set answered to 1. Also fill in the answer time
-    // with the current time.
-    rapidxml::xml_node<>* answered = doc.allocate_node(rapidxml::node_element,
-                                                       MementoXML::ANSWERED,
-                                                       "1");
-    doc.append_node(answered);
-
-    time_t currenttime;
-    time(&currenttime);
-    tm* ct = localtime(&currenttime);
-    std::string answer_timestamp = create_formatted_timestamp(ct, XML_PATTERN);
-    rapidxml::xml_node<>* answer_time = doc.allocate_node(
-                                      rapidxml::node_element,
-                                      MementoXML::ANSWER_TIME,
-                                      doc.allocate_string(answer_timestamp.c_str()));
-    doc.append_node(answer_time);
+    // The call was answered, so fill in the answer time with the current
+    // time.
+    time(&entry.answer_time);
 
     // Also, pick up the answerer from the P-A-I header, as long as the
     // responder hasn't requested this to be private.  Look for the 'id'
     // value in the Privacy header.
     bool privacy_requested = false;
-    pj_str_t privacy_hdr_name = pj_str(const_cast<char*>("Privacy"));
-    pjsip_generic_string_hdr* privacy = (pjsip_generic_string_hdr*)
-                    pjsip_msg_find_hdr_by_name(rsp, &privacy_hdr_name, NULL);
+    pjsip_generic_string_hdr* privacy = headers.privacy;
 
     if (privacy)
     {
@@ -485,44 +485,20 @@ void MementoAppServerTsx::on_response(pjsip_msg* rsp, int fork_id)
 
     if (!privacy_requested)
     {
-      pjsip_routing_hdr* asserted_id = (pjsip_routing_hdr*)
-                 pjsip_msg_find_hdr_by_name(rsp, &P_ASSERTED_IDENTITY, NULL);
+      pjsip_routing_hdr* asserted_id = headers.p_asserted_identity;
 
       if (asserted_id != NULL)
       {
-        _answerer_uri = uri_to_string(PJSIP_URI_IN_FROMTO_HDR,
-                         (pjsip_uri*)pjsip_uri_get_uri(&asserted_id->name_addr));
-        _answerer_name = pj_str_to_string(&asserted_id->name_addr.display);
-
-        // Fill in the 'answerer' values from the answerer values.
-        rapidxml::xml_node<>* answerer = doc.allocate_node(rapidxml::node_element,
-                                                           MementoXML::ANSWERER);
-        rapidxml::xml_node<>* answerer_uri = doc.allocate_node(
-                                       rapidxml::node_element,
-                                       MementoXML::URI,
-                                       doc.allocate_string(_answerer_uri.c_str()));
-        answerer->append_node(answerer_uri);
-
-        if (!_answerer_name.empty())
-        {
-          rapidxml::xml_node<>* answerer_name = doc.allocate_node(
-                                      rapidxml::node_element,
-                                      MementoXML::NAME,
-                                      doc.allocate_string(_answerer_name.c_str()));
-          answerer->append_node(answerer_name);
-        }
-
-        doc.append_node(answerer);
+        print_uri(PJSIP_URI_IN_FROMTO_HDR,
+                  (pjsip_uri*)pjsip_uri_get_uri(&asserted_id->name_addr),
+                  entry.answerer_uri);
+        assign_pj_str(entry.answerer_name, asserted_id->name_addr.display);
       }
     }
 
     type = CallListStore::CallFragment::Type::BEGIN;
   }
 
-  char contents[MAX_CALL_ENTRY_LENGTH] = {0};
-  char* end = rapidxml::print(contents, doc);
-  *end = 0;
-
   // Log to SAS
   if (type == CallListStore::CallFragment::Type::BEGIN)
   {
@@ -535,13 +511,13 @@ void MementoAppServerTsx::on_response(pjsip_msg* rsp, int fork_id)
     SAS::report_event(event);
   }
 
-  // Write the XML to cassandra (using a different thread)
-  _call_list_store_processor->write_call_list_entry(_impu,
-                                                    _start_time_cassandra,
-                                                    _unique_id,
-                                                    type,
-                                                    contents,
-                                                    trail());
+  // Write the call list entry to cassandra (using a different thread). The
+  // request already holds the details of the call, so it's handed over as
+  // it is.
+  _request->fragment.type = type;
+  _request->trail = trail();
+  _call_list_store_processor->write_call_list_entry(_request);
+  _request = NULL;
 
   send_response(rsp);
 }
@@ -555,26 +531,6 @@ std::string create_formatted_timestamp(tm* timestamp,
   return std::string(formatted_time);
 }
 
-std::string uri_to_string(pjsip_uri_context_e context,
-                          const pjsip_uri* uri)
-{
-  int uri_clen = 0;
-  char uri_cstr[500];
-
-  if (uri != NULL)
-  {
-    uri_clen = pjsip_uri_print(context, uri, uri_cstr, sizeof(uri_cstr));
-  }
-
-  return std::string(uri_cstr, uri_clen);
-}
-
-std::string pj_str_to_string(const pj_str_t* pjstr)
-{
-  return ((pjstr != NULL) && (pj_strlen(pjstr) > 0)) ?
-              std::string(pj_strbuf(pjstr), pj_strlen(pjstr)) : std::string("");
-}
-
 pjsip_uri* uri_from_string(const std::string& uri_s,
                            pj_pool_t* pool,
                            pj_bool_t force_name_addr)
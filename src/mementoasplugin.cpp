@@ -9,14 +9,29 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#include <algorithm>
+
 #include "cfgoptions.h"
 #include "sproutletplugin.h"
 #include "mementoappserver.h"
 #include "call_list_store.h"
+#include "bucketed_call_list_store.h"
+#include "cluster_communication_monitor.h"
+#include "cql_call_list_store.h"
+#include "deadline_call_list_store.h"
+#include "local_call_list_store.h"
+#include "sharded_call_list_store.h"
+#include "trim_ownership.h"
 #include "sproutletappserver.h"
 #include "memento_as_alarmdefinition.h"
+#include "utils.h"
 #include "log.h"
 
+// zstd compression level for call fragments. Fragments are small, so
+// higher levels gain very little for the extra CPU.
+static const int CALL_FRAGMENT_COMPRESSION_LEVEL = 3;
+static const int CQL_TIMEOUT_MS = 1000;
+
 void set_memento_opt_str(std::multimap<std::string, std::string>& memento_opts,
                          std::string opt_name,
                          bool required_opt,
@@ -109,6 +124,16 @@ void set_memento_opt_int(std::multimap<std::string, std::string>& memento_opts,
   }
 }
 
+// Whether the call list readers can decode a call fragment format, going by
+// the comma-separated list in call_fragment_reader_formats.
+static bool reader_supports(const std::string& reader_formats,
+                            const std::string& format)
+{
+  std::vector<std::string> formats;
+  Utils::split_string(reader_formats, ',', formats, 0, true);
+  return (std::find(formats.begin(), formats.end(), format) != formats.end());
+}
+
 class MementoPlugin : public SproutletPlugin
 {
 public:
@@ -120,8 +145,13 @@ public:
 
 private:
   CassandraResolver* _cass_resolver;
-  CommunicationMonitor* _cass_comm_monitor;
+  BaseCommunicationMonitor* _cass_comm_monitor;
+  ClusterCommunicationMonitor* _cass_cluster_monitor;
+  CqlCallListStore::Statistics* _cql_stats;
   CallListStore::Store* _call_list_store;
+  NotifyCircuitBreaker* _notify_circuit_breaker;
+  CallFragmentCompressor* _fragment_compressor;
+  TrimOwnership* _trim_ownership;
   MementoAppServer* _memento;
   SproutletAppServerShim* _memento_sproutlet;
 };
@@ -134,7 +164,12 @@ MementoPlugin sproutlet_plugin;
 
 MementoPlugin::MementoPlugin() :
   _cass_comm_monitor(NULL),
+  _cass_cluster_monitor(NULL),
+  _cql_stats(NULL),
   _call_list_store(NULL),
+  _notify_circuit_breaker(NULL),
+  _fragment_compressor(NULL),
+  _trim_ownership(NULL),
   _memento(NULL),
   _memento_sproutlet(NULL)
 {
@@ -155,6 +190,9 @@ bool MementoPlugin::load(struct options& opt, std::list<Sproutlet*>& sproutlets)
 
   int memento_threads = 25;
   std::string memento_notify_url = "";
+  int memento_notify_latency_budget_us = 500000;
+  int memento_notify_failure_threshold = 5;
+  int memento_notify_open_time_ms = 10000;
   int max_call_list_length = 0;
   int call_list_ttl = 604800;
 
@@ -163,6 +201,35 @@ bool MementoPlugin::load(struct options& opt, std::list<Sproutlet*>& sproutlets)
 
   std::string cassandra = "localhost";
   int cass_target_latency_us = 1000000;
+  std::string call_fragment_encoding = "xml";
+  CallFragmentCodec::Encoding fragment_encoding = CallFragmentCodec::XML;
+  std::string call_fragment_reader_formats = "xml";
+  std::string call_fragment_compression = "none";
+  std::string call_fragment_dictionary =
+    "/etc/clearwater/call_fragment_dictionary";
+  int memento_begin_hold_ms = 0;
+  int memento_flood_max_rejected_calls = 0;
+  int memento_flood_window_s = 60;
+  int memento_dialog_table_size = 0;
+  int memento_call_list_bucket_hours = 0;
+  std::string memento_cassandra_protocol = "thrift";
+  int memento_cql_port = 9042;
+  int memento_cql_connections = 2;
+  int memento_cql_token_aware = 1;
+  int memento_cql_hedge_percentile = 0;
+  int memento_cql_hedge_budget_percent = 5;
+  std::string memento_cql_write_consistency = "one";
+  Cql::Consistency cql_write_consistency = Cql::ONE;
+  std::string memento_cql_read_consistency = "one";
+  Cql::Consistency cql_read_consistency = Cql::ONE;
+  int memento_cql_degrade_latency_ms = 0;
+  int memento_cql_degrade_error_percent = 0;
+  int memento_cql_prewarm_connections = 0;
+  int memento_cass_deadline_threads = 0;
+  std::string memento_cassandra_shards_file = "";
+  std::string memento_local_store_file = "";
+  int memento_call_list_view = 0;
+  std::string memento_trim_nodes_file = "";
 
   std::map<std::string, std::multimap<std::string, std::string>>::iterator
     memento_it = opt.plugin_options.find(plugin_name);
@@ -217,6 +284,24 @@ bool MementoPlugin::load(struct options& opt, std::list<Sproutlet*>& sproutlets)
                         memento_notify_url,
                         memento_enabled);
 
+    set_memento_opt_int(memento_opts,
+                        "memento_notify_latency_budget_us",
+                        false,
+                        memento_notify_latency_budget_us,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_notify_failure_threshold",
+                        false,
+                        memento_notify_failure_threshold,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_notify_open_time_ms",
+                        false,
+                        memento_notify_open_time_ms,
+                        memento_enabled);
+
     set_memento_opt_str(memento_opts,
                         "cassandra",
                         false,
@@ -241,6 +326,280 @@ bool MementoPlugin::load(struct options& opt, std::list<Sproutlet*>& sproutlets)
                         cass_target_latency_us,
                         memento_enabled);
 
+    set_memento_opt_str(memento_opts,
+                        "call_fragment_encoding",
+                        false,
+                        call_fragment_encoding,
+                        memento_enabled);
+
+    if ((memento_enabled) &&
+        (!CallFragmentCodec::parse_encoding(call_fragment_encoding,
+                                            fragment_encoding)))
+    {
+      TRC_ERROR("Unknown call_fragment_encoding '%s' - disabling Memento",
+                call_fragment_encoding.c_str());
+      memento_enabled = false;
+    }
+
+    set_memento_opt_str(memento_opts,
+                        "call_fragment_reader_formats",
+                        false,
+                        call_fragment_reader_formats,
+                        memento_enabled);
+
+    // The call lists are read by a separate Ut server, so only write
+    // fragments it has been upgraded to decode.
+    if ((fragment_encoding == CallFragmentCodec::BINARY) &&
+        (!reader_supports(call_fragment_reader_formats, "binary")))
+    {
+      TRC_ERROR("call_fragment_encoding is binary, but call_fragment_reader_formats "
+                "doesn't include binary - storing XML");
+      fragment_encoding = CallFragmentCodec::XML;
+    }
+
+    set_memento_opt_str(memento_opts,
+                        "call_fragment_compression",
+                        false,
+                        call_fragment_compression,
+                        memento_enabled);
+
+    set_memento_opt_str(memento_opts,
+                        "call_fragment_dictionary",
+                        false,
+                        call_fragment_dictionary,
+                        memento_enabled);
+
+    if ((memento_enabled) &&
+        (call_fragment_compression != "none") &&
+        (call_fragment_compression != "zstd"))
+    {
+      TRC_ERROR("Unknown call_fragment_compression '%s' - disabling Memento",
+                call_fragment_compression.c_str());
+      memento_enabled = false;
+    }
+
+    if ((call_fragment_compression == "zstd") &&
+        (!reader_supports(call_fragment_reader_formats, "zstd")))
+    {
+      TRC_ERROR("call_fragment_compression is zstd, but call_fragment_reader_formats "
+                "doesn't include zstd - storing uncompressed fragments");
+      call_fragment_compression = "none";
+    }
+
+    set_memento_opt_int(memento_opts,
+                        "memento_begin_hold_ms",
+                        false,
+                        memento_begin_hold_ms,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_flood_max_rejected_calls",
+                        false,
+                        memento_flood_max_rejected_calls,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_flood_window_s",
+                        false,
+                        memento_flood_window_s,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_dialog_table_size",
+                        false,
+                        memento_dialog_table_size,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_call_list_bucket_hours",
+                        false,
+                        memento_call_list_bucket_hours,
+                        memento_enabled);
+
+    set_memento_opt_str(memento_opts,
+                        "memento_cassandra_protocol",
+                        false,
+                        memento_cassandra_protocol,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cql_port",
+                        false,
+                        memento_cql_port,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cql_connections",
+                        false,
+                        memento_cql_connections,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cql_token_aware",
+                        false,
+                        memento_cql_token_aware,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cql_hedge_percentile",
+                        false,
+                        memento_cql_hedge_percentile,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cql_hedge_budget_percent",
+                        false,
+                        memento_cql_hedge_budget_percent,
+                        memento_enabled);
+
+    set_memento_opt_str(memento_opts,
+                        "memento_cql_write_consistency",
+                        false,
+                        memento_cql_write_consistency,
+                        memento_enabled);
+
+    set_memento_opt_str(memento_opts,
+                        "memento_cql_read_consistency",
+                        false,
+                        memento_cql_read_consistency,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cql_degrade_latency_ms",
+                        false,
+                        memento_cql_degrade_latency_ms,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cql_degrade_error_percent",
+                        false,
+                        memento_cql_degrade_error_percent,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cql_prewarm_connections",
+                        false,
+                        memento_cql_prewarm_connections,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_cass_deadline_threads",
+                        false,
+                        memento_cass_deadline_threads,
+                        memento_enabled);
+
+    set_memento_opt_str(memento_opts,
+                        "memento_cassandra_shards_file",
+                        false,
+                        memento_cassandra_shards_file,
+                        memento_enabled);
+
+    set_memento_opt_str(memento_opts,
+                        "memento_local_store_file",
+                        false,
+                        memento_local_store_file,
+                        memento_enabled);
+
+    set_memento_opt_int(memento_opts,
+                        "memento_call_list_view",
+                        false,
+                        memento_call_list_view,
+                        memento_enabled);
+
+    set_memento_opt_str(memento_opts,
+                        "memento_trim_nodes_file",
+                        false,
+                        memento_trim_nodes_file,
+                        memento_enabled);
+
+    if ((memento_cassandra_protocol != "thrift") &&
+        (memento_cassandra_protocol != "cql"))
+    {
+      TRC_ERROR("Unknown Cassandra protocol %s - using Thrift",
+                memento_cassandra_protocol.c_str());
+      memento_cassandra_protocol = "thrift";
+    }
+
+    if ((memento_cql_hedge_percentile < 0) ||
+        (memento_cql_hedge_percentile > 100))
+    {
+      TRC_ERROR("Invalid CQL hedge percentile %d - not hedging",
+                memento_cql_hedge_percentile);
+      memento_cql_hedge_percentile = 0;
+    }
+
+    if (!ConsistencyPolicy::parse(memento_cql_write_consistency,
+                                  cql_write_consistency))
+    {
+      TRC_ERROR("Unknown CQL write consistency level %s - using one",
+                memento_cql_write_consistency.c_str());
+    }
+
+    if (!ConsistencyPolicy::parse(memento_cql_read_consistency,
+                                  cql_read_consistency))
+    {
+      TRC_ERROR("Unknown CQL read consistency level %s - using one",
+                memento_cql_read_consistency.c_str());
+    }
+
+    if ((memento_cql_degrade_latency_ms < 0) ||
+        (memento_cql_degrade_error_percent < 0) ||
+        (memento_cql_degrade_error_percent > 100))
+    {
+      TRC_ERROR("Invalid CQL consistency thresholds (%d ms, %d%%) - not degrading",
+                memento_cql_degrade_latency_ms,
+                memento_cql_degrade_error_percent);
+      memento_cql_degrade_latency_ms = 0;
+      memento_cql_degrade_error_percent = 0;
+    }
+
+    if (memento_cql_prewarm_connections < 0)
+    {
+      TRC_ERROR("Invalid CQL prewarm connections %d - not prewarming",
+                memento_cql_prewarm_connections);
+      memento_cql_prewarm_connections = 0;
+    }
+    else if (memento_cql_prewarm_connections > memento_cql_connections)
+    {
+      // There are only so many connections to prewarm.
+      memento_cql_prewarm_connections = memento_cql_connections;
+    }
+
+    if ((!memento_local_store_file.empty()) &&
+        (!memento_cassandra_shards_file.empty()))
+    {
+      TRC_ERROR("Can't shard a local call list store - ignoring %s",
+                memento_cassandra_shards_file.c_str());
+      memento_cassandra_shards_file = "";
+    }
+
+    if ((memento_call_list_view != 0) &&
+        ((memento_cassandra_protocol != "cql") ||
+         (!memento_local_store_file.empty()) ||
+         (!memento_cassandra_shards_file.empty())))
+    {
+      TRC_ERROR("Call list views need an unsharded CQL call list store - not keeping views");
+      memento_call_list_view = 0;
+    }
+
+    if ((memento_call_list_bucket_hours > 0) && (call_list_ttl == 0))
+    {
+      TRC_ERROR("Can't bucket the call list store without a call list TTL - using the standard layout");
+      memento_call_list_bucket_hours = 0;
+    }
+    else if ((memento_call_list_bucket_hours > 0) &&
+             (!BucketedCallListStore::valid_period(memento_call_list_bucket_hours * 3600,
+                                                   call_list_ttl)))
+    {
+      // Every read covers each bucket in the TTL, so don't allow short
+      // buckets with a long TTL.
+      TRC_ERROR("Call list buckets of %d hours with a TTL of %d seconds would need more than %d reads for each call list - using the standard layout",
+                memento_call_list_bucket_hours,
+                call_list_ttl,
+                BucketedCallListStore::MAX_BUCKETS);
+      memento_call_list_bucket_hours = 0;
+    }
+
     if (((max_call_list_length == 0) &&
          (call_list_ttl == 0)))
     {
@@ -257,13 +616,6 @@ bool MementoPlugin::load(struct options& opt, std::list<Sproutlet*>& sproutlets)
                                                                                                                                "1.2.826.0.1.1578918.9.8.1.4");
     SNMP::SuccessFailCountByRequestTypeTable* outgoing_sip_transactions_tbl = SNMP::SuccessFailCountByRequestTypeTable::create("memento_as_outgoing_sip_transactions",
                                                                                                                                "1.2.826.0.1.1578918.9.8.1.5");
-    _cass_comm_monitor = new CommunicationMonitor(new Alarm(alarm_manager,
-                                                            "memento",
-                                                            AlarmDef::MEMENTO_AS_CASSANDRA_COMM_ERROR,
-                                                            AlarmDef::CRITICAL),
-                                                  "Memento",
-                                                  "Cassandra");
-
     // We need the address family for the CassandraResolver
     int af = AF_INET;
     struct in6_addr dummy_addr;
@@ -280,8 +632,249 @@ bool MementoPlugin::load(struct options& opt, std::list<Sproutlet*>& sproutlets)
                                            30,
                                            9160);
 
-    _call_list_store = new CallListStore::Store();
-    _call_list_store->configure_connection(cassandra, 9160, _cass_comm_monitor, _cass_resolver);
+    // Work out which Cassandra clusters to store call lists in. Without a
+    // shard configuration, there's just the one.
+    ShardedCallListStore::Config shards;
+    bool sharded = false;
+
+    if (!memento_cassandra_shards_file.empty())
+    {
+      sharded = ShardedCallListStore::read_config(memento_cassandra_shards_file,
+                                                  shards);
+
+      if (!sharded)
+      {
+        TRC_ERROR("Unable to load Cassandra shards from %s - using %s only",
+                  memento_cassandra_shards_file.c_str(),
+                  cassandra.c_str());
+      }
+    }
+
+    if (!sharded)
+    {
+      shards.clusters.clear();
+      shards.overrides.clear();
+      shards.clusters.push_back(std::make_pair("", cassandra));
+    }
+
+    ShardedCallListStore* sharded_store = sharded ?
+      new ShardedCallListStore(stack_data.stats_aggregator) : NULL;
+    CallListViewStore* call_list_view_store = NULL;
+
+    if (!memento_local_store_file.empty())
+    {
+      TRC_STATUS("Storing call lists locally in %s",
+                 memento_local_store_file.c_str());
+    }
+    else if (memento_cassandra_protocol == "cql")
+    {
+      TRC_STATUS("Using CQL for the call list store");
+    }
+
+    if (memento_call_list_bucket_hours > 0)
+    {
+      TRC_STATUS("Bucketing call lists every %d hours",
+                 memento_call_list_bucket_hours);
+    }
+
+    if (memento_local_store_file.empty())
+    {
+      _cass_comm_monitor =
+        new CommunicationMonitor(new Alarm(alarm_manager,
+                                           "memento",
+                                           AlarmDef::MEMENTO_AS_CASSANDRA_COMM_ERROR,
+                                           AlarmDef::CRITICAL),
+                                 "Memento",
+                                 "Cassandra");
+
+      if (sharded)
+      {
+        // There's one alarm for all the clusters, so it mustn't be cleared
+        // while any of them is failing.
+        _cass_cluster_monitor =
+          new ClusterCommunicationMonitor(_cass_comm_monitor);
+        _cass_comm_monitor = NULL;
+      }
+
+      if (memento_cassandra_protocol == "cql")
+      {
+        _cql_stats =
+          new CqlCallListStore::Statistics(stack_data.stats_aggregator);
+      }
+    }
+
+    for (size_t ii = 0; ii < shards.clusters.size(); ii++)
+    {
+      const std::string& name = shards.clusters[ii].first;
+      const std::string& hosts = shards.clusters[ii].second;
+      BaseCommunicationMonitor* comm_monitor = (_cass_cluster_monitor != NULL) ?
+        _cass_cluster_monitor->add_cluster(name) : _cass_comm_monitor;
+
+      CallListStore::Store* store;
+
+      if (!memento_local_store_file.empty())
+      {
+        LocalCallListStore* local_store =
+          new LocalCallListStore(memento_local_store_file);
+
+        if (!local_store->is_valid())
+        {
+          TRC_ERROR("Unable to open local call list store %s - call lists won't be recorded",
+                    memento_local_store_file.c_str());
+        }
+
+        store = local_store;
+      }
+      else if (memento_cassandra_protocol == "cql")
+      {
+        CqlCallListStore* cql_store =
+          new CqlCallListStore(hosts,
+                               memento_cql_port,
+                               memento_cql_connections,
+                               CQL_TIMEOUT_MS,
+                               (memento_cql_token_aware != 0),
+                               memento_cql_hedge_percentile,
+                               memento_cql_hedge_budget_percent,
+                               cql_write_consistency,
+                               cql_read_consistency,
+                               (uint64_t)memento_cql_degrade_latency_ms * 1000,
+                               memento_cql_degrade_error_percent,
+                               memento_cql_prewarm_connections,
+                               comm_monitor,
+                               _cql_stats,
+                               name);
+
+        if (memento_call_list_view != 0)
+        {
+          TRC_STATUS("Keeping materialized call list views");
+          call_list_view_store = cql_store;
+        }
+
+        store = cql_store;
+      }
+      else
+      {
+        store = new CallListStore::Store();
+        store->configure_connection(hosts, 9160, comm_monitor, _cass_resolver);
+      }
+
+      if (memento_call_list_bucket_hours > 0)
+      {
+        // Split each subscriber's call list into time buckets, to stop
+        // heavy users' rows growing too wide. Reads needn't go back past
+        // the point at which the call list would be trimmed.
+        store = new BucketedCallListStore(store,
+                                          memento_call_list_bucket_hours * 3600,
+                                          call_list_ttl,
+                                          (int)(max_call_list_length * 1.1));
+      }
+
+      if (sharded)
+      {
+        TRC_STATUS("Storing call lists in Cassandra cluster %s (%s)",
+                   name.c_str(),
+                   hosts.c_str());
+        sharded_store->add_cluster(name, store);
+      }
+      else
+      {
+        _call_list_store = store;
+      }
+    }
+
+    if (sharded)
+    {
+      for (std::map<std::string, std::string>::const_iterator it =
+             shards.overrides.begin();
+           it != shards.overrides.end();
+           ++it)
+      {
+        sharded_store->add_override(it->first, it->second);
+      }
+
+      _call_list_store = sharded_store;
+    }
+
+    if (memento_cass_deadline_threads > 0)
+    {
+      // Run store operations on their own threads, so that the memento
+      // worker threads can give up on them when they overrun.
+      TRC_STATUS("Enforcing call list store deadlines with %d threads",
+                 memento_cass_deadline_threads);
+      DeadlineCallListStore* deadline_store =
+        new DeadlineCallListStore(_call_list_store,
+                                  call_list_view_store,
+                                  memento_cass_deadline_threads);
+      _call_list_store = deadline_store;
+
+      if (call_list_view_store != NULL)
+      {
+        call_list_view_store = deadline_store;
+      }
+    }
+
+    if (!memento_notify_url.empty())
+    {
+      // Protect the memento worker threads from a slow or unresponsive
+      // notification target.  Two successful probes close the breaker.
+      _notify_circuit_breaker =
+        new NotifyCircuitBreaker(memento_notify_latency_budget_us,
+                                 memento_notify_failure_threshold,
+                                 memento_notify_open_time_ms,
+                                 2,
+                                 new Alarm(alarm_manager,
+                                           "memento",
+                                           AlarmDef::MEMENTO_AS_NOTIFY_CIRCUIT_OPEN,
+                                           AlarmDef::MAJOR),
+                                 stack_data.stats_aggregator);
+    }
+
+    if (call_fragment_compression == "zstd")
+    {
+      // If the dictionary can't be loaded, carry on storing uncompressed
+      // fragments rather than losing call lists altogether.
+      std::string dictionary;
+
+      if (!CallFragmentCompressor::read_dictionary(call_fragment_dictionary,
+                                                   dictionary))
+      {
+        // read_dictionary has already logged why.
+      }
+      else if (!CallFragmentCompressor::is_trained(dictionary))
+      {
+        TRC_ERROR("%s isn't a trained zstd dictionary - create one with "
+                  "train_call_fragment_dictionary",
+                  call_fragment_dictionary.c_str());
+      }
+      else
+      {
+        _fragment_compressor =
+          new CallFragmentCompressor(dictionary,
+                                     CALL_FRAGMENT_COMPRESSION_LEVEL,
+                                     stack_data.stats_aggregator);
+      }
+
+      if ((_fragment_compressor == NULL) ||
+          (!_fragment_compressor->is_valid()))
+      {
+        TRC_ERROR("Call fragment compression disabled - unable to load %s",
+                  call_fragment_dictionary.c_str());
+        delete _fragment_compressor; _fragment_compressor = NULL;
+      }
+    }
+
+    if ((!memento_trim_nodes_file.empty()) && (max_call_list_length > 0))
+    {
+      // Only trim the call lists this node owns, so that nodes writing
+      // calls for the same subscriber don't all read and trim its list.
+      // Nodes heartbeat through the call list store, so that the lists of
+      // a node that's down are shared out between the rest.
+      TRC_STATUS("Sharing call list trims with the live nodes in %s",
+                 memento_trim_nodes_file.c_str());
+      _trim_ownership = new TrimOwnership(opt.local_host,
+                                          memento_trim_nodes_file,
+                                          _call_list_store);
+    }
 
     _memento = new MementoAppServer(memento_prefix,
                                     _call_list_store,
@@ -297,7 +890,16 @@ bool MementoPlugin::load(struct options& opt, std::list<Sproutlet*>& sproutlets)
                                     opt.max_token_rate,
                                     exception_handler,
                                     http_resolver,
-                                    memento_notify_url);
+                                    memento_notify_url,
+                                    _notify_circuit_breaker,
+                                    fragment_encoding,
+                                    _fragment_compressor,
+                                    memento_begin_hold_ms,
+                                    memento_flood_max_rejected_calls,
+                                    memento_flood_window_s * 1000,
+                                    memento_dialog_table_size,
+                                    call_list_view_store,
+                                    _trim_ownership);
 
     _memento_sproutlet = new SproutletAppServerShim(_memento,
                                                     memento_port,
@@ -319,7 +921,12 @@ void MementoPlugin::unload()
 {
   delete _memento_sproutlet;
   delete _memento;
+  delete _notify_circuit_breaker;
+  delete _fragment_compressor;
+  delete _trim_ownership;
   delete _cass_resolver;
   delete _call_list_store;
+  delete _cql_stats;
+  delete _cass_cluster_monitor;
   delete _cass_comm_monitor;
 }
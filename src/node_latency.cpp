@@ -0,0 +1,45 @@
+/**
+ * @file node_latency.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "node_latency.h"
+
+void NodeLatency::request_finished(uint64_t latency_us)
+{
+  _in_flight--;
+  add_sample(latency_us);
+}
+
+void NodeLatency::request_failed(uint64_t penalty_us)
+{
+  _in_flight--;
+  add_sample(penalty_us);
+}
+
+void NodeLatency::add_sample(uint64_t latency_us)
+{
+  uint64_t old_ewma = _ewma_us.load();
+  uint64_t new_ewma;
+
+  do
+  {
+    // The first sample is taken as is.
+    new_ewma = (old_ewma == 0) ?
+      latency_us :
+      old_ewma + ((int64_t)latency_us - (int64_t)old_ewma) / EWMA_DECAY;
+  }
+  while (!_ewma_us.compare_exchange_weak(old_ewma, new_ewma));
+}
+
+uint64_t NodeLatency::score() const
+{
+  int in_flight = _in_flight.load();
+  return (_ewma_us.load() + 1) * ((in_flight > 0) ? in_flight + 1 : 1);
+}
@@ -0,0 +1,221 @@
+/**
+ * @file notify_circuit_breaker.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "notify_circuit_breaker.h"
+#include "log.h"
+
+/// Constructor.
+NotifyCircuitBreaker::NotifyCircuitBreaker(unsigned long latency_budget_us,
+                                           int failure_threshold,
+                                           int open_time_ms,
+                                           int probes_to_close,
+                                           Alarm* alarm,
+                                           LastValueCache* stats_aggregator) :
+  _latency_budget_us(latency_budget_us),
+  _failure_threshold((failure_threshold > 0) ? failure_threshold : 1),
+  _open_time_ms(open_time_ms),
+  _probes_to_close((probes_to_close > 0) ? probes_to_close : 1),
+  _alarm(alarm),
+  _state(CLOSED),
+  _consecutive_failures(0),
+  _successful_probes(0),
+  _probe_in_progress(false),
+  _generation(0),
+  _opened_at_ms(0),
+  _stat_state("memento_notify_circuit_state", stats_aggregator),
+  _stat_dropped_notifications("memento_notify_dropped", stats_aggregator)
+{
+  pthread_mutex_init(&_lock, NULL);
+
+  std::vector<std::string> value;
+  value.push_back(std::to_string(_state));
+  _stat_state.report_change(value);
+}
+
+/// Destructor.
+NotifyCircuitBreaker::~NotifyCircuitBreaker()
+{
+  pthread_mutex_destroy(&_lock);
+  delete _alarm; _alarm = NULL;
+}
+
+bool NotifyCircuitBreaker::allow_request(uint64_t& ticket)
+{
+  bool allowed = false;
+
+  pthread_mutex_lock(&_lock);
+
+  if (_state == OPEN)
+  {
+    if (current_time_ms() >= _opened_at_ms + _open_time_ms)
+    {
+      // The breaker has been open long enough - start probing the target.
+      TRC_INFO("Notify circuit breaker open period expired, probing target");
+      set_state(HALF_OPEN);
+    }
+  }
+
+  switch (_state)
+  {
+  case CLOSED:
+    allowed = true;
+    break;
+
+  case HALF_OPEN:
+    // Only let one probe through at a time, so that a target that is still
+    // broken can only hold up a single worker thread.
+    if (!_probe_in_progress)
+    {
+      _probe_in_progress = true;
+      _generation++;
+      allowed = true;
+    }
+    break;
+
+  case OPEN:
+    break;
+  }
+
+  ticket = _generation;
+  pthread_mutex_unlock(&_lock);
+
+  if (!allowed)
+  {
+    TRC_DEBUG("Notify circuit breaker not closed, dropping notification");
+    _stat_dropped_notifications.increment();
+  }
+
+  return allowed;
+}
+
+void NotifyCircuitBreaker::request_succeeded(uint64_t ticket,
+                                             unsigned long latency_us)
+{
+  pthread_mutex_lock(&_lock);
+
+  if (ticket != _generation)
+  {
+    // Allowed before the breaker last changed state, so it says nothing
+    // about the target as things stand.
+    TRC_DEBUG("Ignoring stale notification result");
+  }
+  else if (latency_us > _latency_budget_us)
+  {
+    // A notification that takes longer than the budget is as bad as a
+    // failure as far as the worker threads are concerned.
+    TRC_DEBUG("Notification took %luus, over budget of %luus",
+              latency_us,
+              _latency_budget_us);
+    record_failure();
+  }
+  else if (_state == HALF_OPEN)
+  {
+    _probe_in_progress = false;
+    _successful_probes++;
+
+    if (_successful_probes >= _probes_to_close)
+    {
+      TRC_STATUS("Notify target is responding again, closing circuit breaker");
+      set_state(CLOSED);
+    }
+  }
+  else
+  {
+    _consecutive_failures = 0;
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+void NotifyCircuitBreaker::request_failed(uint64_t ticket)
+{
+  pthread_mutex_lock(&_lock);
+
+  if (ticket == _generation)
+  {
+    record_failure();
+  }
+  else
+  {
+    TRC_DEBUG("Ignoring stale notification result");
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+NotifyCircuitBreaker::State NotifyCircuitBreaker::state()
+{
+  pthread_mutex_lock(&_lock);
+  State state = _state;
+  pthread_mutex_unlock(&_lock);
+  return state;
+}
+
+void NotifyCircuitBreaker::record_failure()
+{
+  if (_state == HALF_OPEN)
+  {
+    // The probe failed - the target still isn't healthy.
+    TRC_WARNING("Notify circuit breaker probe failed, re-opening");
+    set_state(OPEN);
+  }
+  else if (_state == CLOSED)
+  {
+    _consecutive_failures++;
+
+    if (_consecutive_failures >= _failure_threshold)
+    {
+      TRC_ERROR("%d consecutive notifications failed or exceeded the latency budget, "
+                "opening circuit breaker",
+                _consecutive_failures);
+      set_state(OPEN);
+    }
+  }
+}
+
+void NotifyCircuitBreaker::set_state(State new_state)
+{
+  if (new_state == _state)
+  {
+    return;
+  }
+
+  _state = new_state;
+  _generation++;
+  _consecutive_failures = 0;
+  _successful_probes = 0;
+  _probe_in_progress = false;
+
+  if (new_state == OPEN)
+  {
+    _opened_at_ms = current_time_ms();
+
+    if (_alarm != NULL)
+    {
+      _alarm->set();
+    }
+  }
+  else if ((new_state == CLOSED) && (_alarm != NULL))
+  {
+    _alarm->clear();
+  }
+
+  std::vector<std::string> value;
+  value.push_back(std::to_string(new_state));
+  _stat_state.report_change(value);
+}
+
+uint64_t NotifyCircuitBreaker::current_time_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
@@ -0,0 +1,292 @@
+/**
+ * @file sharded_call_list_store.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <time.h>
+
+#include "sharded_call_list_store.h"
+#include "log.h"
+
+ShardedCallListStore::ShardedCallListStore(LastValueCache* stats_aggregator) :
+  CallListStore::Store(),
+  _next_publish_ms(0),
+  _stat_shards("memento_call_list_shards", stats_aggregator)
+{
+}
+
+ShardedCallListStore::~ShardedCallListStore()
+{
+  for (std::map<std::string, Cluster*>::iterator it = _clusters.begin();
+       it != _clusters.end();
+       ++it)
+  {
+    delete it->second->store;
+    delete it->second;
+  }
+}
+
+void ShardedCallListStore::add_cluster(const std::string& name,
+                                       CallListStore::Store* store)
+{
+  Cluster* cluster = new Cluster();
+  cluster->store = store;
+  cluster->requests = 0;
+  cluster->failures = 0;
+  _clusters[name] = cluster;
+
+  for (int ii = 0; ii < VIRTUAL_NODES; ii++)
+  {
+    _tokens.push_back(
+      std::make_pair(TokenRing::token(name + "#" + std::to_string(ii)), name));
+  }
+
+  _ring.set(_tokens);
+}
+
+bool ShardedCallListStore::add_override(const std::string& impu,
+                                        const std::string& cluster)
+{
+  if (_clusters.find(cluster) == _clusters.end())
+  {
+    return false;
+  }
+
+  _overrides[impu] = cluster;
+  return true;
+}
+
+const std::string& ShardedCallListStore::cluster(const std::string& impu) const
+{
+  std::map<std::string, std::string>::const_iterator it =
+    _overrides.find(impu);
+
+  if (it != _overrides.end())
+  {
+    return it->second;
+  }
+
+  return _ring.owner(TokenRing::token(impu));
+}
+
+ShardedCallListStore::Cluster* ShardedCallListStore::cluster_for(
+                                                const std::string& impu) const
+{
+  return _clusters.at(cluster(impu));
+}
+
+CassandraStore::ResultCode ShardedCallListStore::write_call_fragment_sync(
+                                  const std::string& impu,
+                                  const CallListStore::CallFragment& fragment,
+                                  const int64_t cass_timestamp,
+                                  const int32_t ttl,
+                                  SAS::TrailId trail)
+{
+  Cluster* cluster = cluster_for(impu);
+  CassandraStore::ResultCode rc =
+    cluster->store->write_call_fragment_sync(impu,
+                                             fragment,
+                                             cass_timestamp,
+                                             ttl,
+                                             trail);
+  record(cluster, rc);
+  return rc;
+}
+
+CassandraStore::ResultCode ShardedCallListStore::write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail)
+{
+  Cluster* cluster = cluster_for(impu);
+  CassandraStore::ResultCode rc =
+    BatchCallListStore::write_call_fragments(cluster->store,
+                                             impu,
+                                             fragments,
+                                             cass_timestamp,
+                                             ttl,
+                                             trail);
+  record(cluster, rc);
+  return rc;
+}
+
+CassandraStore::ResultCode ShardedCallListStore::get_call_fragments_sync(
+                            const std::string& impu,
+                            std::vector<CallListStore::CallFragment>& fragments,
+                            SAS::TrailId trail)
+{
+  Cluster* cluster = cluster_for(impu);
+  CassandraStore::ResultCode rc =
+    cluster->store->get_call_fragments_sync(impu, fragments, trail);
+  record(cluster, rc);
+  return rc;
+}
+
+CassandraStore::ResultCode ShardedCallListStore::delete_old_call_fragments_sync(
+                       const std::string& impu,
+                       const std::vector<CallListStore::CallFragment> fragments,
+                       const int64_t cass_timestamp,
+                       SAS::TrailId trail)
+{
+  Cluster* cluster = cluster_for(impu);
+  CassandraStore::ResultCode rc =
+    cluster->store->delete_old_call_fragments_sync(impu,
+                                                   fragments,
+                                                   cass_timestamp,
+                                                   trail);
+  record(cluster, rc);
+  return rc;
+}
+
+void ShardedCallListStore::record(Cluster* cluster,
+                                  CassandraStore::ResultCode rc)
+{
+  cluster->requests++;
+
+  if ((rc == CassandraStore::CONNECTION_ERROR) ||
+      (rc == CassandraStore::RESOURCE_ERROR) ||
+      (rc == CassandraStore::UNKNOWN_ERROR))
+  {
+    cluster->failures++;
+  }
+
+  // Whichever thread moves the publication time on publishes the counts.
+  uint64_t now_ms = current_time_ms();
+  uint64_t next_publish_ms = _next_publish_ms.load();
+
+  if ((now_ms < next_publish_ms) ||
+      (!_next_publish_ms.compare_exchange_strong(next_publish_ms,
+                                                 now_ms + STATS_INTERVAL_MS)))
+  {
+    return;
+  }
+
+  std::vector<std::string> values;
+  values.reserve(_clusters.size() * 3);
+
+  for (std::map<std::string, Cluster*>::const_iterator it = _clusters.begin();
+       it != _clusters.end();
+       ++it)
+  {
+    values.push_back(it->first);
+    values.push_back(std::to_string(it->second->requests.exchange(0)));
+    values.push_back(std::to_string(it->second->failures.exchange(0)));
+  }
+
+  _stat_shards.report_change(values);
+}
+
+bool ShardedCallListStore::parse_config(std::istream& input, Config& config)
+{
+  config.clusters.clear();
+  config.overrides.clear();
+
+  std::string line;
+  int line_number = 0;
+
+  while (std::getline(input, line))
+  {
+    line_number++;
+    std::istringstream words(line);
+    std::string kind;
+
+    if ((!(words >> kind)) || (kind[0] == '#'))
+    {
+      continue;
+    }
+
+    std::string key;
+    std::string value;
+    std::string extra;
+
+    if ((!(words >> key >> value)) || (words >> extra))
+    {
+      TRC_ERROR("Invalid shard configuration on line %d", line_number);
+      return false;
+    }
+
+    if (kind == "cluster")
+    {
+      for (size_t ii = 0; ii < config.clusters.size(); ii++)
+      {
+        if (config.clusters[ii].first == key)
+        {
+          TRC_ERROR("Cluster %s is configured twice", key.c_str());
+          return false;
+        }
+      }
+
+      config.clusters.push_back(std::make_pair(key, value));
+    }
+    else if (kind == "impu")
+    {
+      config.overrides[key] = value;
+    }
+    else
+    {
+      TRC_ERROR("Unknown shard configuration %s on line %d",
+                kind.c_str(),
+                line_number);
+      return false;
+    }
+  }
+
+  if (config.clusters.empty())
+  {
+    TRC_ERROR("No clusters in shard configuration");
+    return false;
+  }
+
+  for (std::map<std::string, std::string>::const_iterator it =
+         config.overrides.begin();
+       it != config.overrides.end();
+       ++it)
+  {
+    bool found = false;
+
+    for (size_t ii = 0; (ii < config.clusters.size()) && (!found); ii++)
+    {
+      found = (config.clusters[ii].first == it->second);
+    }
+
+    if (!found)
+    {
+      TRC_ERROR("%s is pinned to unknown cluster %s",
+                it->first.c_str(),
+                it->second.c_str());
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ShardedCallListStore::read_config(const std::string& path, Config& config)
+{
+  std::ifstream file(path.c_str());
+
+  if (!file.is_open())
+  {
+    TRC_ERROR("Unable to open shard configuration %s", path.c_str());
+    return false;
+  }
+
+  return parse_config(file, config);
+}
+
+uint64_t ShardedCallListStore::current_time_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
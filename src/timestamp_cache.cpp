@@ -0,0 +1,148 @@
+/**
+ * @file timestamp_cache.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <cstring>
+
+#include "timestamp_cache.h"
+
+static const char* CASSANDRA_PATTERN = "%Y%m%d%H%M%S";
+static const char* XML_PATTERN = "%Y-%m-%dT%H:%M:%S";
+
+/// The formatted timestamps for one second. This is a plain aggregate so
+/// that the thread-local instances are zero-initialized (and so invalid)
+/// without needing a constructor.
+struct CachedSecond
+{
+  bool valid;
+  time_t time;
+  long utc_offset;
+  char cassandra[TimestampCache::MAX_LEN];
+  size_t cassandra_len;
+  char xml[TimestampCache::MAX_LEN];
+  size_t xml_len;
+};
+
+// The last second converted to local time on this thread.
+static thread_local CachedSecond local_cache;
+
+// The last second rendered as is (with the UTC offset already applied) on
+// this thread.
+static thread_local CachedSecond offset_applied_cache;
+
+// Writes a zero-padded decimal number with the given number of digits.
+static char* digits(char* p, int value, int num_digits)
+{
+  for (int ii = num_digits - 1; ii >= 0; ii--)
+  {
+    p[ii] = '0' + (value % 10);
+    value /= 10;
+  }
+
+  return p + num_digits;
+}
+
+static void refresh(CachedSecond& cache, time_t time, bool utc_offset_applied)
+{
+  tm broken_down;
+
+  if (utc_offset_applied)
+  {
+    gmtime_r(&time, &broken_down);
+    cache.utc_offset = 0;
+  }
+  else
+  {
+    localtime_r(&time, &broken_down);
+    cache.utc_offset = broken_down.tm_gmtoff;
+  }
+
+  int year = broken_down.tm_year + 1900;
+
+  if ((year >= 0) && (year <= 9999))
+  {
+    // Format the times by hand - this is much cheaper than strftime.
+    char* p = cache.cassandra;
+    p = digits(p, year, 4);
+    p = digits(p, broken_down.tm_mon + 1, 2);
+    p = digits(p, broken_down.tm_mday, 2);
+    p = digits(p, broken_down.tm_hour, 2);
+    p = digits(p, broken_down.tm_min, 2);
+    p = digits(p, broken_down.tm_sec, 2);
+    cache.cassandra_len = p - cache.cassandra;
+
+    p = cache.xml;
+    p = digits(p, year, 4);
+    *p++ = '-';
+    p = digits(p, broken_down.tm_mon + 1, 2);
+    *p++ = '-';
+    p = digits(p, broken_down.tm_mday, 2);
+    *p++ = 'T';
+    p = digits(p, broken_down.tm_hour, 2);
+    *p++ = ':';
+    p = digits(p, broken_down.tm_min, 2);
+    *p++ = ':';
+    p = digits(p, broken_down.tm_sec, 2);
+    cache.xml_len = p - cache.xml;
+  }
+  else
+  {
+    // LCOV_EXCL_START
+    cache.cassandra_len = std::strftime(cache.cassandra,
+                                        sizeof(cache.cassandra),
+                                        CASSANDRA_PATTERN,
+                                        &broken_down);
+    cache.xml_len = std::strftime(cache.xml,
+                                  sizeof(cache.xml),
+                                  XML_PATTERN,
+                                  &broken_down);
+    // LCOV_EXCL_STOP
+  }
+
+  cache.time = time;
+  cache.valid = true;
+}
+
+static const CachedSecond& lookup(time_t time, bool utc_offset_applied)
+{
+  CachedSecond& cache = utc_offset_applied ? offset_applied_cache : local_cache;
+
+  if ((!cache.valid) || (cache.time != time))
+  {
+    refresh(cache, time, utc_offset_applied);
+  }
+
+  return cache;
+}
+
+namespace TimestampCache
+{
+
+void format_cassandra(time_t time,
+                      bool utc_offset_applied,
+                      std::string& out)
+{
+  const CachedSecond& cache = lookup(time, utc_offset_applied);
+  out.assign(cache.cassandra, cache.cassandra_len);
+}
+
+size_t format_xml(time_t time, bool utc_offset_applied, char* buf)
+{
+  const CachedSecond& cache = lookup(time, utc_offset_applied);
+  memcpy(buf, cache.xml, cache.xml_len);
+  return cache.xml_len;
+}
+
+long utc_offset(time_t time)
+{
+  return lookup(time, false).utc_offset;
+}
+
+}
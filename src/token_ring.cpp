@@ -0,0 +1,122 @@
+/**
+ * @file token_ring.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include "token_ring.h"
+
+static const std::string NO_OWNER;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+int64_t TokenRing::token(const std::string& key)
+{
+  // MurmurHash3_x64_128 with a seed of 0, of which the token is the first
+  // half. Cassandra's version sign-extends the bytes of the tail, so we do
+  // the same.
+  const uint8_t* data = (const uint8_t*)key.data();
+  const size_t len = key.length();
+  const size_t blocks = len / 16;
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+  uint64_t h1 = 0;
+  uint64_t h2 = 0;
+
+  for (size_t ii = 0; ii < blocks; ii++)
+  {
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+
+    for (int jj = 7; jj >= 0; jj--)
+    {
+      k1 = (k1 << 8) | data[ii * 16 + jj];
+      k2 = (k2 << 8) | data[ii * 16 + 8 + jj];
+    }
+
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  const int8_t* tail = (const int8_t*)(data + blocks * 16);
+  const size_t tail_len = len & 15;
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+
+  for (size_t ii = tail_len; ii > 8; ii--)
+  {
+    k2 ^= (uint64_t)(int64_t)tail[ii - 1] << ((ii - 9) * 8);
+  }
+
+  if (tail_len > 8)
+  {
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+  }
+
+  for (size_t ii = std::min(tail_len, (size_t)8); ii > 0; ii--)
+  {
+    k1 ^= (uint64_t)(int64_t)tail[ii - 1] << ((ii - 1) * 8);
+  }
+
+  if (tail_len > 0)
+  {
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+  }
+
+  h1 ^= len;
+  h2 ^= len;
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+
+  // The partitioner reserves the minimum token.
+  int64_t token = (int64_t)h1;
+  return (token == std::numeric_limits<int64_t>::min()) ?
+           std::numeric_limits<int64_t>::max() : token;
+}
+
+void TokenRing::set(const std::vector<std::pair<int64_t, std::string>>& tokens)
+{
+  _tokens = tokens;
+  std::sort(_tokens.begin(), _tokens.end());
+}
+
+const std::string& TokenRing::owner(int64_t token) const
+{
+  if (_tokens.empty())
+  {
+    return NO_OWNER;
+  }
+
+  std::vector<std::pair<int64_t, std::string>>::const_iterator it =
+    std::lower_bound(_tokens.begin(),
+                     _tokens.end(),
+                     std::make_pair(token, std::string()));
+
+  return (it != _tokens.end()) ? it->second : _tokens.front().second;
+}
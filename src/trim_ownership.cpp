@@ -0,0 +1,368 @@
+/**
+ * @file trim_ownership.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <sys/stat.h>
+
+#include "trim_ownership.h"
+#include "utils.h"
+#include "log.h"
+
+const std::string TrimOwnership::HEARTBEAT_IMPU = "memento:trim-heartbeat";
+const std::string TrimOwnership::HEARTBEAT_TIMESTAMP = "00000000000000";
+
+TrimOwnership::TrimOwnership(const std::string& local_node,
+                             const std::string& path,
+                             CallListStore::Store* heartbeat_store) :
+  _local_node(local_node),
+  _path(path),
+  _heartbeat_store(heartbeat_store),
+  _local_in_ring(false),
+  _next_reload_ms(0),
+  _mtime(0),
+  _live_nodes_known(false),
+  _live_nodes_read_ms(0),
+  _terminating(false),
+  _heartbeat_thread_running(false)
+{
+  pthread_mutex_init(&_lock, NULL);
+
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&_heartbeat_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  if (_heartbeat_store != NULL)
+  {
+    if (pthread_create(&_heartbeat_thread,
+                       NULL,
+                       &heartbeat_thread_fn,
+                       this) == 0)
+    {
+      _heartbeat_thread_running = true;
+    }
+    else
+    {
+      TRC_ERROR("Unable to start the call list trim heartbeat thread"); // LCOV_EXCL_LINE
+    }
+  }
+}
+
+TrimOwnership::~TrimOwnership()
+{
+  pthread_mutex_lock(&_lock);
+  _terminating = true;
+  pthread_cond_signal(&_heartbeat_cond);
+  pthread_mutex_unlock(&_lock);
+
+  if (_heartbeat_thread_running)
+  {
+    pthread_join(_heartbeat_thread, NULL);
+  }
+
+  pthread_cond_destroy(&_heartbeat_cond);
+  pthread_mutex_destroy(&_lock);
+}
+
+bool TrimOwnership::owns(const std::string& impu)
+{
+  pthread_mutex_lock(&_lock);
+  maybe_reload();
+  bool owns = ((!_local_in_ring) ||
+               (_ring.owner(TokenRing::token(impu)) == _local_node));
+  pthread_mutex_unlock(&_lock);
+  return owns;
+}
+
+void TrimOwnership::set_nodes(const std::vector<std::string>& nodes)
+{
+  pthread_mutex_lock(&_lock);
+  _nodes = nodes;
+  update_ring();
+  pthread_mutex_unlock(&_lock);
+}
+
+void TrimOwnership::set_live_nodes(const std::vector<std::string>& nodes)
+{
+  pthread_mutex_lock(&_lock);
+  _live_nodes = std::set<std::string>(nodes.begin(), nodes.end());
+  _live_nodes_known = true;
+  _live_nodes_read_ms = current_time_ms();
+  update_ring();
+  pthread_mutex_unlock(&_lock);
+}
+
+void TrimOwnership::heartbeat()
+{
+  // Each node's fragment has a fixed key, so every heartbeat overwrites the
+  // last one and refreshes its TTL. The row only holds one fragment per
+  // node, even though the heartbeats expire.
+  CallListStore::CallFragment fragment;
+  fragment.timestamp = HEARTBEAT_TIMESTAMP;
+  fragment.id = _local_node;
+  fragment.type = CallListStore::CallFragment::Type::BEGIN;
+
+  CassandraStore::ResultCode rc =
+    _heartbeat_store->write_call_fragment_sync(
+                                   HEARTBEAT_IMPU,
+                                   fragment,
+                                   CallListStore::Store::generate_timestamp(),
+                                   HEARTBEAT_TTL_S,
+                                   0);
+
+  if (rc != CassandraStore::OK)
+  {
+    TRC_WARNING("Unable to write call list trim heartbeat - rc %d", rc);
+  }
+
+  std::vector<CallListStore::CallFragment> heartbeats;
+  rc = _heartbeat_store->get_call_fragments_sync(HEARTBEAT_IMPU,
+                                                 heartbeats,
+                                                 0);
+
+  if ((rc != CassandraStore::OK) && (rc != CassandraStore::NOT_FOUND))
+  {
+    TRC_WARNING("Unable to read call list trim heartbeats - rc %d", rc);
+
+    // The live nodes read last time are only good for as long as their
+    // heartbeats were. After that, go back to counting every node as live
+    // rather than keep a stale set.
+    pthread_mutex_lock(&_lock);
+
+    if ((_live_nodes_known) &&
+        (current_time_ms() >
+           _live_nodes_read_ms + ((uint64_t)HEARTBEAT_TTL_S * 1000)))
+    {
+      TRC_WARNING("No call list trim heartbeats read for %ds - counting every node as live",
+                  HEARTBEAT_TTL_S);
+      _live_nodes_known = false;
+      _live_nodes.clear();
+      update_ring();
+    }
+
+    pthread_mutex_unlock(&_lock);
+    return;
+  }
+
+  std::vector<std::string> live_nodes;
+
+  for (std::vector<CallListStore::CallFragment>::const_iterator heartbeat =
+         heartbeats.begin();
+       heartbeat != heartbeats.end();
+       ++heartbeat)
+  {
+    live_nodes.push_back(heartbeat->id);
+  }
+
+  set_live_nodes(live_nodes);
+}
+
+void TrimOwnership::update_ring()
+{
+  std::vector<std::string> nodes;
+
+  // This node always counts as live, even if its own heartbeat is lost, so
+  // that it carries on trimming its share.
+  for (std::vector<std::string>::const_iterator node = _nodes.begin();
+       node != _nodes.end();
+       ++node)
+  {
+    if ((!_live_nodes_known) ||
+        (*node == _local_node) ||
+        (_live_nodes.count(*node) != 0))
+    {
+      nodes.push_back(*node);
+    }
+  }
+
+  if (nodes == _ring_nodes)
+  {
+    return;
+  }
+
+  if (nodes.size() < _nodes.size())
+  {
+    TRC_WARNING("%lu of the %lu nodes sharing call list trims have no heartbeat",
+                (unsigned long)(_nodes.size() - nodes.size()),
+                (unsigned long)_nodes.size());
+  }
+
+  _ring_nodes = nodes;
+  set_ring(nodes);
+}
+
+void TrimOwnership::set_ring(const std::vector<std::string>& nodes)
+{
+  std::vector<std::pair<int64_t, std::string>> tokens;
+  tokens.reserve(nodes.size() * VIRTUAL_NODES);
+
+  for (std::vector<std::string>::const_iterator node = nodes.begin();
+       node != nodes.end();
+       ++node)
+  {
+    for (int ii = 0; ii < VIRTUAL_NODES; ii++)
+    {
+      tokens.push_back(
+        std::make_pair(TokenRing::token(*node + "#" + std::to_string(ii)), *node));
+    }
+  }
+
+  _ring.set(tokens);
+  _local_in_ring = (std::find(nodes.begin(), nodes.end(), _local_node) !=
+                    nodes.end());
+
+  if (_local_in_ring)
+  {
+    TRC_STATUS("Sharing call list trims between %lu nodes",
+               (unsigned long)nodes.size());
+  }
+  else
+  {
+    TRC_WARNING("%s isn't one of the %lu nodes sharing call list trims - trimming every call list",
+                _local_node.c_str(),
+                (unsigned long)nodes.size());
+  }
+}
+
+void TrimOwnership::maybe_reload()
+{
+  uint64_t now_ms = current_time_ms();
+
+  if ((_path.empty()) || (now_ms < _next_reload_ms))
+  {
+    return;
+  }
+
+  _next_reload_ms = now_ms + RELOAD_INTERVAL_MS;
+
+  struct stat st;
+
+  if (stat(_path.c_str(), &st) != 0)
+  {
+    TRC_DEBUG("Unable to read %s - keeping the current trim owners",
+              _path.c_str());
+    return;
+  }
+
+  if (st.st_mtime == _mtime)
+  {
+    return;
+  }
+
+  std::ifstream file(_path.c_str());
+  std::vector<std::string> nodes;
+
+  if ((!file.is_open()) || (!parse_nodes(file, nodes)))
+  {
+    TRC_WARNING("Invalid cluster settings in %s - keeping the current trim owners",
+                _path.c_str());
+    return;
+  }
+
+  _mtime = st.st_mtime;
+  _nodes = nodes;
+  update_ring();
+}
+
+bool TrimOwnership::parse_nodes(std::istream& input,
+                                std::vector<std::string>& nodes)
+{
+  std::string line;
+
+  while (std::getline(input, line))
+  {
+    size_t start = line.find_first_not_of(" \t");
+
+    if ((start == std::string::npos) ||
+        (line.compare(start, 8, "servers=") != 0))
+    {
+      continue;
+    }
+
+    std::string value = line.substr(start + 8);
+    value.erase(value.find_last_not_of(" \t\r") + 1);
+
+    std::vector<std::string> servers;
+    Utils::split_string(value, ',', servers, 0, true);
+    nodes.clear();
+
+    for (std::vector<std::string>::const_iterator server = servers.begin();
+         server != servers.end();
+         ++server)
+    {
+      nodes.push_back(address(*server));
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+std::string TrimOwnership::address(const std::string& server)
+{
+  if ((!server.empty()) && (server[0] == '['))
+  {
+    // [IPv6 address]:port
+    size_t end = server.find(']');
+    return server.substr(1, end - 1);
+  }
+
+  // Only strip a port from a hostname or IPv4 address.
+  size_t colon = server.find(':');
+
+  if ((colon == std::string::npos) ||
+      (server.find(':', colon + 1) != std::string::npos))
+  {
+    return server;
+  }
+
+  return server.substr(0, colon);
+}
+
+void* TrimOwnership::heartbeat_thread_fn(void* ownership)
+{
+  ((TrimOwnership*)ownership)->heartbeat_thread();
+  return NULL;
+}
+
+void TrimOwnership::heartbeat_thread()
+{
+  pthread_mutex_lock(&_lock);
+
+  while (!_terminating)
+  {
+    pthread_mutex_unlock(&_lock);
+    heartbeat();
+    pthread_mutex_lock(&_lock);
+
+    uint64_t wake_ms = current_time_ms() + HEARTBEAT_INTERVAL_MS;
+    struct timespec wake;
+    wake.tv_sec = wake_ms / 1000;
+    wake.tv_nsec = (wake_ms % 1000) * 1000000;
+
+    while ((!_terminating) && (current_time_ms() < wake_ms))
+    {
+      pthread_cond_timedwait(&_heartbeat_cond, &_lock, &wake);
+    }
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+uint64_t TrimOwnership::current_time_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
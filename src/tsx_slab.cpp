@@ -0,0 +1,28 @@
+/**
+ * @file tsx_slab.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "tsx_slab.h"
+
+void print_uri(pjsip_uri_context_e context,
+               const pjsip_uri* uri,
+               std::string& dest)
+{
+  if (uri == NULL)
+  {
+    dest.clear();
+    return;
+  }
+
+  // Print straight into the string, then only keep what was used.
+  dest.resize(MAX_PRINTED_URI_LENGTH);
+  int len = pjsip_uri_print(context, uri, &dest[0], MAX_PRINTED_URI_LENGTH);
+  dest.resize((len > 0) ? len : 0);
+}
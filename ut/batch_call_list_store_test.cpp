@@ -0,0 +1,109 @@
+/**
+ * @file batch_call_list_store_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "batch_call_list_store.h"
+#include "deadline_call_list_store.h"
+#include "mock_call_list_store.h"
+
+using ::testing::_;
+using ::testing::Return;
+
+static const std::string IMPU = "sip:6505550000@homedomain";
+
+static std::vector<CallListStore::CallFragment> begin_and_end()
+{
+  std::vector<CallListStore::CallFragment> fragments(2);
+  fragments[0].timestamp = "20021225100000";
+  fragments[0].id = "1";
+  fragments[0].type = CallListStore::CallFragment::Type::BEGIN;
+  fragments[1].timestamp = "20021225100000";
+  fragments[1].id = "1";
+  fragments[1].type = CallListStore::CallFragment::Type::END;
+  return fragments;
+}
+
+// A store that can batch writes gets all the fragments in one call.
+TEST(BatchCallListStoreTest, Batched)
+{
+  MockBatchCallListStore store;
+  EXPECT_CALL(store, write_call_fragment_sync(_, _, _, _, _)).Times(0);
+  EXPECT_CALL(store, write_call_fragments_sync(IMPU, _, 1000, 3600, 0))
+    .WillOnce(Return(CassandraStore::OK));
+
+  EXPECT_EQ(CassandraStore::OK,
+            BatchCallListStore::write_call_fragments(&store,
+                                                     IMPU,
+                                                     begin_and_end(),
+                                                     1000,
+                                                     3600,
+                                                     0));
+}
+
+// A store that can't batch writes gets one write per fragment, stopping at
+// the first that fails.
+TEST(BatchCallListStoreTest, NotBatched)
+{
+  MockCallListStore store;
+  EXPECT_CALL(store, write_call_fragment_sync(IMPU, _, 1000, 3600, 0))
+    .Times(2)
+    .WillRepeatedly(Return(CassandraStore::OK));
+  EXPECT_EQ(CassandraStore::OK,
+            BatchCallListStore::write_call_fragments(&store,
+                                                     IMPU,
+                                                     begin_and_end(),
+                                                     1000,
+                                                     3600,
+                                                     0));
+
+  EXPECT_CALL(store, write_call_fragment_sync(IMPU, _, 1000, 3600, 0))
+    .WillOnce(Return(CassandraStore::CONNECTION_ERROR));
+  EXPECT_EQ(CassandraStore::CONNECTION_ERROR,
+            BatchCallListStore::write_call_fragments(&store,
+                                                     IMPU,
+                                                     begin_and_end(),
+                                                     1000,
+                                                     3600,
+                                                     0));
+}
+
+// Batched writes pass through a deadline store, with or without a
+// deadline.
+TEST(BatchCallListStoreTest, ThroughDeadline)
+{
+  MockBatchCallListStore* mock_store = new MockBatchCallListStore();
+  DeadlineCallListStore store(mock_store, NULL, 1);
+  EXPECT_CALL(*mock_store, write_call_fragments_sync(IMPU, _, 1000, 3600, 0))
+    .Times(2)
+    .WillRepeatedly(Return(CassandraStore::OK));
+
+  EXPECT_EQ(CassandraStore::OK,
+            BatchCallListStore::write_call_fragments(&store,
+                                                     IMPU,
+                                                     begin_and_end(),
+                                                     1000,
+                                                     3600,
+                                                     0));
+
+  DeadlineCallListStore::Deadline deadline(
+                            DeadlineCallListStore::current_time_us() + 1000000);
+  EXPECT_EQ(CassandraStore::OK,
+            BatchCallListStore::write_call_fragments(&store,
+                                                     IMPU,
+                                                     begin_and_end(),
+                                                     1000,
+                                                     3600,
+                                                     0));
+}
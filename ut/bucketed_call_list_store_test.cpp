@@ -0,0 +1,233 @@
+/**
+ * @file bucketed_call_list_store_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <ctime>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "bucketed_call_list_store.h"
+#include "mock_call_list_store.h"
+#include "timestamp_cache.h"
+#include "trim_ownership.h"
+
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::Return;
+using ::testing::SetArgReferee;
+using ::testing::StartsWith;
+
+// Timestamps in the same period share a bucket, and the bucket number
+// increases by one each period.
+TEST(BucketedCallListStoreTest, Bucket)
+{
+  BucketedCallListStore store(new CallListStore::Store(), 3600, 604800, 0);
+
+  // 2002-12-25 10:00:00 is 1040810400 seconds after the epoch.
+  EXPECT_EQ(1040810400 / 3600, store.bucket("20021225100000"));
+  EXPECT_EQ(1040810400 / 3600, store.bucket("20021225105959"));
+  EXPECT_EQ(1040810400 / 3600 + 1, store.bucket("20021225110000"));
+  EXPECT_EQ(1040810400 / 3600 - 1, store.bucket("20021225095959"));
+}
+
+// Invalid timestamps don't have a bucket.
+TEST(BucketedCallListStoreTest, InvalidTimestamp)
+{
+  BucketedCallListStore store(new CallListStore::Store(), 3600, 604800, 0);
+  EXPECT_EQ(-1, store.bucket(""));
+  EXPECT_EQ(-1, store.bucket("2002122510000"));
+  EXPECT_EQ(-1, store.bucket("2002122510000x"));
+  EXPECT_EQ(-1, store.bucket("2002-12-25T10:00:00"));
+}
+
+// Bucket row keys can't clash with an IMPU's row key.
+TEST(BucketedCallListStoreTest, BucketKey)
+{
+  EXPECT_EQ("sip:6505550000@homedomain|b289114",
+            BucketedCallListStore::bucket_key("sip:6505550000@homedomain",
+                                              289114));
+}
+
+static const std::string IMPU = "sip:6505550000@homedomain";
+
+static CallListStore::CallFragment fragment(const std::string& timestamp,
+                                            const std::string& id)
+{
+  CallListStore::CallFragment fragment;
+  fragment.timestamp = timestamp;
+  fragment.id = id;
+  fragment.type = CallListStore::CallFragment::Type::BEGIN;
+  fragment.contents = "<xml>";
+  return fragment;
+}
+
+// Fragments are written to their bucket's row.
+TEST(BucketedCallListStoreTest, Write)
+{
+  MockCallListStore* mock_store = new MockCallListStore();
+  BucketedCallListStore store(mock_store, 3600, 604800, 0);
+
+  EXPECT_CALL(*mock_store,
+              write_call_fragment_sync(IMPU + "|b289114", _, 1000, 3600, 0))
+    .WillOnce(Return(CassandraStore::OK));
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(IMPU,
+                                           fragment("20021225100000", "1"),
+                                           1000,
+                                           3600,
+                                           0));
+}
+
+// The trim heartbeats aren't a call list, so aren't split into buckets.
+TEST(BucketedCallListStoreTest, Heartbeats)
+{
+  MockCallListStore* mock_store = new MockCallListStore();
+  BucketedCallListStore store(mock_store, 3600, 604800, 0);
+  std::vector<CallListStore::CallFragment> heartbeats;
+  heartbeats.push_back(fragment(TrimOwnership::HEARTBEAT_TIMESTAMP, "10.0.0.1"));
+
+  EXPECT_CALL(*mock_store,
+              write_call_fragment_sync(TrimOwnership::HEARTBEAT_IMPU, _, 1000, 35, 0))
+    .WillOnce(Return(CassandraStore::OK));
+  EXPECT_CALL(*mock_store,
+              get_call_fragments_sync(TrimOwnership::HEARTBEAT_IMPU, _, 0))
+    .WillOnce(DoAll(SetArgReferee<1>(heartbeats),
+                    Return(CassandraStore::OK)));
+
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(TrimOwnership::HEARTBEAT_IMPU,
+                                           heartbeats[0],
+                                           1000,
+                                           35,
+                                           0));
+
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(TrimOwnership::HEARTBEAT_IMPU,
+                                          fragments,
+                                          0));
+  ASSERT_EQ(1u, fragments.size());
+  EXPECT_EQ("10.0.0.1", fragments[0].id);
+}
+
+// Deletes are grouped by bucket.
+TEST(BucketedCallListStoreTest, Delete)
+{
+  MockCallListStore* mock_store = new MockCallListStore();
+  BucketedCallListStore store(mock_store, 3600, 604800, 0);
+
+  std::vector<CallListStore::CallFragment> fragments;
+  fragments.push_back(fragment("20021225100000", "1"));
+  fragments.push_back(fragment("20021225110000", "2"));
+  fragments.push_back(fragment("20021225105959", "3"));
+
+  EXPECT_CALL(*mock_store,
+              delete_old_call_fragments_sync(IMPU + "|b289114", _, 1000, 0))
+    .WillOnce(Return(CassandraStore::OK));
+  EXPECT_CALL(*mock_store,
+              delete_old_call_fragments_sync(IMPU + "|b289115", _, 1000, 0))
+    .WillOnce(Return(CassandraStore::CONNECTION_ERROR));
+  EXPECT_EQ(CassandraStore::CONNECTION_ERROR,
+            store.delete_old_call_fragments_sync(IMPU, fragments, 1000, 0));
+}
+
+// Reads cover the IMPU's row and every bucket within the TTL. Fragments in
+// the IMPU's row are moved into their bucket, and only read from there.
+TEST(BucketedCallListStoreTest, ReadAndMigrate)
+{
+  MockCallListStore* mock_store = new MockCallListStore();
+  BucketedCallListStore store(mock_store, 3600, 7200, 0);
+
+  time_t now = time(NULL);
+  std::string timestamp;
+  TimestampCache::format_cassandra(now, false, timestamp);
+  std::vector<CallListStore::CallFragment> legacy;
+  legacy.push_back(fragment(timestamp, "1"));
+  // The bucket holds the migrated fragment too.
+  std::vector<CallListStore::CallFragment> bucketed;
+  bucketed.push_back(fragment(timestamp, "1"));
+  bucketed.push_back(fragment(timestamp, "2"));
+  std::string key = BucketedCallListStore::bucket_key(IMPU,
+                                                      store.bucket(timestamp));
+
+  EXPECT_CALL(*mock_store, get_call_fragments_sync(IMPU, _, 0))
+    .WillOnce(DoAll(SetArgReferee<1>(legacy), Return(CassandraStore::OK)));
+  EXPECT_CALL(*mock_store, write_call_fragment_sync(key, _, _, _, 0))
+    .WillOnce(Return(CassandraStore::OK));
+  EXPECT_CALL(*mock_store, delete_old_call_fragments_sync(IMPU, _, _, 0))
+    .WillOnce(Return(CassandraStore::OK));
+  EXPECT_CALL(*mock_store, get_call_fragments_sync(StartsWith(IMPU + "|b"), _, 0))
+    .Times(2)
+    .WillRepeatedly(Return(CassandraStore::NOT_FOUND));
+  EXPECT_CALL(*mock_store, get_call_fragments_sync(key, _, 0))
+    .WillOnce(DoAll(SetArgReferee<1>(bucketed), Return(CassandraStore::OK)))
+    .RetiresOnSaturation();
+
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(2u, fragments.size());
+  EXPECT_EQ("1", fragments[0].id);
+  EXPECT_EQ("2", fragments[1].id);
+}
+
+// Only a few buckets may be read for each call list.
+TEST(BucketedCallListStoreTest, ValidPeriod)
+{
+  EXPECT_EQ(3, BucketedCallListStore::buckets(3600, 7200));
+  EXPECT_EQ(3, BucketedCallListStore::buckets(3600, 5400));
+  EXPECT_EQ(169, BucketedCallListStore::buckets(3600, 604800));
+  EXPECT_FALSE(BucketedCallListStore::valid_period(3600, 604800));
+  EXPECT_TRUE(BucketedCallListStore::valid_period(6 * 3600, 604800));
+  EXPECT_FALSE(BucketedCallListStore::valid_period(3600, 0));
+}
+
+// Buckets are read newest first, and older buckets aren't read once there
+// are more calls than needed. Fragments are still returned oldest first.
+TEST(BucketedCallListStoreTest, ReadStopsEarly)
+{
+  MockCallListStore* mock_store = new MockCallListStore();
+  BucketedCallListStore store(mock_store, 3600, 6 * 3600, 2);
+
+  time_t now = time(NULL);
+  std::string newest_timestamp;
+  TimestampCache::format_cassandra(now, false, newest_timestamp);
+  std::string older_timestamp;
+  TimestampCache::format_cassandra(now - 3600, false, older_timestamp);
+  std::vector<CallListStore::CallFragment> newest;
+  newest.push_back(fragment(newest_timestamp, "3"));
+  std::vector<CallListStore::CallFragment> older;
+  older.push_back(fragment(older_timestamp, "1"));
+  older.push_back(fragment(older_timestamp, "2"));
+
+  EXPECT_CALL(*mock_store, get_call_fragments_sync(IMPU, _, 0))
+    .WillOnce(Return(CassandraStore::NOT_FOUND));
+  EXPECT_CALL(*mock_store,
+              get_call_fragments_sync(
+                BucketedCallListStore::bucket_key(IMPU, store.bucket(newest_timestamp)),
+                _,
+                0))
+    .WillOnce(DoAll(SetArgReferee<1>(newest), Return(CassandraStore::OK)));
+  EXPECT_CALL(*mock_store,
+              get_call_fragments_sync(
+                BucketedCallListStore::bucket_key(IMPU, store.bucket(older_timestamp)),
+                _,
+                0))
+    .WillOnce(DoAll(SetArgReferee<1>(older), Return(CassandraStore::OK)));
+
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(3u, fragments.size());
+  EXPECT_EQ("1", fragments[0].id);
+  EXPECT_EQ("2", fragments[1].id);
+  EXPECT_EQ("3", fragments[2].id);
+}
@@ -0,0 +1,189 @@
+/**
+ * @file call_flood_detector_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "call_flood_detector.h"
+#include "mockloadmonitor.hpp"
+#include "timestamp_cache.h"
+
+using ::testing::_;
+using ::testing::StrictMock;
+
+static const std::string IMPU = "sip:6505551234@homedomain";
+static const std::string CALLER = "sip:6505550000@homedomain";
+static const time_t START_TIME = 1022751010;
+static const int WINDOW_MS = 60000;
+
+class CallFloodDetectorTest : public ::testing::Test
+{
+public:
+  CallFloodDetectorTest() :
+    _clsp(&_load_monitor, NULL, 0, 0, 0, NULL, NULL, NULL, CallFragmentCodec::XML, NULL, 0, 0, 0, 0, NULL, NULL),
+    _detector(&_clsp, 2, WINDOW_MS, NULL)
+  {
+  }
+
+  // Gets a request for a call to an IMPU.
+  CallListStoreProcessor::CallListRequest* request(
+                       const std::string& impu,
+                       const std::string& caller,
+                       time_t start_time,
+                       CallListStore::CallFragment::Type type =
+                                     CallListStore::CallFragment::Type::REJECTED)
+  {
+    CallListStoreProcessor::CallListRequest* request = _clsp.get_request();
+    request->impu = impu;
+    request->fragment.type = type;
+    request->entry.caller_uri = caller;
+    request->entry.caller_name = "Robocaller";
+    request->entry.start_time = start_time;
+    return request;
+  }
+
+  // Checks that a request is passed through, and frees it.
+  void expect_written(CallListStoreProcessor::CallListRequest* req)
+  {
+    CallListStoreProcessor::CallListRequest* written = _detector.check(req, 0);
+    EXPECT_EQ(req, written);
+
+    if (written != NULL)
+    {
+      _clsp.release_request(written);
+    }
+  }
+
+  static std::string xml_time(time_t time)
+  {
+    char buf[TimestampCache::MAX_LEN];
+    size_t len = TimestampCache::format_xml(time, false, buf);
+    return std::string(buf, len);
+  }
+
+  StrictMock<MockLoadMonitor> _load_monitor;
+  CallListStoreProcessor _clsp;
+  CallFloodDetector _detector;
+};
+
+// Calls up to the threshold are written as normal.
+TEST_F(CallFloodDetectorTest, UnderThreshold)
+{
+  expect_written(request(IMPU, CALLER, START_TIME));
+  expect_written(request(IMPU, CALLER, START_TIME + 1));
+
+  std::vector<CallListStoreProcessor::CallListRequest*> summaries;
+  _detector.flush(WINDOW_MS, summaries);
+  EXPECT_TRUE(summaries.empty());
+  EXPECT_TRUE(_detector._windows.empty());
+}
+
+// Calls other than rejected calls aren't counted or folded.
+TEST_F(CallFloodDetectorTest, OnlyRejected)
+{
+  for (int ii = 0; ii < 5; ii++)
+  {
+    expect_written(request(IMPU, CALLER, START_TIME, CallListStore::CallFragment::Type::BEGIN));
+    expect_written(request(IMPU, CALLER, START_TIME, CallListStore::CallFragment::Type::END));
+  }
+
+  EXPECT_TRUE(_detector._windows.empty());
+}
+
+// Calls over the threshold are folded into a single summary, which is
+// written when the window ends. The calls counted into the summary are
+// complete as far as the load monitor is concerned.
+TEST_F(CallFloodDetectorTest, FoldsExcess)
+{
+  expect_written(request(IMPU, CALLER, START_TIME));
+  expect_written(request(IMPU, CALLER, START_TIME + 1));
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(7);
+
+  CallListStoreProcessor::CallListRequest* summary =
+                                      request(IMPU, CALLER, START_TIME + 2);
+  EXPECT_EQ(NULL, _detector.check(summary, 0));
+
+  for (int ii = 3; ii < 10; ii++)
+  {
+    EXPECT_EQ(NULL, _detector.check(request(IMPU, CALLER, START_TIME + ii), 0));
+  }
+
+  // Nothing is written until the window ends.
+  std::vector<CallListStoreProcessor::CallListRequest*> summaries;
+  _detector.flush(WINDOW_MS - 1, summaries);
+  EXPECT_TRUE(summaries.empty());
+
+  _detector.flush(WINDOW_MS, summaries);
+  ASSERT_EQ(1u, summaries.size());
+  EXPECT_EQ(summary, summaries[0]);
+  EXPECT_EQ(CALLER, summary->entry.caller_uri);
+  EXPECT_EQ("8 missed calls between " + xml_time(START_TIME + 2) +
+            " and " + xml_time(START_TIME + 9),
+            summary->entry.caller_name);
+  EXPECT_EQ(START_TIME + 2, summary->entry.start_time);
+  _clsp.release_request(summary);
+
+  // The next window starts afresh.
+  expect_written(request(IMPU, CALLER, START_TIME + 100));
+  EXPECT_TRUE(_detector._windows.size() == 1);
+}
+
+// A single folded call is written unchanged.
+TEST_F(CallFloodDetectorTest, SingleFold)
+{
+  expect_written(request(IMPU, CALLER, START_TIME));
+  expect_written(request(IMPU, CALLER, START_TIME));
+  EXPECT_EQ(NULL, _detector.check(request(IMPU, CALLER, START_TIME), 0));
+
+  std::vector<CallListStoreProcessor::CallListRequest*> summaries;
+  _detector.flush(WINDOW_MS, summaries);
+  ASSERT_EQ(1u, summaries.size());
+  EXPECT_EQ("Robocaller", summaries[0]->entry.caller_name);
+  _clsp.release_request(summaries[0]);
+}
+
+// Summaries say when the folded calls came from more than one caller.
+TEST_F(CallFloodDetectorTest, MixedCallers)
+{
+  expect_written(request(IMPU, CALLER, START_TIME));
+  expect_written(request(IMPU, CALLER, START_TIME));
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+  EXPECT_EQ(NULL, _detector.check(request(IMPU, CALLER, START_TIME), 0));
+  EXPECT_EQ(NULL, _detector.check(request(IMPU, "sip:other@homedomain", START_TIME), 0));
+
+  std::vector<CallListStoreProcessor::CallListRequest*> summaries;
+  _detector.flush(WINDOW_MS, summaries);
+  ASSERT_EQ(1u, summaries.size());
+  EXPECT_EQ("2 missed calls from multiple callers between " +
+            xml_time(START_TIME) + " and " + xml_time(START_TIME),
+            summaries[0]->entry.caller_name);
+  _clsp.release_request(summaries[0]);
+}
+
+// Each IMPU has its own window.
+TEST_F(CallFloodDetectorTest, PerImpu)
+{
+  expect_written(request(IMPU, CALLER, START_TIME));
+  expect_written(request(IMPU, CALLER, START_TIME));
+  expect_written(request("sip:6505554321@homedomain", CALLER, START_TIME));
+  expect_written(request("sip:6505554321@homedomain", CALLER, START_TIME));
+  EXPECT_EQ(2u, _detector._windows.size());
+}
+
+// Summaries that haven't been flushed are freed with the detector.
+TEST_F(CallFloodDetectorTest, UnflushedSummaryFreed)
+{
+  CallFloodDetector* detector = new CallFloodDetector(&_clsp, 0, WINDOW_MS, NULL);
+  EXPECT_EQ(NULL, detector->check(request(IMPU, CALLER, START_TIME), 0));
+  delete detector;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file call_fragment_codec_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "call_fragment_codec.h"
+
+static const CallListStore::CallFragment::Type TYPES[] = {
+  CallListStore::CallFragment::Type::BEGIN,
+  CallListStore::CallFragment::Type::END,
+  CallListStore::CallFragment::Type::REJECTED
+};
+
+class CallFragmentCodecTest : public ::testing::Test
+{
+public:
+  CallFragmentCodecTest()
+  {
+    _entry.caller_uri = "sip:6505551000@homedomain";
+    _entry.caller_name = "Alice";
+    _entry.callee_uri = "sip:6505551234@homedomain";
+    _entry.callee_name = "Bob";
+    _entry.answerer_uri = "sip:6505551235@homedomain";
+    _entry.answerer_name = "Bob's <cell>";
+    _entry.start_time = 1022751010;
+    _entry.answer_time = 1022751020;
+    _entry.end_time = 1022751300;
+    _entry.outgoing = true;
+  }
+
+  CallListEntry _entry;
+};
+
+// Encoding names are parsed from the configuration.
+TEST_F(CallFragmentCodecTest, ParseEncoding)
+{
+  CallFragmentCodec::Encoding encoding = CallFragmentCodec::XML;
+  EXPECT_TRUE(CallFragmentCodec::parse_encoding("binary", encoding));
+  EXPECT_EQ(CallFragmentCodec::BINARY, encoding);
+  EXPECT_TRUE(CallFragmentCodec::parse_encoding("xml", encoding));
+  EXPECT_EQ(CallFragmentCodec::XML, encoding);
+  EXPECT_FALSE(CallFragmentCodec::parse_encoding("json", encoding));
+}
+
+// The XML encoding is just the rendered XML.
+TEST_F(CallFragmentCodecTest, EncodeXml)
+{
+  for (size_t ii = 0; ii < sizeof(TYPES) / sizeof(TYPES[0]); ii++)
+  {
+    std::string contents;
+    CallFragmentCodec::encode(CallFragmentCodec::XML, TYPES[ii], _entry, contents);
+    EXPECT_EQ(render_call_list_xml(TYPES[ii], _entry), contents);
+  }
+}
+
+// Binary contents are smaller than the XML, and turn back into exactly the
+// XML that would have been stored.
+TEST_F(CallFragmentCodecTest, BinaryRoundTrip)
+{
+  for (size_t ii = 0; ii < sizeof(TYPES) / sizeof(TYPES[0]); ii++)
+  {
+    std::string contents;
+    CallFragmentCodec::encode(CallFragmentCodec::BINARY, TYPES[ii], _entry, contents);
+    EXPECT_EQ(CallFragmentCodec::BINARY_MARKER, contents[0]);
+    EXPECT_LT(contents.length(), render_call_list_xml(TYPES[ii], _entry).length());
+
+    CallListStore::CallFragment::Type type;
+    CallListEntry entry;
+    EXPECT_TRUE(CallFragmentCodec::decode(contents, type, entry));
+    EXPECT_EQ(TYPES[ii], type);
+
+    std::string xml;
+    EXPECT_TRUE(CallFragmentCodec::to_xml(contents, xml));
+    EXPECT_EQ(render_call_list_xml(TYPES[ii], _entry), xml);
+  }
+}
+
+// A row can hold a mix of XML and binary fragments, and each of them
+// decodes to the same XML.
+TEST_F(CallFragmentCodecTest, MixedRow)
+{
+  std::vector<std::string> row(2);
+  CallFragmentCodec::encode(CallFragmentCodec::XML,
+                            CallListStore::CallFragment::Type::BEGIN,
+                            _entry,
+                            row[0]);
+  CallFragmentCodec::encode(CallFragmentCodec::BINARY,
+                            CallListStore::CallFragment::Type::BEGIN,
+                            _entry,
+                            row[1]);
+
+  std::string xml0;
+  std::string xml1;
+  EXPECT_TRUE(CallFragmentCodec::to_xml(row[0], xml0));
+  EXPECT_TRUE(CallFragmentCodec::to_xml(row[1], xml1));
+  EXPECT_EQ(xml0, xml1);
+}
+
+// Truncated or corrupt binary contents are rejected rather than read past
+// the end.
+TEST_F(CallFragmentCodecTest, MalformedBinary)
+{
+  std::string contents;
+  CallFragmentCodec::encode(CallFragmentCodec::BINARY,
+                            CallListStore::CallFragment::Type::BEGIN,
+                            _entry,
+                            contents);
+
+  std::string xml;
+  for (size_t len = 1; len < contents.length(); len++)
+  {
+    EXPECT_FALSE(CallFragmentCodec::to_xml(contents.substr(0, len), xml));
+  }
+
+  // Trailing garbage.
+  EXPECT_FALSE(CallFragmentCodec::to_xml(contents + "x", xml));
+
+  // Unknown version.
+  std::string bad_version = contents;
+  bad_version[1] = '\x7f';
+  EXPECT_FALSE(CallFragmentCodec::to_xml(bad_version, xml));
+
+  // Unknown fragment type.
+  std::string bad_type = contents;
+  bad_type[2] = '\x09';
+  EXPECT_FALSE(CallFragmentCodec::to_xml(bad_type, xml));
+
+  // Over-long varint.
+  std::string bad_varint = contents.substr(0, 4) + std::string(11, '\xff');
+  EXPECT_FALSE(CallFragmentCodec::to_xml(bad_varint, xml));
+}
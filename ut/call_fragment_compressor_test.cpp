@@ -0,0 +1,228 @@
+/**
+ * @file call_fragment_compressor_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include <zdict.h>
+#include "gtest/gtest.h"
+
+#include "call_fragment_codec.h"
+#include "call_fragment_compressor.h"
+#include "zmq_lvc.h"
+
+const static std::string known_stats[] = {
+  "memento_fragment_compression_ratio",
+};
+const static std::string zmq_port = "6666";
+const int num_known_stats = sizeof(known_stats) / sizeof(std::string);
+
+/// Renders a plausible call list entry, different for each seed.
+static CallListEntry sample_entry(int seed)
+{
+  CallListEntry sample;
+  sample.caller_uri = "sip:650555" + std::to_string(1000 + seed % 9000) + "@homedomain";
+  sample.caller_name = "Caller " + std::to_string(seed);
+  sample.callee_uri = "sip:650555" + std::to_string(9999 - seed % 9000) + "@homedomain";
+  sample.callee_name = (seed % 3 == 0) ? "" : "Callee " + std::to_string(seed % 97);
+  sample.start_time = 1022751010 + seed * 37;
+  sample.answer_time = sample.start_time + seed % 20;
+  sample.end_time = sample.answer_time + seed % 600;
+  sample.outgoing = (seed % 2 == 0);
+  return sample;
+}
+
+/// Trains a dictionary as train_call_fragment_dictionary does, on a range
+/// of call fragments. Training takes a while, so this is only done once.
+static std::string train_dictionary()
+{
+  static std::string dictionary;
+
+  if (!dictionary.empty())
+  {
+    return dictionary;
+  }
+
+  static const CallListStore::CallFragment::Type TYPES[] =
+  {
+    CallListStore::CallFragment::Type::BEGIN,
+    CallListStore::CallFragment::Type::END,
+    CallListStore::CallFragment::Type::REJECTED
+  };
+
+  std::string samples;
+  std::vector<size_t> sizes;
+
+  for (int ii = 0; ii < 3000; ii++)
+  {
+    std::string xml = render_call_list_xml(TYPES[ii % 3], sample_entry(ii));
+    samples.append(xml);
+    sizes.push_back(xml.length());
+  }
+
+  dictionary.resize(16384);
+  size_t rc = ZDICT_trainFromBuffer(&dictionary[0],
+                                    dictionary.length(),
+                                    samples.data(),
+                                    sizes.data(),
+                                    sizes.size());
+  dictionary.resize(ZDICT_isError(rc) ? 0 : rc);
+  return dictionary;
+}
+
+class CallFragmentCompressorTest : public ::testing::Test
+{
+public:
+  CallFragmentCompressorTest()
+  {
+    _stats_aggregator = new LastValueCache(num_known_stats,
+                                           known_stats,
+                                           zmq_port,
+                                           10);
+
+    // Use a dictionary trained on call fragments, as the plugin requires.
+    std::string dictionary = train_dictionary();
+    _compressor = new CallFragmentCompressor(dictionary, 3, _stats_aggregator);
+
+    _entry.caller_uri = "sip:6505559876@homedomain";
+    _entry.caller_name = "Carol";
+    _entry.callee_uri = "sip:6505554321@homedomain";
+    _entry.callee_name = "Dave";
+    _entry.answerer_uri = "sip:6505554322@homedomain";
+    _entry.start_time = 1022760000;
+    _entry.answer_time = 1022760005;
+    _entry.outgoing = true;
+  }
+
+  virtual ~CallFragmentCompressorTest()
+  {
+    delete _compressor; _compressor = NULL;
+    delete _stats_aggregator; _stats_aggregator = NULL;
+  }
+
+  LastValueCache* _stats_aggregator;
+  CallFragmentCompressor* _compressor;
+  CallListEntry _entry;
+};
+
+// Call list XML compresses severalfold against the dictionary, and
+// decompresses to exactly the original.
+TEST_F(CallFragmentCompressorTest, RoundTrip)
+{
+  ASSERT_TRUE(_compressor->is_valid());
+  std::string xml = render_call_list_xml(CallListStore::CallFragment::Type::BEGIN,
+                                         _entry);
+  std::string contents = xml;
+  _compressor->compress(contents);
+
+  EXPECT_EQ(CallFragmentCompressor::COMPRESSED_MARKER, contents[0]);
+  EXPECT_LT(contents.length() * 3, xml.length());
+
+  std::string decompressed;
+  EXPECT_TRUE(_compressor->decompress(contents, decompressed));
+  EXPECT_EQ(xml, decompressed);
+}
+
+// Compressed binary-encoded contents decompress to something the codec can
+// turn back into the XML.
+TEST_F(CallFragmentCompressorTest, RoundTripBinary)
+{
+  std::string contents;
+  CallFragmentCodec::encode(CallFragmentCodec::BINARY,
+                            CallListStore::CallFragment::Type::BEGIN,
+                            _entry,
+                            contents);
+  _compressor->compress(contents);
+
+  std::string decompressed;
+  std::string xml;
+  EXPECT_TRUE(_compressor->decompress(contents, decompressed));
+  EXPECT_TRUE(CallFragmentCodec::to_xml(decompressed, xml));
+  EXPECT_EQ(render_call_list_xml(CallListStore::CallFragment::Type::BEGIN, _entry),
+            xml);
+}
+
+// Uncompressed contents are passed through, so rows written before
+// compression was turned on can still be read.
+TEST_F(CallFragmentCompressorTest, Uncompressed)
+{
+  std::string xml = render_call_list_xml(CallListStore::CallFragment::Type::END,
+                                         _entry);
+  std::string decompressed;
+  EXPECT_TRUE(_compressor->decompress(xml, decompressed));
+  EXPECT_EQ(xml, decompressed);
+
+  EXPECT_TRUE(_compressor->decompress("", decompressed));
+  EXPECT_EQ("", decompressed);
+}
+
+// Contents that don't get any smaller are stored as they are.
+TEST_F(CallFragmentCompressorTest, Incompressible)
+{
+  std::string contents = "\x7fq";
+  _compressor->compress(contents);
+  EXPECT_EQ("\x7fq", contents);
+}
+
+// Truncated or corrupt frames are rejected.
+TEST_F(CallFragmentCompressorTest, Corrupt)
+{
+  std::string contents = render_call_list_xml(CallListStore::CallFragment::Type::BEGIN,
+                                              _entry);
+  _compressor->compress(contents);
+
+  std::string decompressed;
+  EXPECT_FALSE(_compressor->decompress(contents.substr(0, 1), decompressed));
+  EXPECT_FALSE(_compressor->decompress(contents.substr(0, contents.length() - 2),
+                                       decompressed));
+
+  std::string corrupt = contents;
+  corrupt[corrupt.length() / 2] ^= 0x55;
+  corrupt[corrupt.length() - 1] ^= 0x55;
+  EXPECT_FALSE(_compressor->decompress(corrupt, decompressed) &&
+               (decompressed ==
+                render_call_list_xml(CallListStore::CallFragment::Type::BEGIN, _entry)));
+}
+
+// Without a dictionary the compressor does nothing.
+TEST_F(CallFragmentCompressorTest, NoDictionary)
+{
+  CallFragmentCompressor compressor("", 3, NULL);
+  EXPECT_FALSE(compressor.is_valid());
+
+  std::string xml = render_call_list_xml(CallListStore::CallFragment::Type::BEGIN,
+                                         _entry);
+  std::string contents = xml;
+  compressor.compress(contents);
+  EXPECT_EQ(xml, contents);
+
+  std::string decompressed;
+  EXPECT_FALSE(compressor.decompress(std::string(1, CallFragmentCompressor::COMPRESSED_MARKER),
+                                     decompressed));
+}
+
+// Only dictionaries trained by zstd count as trained.
+TEST_F(CallFragmentCompressorTest, Trained)
+{
+  EXPECT_TRUE(CallFragmentCompressor::is_trained(train_dictionary()));
+  EXPECT_FALSE(CallFragmentCompressor::is_trained(
+                 render_call_list_xml(CallListStore::CallFragment::Type::BEGIN,
+                                      _entry)));
+  EXPECT_FALSE(CallFragmentCompressor::is_trained(""));
+}
+
+// Dictionaries are read from a file.
+TEST_F(CallFragmentCompressorTest, ReadDictionary)
+{
+  std::string dictionary;
+  EXPECT_FALSE(CallFragmentCompressor::read_dictionary("/nonexistent/dictionary",
+                                                       dictionary));
+  EXPECT_FALSE(CallFragmentCompressor::read_dictionary("/dev/null", dictionary));
+}
@@ -0,0 +1,196 @@
+/**
+ * @file call_list_request_pool_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "batch_call_list_store.h"
+#include "call_list_store_processor.h"
+
+/// Call list store that accepts every write without doing anything, but
+/// remembers where the strings of the last fragments it was given are.
+class NullCallListStore : public CallListStore::Store,
+                          public BatchCallListStore
+{
+public:
+  virtual CassandraStore::ResultCode write_call_fragment_sync(
+                                    const std::string& impu,
+                                    const CallListStore::CallFragment& fragment,
+                                    const int64_t cass_timestamp,
+                                    const int32_t ttl,
+                                    SAS::TrailId trail)
+  {
+    ids.clear();
+    ids.push_back(fragment.id.data());
+    return CassandraStore::OK;
+  }
+
+  virtual CassandraStore::ResultCode write_call_fragments_sync(
+                     const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments,
+                     const int64_t cass_timestamp,
+                     const int32_t ttl,
+                     SAS::TrailId trail)
+  {
+    ids.clear();
+
+    for (size_t ii = 0; ii < fragments.size(); ii++)
+    {
+      ids.push_back(fragments[ii].id.data());
+    }
+
+    return CassandraStore::OK;
+  }
+
+  std::vector<const char*> ids;
+};
+
+/// Load monitor that ignores request latencies.
+class NullLoadMonitor : public LoadMonitor
+{
+public:
+  NullLoadMonitor() : LoadMonitor(100000, 20, 10.0, 10.0, 100.0) {}
+  virtual void request_complete(unsigned long latency, SAS::TrailId trail) {}
+};
+
+class CallListRequestPoolTest : public ::testing::Test
+{
+public:
+  CallListRequestPoolTest()
+  {
+    // No maximum call length and 1 worker thread
+    _clsp = new CallListStoreProcessor(&_load_monitor, &_cls, 0, 1, 604800, NULL, NULL, NULL, CallFragmentCodec::XML, NULL, 0, 0, 0, 0, NULL, NULL);
+
+    _entry.caller_uri = "sip:6505551000@homedomain";
+    _entry.caller_name = "Alice";
+    _entry.callee_uri = "sip:6505551234@homedomain";
+    _entry.callee_name = "Bob";
+    _entry.answerer_uri = "sip:6505551235@homedomain";
+    _entry.answerer_name = "Bob's cell";
+    _entry.start_time = 1022751010;
+    _entry.answer_time = 1022751020;
+    _entry.outgoing = true;
+  }
+
+  virtual ~CallListRequestPoolTest()
+  {
+    delete _clsp; _clsp = NULL;
+  }
+
+  // Fills in a request as the transaction does, writing each detail straight
+  // into the request's existing strings.
+  CallListStoreProcessor::CallListRequest* fill_request(
+               CallListStore::CallFragment::Type type =
+                                    CallListStore::CallFragment::Type::BEGIN)
+  {
+    CallListStoreProcessor::CallListRequest* request = _clsp->get_request();
+    request->impu.assign(_entry.callee_uri);
+    request->fragment.timestamp.assign("20020530093010");
+    request->fragment.id.assign("6246712318729461262");
+    request->fragment.type = type;
+    request->entry.caller_uri.assign(_entry.caller_uri);
+    request->entry.caller_name.assign(_entry.caller_name);
+    request->entry.callee_uri.assign(_entry.callee_uri);
+    request->entry.callee_name.assign(_entry.callee_name);
+    request->entry.answerer_uri.assign(_entry.answerer_uri);
+    request->entry.answerer_name.assign(_entry.answerer_name);
+    request->entry.start_time = _entry.start_time;
+    request->entry.answer_time = _entry.answer_time;
+    request->entry.outgoing = _entry.outgoing;
+    return request;
+  }
+
+  // Writes a fragment on this thread, as a worker thread would.
+  void process(CallListStoreProcessor::CallListRequest* request)
+  {
+    request->stop_watch.start();
+    _clsp->_thread_pool->process_work(request);
+  }
+
+  NullCallListStore _cls;
+  NullLoadMonitor _load_monitor;
+  CallListStoreProcessor* _clsp;
+  CallListEntry _entry;
+};
+
+// Requests are recycled, and come back empty.
+TEST_F(CallListRequestPoolTest, RequestsRecycled)
+{
+  CallListStoreProcessor::CallListRequest* request = fill_request();
+  _clsp->release_request(request);
+
+  CallListStoreProcessor::CallListRequest* recycled = _clsp->get_request();
+  EXPECT_EQ(request, recycled);
+  EXPECT_EQ("", recycled->impu);
+  EXPECT_EQ("", recycled->fragment.id);
+  EXPECT_EQ("", recycled->entry.caller_uri);
+  EXPECT_EQ(0, recycled->entry.start_time);
+  EXPECT_FALSE(recycled->entry.outgoing);
+  _clsp->release_request(recycled);
+}
+
+// Once the pool has warmed up, filling in and writing a fragment reuses the
+// same request, and its strings keep their buffers, so nothing is
+// allocated for them. The store is given the request's own strings.
+TEST_F(CallListRequestPoolTest, RequestsReusedPerFragment)
+{
+  // Warm up the pool, so the recycled strings have enough capacity.
+  process(fill_request());
+  size_t extra_requests = _clsp->_num_extra_requests;
+
+  CallListStoreProcessor::CallListRequest* request = fill_request();
+  const char* impu = request->impu.data();
+  const char* id = request->fragment.id.data();
+  const char* caller_uri = request->entry.caller_uri.data();
+  process(request);
+  EXPECT_EQ(id, _cls.ids[0]);
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    request = fill_request();
+    EXPECT_EQ(impu, request->impu.data());
+    EXPECT_EQ(id, request->fragment.id.data());
+    EXPECT_EQ(caller_uri, request->entry.caller_uri.data());
+    process(request);
+  }
+
+  EXPECT_EQ(extra_requests, _clsp->_num_extra_requests);
+}
+
+// A BEGIN merged with its END is written in one operation, from the
+// requests' own strings, which are back in the requests afterwards.
+TEST_F(CallListRequestPoolTest, MergedFragmentsNotCopied)
+{
+  CallListStoreProcessor::CallListRequest* begin = fill_request();
+  CallListStoreProcessor::CallListRequest* end =
+                     fill_request(CallListStore::CallFragment::Type::END);
+  begin->next = end;
+  const char* begin_id = begin->fragment.id.data();
+  const char* end_id = end->fragment.id.data();
+
+  bool timed_out = false;
+  uint64_t cass_timestamp = 0;
+  EXPECT_TRUE(_clsp->_thread_pool->write_fragments(begin,
+                                                   cass_timestamp,
+                                                   0,
+                                                   timed_out));
+
+  ASSERT_EQ(2u, _cls.ids.size());
+  EXPECT_EQ(begin_id, _cls.ids[0]);
+  EXPECT_EQ(end_id, _cls.ids[1]);
+  EXPECT_EQ(begin_id, begin->fragment.id.data());
+  EXPECT_EQ("6246712318729461262", end->fragment.id);
+  EXPECT_EQ(CallListStore::CallFragment::Type::END, end->fragment.type);
+
+  _clsp->release_request(end);
+  _clsp->release_request(begin);
+}
@@ -17,7 +17,9 @@
 #include "fakelogger.h"
 
 #include "call_list_store_processor.h"
+#include "deadline_call_list_store.h"
 #include "mock_call_list_store.h"
+#include "mock_call_list_view_store.h"
 #include "mockloadmonitor.hpp"
 #include "mockhttpnotifier.h"
 #include "memento_lvc.h"
@@ -28,11 +30,37 @@ using ::testing::_;
 using ::testing::StrictMock;
 using ::testing::Mock;
 using ::testing::DoAll;
+using ::testing::InvokeWithoutArgs;
+using ::testing::SaveArg;
+using ::testing::Between;
+using ::testing::Ge;
 
 static int CALL_LIST_TTL = 604800;
 static int FAKE_SAS_TRAIL = 0;
 static std::string IMPU = "sip:6510001000@home.domain";
 static std::string TIMESTAMP = "20020530093010";
+static CallListEntry ENTRY;
+
+// Queues a request to write a call list entry for IMPU.
+static void write_entry(CallListStoreProcessor* clsp,
+                        CallListStore::CallFragment::Type type,
+                        const CallListEntry& entry)
+{
+  CallListStoreProcessor::CallListRequest* request = clsp->get_request();
+  request->impu = IMPU;
+  request->fragment.timestamp = TIMESTAMP;
+  request->fragment.id = "id";
+  request->fragment.type = type;
+  request->entry = entry;
+  request->trail = FAKE_SAS_TRAIL;
+  clsp->write_call_list_entry(request);
+}
+
+// Matches a CallFragment with the given contents.
+MATCHER_P(FragmentContents, contents, "")
+{
+  return arg.contents == contents;
+}
 
 const static std::string known_stats[] = {
   "memento_completed_calls",
@@ -40,6 +68,15 @@ const static std::string known_stats[] = {
   "memento_not_recorded_overload",
   "memento_cassandra_read_latency",
   "memento_cassandra_write_latency",
+  "memento_cassandra_timeouts",
+  "memento_cassandra_errors",
+  "memento_cassandra_retries",
+  "memento_call_list_view_updates",
+  "memento_call_list_view_conflicts",
+  "memento_call_list_view_errors",
+  "memento_trims_not_owned",
+  "memento_top_write_impus",
+  "memento_top_trim_impus",
 };
 const static std::string zmq_port = "6666";
 const int num_known_stats = sizeof(known_stats) / sizeof(std::string);
@@ -58,7 +95,7 @@ public:
     _http_notifier = new MockHttpNotifier();
 
     // No maximum call length and 1 worker thread
-    _clsp = new CallListStoreProcessor(&_load_monitor, _cls, 0, 1, CALL_LIST_TTL, _stats_aggregator, NULL, _http_notifier);
+    _clsp = new CallListStoreProcessor(&_load_monitor, _cls, 0, 1, CALL_LIST_TTL, _stats_aggregator, NULL, _http_notifier, CallFragmentCodec::XML, NULL, 0, 0, 0, 0, NULL, NULL);
   }
 
   virtual ~CallListStoreProcessorTest()
@@ -90,7 +127,7 @@ public:
     _http_notifier = new MockHttpNotifier();
 
     // Maximum call length of 4 and 2 worker threads
-    _clsp = new CallListStoreProcessor(&_load_monitor, _cls, 4, 2, CALL_LIST_TTL, _stats_aggregator, NULL, _http_notifier);
+    _clsp = new CallListStoreProcessor(&_load_monitor, _cls, 4, 2, CALL_LIST_TTL, _stats_aggregator, NULL, _http_notifier, CallFragmentCodec::XML, NULL, 0, 0, 0, 0, NULL, NULL);
   }
 
   virtual ~CallListStoreProcessorWithLimitTest()
@@ -108,6 +145,118 @@ public:
   MockHttpNotifier* _http_notifier;
 };
 
+// Fixture for tests that hold BEGIN fragments waiting for the END. The
+// hold is long enough that it never expires during a test.
+class CallListStoreProcessorWithHoldTest : public ::testing::Test
+{
+public:
+  CallListStoreProcessorWithHoldTest()
+  {
+    _cls = new MockBatchCallListStore();
+    _stats_aggregator = new LastValueCache(num_known_stats,
+                                           known_stats,
+                                           zmq_port,
+                                           10);
+    _http_notifier = new MockHttpNotifier();
+
+    // No maximum call length, 1 worker thread and a 60s hold,
+    // on a store that can write merged fragments together
+    _clsp = new CallListStoreProcessor(&_load_monitor, _cls, 0, 1, CALL_LIST_TTL, _stats_aggregator, NULL, _http_notifier, CallFragmentCodec::XML, NULL, 60000, 0, 0, 0, NULL, NULL);
+  }
+
+  virtual ~CallListStoreProcessorWithHoldTest()
+  {
+    delete _cls; _cls = NULL;
+    delete _stats_aggregator; _stats_aggregator = NULL;
+    delete _clsp; _clsp = NULL;
+    delete _http_notifier; _http_notifier = NULL;
+  }
+
+  StrictMock<MockLoadMonitor> _load_monitor;
+  CallListStoreProcessor* _clsp;
+  MockBatchCallListStore* _cls;
+  LastValueCache* _stats_aggregator;
+  MockHttpNotifier* _http_notifier;
+};
+
+// Fixture for tests that give each request a 50ms deadline, enforced by a
+// DeadlineCallListStore.
+class CallListStoreProcessorWithDeadlineTest : public ::testing::Test
+{
+public:
+  CallListStoreProcessorWithDeadlineTest()
+  {
+    _cls = new MockCallListStore();
+    _deadline_store = new DeadlineCallListStore(_cls, NULL, 1);
+    _stats_aggregator = new LastValueCache(num_known_stats,
+                                           known_stats,
+                                           zmq_port,
+                                           10);
+    _http_notifier = new MockHttpNotifier();
+
+    // No maximum call length, 1 worker thread and a 50ms target latency
+    _clsp = new CallListStoreProcessor(&_load_monitor, _deadline_store, 0, 1, CALL_LIST_TTL, _stats_aggregator, NULL, _http_notifier, CallFragmentCodec::XML, NULL, 0, 0, 0, 50000, NULL, NULL);
+  }
+
+  virtual ~CallListStoreProcessorWithDeadlineTest()
+  {
+    delete _clsp; _clsp = NULL;
+
+    // This deletes the mock store too.
+    delete _deadline_store; _deadline_store = NULL; _cls = NULL;
+    delete _stats_aggregator; _stats_aggregator = NULL;
+    delete _http_notifier; _http_notifier = NULL;
+  }
+
+  StrictMock<MockLoadMonitor> _load_monitor;
+  CallListStoreProcessor* _clsp;
+  MockCallListStore* _cls;
+  DeadlineCallListStore* _deadline_store;
+  LastValueCache* _stats_aggregator;
+  MockHttpNotifier* _http_notifier;
+};
+
+// Fixture for tests that keep a materialized call list view
+class CallListStoreProcessorWithViewTest : public ::testing::Test
+{
+public:
+  CallListStoreProcessorWithViewTest()
+  {
+    _cls = new MockCallListStore();
+    _clvs = new MockCallListViewStore();
+    _stats_aggregator = new LastValueCache(num_known_stats,
+                                           known_stats,
+                                           zmq_port,
+                                           10);
+    _http_notifier = new MockHttpNotifier();
+
+    // No maximum call length and 1 worker thread
+    _clsp = new CallListStoreProcessor(&_load_monitor, _cls, 0, 1, CALL_LIST_TTL, _stats_aggregator, NULL, _http_notifier, CallFragmentCodec::XML, NULL, 0, 0, 0, 0, _clvs, NULL);
+  }
+
+  virtual ~CallListStoreProcessorWithViewTest()
+  {
+    delete _clsp; _clsp = NULL;
+    delete _cls; _cls = NULL;
+    delete _clvs; _clvs = NULL;
+    delete _stats_aggregator; _stats_aggregator = NULL;
+    delete _http_notifier; _http_notifier = NULL;
+  }
+
+  StrictMock<MockLoadMonitor> _load_monitor;
+  CallListStoreProcessor* _clsp;
+  MockCallListStore* _cls;
+  MockCallListViewStore* _clvs;
+  LastValueCache* _stats_aggregator;
+  MockHttpNotifier* _http_notifier;
+};
+
+// Overruns the 50ms deadline.
+static void overrun_deadline()
+{
+  usleep(60000);
+}
+
 // Create a vector of call list store fragments that the mock
 // get_call_fragments_sync can return. It creates 7 records
 // making up 6 calls; the first two match the begin and end of
@@ -238,7 +387,7 @@ void create_records(std::vector<CallListStore::CallFragment>& records)
 TEST_F(CallListStoreProcessorTest, CallListIsCountNeededNoLimit)
 {
   std::vector<CallListStore::CallFragment> fragments;
-  bool rc =_clsp->_thread_pool->is_call_trim_needed(IMPU, fragments, FAKE_SAS_TRAIL);
+  bool rc =_clsp->_thread_pool->is_call_trim_needed(IMPU, fragments, 0, FAKE_SAS_TRAIL);
   ASSERT_FALSE(rc);
   ASSERT_TRUE(fragments.size() == 0);
 }
@@ -249,7 +398,7 @@ TEST_F(CallListStoreProcessorTest, CallListWriteBegin)
   EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
 
   EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL)).WillOnce(Return(CassandraStore::ResultCode::OK));
-  _clsp->write_call_list_entry(IMPU, TIMESTAMP, "id", CallListStore::CallFragment::Type::BEGIN, "xml", FAKE_SAS_TRAIL);
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
   sleep(1);
 }
 
@@ -259,7 +408,7 @@ TEST_F(CallListStoreProcessorTest, CallListWriteEnd)
   EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
 
   EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL)).WillOnce(Return(CassandraStore::ResultCode::OK));
-  _clsp->write_call_list_entry(IMPU, TIMESTAMP, "id", CallListStore::CallFragment::Type::END, "xml", FAKE_SAS_TRAIL);
+  write_entry(_clsp, CallListStore::CallFragment::Type::END, ENTRY);
   sleep(1);
 }
 
@@ -269,7 +418,23 @@ TEST_F(CallListStoreProcessorTest, CallListWriteRejected)
   EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
 
   EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL)).WillOnce(Return(CassandraStore::ResultCode::OK));
-  _clsp->write_call_list_entry(IMPU, TIMESTAMP, "id", CallListStore::CallFragment::Type::REJECTED, "xml", FAKE_SAS_TRAIL);
+  write_entry(_clsp, CallListStore::CallFragment::Type::REJECTED, ENTRY);
+  sleep(1);
+}
+
+// Test that the worker thread renders the call list entry into the contents
+// of the call fragment it writes.
+TEST_F(CallListStoreProcessorTest, CallListWriteRendersEntry)
+{
+  CallListEntry entry;
+  entry.end_time = 1022751300;
+  std::string xml = render_call_list_xml(CallListStore::CallFragment::Type::END, entry);
+
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
+
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, FragmentContents(xml), _, CALL_LIST_TTL, FAKE_SAS_TRAIL)).WillOnce(Return(CassandraStore::ResultCode::OK));
+  write_entry(_clsp, CallListStore::CallFragment::Type::END, entry);
   sleep(1);
 }
 
@@ -277,7 +442,7 @@ TEST_F(CallListStoreProcessorTest, CallListWriteWithError)
 {
   EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
   EXPECT_CALL(*_cls, write_call_fragment_sync(_, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL)).WillOnce(Return(CassandraStore::ResultCode::CONNECTION_ERROR));
-  _clsp->write_call_list_entry(IMPU, TIMESTAMP, "id", CallListStore::CallFragment::Type::BEGIN, "xml", FAKE_SAS_TRAIL);
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
   sleep(1);
 }
 
@@ -292,7 +457,79 @@ TEST_F(CallListStoreProcessorWithLimitTest, CallListWriteWithTrim)
   EXPECT_CALL(*_cls, get_call_fragments_sync(_,_,_)).WillOnce(DoAll(SetArgReferee<1>(records),
                                                                     Return(CassandraStore::ResultCode::OK)));
   EXPECT_CALL(*_cls, delete_old_call_fragments_sync(_,_,_,_)).WillOnce(Return(CassandraStore::ResultCode::OK));
-  _clsp->write_call_list_entry(IMPU, TIMESTAMP, "id", CallListStore::CallFragment::Type::BEGIN, "xml", FAKE_SAS_TRAIL);
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+}
+
+// Test that a BEGIN fragment is held until its END arrives, and the two are
+// then written together in one store operation, with a single notification.
+TEST_F(CallListStoreProcessorWithHoldTest, CallListMergeBeginEnd)
+{
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+  EXPECT_EQ(1u, _clsp->_held_requests.size());
+
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(2);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
+  EXPECT_CALL(*_cls, write_call_fragment_sync(_, _, _, _, _)).Times(0);
+  EXPECT_CALL(*_cls, write_call_fragments_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(SaveArg<1>(&fragments),
+                    Return(CassandraStore::ResultCode::OK)));
+  write_entry(_clsp, CallListStore::CallFragment::Type::END, ENTRY);
+  sleep(1);
+  EXPECT_EQ(0u, _clsp->_held_requests.size());
+
+  ASSERT_EQ(2u, fragments.size());
+  EXPECT_EQ(CallListStore::CallFragment::Type::BEGIN, fragments[0].type);
+  EXPECT_EQ(CallListStore::CallFragment::Type::END, fragments[1].type);
+  EXPECT_FALSE(fragments[0].contents.empty());
+  EXPECT_FALSE(fragments[1].contents.empty());
+}
+
+// Test that if the merged write fails, neither fragment counts as written,
+// so nobody is notified.
+TEST_F(CallListStoreProcessorWithHoldTest, CallListMergeBeginEndFails)
+{
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(2);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(0);
+  EXPECT_CALL(*_cls, write_call_fragments_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::CONNECTION_ERROR));
+  write_entry(_clsp, CallListStore::CallFragment::Type::END, ENTRY);
+  sleep(1);
+}
+
+// Test that a held BEGIN fragment is written on its own once the hold
+// expires.
+TEST_F(CallListStoreProcessorWithHoldTest, CallListHoldExpires)
+{
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::OK));
+  _clsp->expire_held_requests(UINT64_MAX);
+  sleep(1);
+  EXPECT_EQ(0u, _clsp->_held_requests.size());
+  EXPECT_EQ(0u, _clsp->_held_order.size());
+}
+
+// Test that REJECTED fragments, and END fragments with no held BEGIN, are
+// written straight away.
+TEST_F(CallListStoreProcessorWithHoldTest, CallListNotHeld)
+{
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(2);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(2);
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .Times(2)
+    .WillRepeatedly(Return(CassandraStore::ResultCode::OK));
+  write_entry(_clsp, CallListStore::CallFragment::Type::REJECTED, ENTRY);
+  write_entry(_clsp, CallListStore::CallFragment::Type::END, ENTRY);
   sleep(1);
 }
 
@@ -308,12 +545,85 @@ TEST_F(CallListStoreProcessorWithLimitTest, CallListIsCallTrimNeeded)
                                                                     Return(CassandraStore::ResultCode::OK)));
 
   std::vector<CallListStore::CallFragment> fragments;
-  bool rc =_clsp->_thread_pool->is_call_trim_needed(IMPU, fragments, FAKE_SAS_TRAIL);
+  bool rc =_clsp->_thread_pool->is_call_trim_needed(IMPU, fragments, 0, FAKE_SAS_TRAIL);
 
   ASSERT_TRUE(rc);
   ASSERT_TRUE(fragments.size() == 2);
 }
 
+// Test that a call list owned by another node is only read now and again,
+// and isn't trimmed while it's less than twice the max length (4 here, with
+// 6 calls stored).
+TEST_F(CallListStoreProcessorWithLimitTest, CallListIsCallTrimNeededNotOwned)
+{
+  std::vector<std::string> nodes;
+  nodes.push_back("10.0.0.1");
+  nodes.push_back("10.0.0.2");
+  TrimOwnership first("10.0.0.1", "", NULL);
+  TrimOwnership second("10.0.0.2", "", NULL);
+  first.set_nodes(nodes);
+  second.set_nodes(nodes);
+  _clsp->_thread_pool->_trim_ownership = first.owns(IMPU) ? &second : &first;
+
+  std::vector<CallListStore::CallFragment> records;
+  create_records(records);
+
+  EXPECT_CALL(*_cls, get_call_fragments_sync(_,_,_))
+    .Times(Between(1, 40))
+    .WillRepeatedly(DoAll(SetArgReferee<1>(records),
+                          Return(CassandraStore::ResultCode::OK)));
+
+  for (int ii = 0; ii < 100; ii++)
+  {
+    std::vector<CallListStore::CallFragment> fragments;
+    bool rc =_clsp->_thread_pool->is_call_trim_needed(IMPU, fragments, 0, FAKE_SAS_TRAIL);
+    ASSERT_FALSE(rc);
+  }
+
+  _clsp->_thread_pool->_trim_ownership = NULL;
+}
+
+// Test that a call list owned by another node is trimmed back to the max
+// length once it's more than twice as long.
+TEST_F(CallListStoreProcessorWithLimitTest, CallListIsCallTrimNeededNotOwnedFarOver)
+{
+  std::vector<std::string> nodes;
+  nodes.push_back("10.0.0.1");
+  nodes.push_back("10.0.0.2");
+  TrimOwnership first("10.0.0.1", "", NULL);
+  TrimOwnership second("10.0.0.2", "", NULL);
+  first.set_nodes(nodes);
+  second.set_nodes(nodes);
+  _clsp->_thread_pool->_trim_ownership = first.owns(IMPU) ? &second : &first;
+
+  // Store 9 rejected calls.
+  std::vector<CallListStore::CallFragment> records;
+  for (int ii = 0; ii < 9; ii++)
+  {
+    CallListStore::CallFragment record;
+    record.type = CallListStore::CallFragment::Type::REJECTED;
+    record.timestamp = "2002053009301" + std::to_string(ii);
+    record.id = std::to_string(ii);
+    records.push_back(record);
+  }
+
+  EXPECT_CALL(*_cls, get_call_fragments_sync(_,_,_))
+    .WillRepeatedly(DoAll(SetArgReferee<1>(records),
+                          Return(CassandraStore::ResultCode::OK)));
+
+  bool rc = false;
+  std::vector<CallListStore::CallFragment> fragments;
+
+  for (int ii = 0; (ii < 200) && (!rc); ii++)
+  {
+    rc =_clsp->_thread_pool->is_call_trim_needed(IMPU, fragments, 0, FAKE_SAS_TRAIL);
+  }
+
+  ASSERT_TRUE(rc);
+  ASSERT_EQ(5u, fragments.size());
+  _clsp->_thread_pool->_trim_ownership = NULL;
+}
+
 // Test where getting the call records from the call list store fails when
 // testing if the call list needs trimming. This should return false.
 TEST_F(CallListStoreProcessorWithLimitTest, CallListIsCallTrimNeededCassError)
@@ -324,7 +634,7 @@ TEST_F(CallListStoreProcessorWithLimitTest, CallListIsCallTrimNeededCassError)
                                                                     Return(CassandraStore::ResultCode::UNKNOWN_ERROR)));
 
   std::vector<CallListStore::CallFragment> fragments;
-  bool rc =_clsp->_thread_pool->is_call_trim_needed(IMPU, fragments, FAKE_SAS_TRAIL);
+  bool rc =_clsp->_thread_pool->is_call_trim_needed(IMPU, fragments, 0, FAKE_SAS_TRAIL);
 
   ASSERT_FALSE(rc);
   ASSERT_TRUE(fragments.size() == 0);
@@ -336,7 +646,7 @@ TEST_F(CallListStoreProcessorWithLimitTest, CallListPerformCallTrim)
 {
   EXPECT_CALL(*_cls, delete_old_call_fragments_sync(_,_,_,_)).WillOnce(Return(CassandraStore::ResultCode::OK));
   std::vector<CallListStore::CallFragment> fragments;
-  _clsp->_thread_pool->perform_call_trim(IMPU, fragments, 123, FAKE_SAS_TRAIL);
+  _clsp->_thread_pool->perform_call_trim(IMPU, fragments, 123, 0, FAKE_SAS_TRAIL);
   ASSERT_TRUE(fragments.size() == 0);
 }
 
@@ -346,5 +656,207 @@ TEST_F(CallListStoreProcessorWithLimitTest, CallListPerformCallTrimCassError)
 {
   EXPECT_CALL(*_cls, delete_old_call_fragments_sync(_,_,_,_)).WillOnce(Return(CassandraStore::ResultCode::UNKNOWN_ERROR));
   std::vector<CallListStore::CallFragment> fragments;
-  _clsp->_thread_pool->perform_call_trim(IMPU, fragments, 0, FAKE_SAS_TRAIL);
+  _clsp->_thread_pool->perform_call_trim(IMPU, fragments, 0, 0, FAKE_SAS_TRAIL);
+}
+
+// A write that fails after its deadline is retried once. The latency
+// reported covers both attempts.
+TEST_F(CallListStoreProcessorWithDeadlineTest, CallListWriteTimeoutRetried)
+{
+  EXPECT_CALL(_load_monitor, request_complete(Ge(50000u), _)).Times(1);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
+
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(InvokeWithoutArgs(overrun_deadline),
+                    Return(CassandraStore::ResultCode::RESOURCE_ERROR)))
+    .WillOnce(Return(CassandraStore::ResultCode::OK));
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+}
+
+// A write that keeps missing its deadline is only retried once.
+TEST_F(CallListStoreProcessorWithDeadlineTest, CallListWriteTimeoutGivesUp)
+{
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .Times(2)
+    .WillRepeatedly(DoAll(InvokeWithoutArgs(overrun_deadline),
+                          Return(CassandraStore::ResultCode::RESOURCE_ERROR)));
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+}
+
+// A write that fails in time is an error, and isn't retried.
+TEST_F(CallListStoreProcessorWithDeadlineTest, CallListWriteErrorNotRetried)
+{
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::CONNECTION_ERROR));
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+}
+
+// Without a DeadlineCallListStore, nothing can give up on a write, so a
+// slow failure is an error, and isn't retried.
+TEST_F(CallListStoreProcessorTest, CallListWriteNoDeadlineStore)
+{
+  delete _clsp;
+  _clsp = new CallListStoreProcessor(&_load_monitor, _cls, 0, 1, CALL_LIST_TTL, _stats_aggregator, NULL, _http_notifier, CallFragmentCodec::XML, NULL, 0, 0, 0, 50000, NULL, NULL);
+  EXPECT_EQ(0, _clsp->_thread_pool->_target_latency_us);
+
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(InvokeWithoutArgs(overrun_deadline),
+                    Return(CassandraStore::ResultCode::RESOURCE_ERROR)));
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+}
+
+// A subscriber without a view gets one, seeded from their stored calls.
+TEST_F(CallListStoreProcessorWithViewTest, ViewCreated)
+{
+  std::vector<CallListStore::CallFragment> records;
+  create_records(records);
+  std::string stored;
+
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::OK));
+  EXPECT_CALL(*_clvs, get_call_list_view_sync(IMPU, _, _, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::NOT_FOUND));
+  EXPECT_CALL(*_cls, get_call_fragments_sync(IMPU, _, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(SetArgReferee<1>(records),
+                    Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_clvs, set_call_list_view_sync(IMPU, _, 0, CALL_LIST_TTL, _, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(SaveArg<1>(&stored),
+                    SetArgReferee<4>(true),
+                    Return(CassandraStore::ResultCode::OK)));
+
+  write_entry(_clsp, CallListStore::CallFragment::Type::REJECTED, ENTRY);
+  sleep(1);
+
+  // The 6 stored calls, and the new one.
+  CallListView view;
+  ASSERT_TRUE(view.decode(stored));
+  ASSERT_EQ(7u, view.calls.size());
+  EXPECT_EQ("a", view.calls[0].id);
+  EXPECT_FALSE(view.calls[0].end.empty());
+  EXPECT_EQ("id", view.calls[1].id);
+}
+
+// If the view changes between being read and replaced, the update is
+// redone on the new view.
+TEST_F(CallListStoreProcessorWithViewTest, ViewConflict)
+{
+  CallListView existing;
+  CallListStore::CallFragment other;
+  other.timestamp = "20020530093011";
+  other.id = "other";
+  other.type = CallListStore::CallFragment::Type::REJECTED;
+  existing.add(other, "<other/>", 0);
+  std::string existing_stored;
+  existing.encode(existing_stored);
+  std::string stored;
+
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::OK));
+  EXPECT_CALL(*_clvs, get_call_list_view_sync(IMPU, _, _, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(SetArgReferee<1>(existing_stored),
+                    SetArgReferee<2>(3),
+                    Return(CassandraStore::ResultCode::OK)))
+    .WillOnce(DoAll(SetArgReferee<1>(existing_stored),
+                    SetArgReferee<2>(4),
+                    Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_clvs, set_call_list_view_sync(IMPU, _, 3, CALL_LIST_TTL, _, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(SetArgReferee<4>(false),
+                    Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_clvs, set_call_list_view_sync(IMPU, _, 4, CALL_LIST_TTL, _, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(SaveArg<1>(&stored),
+                    SetArgReferee<4>(true),
+                    Return(CassandraStore::ResultCode::OK)));
+
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+
+  CallListView view;
+  ASSERT_TRUE(view.decode(stored));
+  ASSERT_EQ(2u, view.calls.size());
+  EXPECT_EQ("id", view.calls[0].id);
+  EXPECT_EQ("other", view.calls[1].id);
+}
+
+// A view is seeded from the stored calls without reading them again, if
+// they've already been read.
+TEST_F(CallListStoreProcessorWithViewTest, ViewSeededFromStoredCalls)
+{
+  std::vector<CallListStore::CallFragment> records;
+  create_records(records);
+  std::string stored;
+
+  EXPECT_CALL(*_cls, get_call_fragments_sync(_, _, _)).Times(0);
+  EXPECT_CALL(*_clvs, get_call_list_view_sync(IMPU, _, _, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::NOT_FOUND));
+  EXPECT_CALL(*_clvs, set_call_list_view_sync(IMPU, _, 0, CALL_LIST_TTL, _, FAKE_SAS_TRAIL))
+    .WillOnce(DoAll(SaveArg<1>(&stored),
+                    SetArgReferee<4>(true),
+                    Return(CassandraStore::ResultCode::OK)));
+
+  CallListStoreProcessor::CallListRequest* request = _clsp->get_request();
+  request->impu = IMPU;
+  request->fragment.timestamp = TIMESTAMP;
+  request->fragment.id = "id";
+  request->fragment.type = CallListStore::CallFragment::Type::REJECTED;
+  request->entry = ENTRY;
+  std::vector<CallListStoreProcessor::CallListRequest*> requests(1, request);
+  _clsp->_thread_pool->update_view(IMPU, requests, &records, 0, FAKE_SAS_TRAIL);
+  _clsp->release_request(request);
+
+  CallListView view;
+  ASSERT_TRUE(view.decode(stored));
+  EXPECT_EQ(7u, view.calls.size());
+}
+
+// Conflicting view updates are only retried for a limited time.
+TEST_F(CallListStoreProcessorWithViewTest, ViewConflictsTimeOut)
+{
+  CallListView existing;
+  std::string existing_stored;
+  existing.encode(existing_stored);
+
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+  EXPECT_CALL(*_http_notifier, send_notify(_, _)).Times(1);
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::OK));
+  EXPECT_CALL(*_clvs, get_call_list_view_sync(IMPU, _, _, FAKE_SAS_TRAIL))
+    .Times(2)
+    .WillRepeatedly(DoAll(SetArgReferee<1>(existing_stored),
+                          SetArgReferee<2>(3),
+                          Return(CassandraStore::ResultCode::OK)));
+
+  // Each conflict takes 60ms, so there's only time for two attempts.
+  EXPECT_CALL(*_clvs, set_call_list_view_sync(IMPU, _, 3, CALL_LIST_TTL, _, FAKE_SAS_TRAIL))
+    .Times(2)
+    .WillRepeatedly(DoAll(InvokeWithoutArgs(overrun_deadline),
+                          SetArgReferee<4>(false),
+                          Return(CassandraStore::ResultCode::OK)));
+
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
+}
+
+// A failed write isn't added to the view.
+TEST_F(CallListStoreProcessorWithViewTest, ViewNotUpdatedOnFailedWrite)
+{
+  EXPECT_CALL(_load_monitor, request_complete(_, _)).Times(1);
+  EXPECT_CALL(*_cls, write_call_fragment_sync(IMPU, _, _, CALL_LIST_TTL, FAKE_SAS_TRAIL))
+    .WillOnce(Return(CassandraStore::ResultCode::CONNECTION_ERROR));
+  EXPECT_CALL(*_clvs, get_call_list_view_sync(_, _, _, _)).Times(0);
+
+  write_entry(_clsp, CallListStore::CallFragment::Type::BEGIN, ENTRY);
+  sleep(1);
 }
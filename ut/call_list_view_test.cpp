@@ -0,0 +1,112 @@
+/**
+ * @file call_list_view_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "call_list_view.h"
+
+static CallListStore::CallFragment fragment(const std::string& timestamp,
+                                            const std::string& id,
+                                            CallListStore::CallFragment::Type type)
+{
+  CallListStore::CallFragment fragment;
+  fragment.timestamp = timestamp;
+  fragment.id = id;
+  fragment.type = type;
+  return fragment;
+}
+
+// Calls are kept in timestamp order, and END fragments are merged into
+// their call whichever order they arrive in.
+TEST(CallListViewTest, AddAndRender)
+{
+  CallListView view;
+  view.add(fragment("20021225110000", "b", CallListStore::CallFragment::Type::REJECTED),
+           "<b/>",
+           0);
+  view.add(fragment("20021225100000", "a", CallListStore::CallFragment::Type::END),
+           "<a-end/>",
+           0);
+  view.add(fragment("20021225100000", "a", CallListStore::CallFragment::Type::BEGIN),
+           "<a-begin/>",
+           0);
+
+  // Adding a fragment again changes nothing.
+  view.add(fragment("20021225110000", "b", CallListStore::CallFragment::Type::REJECTED),
+           "<b/>",
+           0);
+
+  ASSERT_EQ(2u, view.calls.size());
+  EXPECT_EQ("a", view.calls[0].id);
+
+  std::string xml;
+  view.to_xml(1000, xml);
+  EXPECT_EQ("<call><a-begin/><a-end/></call><call><b/></call>", xml);
+}
+
+// Views survive being stored, and corrupt views are rejected.
+TEST(CallListViewTest, EncodeDecode)
+{
+  CallListView view;
+  view.add(fragment("20021225100000", "a", CallListStore::CallFragment::Type::BEGIN),
+           "<a-begin/>",
+           2000);
+  view.add(fragment("20021225100000", "a", CallListStore::CallFragment::Type::END),
+           "<a-end/>",
+           3000);
+
+  std::string stored;
+  view.encode(stored);
+
+  CallListView decoded;
+  ASSERT_TRUE(decoded.decode(stored));
+  ASSERT_EQ(1u, decoded.calls.size());
+  EXPECT_EQ("20021225100000", decoded.calls[0].timestamp);
+  EXPECT_EQ(3000, decoded.calls[0].expiry_s);
+  EXPECT_EQ("<a-begin/>", decoded.calls[0].start);
+  EXPECT_EQ("<a-end/>", decoded.calls[0].end);
+
+  EXPECT_FALSE(decoded.decode(stored.substr(0, stored.length() - 1)));
+  EXPECT_TRUE(decoded.calls.empty());
+  EXPECT_FALSE(decoded.decode(""));
+  EXPECT_FALSE(decoded.decode("\x02"));
+}
+
+// Trimming drops expired calls and the oldest calls beyond the limit, only
+// counting calls that have started.
+TEST(CallListViewTest, Trim)
+{
+  CallListView view;
+  view.add(fragment("20021225090000", "old", CallListStore::CallFragment::Type::REJECTED),
+           "<old/>",
+           500);
+  view.add(fragment("20021225100000", "a", CallListStore::CallFragment::Type::REJECTED),
+           "<a/>",
+           0);
+  view.add(fragment("20021225103000", "orphan", CallListStore::CallFragment::Type::END),
+           "<orphan/>",
+           0);
+  view.add(fragment("20021225110000", "b", CallListStore::CallFragment::Type::REJECTED),
+           "<b/>",
+           0);
+  view.add(fragment("20021225120000", "c", CallListStore::CallFragment::Type::REJECTED),
+           "<c/>",
+           0);
+
+  view.trim(0, 1000);
+  EXPECT_EQ(4u, view.calls.size());
+
+  view.trim(2, 1000);
+  ASSERT_EQ(2u, view.calls.size());
+  EXPECT_EQ("b", view.calls[0].id);
+  EXPECT_EQ("c", view.calls[1].id);
+}
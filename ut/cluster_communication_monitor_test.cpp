@@ -0,0 +1,87 @@
+/**
+ * @file cluster_communication_monitor_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+#include "cluster_communication_monitor.h"
+
+using ::testing::StrictMock;
+
+class MockMonitor : public BaseCommunicationMonitor
+{
+public:
+  MOCK_METHOD1(inform_success, void(unsigned long now_ms));
+  MOCK_METHOD1(inform_failure, void(unsigned long now_ms));
+
+protected:
+  virtual void track_communication_changes(unsigned long now_ms = 0) {}
+};
+
+class ClusterCommunicationMonitorTest : public ::testing::Test
+{
+public:
+  ClusterCommunicationMonitorTest() :
+    _monitor(new StrictMock<MockMonitor>()),
+    _clusters(_monitor),
+    _a(_clusters.add_cluster("a")),
+    _b(_clusters.add_cluster("b"))
+  {
+  }
+
+  StrictMock<MockMonitor>* _monitor;
+  ClusterCommunicationMonitor _clusters;
+  BaseCommunicationMonitor* _a;
+  BaseCommunicationMonitor* _b;
+};
+
+// While all clusters are healthy, their successes are passed on.
+TEST_F(ClusterCommunicationMonitorTest, Healthy)
+{
+  EXPECT_CALL(*_monitor, inform_success(0)).Times(2);
+  _a->inform_success();
+  _b->inform_success();
+  EXPECT_EQ(0, _clusters.failing_clusters());
+}
+
+// A healthy cluster's successes aren't passed on while another is failing,
+// so can't clear its alarm.
+TEST_F(ClusterCommunicationMonitorTest, OneFailing)
+{
+  EXPECT_CALL(*_monitor, inform_failure(0)).Times(2);
+  _a->inform_failure();
+  _b->inform_success();
+  _a->inform_failure();
+  _b->inform_success();
+  EXPECT_EQ(1, _clusters.failing_clusters());
+
+  // Once the failing cluster recovers, successes are passed on again.
+  EXPECT_CALL(*_monitor, inform_success(0)).Times(2);
+  _a->inform_success();
+  _b->inform_success();
+  EXPECT_EQ(0, _clusters.failing_clusters());
+}
+
+// Each cluster must recover before successes are passed on.
+TEST_F(ClusterCommunicationMonitorTest, BothFailing)
+{
+  EXPECT_CALL(*_monitor, inform_failure(0)).Times(2);
+  _a->inform_failure();
+  _b->inform_failure();
+  EXPECT_EQ(2, _clusters.failing_clusters());
+
+  _a->inform_success();
+  EXPECT_EQ(1, _clusters.failing_clusters());
+
+  EXPECT_CALL(*_monitor, inform_success(0));
+  _b->inform_success();
+  EXPECT_EQ(0, _clusters.failing_clusters());
+}
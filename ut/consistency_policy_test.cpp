@@ -0,0 +1,98 @@
+/**
+ * @file consistency_policy_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gtest/gtest.h"
+
+#include "consistency_policy.h"
+
+// The policy degrades when requests get slow, and recovers once they are
+// well below the threshold again.
+TEST(ConsistencyPolicyTest, Latency)
+{
+  ConsistencyPolicy policy(Cql::LOCAL_QUORUM, 10000, 0);
+  EXPECT_EQ(Cql::LOCAL_QUORUM, policy.level());
+
+  // Slow requests don't degrade the policy until there are enough of them.
+  for (int ii = 1; ii < ConsistencyPolicy::MIN_SAMPLES; ii++)
+  {
+    EXPECT_FALSE(policy.record(20000, false));
+  }
+
+  EXPECT_TRUE(policy.record(20000, false));
+  EXPECT_TRUE(policy.degraded());
+  EXPECT_EQ(Cql::LOCAL_ONE, policy.level());
+
+  // Requests just under the threshold don't bring it back.
+  for (int ii = 0; ii < 100; ii++)
+  {
+    EXPECT_FALSE(policy.record(9000, false));
+  }
+
+  EXPECT_TRUE(policy.degraded());
+
+  // Fast requests do, eventually.
+  bool recovered = false;
+
+  for (int ii = 0; (ii < 100) && (!recovered); ii++)
+  {
+    recovered = policy.record(1000, false);
+  }
+
+  EXPECT_TRUE(recovered);
+  EXPECT_EQ(Cql::LOCAL_QUORUM, policy.level());
+}
+
+// The policy degrades when too many requests fail.
+TEST(ConsistencyPolicyTest, Errors)
+{
+  ConsistencyPolicy policy(Cql::QUORUM, 0, 20);
+
+  for (int ii = 0; ii < ConsistencyPolicy::MIN_SAMPLES; ii++)
+  {
+    policy.record(1000000, false);
+  }
+
+  // Latency is ignored.
+  EXPECT_FALSE(policy.degraded());
+
+  bool degraded = false;
+
+  for (int ii = 0; (ii < 10) && (!degraded); ii++)
+  {
+    degraded = policy.record(1000, true);
+  }
+
+  EXPECT_TRUE(degraded);
+  EXPECT_EQ(Cql::ONE, policy.level());
+  EXPECT_LE(20, policy.error_percent());
+
+  // It doesn't recover straight away, however well requests go.
+  for (int ii = 1; ii < ConsistencyPolicy::MIN_SAMPLES; ii++)
+  {
+    EXPECT_FALSE(policy.record(1000, false));
+  }
+
+  EXPECT_TRUE(policy.record(1000, false));
+  EXPECT_EQ(Cql::QUORUM, policy.level());
+}
+
+// Levels are named as in configuration.
+TEST(ConsistencyPolicyTest, Names)
+{
+  Cql::Consistency level;
+  EXPECT_TRUE(ConsistencyPolicy::parse("local_quorum", level));
+  EXPECT_EQ(Cql::LOCAL_QUORUM, level);
+  EXPECT_STREQ("local_quorum", ConsistencyPolicy::name(level));
+  EXPECT_FALSE(ConsistencyPolicy::parse("all", level));
+
+  EXPECT_EQ(Cql::ONE, ConsistencyPolicy::weaken(Cql::QUORUM));
+  EXPECT_EQ(Cql::LOCAL_ONE, ConsistencyPolicy::weaken(Cql::LOCAL_ONE));
+}
@@ -0,0 +1,1269 @@
+/**
+ * @file cql_call_list_store_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <arpa/inet.h>
+#include <limits>
+#include <map>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "cql_call_list_store.h"
+
+/// Just enough of a Cassandra node to serve the call list store's prepared
+/// statements, from an in-memory table.
+class FakeCqlServer
+{
+public:
+  FakeCqlServer(const std::string& address = "127.0.0.1", int port = 0) :
+    _address(address),
+    _forget_prepared(false),
+    _error(0),
+    _delay_ms(0)
+  {
+    pthread_mutex_init(&_lock, NULL);
+    _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, address.c_str(), &addr.sin_addr);
+    bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t addr_len = sizeof(addr);
+    getsockname(_listen_fd, (struct sockaddr*)&addr, &addr_len);
+    _port = ntohs(addr.sin_port);
+    listen(_listen_fd, 5);
+    pthread_create(&_accept_thread, NULL, accept_thread_fn, this);
+  }
+
+  ~FakeCqlServer()
+  {
+    shutdown(_listen_fd, SHUT_RDWR);
+    close(_listen_fd);
+    pthread_join(_accept_thread, NULL);
+
+    for (size_t ii = 0; ii < _connection_threads.size(); ii++)
+    {
+      shutdown(_connection_fds[ii], SHUT_RDWR);
+      pthread_join(_connection_threads[ii], NULL);
+      close(_connection_fds[ii]);
+    }
+
+    pthread_mutex_destroy(&_lock);
+  }
+
+  int port() const { return _port; }
+
+  /// Makes the server forget its prepared statements, as if it had been
+  /// restarted.
+  void forget_prepared()
+  {
+    pthread_mutex_lock(&_lock);
+    _forget_prepared = true;
+    pthread_mutex_unlock(&_lock);
+  }
+
+  /// Makes the server fail every execution with this error code.
+  void set_error(int32_t error)
+  {
+    pthread_mutex_lock(&_lock);
+    _error = error;
+    pthread_mutex_unlock(&_lock);
+  }
+
+  /// Makes the server wait this long before answering each execution.
+  void set_delay_ms(int delay_ms)
+  {
+    pthread_mutex_lock(&_lock);
+    _delay_ms = delay_ms;
+    pthread_mutex_unlock(&_lock);
+  }
+
+  /// Sets the tokens this node owns, and the nodes it reports as peers.
+  void set_ring(const std::vector<std::string>& tokens,
+                const std::map<std::string, std::vector<std::string>>& peers)
+  {
+    pthread_mutex_lock(&_lock);
+    _tokens = tokens;
+    _peers = peers;
+    pthread_mutex_unlock(&_lock);
+  }
+
+  int columns(const std::string& key)
+  {
+    pthread_mutex_lock(&_lock);
+    int count = _table[key].size();
+    pthread_mutex_unlock(&_lock);
+    return count;
+  }
+
+  std::map<std::string, int64_t> timestamps;
+
+  /// The statement and consistency level of each request, in order.
+  std::vector<std::pair<std::string, uint16_t>> consistencies;
+
+private:
+  static void* accept_thread_fn(void* server)
+  {
+    ((FakeCqlServer*)server)->accept_thread();
+    return NULL;
+  }
+
+  void accept_thread()
+  {
+    while (true)
+    {
+      int fd = accept(_listen_fd, NULL, NULL);
+
+      if (fd < 0)
+      {
+        break;
+      }
+
+      pthread_t thread;
+      _connection_fds.push_back(fd);
+      pthread_create(&thread, NULL, connection_thread_fn, new Connection(this, fd));
+      _connection_threads.push_back(thread);
+    }
+  }
+
+  struct Connection
+  {
+    Connection(FakeCqlServer* server, int fd) : server(server), fd(fd) {}
+    FakeCqlServer* server;
+    int fd;
+  };
+
+  static void* connection_thread_fn(void* connection)
+  {
+    Connection* conn = (Connection*)connection;
+    conn->server->connection_thread(conn->fd);
+    delete conn;
+    return NULL;
+  }
+
+  void connection_thread(int fd)
+  {
+    while (true)
+    {
+      char header_buf[Cql::HEADER_LEN];
+      Cql::Header header;
+
+      if ((recv(fd, header_buf, Cql::HEADER_LEN, MSG_WAITALL) !=
+           (ssize_t)Cql::HEADER_LEN) ||
+          (!Cql::decode_header((uint8_t*)header_buf, header)))
+      {
+        break;
+      }
+
+      std::string body(header.length, '\0');
+
+      if ((header.length > 0) &&
+          (recv(fd, &body[0], header.length, MSG_WAITALL) !=
+           (ssize_t)header.length))
+      {
+        break;
+      }
+
+      std::string rsp_body;
+      uint8_t rsp_opcode = handle(header.opcode, body, rsp_body);
+
+      header.version = Cql::VERSION | Cql::RESPONSE_FLAG;
+      header.opcode = rsp_opcode;
+      header.length = rsp_body.length();
+      std::string frame(Cql::HEADER_LEN, '\0');
+      Cql::encode_header(header, (uint8_t*)&frame[0]);
+      frame.append(rsp_body);
+      send(fd, frame.data(), frame.length(), MSG_NOSIGNAL);
+    }
+  }
+
+  uint8_t handle(uint8_t opcode, const std::string& body, std::string& rsp_body)
+  {
+    Cql::Writer writer(rsp_body);
+    Cql::Reader reader(body);
+
+    if (opcode == Cql::OP_STARTUP)
+    {
+      return Cql::OP_READY;
+    }
+
+    if (opcode == Cql::OP_QUERY)
+    {
+      std::string query = reader.read_bytes();
+      bool local = (query.find("system.local") != std::string::npos);
+      pthread_mutex_lock(&_lock);
+      writer.write_int(Cql::RESULT_ROWS);
+      writer.write_int(0x0004);
+      writer.write_int(3);
+      writer.write_int(local ? 1 : _peers.size());
+
+      if (local)
+      {
+        writer.write_bytes("org.apache.cassandra.dht.Murmur3Partitioner");
+        writer.write_bytes(inet(_address));
+        writer.write_bytes(token_set(_tokens));
+      }
+      else
+      {
+        for (std::map<std::string, std::vector<std::string>>::const_iterator it =
+               _peers.begin();
+             it != _peers.end();
+             ++it)
+        {
+          writer.write_bytes(inet(it->first));
+          writer.write_bytes(inet("0.0.0.0"));
+          writer.write_bytes(token_set(it->second));
+        }
+      }
+
+      pthread_mutex_unlock(&_lock);
+      return Cql::OP_RESULT;
+    }
+
+    if (opcode == Cql::OP_PREPARE)
+    {
+      // Use the statement's verb as its ID, marking statements on the views
+      // table.
+      std::string query = reader.read_bytes();
+      pthread_mutex_lock(&_lock);
+      _forget_prepared = false;
+      pthread_mutex_unlock(&_lock);
+      writer.write_int(Cql::RESULT_PREPARED);
+      writer.write_short_bytes(
+        query.substr(0, query.find(' ')) +
+        ((query.find("call_list_views") != std::string::npos) ? "_VIEW" : ""));
+      return Cql::OP_RESULT;
+    }
+
+    std::vector<std::pair<std::string, std::vector<std::string>>> executions;
+    int64_t timestamp = 0;
+    uint16_t consistency;
+
+    if (opcode == Cql::OP_EXECUTE)
+    {
+      std::string id = reader.read_short_bytes();
+      consistency = reader.read_short();
+      uint8_t flags = reader.read_byte();
+      std::vector<std::string> values(reader.read_short());
+
+      for (size_t ii = 0; ii < values.size(); ii++)
+      {
+        values[ii] = reader.read_bytes();
+      }
+
+      if (flags & 0x20)
+      {
+        timestamp = reader.read_long();
+      }
+
+      executions.push_back(std::make_pair(id, values));
+    }
+    else
+    {
+      reader.read_byte();
+      uint16_t count = reader.read_short();
+
+      for (uint16_t ii = 0; ii < count; ii++)
+      {
+        reader.read_byte();
+        std::string id = reader.read_short_bytes();
+        std::vector<std::string> values(reader.read_short());
+
+        for (size_t jj = 0; jj < values.size(); jj++)
+        {
+          values[jj] = reader.read_bytes();
+        }
+
+        executions.push_back(std::make_pair(id, values));
+      }
+
+      consistency = reader.read_short();
+
+      if (reader.read_byte() & 0x20)
+      {
+        timestamp = reader.read_long();
+      }
+    }
+
+    pthread_mutex_lock(&_lock);
+    int delay_ms = _delay_ms;
+    pthread_mutex_unlock(&_lock);
+    usleep(delay_ms * 1000);
+
+    pthread_mutex_lock(&_lock);
+    consistencies.push_back(std::make_pair(executions[0].first, consistency));
+    int32_t error = _error;
+    bool forget_prepared = _forget_prepared;
+
+    if (forget_prepared)
+    {
+      error = Cql::ERR_UNPREPARED;
+    }
+
+    if (error != 0)
+    {
+      pthread_mutex_unlock(&_lock);
+      writer.write_int(error);
+      writer.write_string("Failed");
+
+      if (error == Cql::ERR_UNPREPARED)
+      {
+        writer.write_short_bytes(executions[0].first);
+      }
+
+      return Cql::OP_ERROR;
+    }
+
+    writer.write_int(Cql::RESULT_VOID);
+
+    for (size_t ii = 0; ii < executions.size(); ii++)
+    {
+      const std::string& id = executions[ii].first;
+      const std::vector<std::string>& values = executions[ii].second;
+
+      if (id == "INSERT")
+      {
+        _table[values[0]][values[1]] = values[2];
+        timestamps[values[1]] = timestamp;
+      }
+      else if (id == "DELETE")
+      {
+        _table[values[0]].erase(values[1]);
+      }
+      else if (id == "SELECT_VIEW")
+      {
+        std::map<std::string, std::pair<int64_t, std::string>>::const_iterator
+          view = _views.find(values[0]);
+        rsp_body.clear();
+        writer.write_int(Cql::RESULT_ROWS);
+        writer.write_int(0x0004);
+        writer.write_int(2);
+        writer.write_int((view != _views.end()) ? 1 : 0);
+
+        if (view != _views.end())
+        {
+          writer.write_bytes(Cql::long_value(view->second.first));
+          writer.write_bytes(view->second.second);
+        }
+      }
+      else if ((id == "INSERT_VIEW") || (id == "UPDATE_VIEW"))
+      {
+        bool insert = (id == "INSERT_VIEW");
+        const std::string& impu = insert ? values[0] : values[3];
+        bool exists = (_views.find(impu) != _views.end());
+        int64_t expected = 0;
+        bool applied = insert ?
+          (!exists) :
+          ((exists) &&
+           (Cql::parse_long(values[4], expected)) &&
+           (_views[impu].first == expected));
+
+        if (applied)
+        {
+          int64_t version = 0;
+          Cql::parse_long(values[1], version);
+          _views[impu] = std::make_pair(version, values[2]);
+        }
+
+        rsp_body.clear();
+        writer.write_int(Cql::RESULT_ROWS);
+        writer.write_int(0x0004);
+        writer.write_int(1);
+        writer.write_int(1);
+        writer.write_bytes(std::string(1, applied ? '\x01' : '\x00'));
+      }
+      else
+      {
+        const std::map<std::string, std::string>& row = _table[values[0]];
+        rsp_body.clear();
+        writer.write_int(Cql::RESULT_ROWS);
+        writer.write_int(0x0001);
+        writer.write_int(2);
+        writer.write_string("memento");
+        writer.write_string("call_lists");
+        writer.write_string("column1");
+        writer.write_short(0x000D);
+        writer.write_string("value");
+        writer.write_short(0x0003);
+        writer.write_int(row.size());
+
+        for (std::map<std::string, std::string>::const_iterator it = row.begin();
+             it != row.end();
+             ++it)
+        {
+          writer.write_bytes(it->first);
+          writer.write_bytes(it->second);
+        }
+      }
+    }
+
+    pthread_mutex_unlock(&_lock);
+    return Cql::OP_RESULT;
+  }
+
+  static std::string inet(const std::string& address)
+  {
+    std::string value(4, '\0');
+    inet_pton(AF_INET, address.c_str(), &value[0]);
+    return value;
+  }
+
+  static std::string token_set(const std::vector<std::string>& tokens)
+  {
+    std::string value;
+    Cql::Writer writer(value);
+    writer.write_int(tokens.size());
+
+    for (size_t ii = 0; ii < tokens.size(); ii++)
+    {
+      writer.write_bytes(tokens[ii]);
+    }
+
+    return value;
+  }
+
+  std::string _address;
+  pthread_mutex_t _lock;
+  int _listen_fd;
+  int _port;
+  pthread_t _accept_thread;
+  std::vector<pthread_t> _connection_threads;
+  std::vector<int> _connection_fds;
+  bool _forget_prepared;
+  int32_t _error;
+  int _delay_ms;
+  std::vector<std::string> _tokens;
+  std::map<std::string, std::vector<std::string>> _peers;
+  std::map<std::string, std::map<std::string, std::string>> _table;
+  std::map<std::string, std::pair<int64_t, std::string>> _views;
+};
+
+static const std::string IMPU = "sip:6505550000@homedomain";
+
+static CallListStore::CallFragment fragment(const std::string& timestamp,
+                                            const std::string& id,
+                                            CallListStore::CallFragment::Type type)
+{
+  CallListStore::CallFragment fragment;
+  fragment.timestamp = timestamp;
+  fragment.id = id;
+  fragment.type = type;
+  fragment.contents = "<xml>" + id + "</xml>";
+  return fragment;
+}
+
+class CqlCallListStoreTest : public ::testing::Test
+{
+public:
+  CqlCallListStoreTest() :
+    _stats(NULL)
+  {
+    _store = new CqlCallListStore("127.0.0.1",
+                                  _server.port(),
+                                  1,
+                                  1000,
+                                  false,
+                                  0,
+                                  0,
+                                  Cql::ONE,
+                                  Cql::ONE,
+                                  0,
+                                  0,
+                                  0,
+                                  NULL,
+                                  &_stats,
+                                  "");
+  }
+
+  virtual ~CqlCallListStoreTest()
+  {
+    delete _store; _store = NULL;
+  }
+
+  FakeCqlServer _server;
+  CqlCallListStore::Statistics _stats;
+  CqlCallListStore* _store;
+};
+
+// Column names match the Thrift store's, and IDs can contain underscores.
+TEST(CqlCallListStoreColumnTest, ColumnName)
+{
+  CallListStore::CallFragment in = fragment("20021225100000",
+                                            "a_b",
+                                            CallListStore::CallFragment::Type::END);
+  std::string name = CqlCallListStore::column_name(in);
+  EXPECT_EQ("call_20021225100000_a_b_end", name);
+
+  CallListStore::CallFragment out;
+  ASSERT_TRUE(CqlCallListStore::parse_column_name(name, out));
+  EXPECT_EQ("20021225100000", out.timestamp);
+  EXPECT_EQ("a_b", out.id);
+  EXPECT_EQ(CallListStore::CallFragment::Type::END, out.type);
+
+  EXPECT_FALSE(CqlCallListStore::parse_column_name("call_2002_1_middle", out));
+  EXPECT_FALSE(CqlCallListStore::parse_column_name("call_2002_begin", out));
+  EXPECT_FALSE(CqlCallListStore::parse_column_name("other_2002_1_begin", out));
+}
+
+// Fragments that are written can be read back in order, and deleted.
+TEST_F(CqlCallListStoreTest, WriteReadDelete)
+{
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::NOT_FOUND,
+            _store->get_call_fragments_sync(IMPU, fragments, 0));
+
+  CallListStore::CallFragment first =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  CallListStore::CallFragment second =
+    fragment("20021225110000", "2", CallListStore::CallFragment::Type::REJECTED);
+  EXPECT_EQ(CassandraStore::OK,
+            _store->write_call_fragment_sync(IMPU, second, 2000, 3600, 0));
+  EXPECT_EQ(CassandraStore::OK,
+            _store->write_call_fragment_sync(IMPU, first, 1000, 3600, 0));
+  EXPECT_EQ(1000, _server.timestamps[CqlCallListStore::column_name(first)]);
+
+  ASSERT_EQ(CassandraStore::OK,
+            _store->get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(2u, fragments.size());
+  EXPECT_EQ("1", fragments[0].id);
+  EXPECT_EQ("<xml>1</xml>", fragments[0].contents);
+  EXPECT_EQ(CallListStore::CallFragment::Type::BEGIN, fragments[0].type);
+  EXPECT_EQ("2", fragments[1].id);
+  EXPECT_EQ(CallListStore::CallFragment::Type::REJECTED, fragments[1].type);
+
+  EXPECT_EQ(CassandraStore::OK,
+            _store->delete_old_call_fragments_sync(IMPU, fragments, 3000, 0));
+  EXPECT_EQ(0, _server.columns(IMPU));
+}
+
+// Fragments written together go in one batch, with the same timestamp.
+TEST_F(CqlCallListStoreTest, BatchedWrite)
+{
+  std::vector<CallListStore::CallFragment> fragments;
+  fragments.push_back(
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN));
+  fragments.push_back(
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::END));
+
+  EXPECT_EQ(CassandraStore::OK,
+            _store->write_call_fragments_sync(IMPU, fragments, 1000, 3600, 0));
+  EXPECT_EQ(2, _server.columns(IMPU));
+  EXPECT_EQ(1000, _server.timestamps[CqlCallListStore::column_name(fragments[0])]);
+  EXPECT_EQ(1000, _server.timestamps[CqlCallListStore::column_name(fragments[1])]);
+  ASSERT_EQ(1u, _server.consistencies.size());
+  EXPECT_EQ("INSERT", _server.consistencies[0].first);
+}
+
+// Deletes are sent in batches of limited size.
+TEST_F(CqlCallListStoreTest, BatchedDelete)
+{
+  std::vector<CallListStore::CallFragment> fragments;
+
+  for (size_t ii = 0; ii < CqlCallListStore::MAX_BATCH_SIZE + 10; ii++)
+  {
+    fragments.push_back(fragment("20021225100000",
+                                 std::to_string(ii),
+                                 CallListStore::CallFragment::Type::BEGIN));
+    _store->write_call_fragment_sync(IMPU, fragments.back(), 1000, 0, 0);
+  }
+
+  EXPECT_EQ((int)CqlCallListStore::MAX_BATCH_SIZE + 10, _server.columns(IMPU));
+  fragments.pop_back();
+  EXPECT_EQ(CassandraStore::OK,
+            _store->delete_old_call_fragments_sync(IMPU, fragments, 3000, 0));
+  EXPECT_EQ(1, _server.columns(IMPU));
+}
+
+// Statements are prepared again if the server has forgotten them.
+TEST_F(CqlCallListStoreTest, Unprepared)
+{
+  CallListStore::CallFragment first =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  EXPECT_EQ(CassandraStore::OK,
+            _store->write_call_fragment_sync(IMPU, first, 1000, 3600, 0));
+
+  _server.forget_prepared();
+  EXPECT_EQ(CassandraStore::OK,
+            _store->write_call_fragment_sync(IMPU, first, 1000, 3600, 0));
+}
+
+// Errors from the server map onto the Thrift store's result codes.
+TEST_F(CqlCallListStoreTest, Errors)
+{
+  CallListStore::CallFragment first =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+
+  _server.set_error(Cql::ERR_UNAVAILABLE);
+  EXPECT_EQ(CassandraStore::RESOURCE_ERROR,
+            _store->write_call_fragment_sync(IMPU, first, 1000, 3600, 0));
+
+  _server.set_error(Cql::ERR_INVALID);
+  EXPECT_EQ(CassandraStore::INVALID_REQUEST,
+            _store->write_call_fragment_sync(IMPU, first, 1000, 3600, 0));
+
+  _server.set_error(Cql::ERR_PROTOCOL);
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::UNKNOWN_ERROR,
+            _store->get_call_fragments_sync(IMPU, fragments, 0));
+}
+
+// Overloaded and unavailable responses count against the node as the
+// request timeout, however quickly they come back. Other errors don't
+// count at all.
+TEST_F(CqlCallListStoreTest, ErrorsPenaliseNode)
+{
+  CallListStore::CallFragment first =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  NodeLatency* node = _store->_nodes["127.0.0.1"];
+
+  _server.set_error(Cql::ERR_INVALID);
+  _store->write_call_fragment_sync(IMPU, first, 1000, 3600, 0);
+  EXPECT_EQ(0u, node->ewma_us());
+  EXPECT_EQ(0, node->in_flight());
+
+  _server.set_error(Cql::ERR_OVERLOADED);
+  _store->write_call_fragment_sync(IMPU, first, 1000, 3600, 0);
+  EXPECT_EQ(1000000u, node->ewma_us());
+  EXPECT_EQ(0, node->in_flight());
+
+  _server.set_error(0);
+  _store->write_call_fragment_sync(IMPU, first, 1000, 3600, 0);
+  EXPECT_GT(1000000u, node->ewma_us());
+  EXPECT_LT(1000000u * 7 / 8, node->ewma_us());
+}
+
+static void* concurrent_writer(void* store)
+{
+  for (int ii = 0; ii < 50; ii++)
+  {
+    CallListStore::CallFragment fragment;
+    fragment.timestamp = "20021225100000";
+    fragment.id = std::to_string((uintptr_t)pthread_self()) + "-" + std::to_string(ii);
+    fragment.type = CallListStore::CallFragment::Type::BEGIN;
+    EXPECT_EQ(CassandraStore::OK,
+              ((CqlCallListStore*)store)->write_call_fragment_sync(IMPU,
+                                                                   fragment,
+                                                                   1000,
+                                                                   0,
+                                                                   0));
+  }
+
+  return NULL;
+}
+
+// Many threads can share a single connection.
+TEST_F(CqlCallListStoreTest, Concurrent)
+{
+  pthread_t threads[4];
+
+  for (int ii = 0; ii < 4; ii++)
+  {
+    pthread_create(&threads[ii], NULL, concurrent_writer, _store);
+  }
+
+  for (int ii = 0; ii < 4; ii++)
+  {
+    pthread_join(threads[ii], NULL);
+  }
+
+  EXPECT_EQ(200, _server.columns(IMPU));
+}
+
+// Requests fail cleanly if Cassandra can't be reached.
+TEST(CqlCallListStoreConnectionTest, ConnectionError)
+{
+  int port;
+
+  {
+    // Find a port with nothing listening on it.
+    FakeCqlServer server;
+    port = server.port();
+  }
+
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1",
+                         port,
+                         1,
+                         100,
+                         false,
+                         0,
+                         0,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         0,
+                         NULL,
+                         &stats,
+                         "");
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::CONNECTION_ERROR,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+}
+
+/// Finds an IMPU whose partition falls in a token range.
+static std::string impu_in_range(int64_t low, int64_t high)
+{
+  for (int ii = 0; ; ii++)
+  {
+    std::string impu = "sip:" + std::to_string(ii) + "@homedomain";
+    int64_t token = TokenRing::token(impu);
+
+    if ((token > low) && (token <= high))
+    {
+      return impu;
+    }
+  }
+}
+
+// Requests go straight to the node that owns the partition, and fall back
+// to the configured host if that node can't be reached.
+TEST(CqlCallListStoreRoutingTest, TokenAware)
+{
+  FakeCqlServer local("127.0.0.1");
+  FakeCqlServer peer("127.0.0.2", local.port());
+  std::map<std::string, std::vector<std::string>> peers;
+  peers["127.0.0.2"].push_back("4611686018427387904");
+  peers["127.0.0.3"].push_back("-4611686018427387904");
+  local.set_ring(std::vector<std::string>(1, "0"), peers);
+
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1",
+                         local.port(),
+                         1,
+                         1000,
+                         true,
+                         0,
+                         0,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         0,
+                         NULL,
+                         &stats,
+                         "");
+  std::string local_impu = impu_in_range(-4611686018427387904LL, 0);
+  std::string peer_impu = impu_in_range(0, 4611686018427387904LL);
+  std::string down_impu = impu_in_range(4611686018427387904LL,
+                                        std::numeric_limits<int64_t>::max());
+
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(local_impu, call, 1000, 0, 0));
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(peer_impu, call, 1000, 0, 0));
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(down_impu, call, 1000, 0, 0));
+
+  EXPECT_EQ(1, local.columns(local_impu));
+  EXPECT_EQ(1, peer.columns(peer_impu));
+  EXPECT_EQ(0, local.columns(peer_impu));
+
+  // 127.0.0.3 owns the last IMPU's partition (wrapping round the ring), but
+  // isn't there, so that write fell back to the configured host.
+  EXPECT_EQ(1, local.columns(down_impu));
+  EXPECT_EQ(1u, store._routes["127.0.0.1"].direct);
+  EXPECT_EQ(1u, store._routes["127.0.0.1"].fallback);
+  EXPECT_EQ(1u, store._routes["127.0.0.2"].direct);
+}
+
+// Requests skip the owner if it's much slower than the other nodes.
+TEST(CqlCallListStoreRoutingTest, SlowOwner)
+{
+  FakeCqlServer local("127.0.0.1");
+  FakeCqlServer peer("127.0.0.2", local.port());
+  std::map<std::string, std::vector<std::string>> peers;
+  peers["127.0.0.2"].push_back("4611686018427387904");
+  local.set_ring(std::vector<std::string>(1, "0"), peers);
+
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1",
+                         local.port(),
+                         1,
+                         1000,
+                         true,
+                         0,
+                         0,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         0,
+                         NULL,
+                         &stats,
+                         "");
+  std::string peer_impu = impu_in_range(0, 4611686018427387904LL);
+
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(peer_impu, call, 1000, 0, 0));
+  EXPECT_EQ(1, peer.columns(peer_impu));
+  EXPECT_LT(0u, store._nodes["127.0.0.2"]->ewma_us());
+
+  // Make the owner look like it's taking a whole second per request.
+  store._nodes["127.0.0.2"]->_ewma_us = 1000000;
+
+  call = fragment("20021225100000", "1", CallListStore::CallFragment::Type::END);
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(peer_impu, call, 1000, 0, 0));
+  EXPECT_EQ(1, peer.columns(peer_impu));
+  EXPECT_EQ(1, local.columns(peer_impu));
+  EXPECT_EQ(1u, store._routes["127.0.0.2"].direct);
+  EXPECT_EQ(1u, store._routes["127.0.0.1"].fallback);
+}
+
+// A host configured by name shares its connections with its entry in the
+// token map, rather than the node getting a second set.
+TEST(CqlCallListStoreRoutingTest, HostByName)
+{
+  FakeCqlServer local("127.0.0.1");
+  local.set_ring(std::vector<std::string>(1, "0"),
+                 std::map<std::string, std::vector<std::string>>());
+
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("localhost",
+                         local.port(),
+                         2,
+                         1000,
+                         true,
+                         0,
+                         0,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         0,
+                         NULL,
+                         &stats,
+                         "");
+
+  pthread_mutex_lock(&store._ring_lock);
+  EXPECT_FALSE(store._ring.empty());
+  EXPECT_EQ(1u, store._host_slots.size());
+  EXPECT_EQ(2u, store._host_slots["127.0.0.1"].size());
+  EXPECT_TRUE(store._discovered_slots.empty());
+  EXPECT_EQ(1u, store._nodes.size());
+  pthread_mutex_unlock(&store._ring_lock);
+}
+
+// The background thread reloads the token map, and stops routing to nodes
+// that have left the ring.
+TEST(CqlCallListStoreRoutingTest, NodeLeaves)
+{
+  FakeCqlServer local("127.0.0.1");
+  FakeCqlServer peer("127.0.0.2", local.port());
+  std::map<std::string, std::vector<std::string>> peers;
+  peers["127.0.0.2"].push_back("4611686018427387904");
+  local.set_ring(std::vector<std::string>(1, "0"), peers);
+
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1",
+                         local.port(),
+                         1,
+                         1000,
+                         true,
+                         0,
+                         0,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         0,
+                         NULL,
+                         &stats,
+                         "");
+  std::string peer_impu = impu_in_range(0, 4611686018427387904LL);
+
+  pthread_mutex_lock(&store._ring_lock);
+  ASSERT_EQ(1u, store._host_slots.count("127.0.0.2"));
+  CqlCallListStore::Slot* departed = store._host_slots["127.0.0.2"][0];
+  pthread_mutex_unlock(&store._ring_lock);
+
+  // 127.0.0.2 leaves, and the token map is due a reload.
+  local.set_ring(std::vector<std::string>(1, "0"),
+                 std::map<std::string, std::vector<std::string>>());
+  pthread_mutex_lock(&store._ring_lock);
+  store._next_ring_refresh_ms = 0;
+  pthread_mutex_unlock(&store._ring_lock);
+  bool left = false;
+
+  for (int ii = 0; (ii < 50) && (!left); ii++)
+  {
+    usleep(100000);
+    pthread_mutex_lock(&store._ring_lock);
+    left = (store._host_slots.count("127.0.0.2") == 0);
+    pthread_mutex_unlock(&store._ring_lock);
+  }
+
+  ASSERT_TRUE(left);
+
+  // Its connection is retired, but not freed while requests might still be
+  // using it.
+  pthread_mutex_lock(&store._ring_lock);
+  EXPECT_TRUE(store._discovered_slots.empty());
+  ASSERT_EQ(1u, store._retired_slots.size());
+  EXPECT_EQ(departed, store._retired_slots[0].second);
+  pthread_mutex_unlock(&store._ring_lock);
+
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(peer_impu, call, 1000, 0, 0));
+  EXPECT_EQ(1, local.columns(peer_impu));
+  EXPECT_EQ(0, peer.columns(peer_impu));
+
+  // Once no request can be using it, the connection is freed, and the
+  // node's latency isn't published any more.
+  pthread_mutex_lock(&store._ring_lock);
+  store.free_retired_slots(CqlCallListStore::current_time_ms() +
+                           CqlCallListStore::RING_REFRESH_INTERVAL_MS);
+  EXPECT_TRUE(store._retired_slots.empty());
+  EXPECT_EQ(0u, store._nodes.count("127.0.0.2"));
+  EXPECT_EQ(1u, store._nodes.count("127.0.0.1"));
+  pthread_mutex_unlock(&store._ring_lock);
+}
+
+// A timestamped write that's slow to complete is hedged to another node,
+// and the first successful response wins.
+TEST(CqlCallListStoreHedgeTest, SlowWrite)
+{
+  FakeCqlServer local("127.0.0.1");
+  FakeCqlServer peer("127.0.0.2", local.port());
+  local.set_ring(std::vector<std::string>(1, "0"),
+                 std::map<std::string, std::vector<std::string>>());
+
+  // 127.0.0.1 owns every partition, so gets every request to start with.
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1,127.0.0.2",
+                         local.port(),
+                         1,
+                         1000,
+                         true,
+                         50,
+                         100,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         0,
+                         NULL,
+                         &stats,
+                         "");
+
+  // Build up enough latency samples to hedge.
+  for (size_t ii = 0; ii < LatencyWindow::MIN_SAMPLES; ii++)
+  {
+    CallListStore::CallFragment call =
+      fragment("20021225100000",
+               std::to_string(ii),
+               CallListStore::CallFragment::Type::BEGIN);
+    EXPECT_EQ(CassandraStore::OK,
+              store.write_call_fragment_sync("sip:6505550000@homedomain",
+                                             call,
+                                             1000,
+                                             0,
+                                             0));
+  }
+
+  EXPECT_EQ(0u, store._hedges_sent.load());
+  EXPECT_LT(0u, store._hedge_latency[0]->percentile_us());
+
+  local.set_delay_ms(300);
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "hedged", CallListStore::CallFragment::Type::END);
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync("sip:6505550001@homedomain",
+                                           call,
+                                           1000,
+                                           0,
+                                           0));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  EXPECT_EQ(1, peer.columns("sip:6505550001@homedomain"));
+  EXPECT_EQ(1000, peer.timestamps[CqlCallListStore::column_name(call)]);
+  EXPECT_LT(end.tv_sec * 1000 + end.tv_nsec / 1000000,
+            start.tv_sec * 1000 + start.tv_nsec / 1000000 + 300);
+  EXPECT_EQ(1u, store._hedges_sent.load());
+  EXPECT_EQ(1u, store._hedges_won.load());
+}
+
+// An error response from a hedge doesn't win while the primary might still
+// succeed, and is only taken once every attempt has failed.
+TEST(CqlCallListStoreHedgeTest, HedgeError)
+{
+  FakeCqlServer local("127.0.0.1");
+  FakeCqlServer peer("127.0.0.2", local.port());
+  local.set_ring(std::vector<std::string>(1, "0"),
+                 std::map<std::string, std::vector<std::string>>());
+
+  // 127.0.0.1 owns every partition, so gets every request to start with.
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1,127.0.0.2",
+                         local.port(),
+                         1,
+                         1000,
+                         true,
+                         50,
+                         100,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         0,
+                         NULL,
+                         &stats,
+                         "");
+
+  // Build up enough latency samples to hedge.
+  for (size_t ii = 0; ii < LatencyWindow::MIN_SAMPLES; ii++)
+  {
+    CallListStore::CallFragment call =
+      fragment("20021225100000",
+               std::to_string(ii),
+               CallListStore::CallFragment::Type::BEGIN);
+    EXPECT_EQ(CassandraStore::OK,
+              store.write_call_fragment_sync("sip:6505550000@homedomain",
+                                             call,
+                                             1000,
+                                             0,
+                                             0));
+  }
+
+  local.set_delay_ms(300);
+  peer.set_error(Cql::ERR_OVERLOADED);
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "hedged", CallListStore::CallFragment::Type::END);
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync("sip:6505550001@homedomain",
+                                           call,
+                                           1000,
+                                           0,
+                                           0));
+  EXPECT_EQ(1, local.columns("sip:6505550001@homedomain"));
+  EXPECT_EQ(0, peer.columns("sip:6505550001@homedomain"));
+  EXPECT_EQ(1u, store._hedges_sent.load());
+  EXPECT_EQ(0u, store._hedges_won.load());
+
+  // Once both nodes fail, the error is returned.
+  local.set_error(Cql::ERR_OVERLOADED);
+  EXPECT_NE(CassandraStore::OK,
+            store.write_call_fragment_sync("sip:6505550002@homedomain",
+                                           call,
+                                           1000,
+                                           0,
+                                           0));
+}
+
+// Writes and reads drop to a weaker consistency level while Cassandra is
+// failing, and degraded reads aren't retried at QUORUM.
+TEST(CqlCallListStoreConsistencyTest, Degrade)
+{
+  FakeCqlServer server;
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1",
+                         server.port(),
+                         1,
+                         1000,
+                         false,
+                         0,
+                         0,
+                         Cql::LOCAL_QUORUM,
+                         Cql::LOCAL_ONE,
+                         0,
+                         50,
+                         0,
+                         NULL,
+                         &stats,
+                         "");
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  std::vector<CallListStore::CallFragment> fragments;
+
+  // Reads that find nothing are retried at LOCAL_QUORUM.
+  EXPECT_EQ(CassandraStore::NOT_FOUND,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(2u, server.consistencies.size());
+  EXPECT_EQ(Cql::LOCAL_ONE, server.consistencies[0].second);
+  EXPECT_EQ(Cql::LOCAL_QUORUM, server.consistencies[1].second);
+
+  server.set_error(Cql::ERR_UNAVAILABLE);
+
+  for (int ii = 0; ii < ConsistencyPolicy::MIN_SAMPLES; ii++)
+  {
+    store.write_call_fragment_sync(IMPU, call, 1000, 3600, 0);
+    store.get_call_fragments_sync(IMPU, fragments, 0);
+  }
+
+  EXPECT_TRUE(store._write_policy.degraded());
+  EXPECT_TRUE(store._read_policy.degraded());
+
+  server.set_error(0);
+  server.consistencies.clear();
+  EXPECT_EQ(CassandraStore::OK,
+            store.write_call_fragment_sync(IMPU, call, 1000, 3600, 0));
+  EXPECT_EQ(CassandraStore::NOT_FOUND,
+            store.get_call_fragments_sync("sip:6505550001@homedomain",
+                                          fragments,
+                                          0));
+  ASSERT_EQ(2u, server.consistencies.size());
+  EXPECT_EQ("INSERT", server.consistencies[0].first);
+  EXPECT_EQ(Cql::LOCAL_ONE, server.consistencies[0].second);
+  EXPECT_EQ("SELECT", server.consistencies[1].first);
+  EXPECT_EQ(Cql::LOCAL_ONE, server.consistencies[1].second);
+}
+
+// Views are created, read and replaced at QUORUM, and a replacement only
+// applies at the version that was read.
+TEST_F(CqlCallListStoreTest, View)
+{
+  std::string view;
+  int64_t version = 0;
+  bool applied = false;
+
+  EXPECT_EQ(CassandraStore::NOT_FOUND,
+            _store->get_call_list_view_sync(IMPU, view, version, 0));
+
+  EXPECT_EQ(CassandraStore::OK,
+            _store->set_call_list_view_sync(IMPU, "first", 0, 3600, applied, 0));
+  EXPECT_TRUE(applied);
+
+  // Someone else has already created the view.
+  EXPECT_EQ(CassandraStore::OK,
+            _store->set_call_list_view_sync(IMPU, "other", 0, 3600, applied, 0));
+  EXPECT_FALSE(applied);
+
+  ASSERT_EQ(CassandraStore::OK,
+            _store->get_call_list_view_sync(IMPU, view, version, 0));
+  EXPECT_EQ("first", view);
+  EXPECT_EQ(1, version);
+
+  EXPECT_EQ(CassandraStore::OK,
+            _store->set_call_list_view_sync(IMPU, "second", version, 3600, applied, 0));
+  EXPECT_TRUE(applied);
+
+  // A stale version doesn't apply.
+  EXPECT_EQ(CassandraStore::OK,
+            _store->set_call_list_view_sync(IMPU, "stale", version, 3600, applied, 0));
+  EXPECT_FALSE(applied);
+
+  ASSERT_EQ(CassandraStore::OK,
+            _store->get_call_list_view_sync(IMPU, view, version, 0));
+  EXPECT_EQ("second", view);
+  EXPECT_EQ(2, version);
+
+  for (size_t ii = 0; ii < _server.consistencies.size(); ii++)
+  {
+    EXPECT_EQ(Cql::QUORUM, _server.consistencies[ii].second);
+  }
+}
+
+/// @returns - Whether a slot is connected with every statement prepared.
+static bool is_warm(CqlCallListStore::Slot* slot)
+{
+  pthread_mutex_lock(&slot->lock);
+  bool warm = ((slot->connection->is_connected()) &&
+               (!slot->prepared[CqlCallListStore::NUM_STATEMENTS - 1].empty()));
+  pthread_mutex_unlock(&slot->lock);
+  return warm;
+}
+
+// Prewarmed connections to every node in the ring are open, with every
+// statement prepared, before any requests arrive.
+TEST(CqlCallListStorePrewarmTest, Prewarm)
+{
+  FakeCqlServer local("127.0.0.1");
+  FakeCqlServer peer("127.0.0.2", local.port());
+  std::map<std::string, std::vector<std::string>> peers;
+  peers["127.0.0.2"].push_back("4611686018427387904");
+  peers["127.0.0.3"].push_back("-4611686018427387904");
+  local.set_ring(std::vector<std::string>(1, "0"), peers);
+
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1",
+                         local.port(),
+                         2,
+                         100,
+                         true,
+                         0,
+                         0,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         1,
+                         NULL,
+                         &stats,
+                         "");
+
+  ASSERT_EQ(2u, store._host_slots["127.0.0.1"].size());
+  ASSERT_EQ(2u, store._host_slots["127.0.0.2"].size());
+  EXPECT_TRUE(is_warm(store._host_slots["127.0.0.1"][0]));
+  EXPECT_TRUE(is_warm(store._host_slots["127.0.0.2"][0]));
+
+  // Only one connection to each node is prewarmed.
+  EXPECT_FALSE(store._host_slots["127.0.0.2"][1]->connection->is_connected());
+
+  // 127.0.0.3 isn't there, so it waits before trying again.
+  EXPECT_FALSE(store._host_slots["127.0.0.3"][0]->connection->is_connected());
+  EXPECT_NE(0u, store._host_slots["127.0.0.3"][0]->next_connect_ms);
+}
+
+// Prewarmed connections that failed are reopened once they're due a retry,
+// without waiting for a request.
+TEST(CqlCallListStorePrewarmTest, Reconnect)
+{
+  int port;
+
+  {
+    // Find a port with nothing listening on it.
+    FakeCqlServer server;
+    port = server.port();
+  }
+
+  CqlCallListStore::Statistics stats(NULL);
+  CqlCallListStore store("127.0.0.1",
+                         port,
+                         1,
+                         100,
+                         false,
+                         0,
+                         0,
+                         Cql::ONE,
+                         Cql::ONE,
+                         0,
+                         0,
+                         1,
+                         NULL,
+                         &stats,
+                         "");
+  EXPECT_FALSE(is_warm(store._slots[0]));
+
+  FakeCqlServer server("127.0.0.1", port);
+  bool warm = false;
+
+  for (int ii = 0; (ii < 50) && (!warm); ii++)
+  {
+    usleep(100000);
+    warm = is_warm(store._slots[0]);
+  }
+
+  EXPECT_TRUE(warm);
+}
@@ -0,0 +1,124 @@
+/**
+ * @file cql_frame_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "cql_frame.h"
+
+// Headers survive a round trip, and are big-endian on the wire.
+TEST(CqlFrameTest, Header)
+{
+  std::string frame = Cql::request(Cql::OP_EXECUTE, 0x0102, "body");
+  ASSERT_EQ(Cql::HEADER_LEN + 4, frame.length());
+  EXPECT_EQ(std::string("\x04\x00\x01\x02\x0A\x00\x00\x00\x04", 9),
+            frame.substr(0, Cql::HEADER_LEN));
+
+  Cql::Header header;
+  ASSERT_TRUE(Cql::decode_header((const uint8_t*)frame.data(), header));
+  EXPECT_EQ(0x0102, header.stream);
+  EXPECT_EQ(Cql::OP_EXECUTE, header.opcode);
+  EXPECT_EQ(4u, header.length);
+
+  // Other protocol versions are rejected.
+  frame[0] = 0x83;
+  EXPECT_FALSE(Cql::decode_header((const uint8_t*)frame.data(), header));
+}
+
+// Executions carry their values, consistency and timestamp.
+TEST(CqlFrameTest, Execute)
+{
+  std::vector<std::string> values;
+  values.push_back("key");
+  values.push_back(Cql::int_value(3600));
+  std::string body = Cql::execute_body("id", values, Cql::QUORUM, 1000);
+
+  Cql::Reader reader(body);
+  EXPECT_EQ("id", reader.read_short_bytes());
+  EXPECT_EQ(Cql::QUORUM, reader.read_short());
+  EXPECT_EQ(0x21, reader.read_byte());
+  EXPECT_EQ(2, reader.read_short());
+  EXPECT_EQ("key", reader.read_bytes());
+  EXPECT_EQ(Cql::int_value(3600), reader.read_bytes());
+  EXPECT_EQ(1000, reader.read_long());
+  EXPECT_TRUE(reader.ok());
+
+  // There's nothing left.
+  reader.read_byte();
+  EXPECT_FALSE(reader.ok());
+}
+
+// Bigint values round trip, and anything but 8 bytes is rejected.
+TEST(CqlFrameTest, LongValue)
+{
+  int64_t value = 0;
+  EXPECT_TRUE(Cql::parse_long(Cql::long_value(-2), value));
+  EXPECT_EQ(-2, value);
+  EXPECT_TRUE(Cql::parse_long(Cql::long_value(0x0102030405060708), value));
+  EXPECT_EQ(0x0102030405060708, value);
+  EXPECT_FALSE(Cql::parse_long(Cql::int_value(1), value));
+}
+
+// Rows results are parsed whatever column types are in the metadata.
+TEST(CqlFrameTest, Rows)
+{
+  std::string body;
+  Cql::Writer writer(body);
+  writer.write_int(Cql::RESULT_ROWS);
+  writer.write_int(0);
+  writer.write_int(2);
+  writer.write_string("memento");
+  writer.write_string("call_lists");
+  writer.write_string("column1");
+  writer.write_short(0x000D);
+  writer.write_string("memento");
+  writer.write_string("call_lists");
+  writer.write_string("value");
+  writer.write_short(0x0021);
+  writer.write_short(0x000D);
+  writer.write_short(0x0020);
+  writer.write_short(0x0003);
+  writer.write_int(2);
+  writer.write_bytes("a");
+  writer.write_bytes("1");
+  writer.write_bytes("b");
+  writer.write_int(-1);
+
+  std::vector<std::vector<std::string>> rows;
+  ASSERT_TRUE(Cql::parse_rows(body, rows));
+  ASSERT_EQ(2u, rows.size());
+  EXPECT_EQ("a", rows[0][0]);
+  EXPECT_EQ("1", rows[0][1]);
+  EXPECT_EQ("b", rows[1][0]);
+  EXPECT_EQ("", rows[1][1]);
+
+  // Truncated results are rejected.
+  EXPECT_FALSE(Cql::parse_rows(body.substr(0, body.length() - 1), rows));
+}
+
+// Unprepared errors carry the statement ID.
+TEST(CqlFrameTest, Error)
+{
+  std::string body;
+  Cql::Writer writer(body);
+  writer.write_int(Cql::ERR_UNPREPARED);
+  writer.write_string("Unknown statement");
+  writer.write_short_bytes("id");
+
+  int32_t code;
+  std::string message;
+  std::string id;
+  ASSERT_TRUE(Cql::parse_error(body, code, message, id));
+  EXPECT_EQ(Cql::ERR_UNPREPARED, code);
+  EXPECT_EQ("Unknown statement", message);
+  EXPECT_EQ("id", id);
+}
@@ -0,0 +1,149 @@
+/**
+ * @file deadline_call_list_store_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <unistd.h>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "deadline_call_list_store.h"
+#include "mock_call_list_store.h"
+#include "mock_call_list_view_store.h"
+
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::InvokeWithoutArgs;
+using ::testing::Return;
+using ::testing::SetArgReferee;
+
+static const std::string IMPU = "sip:6505550000@homedomain";
+
+static void slow_operation()
+{
+  usleep(200000);
+}
+
+class DeadlineCallListStoreTest : public ::testing::Test
+{
+public:
+  DeadlineCallListStoreTest() :
+    _mock_store(new MockCallListStore()),
+    _store(_mock_store, &_mock_view_store, 2)
+  {
+  }
+
+  MockCallListViewStore _mock_view_store;
+  MockCallListStore* _mock_store;
+  DeadlineCallListStore _store;
+};
+
+// Operations without a deadline go straight through.
+TEST_F(DeadlineCallListStoreTest, NoDeadline)
+{
+  CallListStore::CallFragment fragment;
+  EXPECT_CALL(*_mock_store, write_call_fragment_sync(IMPU, _, 1000, 3600, 0))
+    .WillOnce(Return(CassandraStore::OK));
+  EXPECT_EQ(CassandraStore::OK,
+            _store.write_call_fragment_sync(IMPU, fragment, 1000, 3600, 0));
+}
+
+// Operations that finish in time return their result.
+TEST_F(DeadlineCallListStoreTest, InTime)
+{
+  std::vector<CallListStore::CallFragment> stored(2);
+  stored[0].id = "a";
+  stored[1].id = "b";
+
+  EXPECT_CALL(*_mock_store, get_call_fragments_sync(IMPU, _, 0))
+    .WillOnce(DoAll(SetArgReferee<1>(stored), Return(CassandraStore::OK)));
+  EXPECT_CALL(*_mock_store, delete_old_call_fragments_sync(IMPU, _, 1001, 0))
+    .WillOnce(Return(CassandraStore::INVALID_REQUEST));
+
+  DeadlineCallListStore::Deadline deadline(
+                          DeadlineCallListStore::current_time_us() + 1000000);
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::OK,
+            _store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(2u, fragments.size());
+  EXPECT_EQ("b", fragments[1].id);
+
+  EXPECT_EQ(CassandraStore::INVALID_REQUEST,
+            _store.delete_old_call_fragments_sync(IMPU, fragments, 1001, 0));
+}
+
+// The caller gives up on an operation when its deadline passes, without
+// waiting for the operation to finish.
+TEST_F(DeadlineCallListStoreTest, Overrun)
+{
+  CallListStore::CallFragment fragment;
+  EXPECT_CALL(*_mock_store, write_call_fragment_sync(IMPU, _, 1000, 3600, 0))
+    .WillOnce(DoAll(InvokeWithoutArgs(slow_operation),
+                    Return(CassandraStore::OK)));
+
+  uint64_t start_us = DeadlineCallListStore::current_time_us();
+
+  {
+    DeadlineCallListStore::Deadline deadline(start_us + 20000);
+    EXPECT_EQ(CassandraStore::RESOURCE_ERROR,
+              _store.write_call_fragment_sync(IMPU, fragment, 1000, 3600, 0));
+  }
+
+  EXPECT_LT(DeadlineCallListStore::current_time_us(), start_us + 200000);
+
+  // The deadline doesn't outlive its scope.
+  EXPECT_EQ(0u, DeadlineCallListStore::Deadline::current());
+}
+
+// Operations whose deadline has passed aren't run.
+TEST_F(DeadlineCallListStoreTest, Expired)
+{
+  EXPECT_CALL(*_mock_store, get_call_fragments_sync(_, _, _)).Times(0);
+
+  DeadlineCallListStore::Deadline deadline(
+                                  DeadlineCallListStore::current_time_us());
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::RESOURCE_ERROR,
+            _store.get_call_fragments_sync(IMPU, fragments, 0));
+}
+
+// View operations are run against the view store in the same way.
+TEST_F(DeadlineCallListStoreTest, Views)
+{
+  EXPECT_CALL(_mock_view_store, get_call_list_view_sync(IMPU, _, _, 0))
+    .WillOnce(DoAll(SetArgReferee<1>(std::string("view")),
+                    SetArgReferee<2>(3),
+                    Return(CassandraStore::OK)));
+  EXPECT_CALL(_mock_view_store, set_call_list_view_sync(IMPU, "new", 3, 3600, _, 0))
+    .WillOnce(DoAll(SetArgReferee<4>(true), Return(CassandraStore::OK)))
+    .WillOnce(DoAll(InvokeWithoutArgs(slow_operation),
+                    SetArgReferee<4>(true),
+                    Return(CassandraStore::OK)));
+
+  DeadlineCallListStore::Deadline deadline(
+                          DeadlineCallListStore::current_time_us() + 100000);
+  std::string view;
+  int64_t version = 0;
+  EXPECT_EQ(CassandraStore::OK,
+            _store.get_call_list_view_sync(IMPU, view, version, 0));
+  EXPECT_EQ("view", view);
+  EXPECT_EQ(3, version);
+
+  bool applied = false;
+  EXPECT_EQ(CassandraStore::OK,
+            _store.set_call_list_view_sync(IMPU, "new", 3, 3600, applied, 0));
+  EXPECT_TRUE(applied);
+
+  // If the caller gives up on a replacement, it can't tell whether it was
+  // applied.
+  EXPECT_EQ(CassandraStore::RESOURCE_ERROR,
+            _store.set_call_list_view_sync(IMPU, "new", 3, 3600, applied, 0));
+  EXPECT_FALSE(applied);
+}
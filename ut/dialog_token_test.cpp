@@ -0,0 +1,212 @@
+/**
+ * @file dialog_token_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <ctime>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "dialog_token.h"
+#include "base64.h"
+
+static const std::string IMPU = "sip:6505551234@homedomain";
+
+class DialogTokenTest : public ::testing::Test
+{
+public:
+  DialogTokenTest()
+  {
+    // The timestamp is formatted in the AS's local time, exactly as the
+    // BEGIN fragment's timestamp is.
+    _start_time = 1022751010;
+    tm local_time;
+    localtime_r(&_start_time, &local_time);
+    char buf[16];
+    strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", &local_time);
+    _timestamp = buf;
+  }
+
+  time_t _start_time;
+  std::string _timestamp;
+};
+
+// A compact token decodes to the same timestamp, ID and IMPU that the AS
+// writes in the BEGIN fragment.
+TEST_F(DialogTokenTest, RoundTrip)
+{
+  std::string token;
+  DialogToken::encode(_start_time,
+                      18446744073709551615UL,
+                      IMPU.data(),
+                      IMPU.length(),
+                      token);
+  EXPECT_EQ(DialogToken::COMPACT_PREFIX, token[0]);
+  EXPECT_EQ(std::string::npos, token.find_first_of("+/=."));
+
+  std::string timestamp;
+  std::string id;
+  std::string impu;
+  EXPECT_TRUE(DialogToken::decode(token, NULL, timestamp, id, impu));
+  EXPECT_EQ(_timestamp, timestamp);
+  EXPECT_EQ("18446744073709551615", id);
+  EXPECT_EQ(IMPU, impu);
+}
+
+// IMPUs of every length (and so every amount of trailing base64) round
+// trip.
+TEST_F(DialogTokenTest, ImpuLengths)
+{
+  for (size_t len = 0; len <= IMPU.length(); len++)
+  {
+    std::string token;
+    DialogToken::encode(_start_time, 123, IMPU.data(), len, token);
+
+    std::string timestamp;
+    std::string id;
+    std::string impu;
+    EXPECT_TRUE(DialogToken::decode(token, NULL, timestamp, id, impu));
+    EXPECT_EQ("123", id);
+    EXPECT_EQ(IMPU.substr(0, len), impu);
+  }
+}
+
+// Compact tokens are smaller than the tokens older versions wrote.
+TEST_F(DialogTokenTest, SmallerThanLegacy)
+{
+  std::string token;
+  DialogToken::encode(_start_time,
+                      9876543210123456789UL,
+                      IMPU.data(),
+                      IMPU.length(),
+                      token);
+  std::string legacy = _timestamp + "_9876543210123456789_" +
+    base64_encode(reinterpret_cast<const unsigned char*>(IMPU.data()),
+                  IMPU.length());
+  EXPECT_LT(token.length(), legacy.length());
+}
+
+// Tokens written by older versions are still accepted.
+TEST_F(DialogTokenTest, Legacy)
+{
+  std::string timestamp;
+  std::string id;
+  std::string impu;
+  EXPECT_TRUE(DialogToken::decode("123_456_c2lwOjY1MDU1NTEyMzRAaG9tZWRvbWFpbg==",
+                                  NULL,
+                                  timestamp,
+                                  id,
+                                  impu));
+  EXPECT_EQ("123", timestamp);
+  EXPECT_EQ("456", id);
+  EXPECT_EQ(IMPU, impu);
+
+  EXPECT_FALSE(DialogToken::decode("123_456", NULL, timestamp, id, impu));
+}
+
+// Malformed tokens are rejected.
+TEST_F(DialogTokenTest, Malformed)
+{
+  std::string token;
+  DialogToken::encode(_start_time, 123, IMPU.data(), IMPU.length(), token);
+
+  std::string timestamp;
+  std::string id;
+  std::string impu;
+  EXPECT_FALSE(DialogToken::decode("", NULL, timestamp, id, impu));
+  EXPECT_FALSE(DialogToken::decode("m", NULL, timestamp, id, impu));
+  EXPECT_FALSE(DialogToken::decode(token.substr(0, 10), NULL, timestamp, id, impu));
+  EXPECT_FALSE(DialogToken::decode(token.substr(0, 18), NULL, timestamp, id, impu));
+  EXPECT_FALSE(DialogToken::decode(token + "+", NULL, timestamp, id, impu));
+  EXPECT_FALSE(DialogToken::decode("m" + std::string(4000, 'A'),
+                                   NULL,
+                                   timestamp,
+                                   id,
+                                   impu));
+}
+
+// With a dialog table, the token just carries a key, and the details can
+// be taken from the table once.
+TEST_F(DialogTokenTest, Table)
+{
+  DialogTable table(10);
+  DialogDetails details;
+  details.timestamp = _timestamp;
+  details.id = "123";
+  details.impu = IMPU;
+
+  std::string token;
+  DialogToken::encode_key(table.add(details), token);
+  EXPECT_EQ(DialogToken::TABLE_PREFIX, token[0]);
+  EXPECT_EQ(12u, token.length());
+  EXPECT_EQ(1u, table.size());
+
+  std::string timestamp;
+  std::string id;
+  std::string impu;
+  EXPECT_FALSE(DialogToken::decode(token, NULL, timestamp, id, impu));
+  EXPECT_TRUE(DialogToken::decode(token, &table, timestamp, id, impu));
+  EXPECT_EQ(_timestamp, timestamp);
+  EXPECT_EQ("123", id);
+  EXPECT_EQ(IMPU, impu);
+  EXPECT_EQ(0u, table.size());
+
+  // The dialog has been removed, so a retransmitted BYE doesn't write a
+  // second END fragment.
+  EXPECT_FALSE(DialogToken::decode(token, &table, timestamp, id, impu));
+}
+
+// The oldest dialogs are evicted once the table is full.
+TEST_F(DialogTokenTest, TableFull)
+{
+  DialogTable table(2);
+  DialogDetails details;
+  uint64_t first = table.add(details);
+  table.add(details);
+  table.add(details);
+  EXPECT_EQ(2u, table.size());
+
+  std::string timestamp;
+  std::string id;
+  std::string impu;
+  EXPECT_FALSE(table.take(first, timestamp, id, impu));
+}
+
+// A dialog that is never taken doesn't stop the table tidying up after the
+// ones that are, and only the oldest dialog still in the table is evicted.
+TEST_F(DialogTokenTest, TableLongCall)
+{
+  DialogTable table(3);
+  DialogDetails details;
+  uint64_t long_call = table.add(details);
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    std::string timestamp;
+    std::string id;
+    std::string impu;
+    EXPECT_TRUE(table.take(table.add(details), timestamp, id, impu));
+  }
+
+  EXPECT_EQ(1u, table.size());
+  EXPECT_EQ(1u, table._order.size());
+
+  // Fill the table. The long call is now the oldest, so it goes first.
+  uint64_t second = table.add(details);
+  table.add(details);
+  table.add(details);
+  EXPECT_EQ(3u, table.size());
+  EXPECT_EQ(3u, table._order.size());
+
+  std::string timestamp;
+  std::string id;
+  std::string impu;
+  EXPECT_FALSE(table.take(long_call, timestamp, id, impu));
+  EXPECT_TRUE(table.take(second, timestamp, id, impu));
+}
@@ -0,0 +1,134 @@
+/**
+ * @file heavy_hitters_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "heavy_hitters.h"
+
+// Keys are counted exactly while there is room for them all.
+TEST(HeavyHittersTest, ExactWhileRoom)
+{
+  HeavyHitters hitters(4);
+  hitters.add("a");
+  hitters.add("b", 5);
+  hitters.add("c", 2);
+  hitters.add("a");
+
+  std::vector<HeavyHitters::Entry> top;
+  hitters.top(2, top);
+  ASSERT_EQ(2u, top.size());
+  EXPECT_EQ("b", top[0].key);
+  EXPECT_EQ(5u, top[0].count);
+  EXPECT_EQ("a", top[1].key);
+  EXPECT_EQ(2u, top[1].count);
+  EXPECT_EQ(0u, top[1].error);
+
+  hitters.top(10, top);
+  EXPECT_EQ(3u, top.size());
+}
+
+// Heavy keys are found in a long stream of mostly distinct keys, using a
+// fixed amount of memory, and their counts are within the error bound.
+TEST(HeavyHittersTest, FindsHeavyKeys)
+{
+  HeavyHitters hitters(16);
+
+  for (int ii = 0; ii < 10000; ii++)
+  {
+    hitters.add("hot1");
+
+    if (ii % 2 == 0)
+    {
+      hitters.add("hot2");
+    }
+
+    hitters.add("cold" + std::to_string(ii));
+  }
+
+  std::vector<HeavyHitters::Entry> top;
+  hitters.top(2, top);
+  ASSERT_EQ(2u, top.size());
+  EXPECT_EQ("hot1", top[0].key);
+  EXPECT_EQ("hot2", top[1].key);
+
+  for (size_t ii = 0; ii < top.size(); ii++)
+  {
+    uint64_t actual = (ii == 0) ? 10000 : 5000;
+    EXPECT_GE(top[ii].count, actual);
+    EXPECT_LE(top[ii].count - top[ii].error, actual);
+  }
+
+  EXPECT_EQ(16u, hitters._entries.size());
+  EXPECT_EQ(16u, hitters._index.size());
+}
+
+// The tracker counts over an interval, and starts again once it has
+// published.
+TEST(HeavyHittersTest, TrackerInterval)
+{
+  HotImpuTracker tracker(2, 1000, NULL);
+  tracker.record_write("sip:1@home.domain", 1);
+  tracker.record_write("sip:1@home.domain", 500);
+  tracker.record_trim("sip:2@home.domain", 7, 999);
+  EXPECT_EQ(1u, tracker._writes._entries.size());
+  EXPECT_EQ(2u, tracker._writes._entries[0].count);
+  EXPECT_EQ(7u, tracker._trims._entries[0].count);
+
+  tracker.record_write("sip:3@home.domain", 1001);
+  ASSERT_EQ(1u, tracker._writes._entries.size());
+  EXPECT_EQ("sip:3@home.domain", tracker._writes._entries[0].key);
+  EXPECT_EQ(0u, tracker._trims._entries.size());
+}
+
+// Taking the counts empties the table, ready for the next interval.
+TEST(HeavyHittersTest, Take)
+{
+  HeavyHitters hitters(4);
+  hitters.add("a", 3);
+  hitters.add("b", 5);
+
+  std::vector<HeavyHitters::Entry> entries;
+  hitters.take(entries);
+  EXPECT_EQ(2u, entries.size());
+  EXPECT_EQ(0u, hitters._entries.size());
+  EXPECT_EQ(0u, hitters._index.size());
+
+  HeavyHitters::keep_top(1, entries);
+  ASSERT_EQ(1u, entries.size());
+  EXPECT_EQ("b", entries[0].key);
+
+  hitters.add("a");
+  EXPECT_EQ(1u, hitters._entries[0].count);
+}
+
+// Ending an interval hands back its counts, to publish once the lock is
+// released, and leaves the tracker counting afresh.
+TEST(HeavyHittersTest, TrackerEndInterval)
+{
+  HotImpuTracker tracker(2, 1000, NULL);
+  tracker.record_write("sip:1@home.domain", 1);
+  tracker.record_trim("sip:2@home.domain", 7, 2);
+
+  std::vector<HeavyHitters::Entry> writes;
+  std::vector<HeavyHitters::Entry> trims;
+  EXPECT_FALSE(tracker.end_interval(999, writes, trims));
+  EXPECT_TRUE(writes.empty());
+
+  EXPECT_TRUE(tracker.end_interval(1001, writes, trims));
+  ASSERT_EQ(1u, writes.size());
+  EXPECT_EQ("sip:1@home.domain", writes[0].key);
+  ASSERT_EQ(1u, trims.size());
+  EXPECT_EQ(7u, trims[0].count);
+  EXPECT_EQ(0u, tracker._writes._entries.size());
+  EXPECT_EQ(0u, tracker._trims._entries.size());
+}
@@ -0,0 +1,37 @@
+/**
+ * @file keyed_statistic_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gtest/gtest.h"
+
+#include "keyed_statistic.h"
+
+// Each key's values are published together, in key order, and a key's
+// report replaces only its own values.
+TEST(KeyedStatisticTest, Keys)
+{
+  KeyedStatistic stat("memento_cql_hedges", NULL);
+  stat.report_change("b", {"1", "2"});
+  stat.report_change("a", {"3"});
+  stat.report_change("b", {"4"});
+
+  std::vector<std::string> expected = {"a", "3", "b", "4"};
+  EXPECT_EQ(expected, stat.all_values());
+}
+
+// Values under the empty key aren't preceded by anything.
+TEST(KeyedStatisticTest, Unkeyed)
+{
+  KeyedStatistic stat("memento_cql_hedges", NULL);
+  stat.report_change("", {"1", "2"});
+
+  std::vector<std::string> expected = {"1", "2"};
+  EXPECT_EQ(expected, stat.all_values());
+}
@@ -0,0 +1,50 @@
+/**
+ * @file latency_window_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gtest/gtest.h"
+
+#include "latency_window.h"
+
+// The percentile isn't known until there are enough samples.
+TEST(LatencyWindowTest, Percentile)
+{
+  LatencyWindow window(95);
+
+  for (uint64_t ii = 1; ii < LatencyWindow::MIN_SAMPLES; ii++)
+  {
+    window.record(ii);
+  }
+
+  EXPECT_EQ(0u, window.percentile_us());
+
+  window.record(LatencyWindow::MIN_SAMPLES);
+  EXPECT_EQ(95u, window.percentile_us());
+}
+
+// Old samples drop out of the window.
+TEST(LatencyWindowTest, Window)
+{
+  LatencyWindow window(50);
+
+  for (size_t ii = 0; ii < LatencyWindow::WINDOW_SIZE; ii++)
+  {
+    window.record(1000);
+  }
+
+  EXPECT_EQ(1000u, window.percentile_us());
+
+  for (size_t ii = 0; ii < LatencyWindow::WINDOW_SIZE / 2 + 100; ii++)
+  {
+    window.record(10);
+  }
+
+  EXPECT_EQ(10u, window.percentile_us());
+}
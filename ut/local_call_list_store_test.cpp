@@ -0,0 +1,310 @@
+/**
+ * @file local_call_list_store_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "local_call_list_store.h"
+
+static const std::string IMPU = "sip:6505550000@homedomain";
+
+static CallListStore::CallFragment fragment(const std::string& timestamp,
+                                            const std::string& id,
+                                            CallListStore::CallFragment::Type type)
+{
+  CallListStore::CallFragment fragment;
+  fragment.timestamp = timestamp;
+  fragment.id = id;
+  fragment.type = type;
+  fragment.contents = "<xml>" + id + "</xml>";
+  return fragment;
+}
+
+class LocalCallListStoreTest : public ::testing::Test
+{
+public:
+  LocalCallListStoreTest()
+  {
+    char path[] = "/tmp/local_call_list_store_testXXXXXX";
+    close(mkstemp(path));
+    _path = path;
+  }
+
+  virtual ~LocalCallListStoreTest()
+  {
+    unlink(_path.c_str());
+    unlink((_path + ".compact").c_str());
+  }
+
+  uint64_t file_size()
+  {
+    struct stat st;
+    stat(_path.c_str(), &st);
+    return st.st_size;
+  }
+
+  std::string _path;
+};
+
+// Fragments come back in timestamp order, and survive a restart.
+TEST_F(LocalCallListStoreTest, WriteReadRestart)
+{
+  CallListStore::CallFragment first =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  CallListStore::CallFragment second =
+    fragment("20021225110000", "2", CallListStore::CallFragment::Type::REJECTED);
+  std::vector<CallListStore::CallFragment> fragments;
+
+  {
+    LocalCallListStore store(_path);
+    ASSERT_TRUE(store.is_valid());
+    EXPECT_EQ(CassandraStore::NOT_FOUND,
+              store.get_call_fragments_sync(IMPU, fragments, 0));
+    EXPECT_EQ(CassandraStore::OK,
+              store.write_call_fragment_sync(IMPU, second, 1000, 3600, 0));
+    EXPECT_EQ(CassandraStore::OK,
+              store.write_call_fragment_sync(IMPU, first, 1000, 3600, 0));
+  }
+
+  LocalCallListStore store(_path);
+  ASSERT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(2u, fragments.size());
+  EXPECT_EQ("1", fragments[0].id);
+  EXPECT_EQ("<xml>1</xml>", fragments[0].contents);
+  EXPECT_EQ(CallListStore::CallFragment::Type::REJECTED, fragments[1].type);
+}
+
+// Fragments written together are appended to the log in one go, and
+// survive a restart.
+TEST_F(LocalCallListStoreTest, BatchedWrite)
+{
+  std::vector<CallListStore::CallFragment> fragments;
+  fragments.push_back(
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN));
+  fragments.push_back(
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::END));
+
+  {
+    LocalCallListStore store(_path);
+    EXPECT_EQ(CassandraStore::OK,
+              store.write_call_fragments_sync(IMPU, fragments, 1000, 3600, 0));
+  }
+
+  LocalCallListStore store(_path);
+  std::vector<CallListStore::CallFragment> read;
+  ASSERT_EQ(CassandraStore::OK, store.get_call_fragments_sync(IMPU, read, 0));
+  ASSERT_EQ(2u, read.size());
+  EXPECT_EQ(CallListStore::CallFragment::Type::BEGIN, read[0].type);
+  EXPECT_EQ(CallListStore::CallFragment::Type::END, read[1].type);
+}
+
+// The index only holds where fragments' contents are, and reads fetch them
+// from the log.
+TEST_F(LocalCallListStoreTest, ContentsNotIndexed)
+{
+  LocalCallListStore store(_path);
+  store.write_call_fragment_sync(IMPU,
+                                 fragment("20021225100000",
+                                          "1",
+                                          CallListStore::CallFragment::Type::BEGIN),
+                                 1000,
+                                 3600,
+                                 0);
+
+  const LocalCallListStore::Entry& entry = store._rows[IMPU].begin()->second;
+  EXPECT_TRUE(entry.fragment.contents.empty());
+  EXPECT_EQ(12u, entry.contents_len);
+  EXPECT_EQ(file_size() - 12, entry.contents_offset);
+
+  std::vector<CallListStore::CallFragment> fragments;
+  ASSERT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(1u, fragments.size());
+  EXPECT_EQ("<xml>1</xml>", fragments[0].contents);
+}
+
+// Deletes only remove fragments at least as old as the delete, and are
+// replayed too.
+TEST_F(LocalCallListStoreTest, Delete)
+{
+  CallListStore::CallFragment old_call =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  CallListStore::CallFragment new_call =
+    fragment("20021225110000", "2", CallListStore::CallFragment::Type::BEGIN);
+  std::vector<CallListStore::CallFragment> fragments;
+
+  {
+    LocalCallListStore store(_path);
+    store.write_call_fragment_sync(IMPU, old_call, 1000, 3600, 0);
+    store.write_call_fragment_sync(IMPU, new_call, 3000, 3600, 0);
+
+    std::vector<CallListStore::CallFragment> to_delete;
+    to_delete.push_back(old_call);
+    to_delete.push_back(new_call);
+    EXPECT_EQ(CassandraStore::OK,
+              store.delete_old_call_fragments_sync(IMPU, to_delete, 2000, 0));
+  }
+
+  LocalCallListStore store(_path);
+  ASSERT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(1u, fragments.size());
+  EXPECT_EQ("2", fragments[0].id);
+}
+
+// A delete leaves a tombstone, even if there's nothing to delete, so an
+// older write that arrives later, or is replayed later, doesn't bring the
+// fragment back. Compaction drops the tombstone.
+TEST_F(LocalCallListStoreTest, Tombstone)
+{
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  std::vector<CallListStore::CallFragment> fragments;
+
+  {
+    LocalCallListStore store(_path);
+    EXPECT_EQ(CassandraStore::OK,
+              store.delete_old_call_fragments_sync(
+                              IMPU,
+                              std::vector<CallListStore::CallFragment>(1, call),
+                              2000,
+                              0));
+    store.write_call_fragment_sync(IMPU, call, 1000, 3600, 0);
+    store.write_call_fragment_sync(IMPU, call, 2000, 3600, 0);
+    EXPECT_EQ(CassandraStore::NOT_FOUND,
+              store.get_call_fragments_sync(IMPU, fragments, 0));
+    EXPECT_EQ(0u, store._live_bytes);
+  }
+
+  LocalCallListStore store(_path);
+  EXPECT_EQ(CassandraStore::NOT_FOUND,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(1u, store._rows[IMPU].size());
+  EXPECT_TRUE(store._rows[IMPU].begin()->second.deleted);
+
+  EXPECT_TRUE(store.compact());
+  EXPECT_EQ(0u, store._rows.count(IMPU));
+  EXPECT_EQ(0u, file_size());
+
+  // A newer write isn't held back by a tombstone.
+  store.write_call_fragment_sync(IMPU, call, 3000, 3600, 0);
+  ASSERT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  EXPECT_EQ(1u, fragments.size());
+}
+
+// Expired fragments aren't returned.
+TEST_F(LocalCallListStoreTest, Expiry)
+{
+  LocalCallListStore store(_path);
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+  store.write_call_fragment_sync(IMPU, call, 1000, 3600, 0);
+
+  // Wind the fragment's expiry back.
+  store._rows[IMPU].begin()->second.expiry_s = time(NULL) - 1;
+
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_EQ(CassandraStore::NOT_FOUND,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  EXPECT_EQ(0u, store._live_bytes);
+}
+
+// A torn record at the end of the log is discarded.
+TEST_F(LocalCallListStoreTest, TornWrite)
+{
+  {
+    LocalCallListStore store(_path);
+    store.write_call_fragment_sync(IMPU,
+                                   fragment("20021225100000",
+                                            "1",
+                                            CallListStore::CallFragment::Type::BEGIN),
+                                   1000,
+                                   3600,
+                                   0);
+    store.write_call_fragment_sync(IMPU,
+                                   fragment("20021225110000",
+                                            "2",
+                                            CallListStore::CallFragment::Type::BEGIN),
+                                   1000,
+                                   3600,
+                                   0);
+  }
+
+  uint64_t size = file_size();
+  ASSERT_EQ(0, truncate(_path.c_str(), size - 3));
+
+  LocalCallListStore store(_path);
+  std::vector<CallListStore::CallFragment> fragments;
+  ASSERT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  EXPECT_EQ(1u, fragments.size());
+  EXPECT_EQ(size / 2, file_size());
+}
+
+// Compaction leaves just the live fragments in the log.
+TEST_F(LocalCallListStoreTest, Compact)
+{
+  LocalCallListStore store(_path);
+  CallListStore::CallFragment call =
+    fragment("20021225100000", "1", CallListStore::CallFragment::Type::BEGIN);
+
+  for (int ii = 0; ii < 10; ii++)
+  {
+    store.write_call_fragment_sync(IMPU, call, 1000 + ii, 3600, 0);
+  }
+
+  EXPECT_EQ(10 * store._live_bytes, file_size());
+
+  EXPECT_TRUE(store.compact());
+  EXPECT_EQ(store._live_bytes, file_size());
+
+  // The index points into the compacted log.
+  std::vector<CallListStore::CallFragment> fragments;
+  ASSERT_EQ(CassandraStore::OK,
+            store.get_call_fragments_sync(IMPU, fragments, 0));
+  ASSERT_EQ(1u, fragments.size());
+  EXPECT_EQ("<xml>1</xml>", fragments[0].contents);
+
+  // The store carries on writing to the compacted log.
+  store.write_call_fragment_sync(IMPU,
+                                 fragment("20021225110000",
+                                          "2",
+                                          CallListStore::CallFragment::Type::END),
+                                 2000,
+                                 3600,
+                                 0);
+
+  LocalCallListStore reloaded(_path);
+  ASSERT_EQ(CassandraStore::OK,
+            reloaded.get_call_fragments_sync(IMPU, fragments, 0));
+  EXPECT_EQ(2u, fragments.size());
+}
+
+// A store that can't open its log fails requests.
+TEST(LocalCallListStoreInvalidTest, NoLog)
+{
+  LocalCallListStore store("/nonexistent/call_lists.log");
+  EXPECT_FALSE(store.is_valid());
+  EXPECT_EQ(CassandraStore::RESOURCE_ERROR,
+            store.write_call_fragment_sync(IMPU,
+                                           fragment("20021225100000",
+                                                    "1",
+                                                    CallListStore::CallFragment::Type::BEGIN),
+                                           1000,
+                                           3600,
+                                           0));
+}
@@ -28,6 +28,15 @@ using testing::Return;
 using ::testing::_;
 using ::testing::StrictMock;
 
+// Matches a call list request for the given IMPU and type, whose entry
+// renders to the expected call fragment XML.
+MATCHER_P3(WritesEntry, impu, type, xml, "")
+{
+  return ((arg->impu == impu) &&
+          (arg->fragment.type == type) &&
+          (render_call_list_xml(type, arg->entry) == xml));
+}
+
 const static std::string known_stats[] = {
   "memento_completed_calls",
   "memento_failed_calls",
@@ -264,7 +273,16 @@ TEST_F(MementoAppServerTest, CreateMementoAppServer)
                                                0.0,
                                                NULL, // Exception Handler
                                                NULL, // HTTP Resolver
-                                               "http://example.com/notify");
+                                               "http://example.com/notify",
+                                               NULL, // Notify circuit breaker
+                                               CallFragmentCodec::XML,
+                                               NULL, // Fragment compressor
+                                               0, // BEGIN hold
+                                               0, // Flood max rejected calls
+                                               60000, // Flood window
+                                               0, // Dialog table size
+                                               NULL, // Call list view store
+                                               NULL); // Trim ownership
 
   // Test creating an app server transaction with an invalid method -
   // it shouldn't be created.
@@ -319,7 +337,7 @@ TEST_F(MementoAppServerTest, MainlineIncomingTest)
                     append(timestamp).append("</start-time>\n<answered>1</answered>\n<answer-time>").
                     append(timestamp).append("</answer-time>\n\n");
   std::string impu = "sip:6505551234@homedomain";
-  EXPECT_CALL(*_clsp, write_call_list_entry(impu, _, _, CallListStore::CallFragment::Type::BEGIN, xml, _));
+  EXPECT_CALL(*_clsp, write_call_list_entry(WritesEntry(impu, CallListStore::CallFragment::Type::BEGIN, xml)));
   EXPECT_CALL(*_helper, send_response(_));
   pjsip_msg* rsp = parse_msg(msg.get_response());
   as_tsx.on_response(rsp, 0);
@@ -363,7 +381,7 @@ TEST_F(MementoAppServerTest, MainlineOutgoingTest)
                     append(timestamp).append("</start-time>\n<answered>1</answered>\n<answer-time>").
                     append(timestamp).append("</answer-time>\n\n");
   std::string impu = "sip:6505550000@homedomain";
-  EXPECT_CALL(*_clsp, write_call_list_entry(impu, _, _, CallListStore::CallFragment::Type::BEGIN, xml, _));
+  EXPECT_CALL(*_clsp, write_call_list_entry(WritesEntry(impu, CallListStore::CallFragment::Type::BEGIN, xml)));
   EXPECT_CALL(*_helper, send_response(_));
   pjsip_msg* rsp = parse_msg(msg.get_response());
   as_tsx.on_response(rsp, 0);
@@ -416,7 +434,7 @@ TEST_F(MementoAppServerTest, OnResponseRecordAnswerer)
                     append(timestamp).append("</answer-time>\n<answerer>\n\t<URI>sip:6505551235@homedomain</URI>\n" \
                                 "\t<name>Bob&apos;s cell</name>\n</answerer>\n\n");
   std::string impu = "sip:6505550000@homedomain";
-  EXPECT_CALL(*_clsp, write_call_list_entry(impu, _, _, CallListStore::CallFragment::Type::BEGIN, xml, _));
+  EXPECT_CALL(*_clsp, write_call_list_entry(WritesEntry(impu, CallListStore::CallFragment::Type::BEGIN, xml)));
   EXPECT_CALL(*_helper, send_response(_));
   as_tsx.on_response(rsp, 0);
 }
@@ -473,7 +491,7 @@ TEST_F(MementoAppServerTest, OnResponseNotRecordPrivateAnswerer)
                     append(timestamp).append("</start-time>\n<answered>1</answered>\n<answer-time>").
                     append(timestamp).append("</answer-time>\n\n");
   std::string impu = "sip:6505550000@homedomain";
-  EXPECT_CALL(*_clsp, write_call_list_entry(impu, _, _, CallListStore::CallFragment::Type::BEGIN, xml, _));
+  EXPECT_CALL(*_clsp, write_call_list_entry(WritesEntry(impu, CallListStore::CallFragment::Type::BEGIN, xml)));
   EXPECT_CALL(*_helper, send_response(_));
   as_tsx.on_response(rsp, 0);
 }
@@ -533,7 +551,7 @@ TEST_F(MementoAppServerTest, OnMultipleResponses)
   as_tsx.on_initial_request(parse_msg(msg.get_request()));
 
   pjsip_msg* rsp = parse_msg(msg.get_response());
-  EXPECT_CALL(*_clsp, write_call_list_entry(_, _, _, _, _, _));
+  EXPECT_CALL(*_clsp, write_call_list_entry(_));
   EXPECT_CALL(*_helper, send_response(_));
   as_tsx.on_response(rsp, 0);
 
@@ -583,7 +601,7 @@ TEST_F(MementoAppServerTest, OnErrorResponse)
                                 "\n</from>\n<outgoing>0</outgoing>\n<start-time>").
                     append(timestamp).append("</start-time>\n<answered>0</answered>\n\n");
   std::string impu = "sip:6505551234@homedomain";
-  EXPECT_CALL(*_clsp, write_call_list_entry(impu, _, _, CallListStore::CallFragment::Type::REJECTED, xml, _));
+  EXPECT_CALL(*_clsp, write_call_list_entry(WritesEntry(impu, CallListStore::CallFragment::Type::REJECTED, xml)));
   EXPECT_CALL(*_helper, send_response(_));
   pjsip_msg* rsp = parse_msg(msg.get_response());
   as_tsx.on_response(rsp, 0);
@@ -608,7 +626,7 @@ TEST_F(MementoAppServerWithDialogIDTest, OnInDialogRequestTest)
 
   // On a 200 OK response the as_tsx_initial generates a BEGIN call fragment
   // writes it to the call list store
-  EXPECT_CALL(*_clsp, write_call_list_entry(_, _, _, _, _, _));
+  EXPECT_CALL(*_clsp, write_call_list_entry(_));
   EXPECT_CALL(*_helper, send_response(_));
   pjsip_msg* rsp = parse_msg(msg.get_response());
   as_tsx_initial.on_response(rsp, 0);
@@ -638,7 +656,7 @@ TEST_F(MementoAppServerWithDialogIDTest, OnInDialogRequestTest)
 
   std::string xml = std::string("<end-time>").append(timestamp).append("</end-time>\n\n");
   EXPECT_CALL(*_helper, send_request(_)).WillOnce(Return(0));
-  EXPECT_CALL(*_clsp, write_call_list_entry(impu, _, _, CallListStore::CallFragment::Type::END, xml, _));
+  EXPECT_CALL(*_clsp, write_call_list_entry(WritesEntry(impu, CallListStore::CallFragment::Type::END, xml)));
   as_tsx_end.on_in_dialog_request(parse_msg(msg.get_request()));
 
   // On a 200 OK response to that BYE, nothing is written to the store
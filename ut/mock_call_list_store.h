@@ -12,6 +12,7 @@
 #ifndef MOCK_CALL_LIST_STORE_H_
 #define MOCK_CALL_LIST_STORE_H_
 
+#include "batch_call_list_store.h"
 #include "call_list_store.h"
 #include "mock_cassandra_store.h"
 
@@ -52,5 +53,19 @@ public:
                                           SAS::TrailId trail));
 };
 
+class MockBatchCallListStore : public MockCallListStore,
+                               public BatchCallListStore
+{
+public:
+  virtual ~MockBatchCallListStore() {};
+
+  MOCK_METHOD5(write_call_fragments_sync,
+               CassandraStore::ResultCode(const std::string& impu,
+                                          const std::vector<CallListStore::CallFragment>& fragments,
+                                          const int64_t cass_timestamp,
+                                          const int32_t ttl,
+                                          SAS::TrailId trail));
+};
+
 #endif
 
@@ -17,15 +17,16 @@
 class MockCallListStoreProcessor : public CallListStoreProcessor
 {
 public:
-  MockCallListStoreProcessor() : CallListStoreProcessor(NULL, NULL, 0, 0, 0, NULL, NULL, NULL) {}
+  MockCallListStoreProcessor() : CallListStoreProcessor(NULL, NULL, 0, 0, 0, NULL, NULL, NULL, CallFragmentCodec::XML, NULL, 0, 0, 0, 0, NULL, NULL)
+  {
+    // The processor owns the requests it's given, so hand them straight
+    // back to the pool.
+    ON_CALL(*this, write_call_list_entry(::testing::_))
+      .WillByDefault(::testing::Invoke(this, &CallListStoreProcessor::release_request));
+  }
   virtual ~MockCallListStoreProcessor() {};
 
-  MOCK_METHOD6(write_call_list_entry, void(std::string impu,
-                                           std::string timestamp,
-                                           std::string id,
-                                           CallListStore::CallFragment::Type type,
-                                           std::string xml,
-                                           SAS::TrailId trail));
+  MOCK_METHOD1(write_call_list_entry, void(CallListRequest* request));
 };
 
 #endif
@@ -0,0 +1,38 @@
+/**
+ * @file mock_call_list_view_store.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef MOCK_CALL_LIST_VIEW_STORE_H_
+#define MOCK_CALL_LIST_VIEW_STORE_H_
+
+#include "gmock/gmock.h"
+#include "call_list_view.h"
+
+class MockCallListViewStore : public CallListViewStore
+{
+public:
+  virtual ~MockCallListViewStore() {};
+
+  MOCK_METHOD4(get_call_list_view_sync,
+               CassandraStore::ResultCode(const std::string& impu,
+                                          std::string& view,
+                                          int64_t& version,
+                                          SAS::TrailId trail));
+
+  MOCK_METHOD6(set_call_list_view_sync,
+               CassandraStore::ResultCode(const std::string& impu,
+                                          const std::string& view,
+                                          int64_t version,
+                                          int32_t ttl,
+                                          bool& applied,
+                                          SAS::TrailId trail));
+};
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file node_latency_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gtest/gtest.h"
+
+#include "node_latency.h"
+
+// The average starts at the first sample and moves towards later ones.
+TEST(NodeLatencyTest, Ewma)
+{
+  NodeLatency node;
+  EXPECT_EQ(0u, node.ewma_us());
+
+  node.request_started();
+  node.request_finished(1000);
+  EXPECT_EQ(1000u, node.ewma_us());
+
+  node.request_started();
+  node.request_finished(9000);
+  EXPECT_EQ(2000u, node.ewma_us());
+
+  node.request_started();
+  node.request_finished(0);
+  EXPECT_EQ(1750u, node.ewma_us());
+}
+
+// Requests in flight make a node score worse.
+TEST(NodeLatencyTest, Score)
+{
+  NodeLatency node;
+  EXPECT_EQ(1u, node.score());
+
+  node.request_started();
+  node.request_finished(999);
+  EXPECT_EQ(1000u, node.score());
+
+  node.request_started();
+  node.request_started();
+  EXPECT_EQ(2, node.in_flight());
+  EXPECT_EQ(3000u, node.score());
+}
+
+// Failures count as their penalty, and discarded requests don't count.
+TEST(NodeLatencyTest, Failures)
+{
+  NodeLatency node;
+
+  node.request_started();
+  node.request_finished(1000);
+
+  node.request_started();
+  node.request_discarded();
+  EXPECT_EQ(1000u, node.ewma_us());
+  EXPECT_EQ(0, node.in_flight());
+
+  node.request_started();
+  node.request_failed(9000);
+  EXPECT_EQ(2000u, node.ewma_us());
+  EXPECT_EQ(0, node.in_flight());
+}
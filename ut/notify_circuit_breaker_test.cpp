@@ -0,0 +1,185 @@
+/**
+ * @file notify_circuit_breaker_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gtest/gtest.h"
+#include "test_interposer.hpp"
+
+#include "notify_circuit_breaker.h"
+#include "zmq_lvc.h"
+
+const static std::string known_stats[] = {
+  "memento_notify_circuit_state",
+  "memento_notify_dropped",
+};
+const static std::string zmq_port = "6666";
+const int num_known_stats = sizeof(known_stats) / sizeof(std::string);
+
+static const unsigned long LATENCY_BUDGET_US = 100000;
+static const int FAILURE_THRESHOLD = 3;
+static const int OPEN_TIME_MS = 5000;
+static const int PROBES_TO_CLOSE = 2;
+
+class NotifyCircuitBreakerTest : public ::testing::Test
+{
+public:
+  NotifyCircuitBreakerTest()
+  {
+    cwtest_completely_control_time();
+    _stats_aggregator = new LastValueCache(num_known_stats,
+                                           known_stats,
+                                           zmq_port,
+                                           10);
+    _breaker = new NotifyCircuitBreaker(LATENCY_BUDGET_US,
+                                        FAILURE_THRESHOLD,
+                                        OPEN_TIME_MS,
+                                        PROBES_TO_CLOSE,
+                                        NULL,
+                                        _stats_aggregator);
+  }
+
+  virtual ~NotifyCircuitBreakerTest()
+  {
+    delete _breaker; _breaker = NULL;
+    delete _stats_aggregator; _stats_aggregator = NULL;
+    cwtest_reset_time();
+  }
+
+  // Drive the breaker open with consecutive failures.
+  void trip()
+  {
+    for (int ii = 0; ii < FAILURE_THRESHOLD; ii++)
+    {
+      ASSERT_TRUE(_breaker->allow_request(ticket));
+      _breaker->request_failed(ticket);
+    }
+    ASSERT_EQ(NotifyCircuitBreaker::OPEN, _breaker->state());
+  }
+
+  NotifyCircuitBreaker* _breaker;
+  LastValueCache* _stats_aggregator;
+  uint64_t ticket;
+};
+
+// A healthy target leaves the breaker closed.
+TEST_F(NotifyCircuitBreakerTest, StaysClosedWhenHealthy)
+{
+  for (int ii = 0; ii < 10; ii++)
+  {
+    EXPECT_TRUE(_breaker->allow_request(ticket));
+    _breaker->request_succeeded(ticket, LATENCY_BUDGET_US / 2);
+  }
+  EXPECT_EQ(NotifyCircuitBreaker::CLOSED, _breaker->state());
+}
+
+// Failures only open the breaker if they are consecutive.
+TEST_F(NotifyCircuitBreakerTest, SuccessResetsFailureCount)
+{
+  for (int ii = 0; ii < 5; ii++)
+  {
+    for (int jj = 0; jj < FAILURE_THRESHOLD - 1; jj++)
+    {
+      EXPECT_TRUE(_breaker->allow_request(ticket));
+      _breaker->request_failed(ticket);
+    }
+    EXPECT_TRUE(_breaker->allow_request(ticket));
+    _breaker->request_succeeded(ticket, 0);
+  }
+  EXPECT_EQ(NotifyCircuitBreaker::CLOSED, _breaker->state());
+}
+
+// Consecutive failures open the breaker, after which requests are dropped.
+TEST_F(NotifyCircuitBreakerTest, OpensOnFailures)
+{
+  trip();
+  EXPECT_FALSE(_breaker->allow_request(ticket));
+}
+
+// Notifications that exceed the latency budget count as failures.
+TEST_F(NotifyCircuitBreakerTest, OpensOnSlowResponses)
+{
+  for (int ii = 0; ii < FAILURE_THRESHOLD; ii++)
+  {
+    EXPECT_TRUE(_breaker->allow_request(ticket));
+    _breaker->request_succeeded(ticket, LATENCY_BUDGET_US + 1);
+  }
+  EXPECT_EQ(NotifyCircuitBreaker::OPEN, _breaker->state());
+  EXPECT_FALSE(_breaker->allow_request(ticket));
+}
+
+// Once the open period expires, a single probe is let through at a time,
+// and enough successful probes close the breaker.
+TEST_F(NotifyCircuitBreakerTest, HalfOpenProbesClose)
+{
+  trip();
+
+  cwtest_advance_time_ms(OPEN_TIME_MS - 1);
+  EXPECT_FALSE(_breaker->allow_request(ticket));
+
+  cwtest_advance_time_ms(1);
+  EXPECT_TRUE(_breaker->allow_request(ticket));
+  EXPECT_EQ(NotifyCircuitBreaker::HALF_OPEN, _breaker->state());
+
+  // The first probe is still outstanding so a second is not allowed.
+  EXPECT_FALSE(_breaker->allow_request(ticket));
+  _breaker->request_succeeded(ticket, 0);
+  EXPECT_EQ(NotifyCircuitBreaker::HALF_OPEN, _breaker->state());
+
+  EXPECT_TRUE(_breaker->allow_request(ticket));
+  _breaker->request_succeeded(ticket, 0);
+  EXPECT_EQ(NotifyCircuitBreaker::CLOSED, _breaker->state());
+  EXPECT_TRUE(_breaker->allow_request(ticket));
+}
+
+// A failed probe re-opens the breaker for another full open period.
+TEST_F(NotifyCircuitBreakerTest, FailedProbeReopens)
+{
+  trip();
+
+  cwtest_advance_time_ms(OPEN_TIME_MS);
+  EXPECT_TRUE(_breaker->allow_request(ticket));
+  _breaker->request_failed(ticket);
+  EXPECT_EQ(NotifyCircuitBreaker::OPEN, _breaker->state());
+
+  cwtest_advance_time_ms(OPEN_TIME_MS - 1);
+  EXPECT_FALSE(_breaker->allow_request(ticket));
+
+  cwtest_advance_time_ms(1);
+  EXPECT_TRUE(_breaker->allow_request(ticket));
+}
+
+// A notification allowed before the breaker opened doesn't count as the
+// probe, however it turns out.
+TEST_F(NotifyCircuitBreakerTest, StaleResultsIgnored)
+{
+  uint64_t straggler;
+  EXPECT_TRUE(_breaker->allow_request(straggler));
+  trip();
+
+  cwtest_advance_time_ms(OPEN_TIME_MS);
+  EXPECT_TRUE(_breaker->allow_request(ticket));
+  EXPECT_EQ(NotifyCircuitBreaker::HALF_OPEN, _breaker->state());
+
+  // The straggler neither closes the breaker nor frees up the probe.
+  _breaker->request_succeeded(straggler, 0);
+  _breaker->request_succeeded(straggler, 0);
+  EXPECT_EQ(NotifyCircuitBreaker::HALF_OPEN, _breaker->state());
+  uint64_t second;
+  EXPECT_FALSE(_breaker->allow_request(second));
+
+  _breaker->request_failed(straggler);
+  EXPECT_EQ(NotifyCircuitBreaker::HALF_OPEN, _breaker->state());
+
+  // The real probe still counts.
+  _breaker->request_succeeded(ticket, 0);
+  EXPECT_TRUE(_breaker->allow_request(ticket));
+  _breaker->request_succeeded(ticket, 0);
+  EXPECT_EQ(NotifyCircuitBreaker::CLOSED, _breaker->state());
+}
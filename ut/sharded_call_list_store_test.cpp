@@ -0,0 +1,144 @@
+/**
+ * @file sharded_call_list_store_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <sstream>
+#include <string>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "sharded_call_list_store.h"
+#include "mock_call_list_store.h"
+
+using ::testing::_;
+using ::testing::Return;
+
+static const std::string IMPU = "sip:6505550000@homedomain";
+
+class ShardedCallListStoreTest : public ::testing::Test
+{
+public:
+  ShardedCallListStoreTest() : _store(NULL)
+  {
+    _east = new MockCallListStore();
+    _west = new MockCallListStore();
+    _store.add_cluster("east", _east);
+    _store.add_cluster("west", _west);
+  }
+
+  ShardedCallListStore _store;
+  MockCallListStore* _east;
+  MockCallListStore* _west;
+};
+
+// IMPUs are spread across the clusters, and each IMPU's requests all go to
+// its cluster.
+TEST_F(ShardedCallListStoreTest, Routing)
+{
+  int east = 0;
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    std::string impu = "sip:" + std::to_string(6505550000 + ii) + "@homedomain";
+    east += (_store.cluster(impu) == "east") ? 1 : 0;
+  }
+
+  EXPECT_LT(300, east);
+  EXPECT_GT(700, east);
+
+  MockCallListStore* owner = (_store.cluster(IMPU) == "east") ? _east : _west;
+  MockCallListStore* other = (owner == _east) ? _west : _east;
+  CallListStore::CallFragment fragment;
+  std::vector<CallListStore::CallFragment> fragments;
+
+  EXPECT_CALL(*owner, write_call_fragment_sync(IMPU, _, 1000, 3600, 0))
+    .WillOnce(Return(CassandraStore::OK));
+  EXPECT_CALL(*owner, get_call_fragments_sync(IMPU, _, 0))
+    .WillOnce(Return(CassandraStore::NOT_FOUND));
+  EXPECT_CALL(*owner, delete_old_call_fragments_sync(IMPU, _, 1000, 0))
+    .WillOnce(Return(CassandraStore::RESOURCE_ERROR));
+  EXPECT_CALL(*other, write_call_fragment_sync(_, _, _, _, _)).Times(0);
+
+  EXPECT_EQ(CassandraStore::OK,
+            _store.write_call_fragment_sync(IMPU, fragment, 1000, 3600, 0));
+  EXPECT_EQ(CassandraStore::NOT_FOUND,
+            _store.get_call_fragments_sync(IMPU, fragments, 0));
+  EXPECT_EQ(CassandraStore::RESOURCE_ERROR,
+            _store.delete_old_call_fragments_sync(IMPU, fragments, 1000, 0));
+}
+
+// Adding a cluster only moves IMPUs onto the new cluster.
+TEST_F(ShardedCallListStoreTest, AddCluster)
+{
+  std::map<std::string, std::string> before;
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    std::string impu = "sip:" + std::to_string(6505550000 + ii) + "@homedomain";
+    before[impu] = _store.cluster(impu);
+  }
+
+  _store.add_cluster("north", new MockCallListStore());
+
+  for (std::map<std::string, std::string>::const_iterator it = before.begin();
+       it != before.end();
+       ++it)
+  {
+    const std::string& after = _store.cluster(it->first);
+    EXPECT_TRUE((after == it->second) || (after == "north"));
+  }
+}
+
+// Overrides pin IMPUs to a cluster.
+TEST_F(ShardedCallListStoreTest, Override)
+{
+  std::string other = (_store.cluster(IMPU) == "east") ? "west" : "east";
+  EXPECT_FALSE(_store.add_override(IMPU, "north"));
+  EXPECT_TRUE(_store.add_override(IMPU, other));
+  EXPECT_EQ(other, _store.cluster(IMPU));
+}
+
+// Shard configuration files list clusters and overrides.
+TEST(ShardedCallListStoreConfigTest, Parse)
+{
+  std::istringstream input("# Call list clusters\n"
+                           "cluster east cass-east-1,cass-east-2\n"
+                           "\n"
+                           "cluster west cass-west\n"
+                           "impu sip:6505550000@homedomain west\n");
+  ShardedCallListStore::Config config;
+  ASSERT_TRUE(ShardedCallListStore::parse_config(input, config));
+  ASSERT_EQ(2u, config.clusters.size());
+  EXPECT_EQ("east", config.clusters[0].first);
+  EXPECT_EQ("cass-east-1,cass-east-2", config.clusters[0].second);
+  EXPECT_EQ("west", config.clusters[1].first);
+  EXPECT_EQ("west", config.overrides[IMPU]);
+}
+
+// Invalid shard configuration files are rejected.
+TEST(ShardedCallListStoreConfigTest, Invalid)
+{
+  const char* invalid[] =
+  {
+    "",
+    "cluster east\n",
+    "cluster east cass-east extra\n",
+    "cluster east cass-east\ncluster east cass-west\n",
+    "cluster east cass-east\nimpu sip:6505550000@homedomain west\n",
+    "shard east cass-east\n",
+  };
+
+  for (size_t ii = 0; ii < sizeof(invalid) / sizeof(invalid[0]); ii++)
+  {
+    std::istringstream input(invalid[ii]);
+    ShardedCallListStore::Config config;
+    EXPECT_FALSE(ShardedCallListStore::parse_config(input, config)) << invalid[ii];
+  }
+}
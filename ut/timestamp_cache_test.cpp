@@ -0,0 +1,112 @@
+/**
+ * @file timestamp_cache_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <pthread.h>
+#include <ctime>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "timestamp_cache.h"
+
+static const time_t BASE_TIME = 1022751010;
+
+// Formats a time with strftime, for comparison.
+static std::string strftime_local(time_t time, const char* pattern)
+{
+  tm local_time;
+  localtime_r(&time, &local_time);
+  char buf[80];
+  size_t len = strftime(buf, sizeof(buf), pattern, &local_time);
+  return std::string(buf, len);
+}
+
+static std::string cached_xml(time_t time, bool utc_offset_applied)
+{
+  char buf[TimestampCache::MAX_LEN];
+  size_t len = TimestampCache::format_xml(time, utc_offset_applied, buf);
+  return std::string(buf, len);
+}
+
+// The cached timestamps match strftime, both for repeated lookups of the
+// same second and as the second changes.
+TEST(TimestampCacheTest, MatchesStrftime)
+{
+  for (time_t time = BASE_TIME; time < BASE_TIME + 100; time += 7)
+  {
+    for (int repeat = 0; repeat < 2; repeat++)
+    {
+      std::string cassandra;
+      TimestampCache::format_cassandra(time, false, cassandra);
+      EXPECT_EQ(strftime_local(time, "%Y%m%d%H%M%S"), cassandra);
+      EXPECT_EQ(TimestampCache::CASSANDRA_LEN, cassandra.length());
+
+      std::string xml = cached_xml(time, false);
+      EXPECT_EQ(strftime_local(time, "%Y-%m-%dT%H:%M:%S"), xml);
+      EXPECT_EQ(TimestampCache::XML_LEN, xml.length());
+    }
+  }
+}
+
+// Times that already have the UTC offset applied are rendered as is, and
+// are cached separately from local times.
+TEST(TimestampCacheTest, UtcOffsetApplied)
+{
+  time_t local_seconds = BASE_TIME + TimestampCache::utc_offset(BASE_TIME);
+
+  EXPECT_EQ(cached_xml(BASE_TIME, false), cached_xml(local_seconds, true));
+
+  std::string cassandra;
+  std::string offset_applied;
+  TimestampCache::format_cassandra(BASE_TIME, false, cassandra);
+  TimestampCache::format_cassandra(local_seconds, true, offset_applied);
+  EXPECT_EQ(cassandra, offset_applied);
+
+  EXPECT_EQ("2002-05-30T09:30:10", cached_xml(BASE_TIME, true));
+}
+
+static void* format_times(void* arg)
+{
+  bool* ok = (bool*)arg;
+
+  for (time_t time = BASE_TIME; time < BASE_TIME + 1000; time++)
+  {
+    std::string cassandra;
+    TimestampCache::format_cassandra(time, false, cassandra);
+
+    if (cassandra != strftime_local(time, "%Y%m%d%H%M%S"))
+    {
+      *ok = false;
+    }
+  }
+
+  return NULL;
+}
+
+// Each thread has its own cache, so threads formatting different times
+// don't see each other's results.
+TEST(TimestampCacheTest, Threads)
+{
+  const int NUM_THREADS = 4;
+  pthread_t threads[NUM_THREADS];
+  bool ok[NUM_THREADS];
+
+  for (int ii = 0; ii < NUM_THREADS; ii++)
+  {
+    ok[ii] = true;
+    pthread_create(&threads[ii], NULL, format_times, &ok[ii]);
+  }
+
+  for (int ii = 0; ii < NUM_THREADS; ii++)
+  {
+    pthread_join(threads[ii], NULL);
+    EXPECT_TRUE(ok[ii]);
+  }
+}
@@ -0,0 +1,50 @@
+/**
+ * @file token_ring_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "token_ring.h"
+
+// Tokens match Cassandra's Murmur3Partitioner, including its handling of
+// bytes with the top bit set.
+TEST(TokenRingTest, Token)
+{
+  EXPECT_EQ(0, TokenRing::token(""));
+  EXPECT_EQ(-2129773440516405919LL, TokenRing::token("foo"));
+  EXPECT_EQ(-6011227522167558210LL,
+            TokenRing::token("sip:6505550000@homedomain"));
+  EXPECT_EQ(5767299656504056697LL, TokenRing::token("\xff\x80" "abc"));
+  EXPECT_EQ(-6715782619493340315LL,
+            TokenRing::token("0123456789abcdef0123456789abcdefX"));
+}
+
+// Each node owns the tokens up to and including its own, wrapping round.
+TEST(TokenRingTest, Owner)
+{
+  TokenRing ring;
+  EXPECT_TRUE(ring.empty());
+  EXPECT_EQ("", ring.owner(0));
+
+  std::vector<std::pair<int64_t, std::string>> tokens;
+  tokens.push_back(std::make_pair(100, "b"));
+  tokens.push_back(std::make_pair(-100, "a"));
+  tokens.push_back(std::make_pair(200, "c"));
+  ring.set(tokens);
+
+  EXPECT_EQ("a", ring.owner(-200));
+  EXPECT_EQ("a", ring.owner(-100));
+  EXPECT_EQ("b", ring.owner(-99));
+  EXPECT_EQ("b", ring.owner(100));
+  EXPECT_EQ("c", ring.owner(101));
+  EXPECT_EQ("a", ring.owner(201));
+}
@@ -0,0 +1,235 @@
+/**
+ * @file trim_ownership_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "mock_call_list_store.h"
+#include "trim_ownership.h"
+
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::Return;
+using ::testing::SaveArg;
+using ::testing::SetArgReferee;
+
+static std::string impu(int ii)
+{
+  return "sip:" + std::to_string(6505550000 + ii) + "@homedomain";
+}
+
+static std::vector<std::string> nodes(const std::string& a,
+                                      const std::string& b,
+                                      const std::string& c = "")
+{
+  std::vector<std::string> nodes;
+  nodes.push_back(a);
+  nodes.push_back(b);
+
+  if (!c.empty())
+  {
+    nodes.push_back(c);
+  }
+
+  return nodes;
+}
+
+// Each IMPU is owned by exactly one node, and the IMPUs are spread between
+// them.
+TEST(TrimOwnershipTest, OneOwner)
+{
+  TrimOwnership first("10.0.0.1", "", NULL);
+  TrimOwnership second("10.0.0.2", "", NULL);
+  first.set_nodes(nodes("10.0.0.1", "10.0.0.2"));
+  second.set_nodes(nodes("10.0.0.1", "10.0.0.2"));
+  int owned = 0;
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    EXPECT_NE(first.owns(impu(ii)), second.owns(impu(ii)));
+    owned += first.owns(impu(ii)) ? 1 : 0;
+  }
+
+  EXPECT_LT(300, owned);
+  EXPECT_GT(700, owned);
+}
+
+// A node joining only takes IMPUs for itself.
+TEST(TrimOwnershipTest, NodeJoins)
+{
+  TrimOwnership ownership("10.0.0.1", "", NULL);
+  ownership.set_nodes(nodes("10.0.0.1", "10.0.0.2"));
+  std::vector<bool> before;
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    before.push_back(ownership.owns(impu(ii)));
+  }
+
+  ownership.set_nodes(nodes("10.0.0.1", "10.0.0.2", "10.0.0.3"));
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    EXPECT_TRUE((before[ii]) || (!ownership.owns(impu(ii))));
+  }
+}
+
+// A node that isn't in the set (or has no set) trims everything.
+TEST(TrimOwnershipTest, NotInSet)
+{
+  TrimOwnership ownership("10.0.0.9", "", NULL);
+  EXPECT_TRUE(ownership.owns(impu(0)));
+
+  ownership.set_nodes(nodes("10.0.0.1", "10.0.0.2"));
+
+  for (int ii = 0; ii < 100; ii++)
+  {
+    EXPECT_TRUE(ownership.owns(impu(ii)));
+  }
+}
+
+// Nodes without a heartbeat are left out of the ring, except this one.
+TEST(TrimOwnershipTest, LiveNodes)
+{
+  TrimOwnership first("10.0.0.1", "", NULL);
+  TrimOwnership second("10.0.0.2", "", NULL);
+  first.set_nodes(nodes("10.0.0.1", "10.0.0.2", "10.0.0.3"));
+  second.set_nodes(nodes("10.0.0.1", "10.0.0.2", "10.0.0.3"));
+
+  // Neither node has seen 10.0.0.3's heartbeat, and the first hasn't seen
+  // its own.
+  first.set_live_nodes(nodes("10.0.0.2", "10.0.0.4"));
+  second.set_live_nodes(nodes("10.0.0.1", "10.0.0.2"));
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    EXPECT_NE(first.owns(impu(ii)), second.owns(impu(ii)));
+  }
+
+  // Once 10.0.0.3 is back, it takes some of the IMPUs again.
+  first.set_live_nodes(nodes("10.0.0.1", "10.0.0.2", "10.0.0.3"));
+  second.set_live_nodes(nodes("10.0.0.1", "10.0.0.2", "10.0.0.3"));
+  int owned = 0;
+
+  for (int ii = 0; ii < 1000; ii++)
+  {
+    owned += ((first.owns(impu(ii))) || (second.owns(impu(ii)))) ? 1 : 0;
+  }
+
+  EXPECT_LT(500, owned);
+  EXPECT_GT(900, owned);
+}
+
+// Each heartbeat overwrites the node's own fragment, and the live nodes are
+// read from everyone's.
+TEST(TrimOwnershipTest, Heartbeat)
+{
+  MockCallListStore store;
+  std::vector<CallListStore::CallFragment> heartbeats(2);
+  heartbeats[0].id = "10.0.0.1";
+  heartbeats[1].id = "10.0.0.3";
+  CallListStore::CallFragment written;
+
+  EXPECT_CALL(store, write_call_fragment_sync(TrimOwnership::HEARTBEAT_IMPU,
+                                              _,
+                                              _,
+                                              TrimOwnership::HEARTBEAT_TTL_S,
+                                              _))
+    .WillRepeatedly(DoAll(SaveArg<1>(&written),
+                          Return(CassandraStore::OK)));
+  EXPECT_CALL(store, get_call_fragments_sync(TrimOwnership::HEARTBEAT_IMPU, _, _))
+    .WillRepeatedly(DoAll(SetArgReferee<1>(heartbeats),
+                          Return(CassandraStore::OK)));
+
+  TrimOwnership ownership("10.0.0.1", "", &store);
+  ownership.set_nodes(nodes("10.0.0.1", "10.0.0.2", "10.0.0.3"));
+  ownership.heartbeat();
+
+  pthread_mutex_lock(&ownership._lock);
+  std::vector<std::string> ring_nodes = ownership._ring_nodes;
+  pthread_mutex_unlock(&ownership._lock);
+
+  ASSERT_EQ(2u, ring_nodes.size());
+  EXPECT_EQ("10.0.0.1", ring_nodes[0]);
+  EXPECT_EQ("10.0.0.3", ring_nodes[1]);
+  EXPECT_EQ(TrimOwnership::HEARTBEAT_TIMESTAMP, written.timestamp);
+  EXPECT_EQ("10.0.0.1", written.id);
+}
+
+// If the heartbeats can't be read for longer than they last, every node
+// counts as live again.
+TEST(TrimOwnershipTest, HeartbeatsUnreadable)
+{
+  MockCallListStore store;
+
+  EXPECT_CALL(store, write_call_fragment_sync(_, _, _, _, _))
+    .WillRepeatedly(Return(CassandraStore::OK));
+  EXPECT_CALL(store, get_call_fragments_sync(_, _, _))
+    .WillRepeatedly(Return(CassandraStore::CONNECTION_ERROR));
+
+  TrimOwnership ownership("10.0.0.1", "", &store);
+  ownership.set_nodes(nodes("10.0.0.1", "10.0.0.2"));
+  ownership.set_live_nodes(nodes("10.0.0.1", "10.0.0.3"));
+
+  // Recently read heartbeats are kept.
+  ownership.heartbeat();
+  pthread_mutex_lock(&ownership._lock);
+  EXPECT_EQ(1u, ownership._ring_nodes.size());
+  ownership._live_nodes_read_ms -= (TrimOwnership::HEARTBEAT_TTL_S + 1) * 1000;
+  pthread_mutex_unlock(&ownership._lock);
+
+  // Stale ones aren't.
+  ownership.heartbeat();
+  pthread_mutex_lock(&ownership._lock);
+  EXPECT_EQ(2u, ownership._ring_nodes.size());
+  pthread_mutex_unlock(&ownership._lock);
+}
+
+// Node addresses are taken from the servers line, without their ports.
+TEST(TrimOwnershipTest, Parse)
+{
+  std::istringstream input("# Cluster settings\n"
+                           "new_servers=10.0.0.4:11211\n"
+                           "servers=10.0.0.1:11211, [fd00::2]:11211,sprout-3\n");
+  std::vector<std::string> parsed;
+  ASSERT_TRUE(TrimOwnership::parse_nodes(input, parsed));
+  ASSERT_EQ(3u, parsed.size());
+  EXPECT_EQ("10.0.0.1", parsed[0]);
+  EXPECT_EQ("fd00::2", parsed[1]);
+  EXPECT_EQ("sprout-3", parsed[2]);
+
+  std::istringstream empty("new_servers=10.0.0.4:11211\n");
+  EXPECT_FALSE(TrimOwnership::parse_nodes(empty, parsed));
+}
+
+// The nodes are loaded from the cluster settings file.
+TEST(TrimOwnershipTest, File)
+{
+  char path[] = "/tmp/trim_ownership_testXXXXXX";
+  close(mkstemp(path));
+  std::ofstream(path) << "servers=10.0.0.1:11211,10.0.0.2:11211\n";
+
+  TrimOwnership first("10.0.0.1", path, NULL);
+  TrimOwnership second("10.0.0.2", path, NULL);
+
+  for (int ii = 0; ii < 100; ii++)
+  {
+    EXPECT_NE(first.owns(impu(ii)), second.owns(impu(ii)));
+  }
+
+  unlink(path);
+}
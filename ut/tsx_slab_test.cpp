@@ -0,0 +1,70 @@
+/**
+ * @file tsx_slab_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "sip_common.hpp"
+#include "mementoappserver.h"
+#include "tsx_slab.h"
+
+class TsxSlabTest : public SipCommonTest
+{
+};
+
+// URIs are printed straight into a string, and a recycled string is reused.
+TEST_F(TsxSlabTest, PrintUri)
+{
+  pjsip_uri* uri = uri_from_string("sip:6505551234@homedomain;user=phone",
+                                   stack_data.pool,
+                                   PJ_FALSE);
+  std::string printed;
+  print_uri(PJSIP_URI_IN_FROMTO_HDR, uri, printed);
+  EXPECT_EQ("sip:6505551234@homedomain;user=phone", printed);
+
+  const char* buffer = printed.data();
+  printed.clear();
+  print_uri(PJSIP_URI_IN_FROMTO_HDR, uri, printed);
+  EXPECT_EQ("sip:6505551234@homedomain;user=phone", printed);
+  EXPECT_EQ(buffer, printed.data());
+
+  print_uri(PJSIP_URI_IN_FROMTO_HDR, NULL, printed);
+  EXPECT_EQ("", printed);
+}
+
+// pj_str_t values are assigned to strings, and empty ones clear them.
+TEST_F(TsxSlabTest, AssignPjStr)
+{
+  std::string dest = "Bob";
+  assign_pj_str(dest, pj_str((char*)"Alice"));
+  EXPECT_EQ("Alice", dest);
+
+  pj_str_t empty = {NULL, 0};
+  assign_pj_str(dest, empty);
+  EXPECT_EQ("", dest);
+}
+
+// Transactions are recycled through the per-thread slab.
+TEST_F(TsxSlabTest, TsxSlab)
+{
+  std::string service_name = "memento";
+  std::string home_domain = "home.domain";
+
+  MementoAppServerTsx* tsx = new MementoAppServerTsx(NULL, service_name, home_domain);
+  size_t cached = ThreadSlab<MementoAppServerTsx>::cached();
+  delete tsx;
+  EXPECT_EQ(cached + 1, ThreadSlab<MementoAppServerTsx>::cached());
+
+  MementoAppServerTsx* recycled = new MementoAppServerTsx(NULL, service_name, home_domain);
+  EXPECT_EQ((void*)tsx, (void*)recycled);
+  EXPECT_EQ(cached, ThreadSlab<MementoAppServerTsx>::cached());
+  delete recycled;
+}